@@ -4,8 +4,13 @@
 namespace Doodle
 {
 
+static const int BRUSH_RENDER_SQUARE_SHAPE = 1;
 static const int BRUSH_RENDER_DITHER_SHAPE = 2;
+static const int BRUSH_RENDER_DIAMOND_SHAPE = 4;
+static const int BRUSH_RENDER_CROSS_SHAPE = 5;
 static const int BRUSH_RENDER_SPRAY_SHAPE = 6;
+// Remote packets may carry sizes above the local picker's maximum.
+static const int BRUSH_RENDER_MAX_SIZE_TENTHS = 310;
 
 inline bool brushUsesSparseSampling(int shape)
 {
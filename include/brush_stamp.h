@@ -0,0 +1,103 @@
+#ifndef DOODLE_BRUSH_STAMP_H
+#define DOODLE_BRUSH_STAMP_H
+
+#include <3ds.h>
+#include <stddef.h>
+#include <vector>
+#include "ui.h"
+
+namespace Doodle
+{
+
+static const int BRUSH_STAMP_MAX_EXTENT = 15;
+static const int BRUSH_STAMP_MAX_SPAN = 2 * BRUSH_STAMP_MAX_EXTENT + 1;
+
+bool brushContainsPixelAtWholeSize(int centerX, int centerY, int x, int y,
+                                   int size, int shape);
+
+// Coverage in tenths of the pixel at (x, y) relative to a stamp centered on
+// (centerX, centerY). This is the per-pixel definition every stamp mask is
+// built from; sizeTenths must already be clamped to the rendered range.
+int brushStampCoverageTenths(int centerX, int centerY, int x, int y,
+                             int sizeTenths, int shape, bool feather);
+
+struct BrushStampMask
+{
+    int sizeTenths;
+    int shape;
+    bool feather;
+    int phaseX;
+    int phaseY;
+    int extent;
+    // Fully opaque, with each nonempty row one run through the center
+    // column and the nonempty rows themselves contiguous. Restamping such a
+    // mask only rewrites the same color, so overlapping stamps can be merged.
+    bool solid;
+    // Nonzero columns of each row, as [rowStart, rowEnd) offsets from -extent.
+    u8 rowStart[BRUSH_STAMP_MAX_SPAN];
+    u8 rowEnd[BRUSH_STAMP_MAX_SPAN];
+    u8 coverage[BRUSH_STAMP_MAX_SPAN * BRUSH_STAMP_MAX_SPAN];
+};
+
+// Precomputed coverage masks for recently used brushes. Dither, spray and
+// fractional-size transitions depend on the pixel position modulo 8, so
+// masks are keyed on the stamp center's phase as well as the brush; shapes
+// without a pattern share the phase-0 mask. Each brush's 64 phases map to
+// distinct slots, so a sparse stroke never evicts its own masks.
+class BrushStampCache
+{
+public:
+    BrushStampCache();
+
+    const BrushStampMask &mask(int sizeTenths, int shape, bool feather,
+                               int centerX, int centerY);
+    unsigned long builds() const { return builds_; }
+    // Per-row span scratch for drawBrushStamps, kept to avoid reallocating.
+    std::vector<int> &rowSpans() { return rowSpans_; }
+
+private:
+    std::vector<BrushStampMask> slots_;
+    std::vector<bool> used_;
+    std::vector<int> rowSpans_;
+    unsigned long builds_;
+};
+
+// Pixels [minX, maxX) x [minY, maxY) a clipped draw may write.
+struct BrushClip
+{
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+};
+
+// Blends one brush stamp into an RGB buffer, clipped to its bounds.
+void drawBrushStamp(BrushStampCache &cache, u8 *buffer, int width, int height,
+                    int centerX, int centerY, int sizeTenths, int shape,
+                    u8 r, u8 g, u8 b, bool feather);
+
+// Draws a sequence of stamps with the same result as calling
+// drawBrushStamp for each center in order. Runs of a solid brush whose
+// centers step at most one pixel and move monotonically in y are swept:
+// their union is one span per scanline and each pixel is written once.
+// Patterned, feathered and blended brushes are stamped one by one.
+void drawBrushStamps(BrushStampCache &cache, u8 *buffer, int width, int height,
+                     const DrawPoint *centers, size_t count, int sizeTenths, int shape,
+                     u8 r, u8 g, u8 b, bool feather);
+// The same, leaving every pixel outside clip untouched, so part of a stroke
+// can be redrawn without restamping the rest.
+void drawBrushStamps(BrushStampCache &cache, u8 *buffer, int width, int height,
+                     const BrushClip &clip, const DrawPoint *centers, size_t count,
+                     int sizeTenths, int shape, u8 r, u8 g, u8 b, bool feather);
+
+// Draws nothing. Sets opaque, one byte per pixel of clip row by row, where
+// a stamp covers the pixel fully: once the stamps are drawn those pixels
+// hold the brush color whatever was under them. clip must lie within the
+// buffer the stamps are drawn to.
+void markOpaqueBrushStamps(BrushStampCache &cache, const BrushClip &clip,
+                           const DrawPoint *centers, size_t count,
+                           int sizeTenths, int shape, bool feather, u8 *opaque);
+
+} // namespace Doodle
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef DOODLE_BUFFER_POOL_H
+#define DOODLE_BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Doodle
+{
+
+// Block sizes and counts of the network buffer pool, about 240 KiB in all.
+// Draw frames and control lines fit the small class; the large class covers
+// the biggest message either side sends. Snapshot pieces and anything else
+// past the largest block come from the heap.
+static const int BUFFER_POOL_CLASS_COUNT = 3;
+static const size_t BUFFER_POOL_BLOCK_BYTES[BUFFER_POOL_CLASS_COUNT] = {256, 2048, 16384};
+static const size_t BUFFER_POOL_BLOCK_COUNTS[BUFFER_POOL_CLASS_COUNT] = {192, 32, 8};
+
+struct BufferPoolStats
+{
+    // Buffers handed out, and how many of those had to use malloc because
+    // they were too large for a block or their class had run dry. A steady
+    // stream of draw traffic should leave heapAllocations unchanged.
+    uint32_t acquired;
+    uint32_t heapAllocations;
+    uint32_t exhausted;
+    uint32_t inUse;
+    uint32_t peakInUse;
+};
+
+class BufferPool;
+
+// Move-only owner of one pooled or heap block. The bytes are always
+// followed by a NUL, so text payloads can be parsed where they lie.
+// Destroying or resetting the handle returns the block to its pool.
+class PooledBuffer
+{
+public:
+    PooledBuffer();
+    ~PooledBuffer();
+    PooledBuffer(PooledBuffer &&other);
+    PooledBuffer &operator=(PooledBuffer &&other);
+
+    uint8_t *data() { return data_; }
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // Bytes the block can hold, not counting the NUL.
+    size_t capacity() const { return capacity_; }
+    const char *c_str() const { return data_ ? (const char *)data_ : ""; }
+
+    // Changes the length within capacity and moves the NUL after it.
+    bool resize(size_t size);
+    void reset();
+
+private:
+    PooledBuffer(const PooledBuffer &);
+    PooledBuffer &operator=(const PooledBuffer &);
+
+    friend class BufferPool;
+
+    BufferPool *pool_;
+    uint8_t *data_;
+    size_t size_;
+    size_t capacity_;
+    int sizeClass_;
+};
+
+// Fixed-size slabs with an intrusive free list per size class. Buffers are
+// taken on one thread and released on another, so the owner supplies a
+// lock; without one the pool is single-threaded. Handles must not outlive
+// their pool.
+class BufferPool
+{
+public:
+    typedef void (*LockFunction)(void *context);
+
+    BufferPool();
+    ~BufferPool();
+
+    // Allocates every slab up front. Until then, or if it fails, buffers
+    // come from the heap and are counted as such.
+    bool reserve();
+    void setLock(LockFunction lock, LockFunction unlock, void *context);
+
+    // Replaces buffer with size bytes of undefined content. Fails only when
+    // the heap cannot supply an oversize or overflow block.
+    bool acquire(size_t size, PooledBuffer &buffer);
+    bool acquireCopy(const void *bytes, size_t size, PooledBuffer &buffer);
+
+    BufferPoolStats stats();
+
+private:
+    BufferPool(const BufferPool &);
+    BufferPool &operator=(const BufferPool &);
+
+    friend class PooledBuffer;
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    void recycle(uint8_t *data, int sizeClass);
+    void lock();
+    void unlock();
+
+    uint8_t *slabs_[BUFFER_POOL_CLASS_COUNT];
+    FreeBlock *free_[BUFFER_POOL_CLASS_COUNT];
+    LockFunction lock_;
+    LockFunction unlock_;
+    void *lockContext_;
+    BufferPoolStats stats_;
+};
+
+} // namespace Doodle
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef DOODLE_BYTE_ORDER_H
+#define DOODLE_BYTE_ORDER_H
+
+#include <stdint.h>
+
+namespace Doodle
+{
+
+// Little-endian fields of the journal, trust-store table and CIA formats,
+// read and written a byte at a time so alignment never matters.
+inline void putLittle32(uint8_t *bytes, uint32_t value)
+{
+    bytes[0] = (uint8_t)value;
+    bytes[1] = (uint8_t)(value >> 8);
+    bytes[2] = (uint8_t)(value >> 16);
+    bytes[3] = (uint8_t)(value >> 24);
+}
+
+inline uint32_t getLittle32(const uint8_t *bytes)
+{
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) |
+           ((uint32_t)bytes[3] << 24);
+}
+
+} // namespace Doodle
+
+#endif
@@ -6,6 +6,8 @@
 #include <cstring>
 #include <algorithm>
 
+struct z_stream_s;
+
 struct DirtyRect {
     int minX, minY, maxX, maxY;
     bool valid;
@@ -18,8 +20,18 @@ public:
 
     bool allocate(int width, int height);
     bool loadFromCompressed(const u8 *compressedData, size_t compressedSize);
+    // Incremental form of loadFromCompressed for snapshots that arrive in
+    // pieces. Each append inflates straight into pixels and marks the rows
+    // it reached dirty; finish succeeds only if the stream ended exactly at
+    // the canvas size.
+    bool beginCompressedLoad();
+    bool appendCompressed(const u8 *data, size_t length, DirtyRect &rowsWritten);
+    bool finishCompressedLoad();
+    void cancelCompressedLoad();
+    bool compressedLoadActive() const;
     void markFullDirty();
     void markDirty(int x, int y, int radius);
+    void markDirtyRect(const DirtyRect &rect);
     void clearDirty();
     void clampOffsets(int screenWidth, int screenHeight);
     void zoomIn();
@@ -43,6 +55,13 @@ public:
     u8 *pixels;
     DirtyRect dirty;
     char channel[25];
+
+private:
+    CanvasState(const CanvasState &);
+    CanvasState &operator=(const CanvasState &);
+
+    z_stream_s *loadStream;
+    bool loadStreamEnded;
 };
 
 #endif
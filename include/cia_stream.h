@@ -0,0 +1,91 @@
+#ifndef DOODLE_CIA_STREAM_H
+#define DOODLE_CIA_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "sha256.h"
+
+namespace Doodle
+{
+
+static const size_t CIA_STREAM_CHUNK_BYTES = 64 * 1024;
+
+// The AM service calls a CIA install makes. The updater drives the console's
+// service through this; host tests substitute a fake.
+class CiaInstallService
+{
+public:
+    virtual ~CiaInstallService() {}
+
+    // Each returns 0 or the service's failing result code.
+    virtual int32_t begin(uint64_t titleId) = 0;
+    virtual int32_t write(uint64_t offset, const uint8_t *data, size_t length) = 0;
+    virtual int32_t finish() = 0;
+    virtual void cancel() = 0;
+};
+
+enum CiaStreamStatus
+{
+    CIA_STREAM_OK = 0,
+    CIA_STREAM_SIZE_MISMATCH,
+    CIA_STREAM_CHECKSUM_MISMATCH,
+    CIA_STREAM_INSTALL_FAILED
+};
+
+// Title ID from the TMD of a CIA whose first length bytes are given; false
+// until enough of the file is present or when its layout is invalid.
+bool ciaTitleId(const uint8_t *cia, size_t length, uint64_t &titleId, bool &needMore);
+
+// Installs a CIA while it downloads, so no byte is staged on the SD card.
+// Incoming bytes are hashed and gathered into CIA_STREAM_CHUNK_BYTES writes.
+// The install begins with the first write, once the title ID in the TMD is
+// known to match. Any failure, including a wrong size or digest found at the
+// end, cancels the install so nothing partial is ever committed.
+class CiaStreamInstall
+{
+public:
+    CiaStreamInstall(CiaInstallService &service, uint64_t expectedTitleId,
+                     uint64_t expectedSize, const char *expectedSha256);
+    // Cancels an install that was begun but not finished.
+    ~CiaStreamInstall();
+
+    // Body callback; false stops the download and error() says why.
+    bool write(const uint8_t *data, size_t length);
+    // After the last byte: checks size and digest, then commits or cancels.
+    CiaStreamStatus finish();
+    // For a download that failed underneath; cancels if begun.
+    void cancel();
+
+    uint64_t received() const { return received_; }
+    bool failed() const { return failed_; }
+    // The body stopped short with nothing about the CIA refused, so the
+    // same artifact can still be fetched another way.
+    bool interrupted() const { return !failed_ && received_ < expectedSize_; }
+    const char *error() const { return error_; }
+
+private:
+    CiaStreamInstall(const CiaStreamInstall &);
+    CiaStreamInstall &operator=(const CiaStreamInstall &);
+
+    bool flush();
+    bool fail(CiaStreamStatus status, const char *format, ...);
+
+    CiaInstallService &service_;
+    uint64_t expectedTitleId_;
+    uint64_t expectedSize_;
+    char expectedSha256_[65];
+    Sha256 hash_;
+    std::vector<uint8_t> pending_;
+    uint64_t received_;
+    uint64_t written_;
+    bool begun_;
+    bool failed_;
+    CiaStreamStatus status_;
+    char error_[160];
+};
+
+} // namespace Doodle
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef DOODLE_CONTROL_ROUTER_H
+#define DOODLE_CONTROL_ROUTER_H
+
+namespace Doodle
+{
+
+// Server control messages the client reacts to, keyed on their "type".
+enum ControlMessageType
+{
+    CONTROL_MESSAGE_UNKNOWN = 0,
+    CONTROL_MESSAGE_ACCESS_RESTORED,
+    CONTROL_MESSAGE_ADMIN_CANVAS_RESULT,
+    CONTROL_MESSAGE_BANNED,
+    CONTROL_MESSAGE_CHANNELS,
+    CONTROL_MESSAGE_DISCONNECTED,
+    CONTROL_MESSAGE_DISPLAY_NAME_CHANGED,
+    CONTROL_MESSAGE_DISPLAY_NAME_REJECTED,
+    CONTROL_MESSAGE_ERROR,
+    CONTROL_MESSAGE_IDENTITY_ACCEPTED,
+    CONTROL_MESSAGE_IDENTITY_BACKUP_CODE,
+    CONTROL_MESSAGE_IDENTITY_NEEDS_DISPLAY_NAME,
+    CONTROL_MESSAGE_MODERATION_RESULT,
+    CONTROL_MESSAGE_MUTED,
+    CONTROL_MESSAGE_ONBOARDING_STATE,
+    CONTROL_MESSAGE_PRESENCE,
+    CONTROL_MESSAGE_RECOVERY_FAILED,
+    CONTROL_MESSAGE_RULES_ACCEPTED,
+    CONTROL_MESSAGE_RULES_REJECTED,
+    CONTROL_MESSAGE_RULES_REQUIRED,
+    CONTROL_MESSAGE_SERVER_RESTARTING,
+    CONTROL_MESSAGE_STAFF_CHAT_END,
+    CONTROL_MESSAGE_STAFF_CHAT_MESSAGE,
+    CONTROL_MESSAGE_STAFF_CHAT_RESULT,
+    CONTROL_MESSAGE_STAFF_CHAT_START,
+    CONTROL_MESSAGE_SUPPORT_ONLY,
+    CONTROL_MESSAGE_TICKET_COUNTS,
+    CONTROL_MESSAGE_TICKET_LIST_END,
+    CONTROL_MESSAGE_TICKET_LIST_START,
+    CONTROL_MESSAGE_TICKET_MESSAGE,
+    CONTROL_MESSAGE_TICKET_RESULT,
+    CONTROL_MESSAGE_TICKET_SUMMARY,
+    CONTROL_MESSAGE_TICKET_THREAD_END,
+    CONTROL_MESSAGE_TICKET_THREAD_START,
+    CONTROL_MESSAGE_TICKET_UPDATED,
+    CONTROL_MESSAGE_TYPE_COUNT
+};
+
+// Reads the value of the first "type":"..." key in a JSON line and looks it
+// up in a name-sorted table with a binary search, so routing a message costs
+// one scan of its envelope instead of one strstr per candidate parser.
+// Missing, unterminated and unrecognized types are CONTROL_MESSAGE_UNKNOWN.
+ControlMessageType controlMessageType(const char *json);
+
+// The wire name of a type, or "" for CONTROL_MESSAGE_UNKNOWN.
+const char *controlMessageTypeName(ControlMessageType type);
+
+} // namespace Doodle
+
+#endif
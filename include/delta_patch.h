@@ -0,0 +1,130 @@
+#ifndef DOODLE_DELTA_PATCH_H
+#define DOODLE_DELTA_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "sha256.h"
+
+namespace Doodle
+{
+
+// Delta patch from one release artifact to the next. After the magic
+// "DPT1" every integer is an unsigned LEB128 varint:
+//   baseSize targetSize, then operations until END
+//   COPY baseOffset length           base bytes unchanged
+//   ADD baseOffset length runs...    base bytes plus a difference; the runs
+//                                    alternate an unchanged count with a
+//                                    changed count and that many bytes to
+//                                    add, so moved code costs only the
+//                                    addresses that moved with it
+//   INSERT length bytes              bytes the base does not have
+enum DeltaPatchOp
+{
+    DELTA_OP_END = 0,
+    DELTA_OP_COPY = 1,
+    DELTA_OP_ADD = 2,
+    DELTA_OP_INSERT = 3
+};
+
+static const size_t DELTA_PATCH_OUTPUT_BYTES = 8 * 1024;
+
+// Patch turning base into target. For the release tool and tests.
+void buildDeltaPatch(const uint8_t *base, size_t baseSize, const uint8_t *target, size_t targetSize,
+                     std::vector<uint8_t> &patch);
+
+enum DeltaPatchStatus
+{
+    DELTA_PATCH_OK = 0,
+    DELTA_PATCH_INVALID,
+    DELTA_PATCH_CHECKSUM_MISMATCH,
+    DELTA_PATCH_TARGET_MISMATCH,
+    DELTA_PATCH_IO_FAILED
+};
+
+typedef bool (*DeltaOutputCallback)(const uint8_t *data, size_t length, void *userData);
+
+// Applies a patch while it downloads: base bytes are read from the
+// installed artifact and the rebuilt artifact is handed to the output in
+// order. Both the patch and the result are hashed on the way through, and
+// nothing is trusted until finish() has compared them with the manifest.
+class DeltaPatchApplier
+{
+public:
+    DeltaPatchApplier(FILE *base, DeltaOutputCallback output, void *userData,
+                      uint64_t expectedPatchSize, const char *expectedPatchSha256,
+                      uint64_t expectedTargetSize, const char *expectedTargetSha256);
+
+    // Body callback; false stops the download and error() says why.
+    bool write(const uint8_t *data, size_t length);
+    // After the last patch byte: flushes the output and checks both digests.
+    DeltaPatchStatus finish();
+
+    uint64_t patchBytes() const { return patchBytes_; }
+    uint64_t produced() const { return produced_; }
+    const char *error() const { return error_; }
+
+private:
+    enum State
+    {
+        READ_MAGIC,
+        READ_BASE_SIZE,
+        READ_TARGET_SIZE,
+        READ_OP,
+        READ_OFFSET,
+        READ_LENGTH,
+        READ_UNCHANGED,
+        READ_CHANGED,
+        CHANGED_BYTES,
+        INSERT_BYTES,
+        PATCH_DONE
+    };
+
+    DeltaPatchApplier(const DeltaPatchApplier &);
+    DeltaPatchApplier &operator=(const DeltaPatchApplier &);
+
+    bool field(uint64_t value);
+    bool copyBase(uint64_t offset, uint64_t length);
+    bool readBase(uint64_t offset, uint8_t *out, size_t length);
+    bool plan(uint64_t length);
+    bool flush();
+    bool fail(DeltaPatchStatus status, const char *format, ...);
+
+    FILE *base_;
+    uint64_t baseSize_;
+    uint64_t basePosition_;
+    DeltaOutputCallback output_;
+    void *userData_;
+    uint64_t expectedPatchSize_;
+    char expectedPatchSha256_[65];
+    uint64_t expectedTargetSize_;
+    char expectedTargetSha256_[65];
+
+    State state_;
+    uint8_t magic_[4];
+    size_t magicLength_;
+    uint64_t varint_;
+    unsigned int varintShift_;
+    uint64_t op_;
+    uint64_t offset_;
+    uint64_t opRemaining_;
+    uint64_t runRemaining_;
+
+    uint8_t out_[DELTA_PATCH_OUTPUT_BYTES];
+    size_t outLength_;
+    uint64_t patchBytes_;
+    // Output the operations read so far account for, and output made.
+    uint64_t planned_;
+    uint64_t produced_;
+    Sha256 patchHash_;
+    Sha256 targetHash_;
+    bool failed_;
+    DeltaPatchStatus status_;
+    char error_[96];
+};
+
+} // namespace Doodle
+
+#endif
@@ -13,6 +13,9 @@
 #define MBEDTLS_SSL_TLS_C
 #define MBEDTLS_SSL_SERVER_NAME_INDICATION
 #define MBEDTLS_SSL_EXTENDED_MASTER_SECRET
+/* Reconnects after sleep or Wi-Fi loss resume the previous session, by
+ * ticket when the server issues one and by session ID otherwise. */
+#define MBEDTLS_SSL_SESSION_TICKETS
 #define MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED
 
 /* Only these curves are offered during the TLS handshake. secp521r1 remains
@@ -31,6 +34,9 @@
 #define MBEDTLS_X509_RSASSA_PSS_SUPPORT
 #define MBEDTLS_PKCS1_V15
 #define MBEDTLS_PKCS1_V21
+/* Trust anchors come from the embedded table one issuer at a time through
+ * a CA callback instead of a chain parsed up front. */
+#define MBEDTLS_X509_TRUSTED_CERTIFICATE_CALLBACK
 
 /* Cryptographic modules required by the two allowed AEAD suites and the
  * current Mozilla CA set. */
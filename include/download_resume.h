@@ -0,0 +1,73 @@
+#ifndef DOODLE_DOWNLOAD_RESUME_H
+#define DOODLE_DOWNLOAD_RESUME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "https_client.h"
+#include "sha256.h"
+
+namespace Doodle
+{
+
+// A download kept in a .part file across dropped connections. A .part.tag
+// file beside it records which artifact digest the bytes belong to and the
+// server's validator, so a later attempt asks only for the rest and seeds
+// its SHA-256 from what is already on the card.
+class ResumableDownload
+{
+public:
+    ResumableDownload();
+    // Closes the file, keeping it for a later attempt.
+    ~ResumableDownload();
+
+    // Opens partPath for the artifact with this digest and size. Bytes an
+    // earlier attempt left for the same artifact are kept and hashed again,
+    // unless this object already hashed them before close(). Anything else
+    // there is truncated.
+    bool open(const char *partPath, const char *expectedSha256, uint64_t expectedSize);
+    // Where the next request should start, with If-Range when known.
+    HttpsRange range() const;
+    // Body callback for one attempt. The first call after open() reads the
+    // response: a 206 continues the kept bytes, a 200 replaces them.
+    bool write(const HttpsResponse &response, const uint8_t *data, size_t length);
+    // Flushes and closes, keeping the file and tag.
+    bool close();
+    // Closes and deletes the file and its tag.
+    void discard();
+    // Digest of everything written; call once, after the last write.
+    void finishHex(char out[65]);
+
+    uint64_t size() const { return size_; }
+    // Bytes kept from an earlier attempt at open().
+    uint64_t resumedFrom() const { return kept_; }
+    const char *error() const { return error_; }
+
+private:
+    ResumableDownload(const ResumableDownload &);
+    ResumableDownload &operator=(const ResumableDownload &);
+
+    bool readTag();
+    void writeTag(const char *validator);
+    uint64_t rehash();
+    bool fail(const char *format, ...);
+
+    FILE *file_;
+    char partPath_[320];
+    char tagPath_[328];
+    char expectedSha256_[65];
+    char validator_[96];
+    uint64_t expectedSize_;
+    uint64_t kept_;
+    uint64_t size_;
+    bool started_;
+    // size_ and hash_ still describe the closed file.
+    bool hashed_;
+    Sha256 hash_;
+    char error_[96];
+};
+
+} // namespace Doodle
+
+#endif
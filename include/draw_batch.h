@@ -0,0 +1,91 @@
+#ifndef DOODLE_DRAW_BATCH_H
+#define DOODLE_DRAW_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "ui.h"
+
+namespace Doodle
+{
+
+// The build may set DRAW_BATCH_LATENCY_MS and DRAW_BATCH_BYTE_BUDGET to
+// override the defaults.
+#ifdef DRAW_BATCH_LATENCY_MS
+static const int DRAW_BATCH_DEFAULT_LATENCY_MS = DRAW_BATCH_LATENCY_MS;
+#else
+static const int DRAW_BATCH_DEFAULT_LATENCY_MS = 33;
+#endif
+#ifdef DRAW_BATCH_BYTE_BUDGET
+static const size_t DRAW_BATCH_DEFAULT_BYTE_BUDGET = DRAW_BATCH_BYTE_BUDGET;
+#else
+static const size_t DRAW_BATCH_DEFAULT_BYTE_BUDGET = 256;
+#endif
+
+// Decides when the pending samples of a stroke go out as a draw packet.
+// A batch is held until its oldest sample is latencyMs old or its type-6
+// encoding reaches byteBudget or a packet's point limit. Unless it outruns
+// the budget, a held stylus then costs one packet per latency period
+// rounded up to whole frames, 20 a second at the default and 60 frames/s,
+// however many samples it produces. Style changes and stylus release are
+// flushed by the caller regardless. A latency of 0 sends each frame's
+// samples as soon as they are taken.
+class DrawBatcher
+{
+public:
+    explicit DrawBatcher(int latencyMs = DRAW_BATCH_DEFAULT_LATENCY_MS,
+                         size_t byteBudget = DRAW_BATCH_DEFAULT_BYTE_BUDGET);
+
+    int latencyMs() const { return latencyMs_; }
+    size_t byteBudget() const { return byteBudget_; }
+
+    // Called once per frame with the batch as it stands. Points appended
+    // since the last call are timed and costed from nowMs; a batch that
+    // was cleared elsewhere starts over. Returns true when it should be
+    // sent now, after which the caller clears it and calls reset().
+    bool due(const std::vector<DrawPoint> &pending, uint64_t nowMs);
+
+    // Encoded size of the batch as last seen by due(), header included.
+    size_t pendingBytes() const { return pendingBytes_; }
+
+    void reset();
+
+private:
+    int latencyMs_;
+    size_t byteBudget_;
+    bool started_;
+    uint64_t startedAt_;
+    size_t countedPoints_;
+    size_t pendingBytes_;
+};
+
+// Packets and bytes handed to the network over roughly the last second,
+// kept in ten 100 ms buckets so reading the rate never walks a history.
+class SendRateCounter
+{
+public:
+    SendRateCounter();
+
+    void record(size_t bytes, uint64_t nowMs);
+    unsigned packetsPerSecond(uint64_t nowMs);
+    unsigned bytesPerSecond(uint64_t nowMs);
+
+    uint64_t totalPackets() const { return totalPackets_; }
+    uint64_t totalBytes() const { return totalBytes_; }
+
+private:
+    static const int BUCKET_COUNT = 10;
+    static const uint64_t BUCKET_MS = 100;
+
+    void advance(uint64_t nowMs);
+
+    uint64_t currentBucket_;
+    unsigned packets_[BUCKET_COUNT];
+    unsigned bytes_[BUCKET_COUNT];
+    uint64_t totalPackets_;
+    uint64_t totalBytes_;
+};
+
+} // namespace Doodle
+
+#endif
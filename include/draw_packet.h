@@ -0,0 +1,74 @@
+#ifndef DOODLE_DRAW_PACKET_H
+#define DOODLE_DRAW_PACKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ui.h"
+
+namespace Doodle
+{
+
+// Binary draw packet types. Types 1, 4 and 5 share a seven-byte header
+// followed by absolute little-endian u16 x/y pairs. Type 6 carries the same
+// style with a flags byte, an absolute first point and one varint per
+// following point:
+//
+//   [6][r][g][b][sizeTenths][shape][flags][count][x:u16][y:u16][delta]...
+//
+// Each delta interleaves the bits of zigzag(dx) and zigzag(dy) (dx in the
+// even bits) and is written as a LEB128 varint, so neighbouring stroke
+// samples cost one byte instead of four.
+static const uint8_t DRAW_PACKET_WHOLE_SIZE = 1;
+static const uint8_t DRAW_PACKET_TENTHS = 4;
+static const uint8_t DRAW_PACKET_FEATHER = 5;
+static const uint8_t DRAW_PACKET_DELTA = 6;
+
+static const uint8_t DRAW_PACKET_FLAG_FEATHER = 0x01;
+static const size_t DRAW_PACKET_ABSOLUTE_HEADER = 7;
+static const size_t DRAW_PACKET_DELTA_HEADER = 12;
+static const size_t DRAW_PACKET_MAX_POINTS = 255;
+// Largest delta is a 17-bit zigzag per axis, 34 interleaved bits.
+static const size_t DRAW_PACKET_MAX_DELTA_BYTES = 5;
+static const size_t DRAW_PACKET_MAX_BYTES =
+    DRAW_PACKET_DELTA_HEADER + (DRAW_PACKET_MAX_POINTS - 1) * DRAW_PACKET_MAX_DELTA_BYTES;
+
+struct DrawPacketStyle
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    int sizeTenths;
+    uint8_t shape;
+    bool feather;
+};
+
+// Packet fields are little-endian and may sit at any alignment.
+inline uint16_t readPacketU16(const uint8_t *bytes)
+{
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+inline void writePacketU16(uint8_t *bytes, uint16_t value)
+{
+    bytes[0] = (uint8_t)value;
+    bytes[1] = (uint8_t)(value >> 8);
+}
+
+// Bytes one type-6 delta of (dx, dy) takes on the wire.
+size_t deltaDrawPointBytes(int dx, int dy);
+
+// Writes a type-6 packet for the leading points, which must lie in
+// 0..65535. Stops early rather than exceed capacity. Returns how many
+// points were encoded (0 when not even the header fits) and sets length.
+size_t encodeDeltaDrawPacket(const DrawPacketStyle &style, const DrawPoint *points,
+                             size_t count, uint8_t *packet, size_t capacity,
+                             size_t &length);
+
+// Decodes a type 1, 4, 5 or 6 packet into at most DRAW_PACKET_MAX_POINTS
+// points. Rejects truncated, trailing or out-of-range data.
+bool decodeDrawPacket(const uint8_t *packet, size_t length, DrawPacketStyle &style,
+                      DrawPoint *points, size_t &count);
+
+} // namespace Doodle
+
+#endif
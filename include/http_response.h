@@ -0,0 +1,72 @@
+#ifndef DOODLE_HTTP_RESPONSE_H
+#define DOODLE_HTTP_RESPONSE_H
+
+#include <stddef.h>
+#include <string>
+
+#include "https_client.h"
+
+namespace Doodle
+{
+
+// GET request for path, with Range and If-Range when range.start is set.
+// Returns the length written, or 0 when it did not fit.
+size_t formatHttpGet(char *out, size_t outSize, const char *path, const char *hostHeader,
+                     const HttpsRange &range);
+
+// "bytes first-last/complete"; complete is -1 for "*".
+bool parseContentRange(const std::string &value, unsigned long long &first,
+                       unsigned long long &last, long long &complete);
+
+class BodyDecoder;
+
+// Reads one HTTP/1.1 response as the connection delivers it: skips
+// informational responses, checks status and framing, and hands the body
+// to the callback. Only 200 is accepted, or 206 when range asked for a
+// start the Content-Range confirms.
+class HttpResponseReader
+{
+public:
+    enum Result
+    {
+        READ_MORE,
+        READ_COMPLETE,
+        READ_REDIRECT,
+        READ_FAILED
+    };
+
+    HttpResponseReader(HttpsResponse &response, std::string &redirectLocation,
+                       const HttpsRange &range, size_t maxBodyBytes,
+                       HttpsBodyCallback callback, void *userData, char *error, size_t errorSize);
+    ~HttpResponseReader();
+
+    Result feed(const unsigned char *data, size_t length);
+    // The peer closed the connection; completes a close-delimited body.
+    Result closed();
+
+    size_t bodyBytes() const;
+
+private:
+    HttpResponseReader(const HttpResponseReader &);
+    HttpResponseReader &operator=(const HttpResponseReader &);
+
+    Result startBody();
+
+    HttpsResponse &response_;
+    std::string &redirectLocation_;
+    HttpsRange range_;
+    size_t maxBodyBytes_;
+    HttpsBodyCallback callback_;
+    void *userData_;
+    char *error_;
+    size_t errorSize_;
+    std::string headers_;
+    std::string contentRange_;
+    int informationalResponses_;
+    bool headersDone_;
+    BodyDecoder *decoder_;
+};
+
+} // namespace Doodle
+
+#endif
@@ -9,8 +9,29 @@ struct HttpsResponse
     long long contentLength;
     size_t bodyBytes;
     bool chunked;
+    // 206 Partial Content: the body starts rangeStart bytes into a resource
+    // completeLength bytes long (-1 when the server did not say).
+    bool partial;
+    unsigned long long rangeStart;
+    long long completeLength;
+    // Strong ETag, else Last-Modified, for a later If-Range; empty if neither.
+    char validator[96];
+    // Handshake of the connection that produced the final response.
+    bool tlsResumed;
+    unsigned long tlsHandshakeMs;
 };
 
+// Asks for the body from start on, but only while the resource still
+// matches validator (NULL or empty skips the condition). A start of 0 sends
+// a plain GET.
+struct HttpsRange
+{
+    unsigned long long start;
+    const char* validator;
+};
+
+// The response's headers are filled in before the first call, so a body
+// callback holding the response can tell a 206 continuation from a 200.
 typedef bool (*HttpsBodyCallback)(const unsigned char* data, size_t length, void* userData);
 
 // Minimal same-origin HTTPS/1.1 client used by the updater. It deliberately
@@ -22,6 +43,13 @@ public:
                     size_t maxBodyBytes, HttpsBodyCallback bodyCallback,
                     void* userData, HttpsResponse& response,
                     char* error, size_t errorSize, int maxRedirects = 3);
+    // As get, resuming at range.start. The server may still answer 200 with
+    // the whole body when it ignores ranges or the validator no longer matches.
+    static bool getRange(const char* host, const char* port, const char* path,
+                         const HttpsRange& range, size_t maxBodyBytes,
+                         HttpsBodyCallback bodyCallback, void* userData,
+                         HttpsResponse& response, char* error, size_t errorSize,
+                         int maxRedirects = 3);
 };
 
 #endif
@@ -0,0 +1,82 @@
+#ifndef DOODLE_LOCAL_ECHO_H
+#define DOODLE_LOCAL_ECHO_H
+
+#include <3ds.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "canvas_state.h"
+
+namespace Doodle
+{
+
+static const int LOCAL_ECHO_TILE_SIZE = 32;
+
+// Canvas tiles under local draw packets the server has not yet confirmed.
+// Local strokes go into the canvas as they are drawn, so a remote packet
+// that arrives before they are confirmed lands on top of them. The server
+// took that packet first and keeps ours on top. Each tile remembers the
+// newest pending packet over it. When a remote change reaches such tiles,
+// the caller redraws its pending packets clipped to the changed part of
+// them. That restores the server's order without fetching a snapshot.
+class LocalEchoTiles
+{
+public:
+    LocalEchoTiles();
+
+    // Forgets every pending tile; call when a snapshot replaces the canvas.
+    void reset(int canvasWidth, int canvasHeight);
+
+    // A local packet drawn over bounds went out as message sequence.
+    void markPending(const DirtyRect &bounds, uint32_t sequence);
+    // Releases tiles whose packets are all confirmed.
+    void acknowledge(uint32_t sequence);
+    uint32_t acknowledged() const { return acknowledged_; }
+    size_t pendingTiles() const { return pendingTiles_; }
+
+    // The parts of changed that lie on pending tiles, one rectangle per run
+    // of adjacent pending tiles in a tile row, each clipped to changed.
+    // Replaces areas and returns how many there are.
+    size_t pendingAreas(const DirtyRect &changed, std::vector<DirtyRect> &areas) const;
+
+private:
+    bool tileRange(const DirtyRect &rect, int &minTileX, int &minTileY,
+                   int &maxTileX, int &maxTileY) const;
+
+    int canvasWidth_;
+    int canvasHeight_;
+    int tilesX_;
+    int tilesY_;
+    // Newest pending sequence per tile; 0 when the tile has none.
+    std::vector<uint32_t> newest_;
+    size_t pendingTiles_;
+    uint32_t acknowledged_;
+};
+
+// Confines one restack to the pixels the remote packet overwrote outright.
+// There the canvas holds only the remote color, so drawing our pending
+// packets again gives the server's order exactly. Anywhere else in the area
+// the remote packet blended over our stroke or missed it, and drawing it
+// again would blend its soft edges twice; those pixels are put back.
+class LocalEchoRestack
+{
+public:
+    // Saves area of the canvas and clears the opaque map.
+    void begin(const u8 *canvas, int canvasWidth, const DirtyRect &area);
+    // One byte per pixel of the area, row by row; the remote packet's
+    // opaque pixels are set in it before the pending packets are redrawn.
+    u8 *opaque() { return &opaque_[0]; }
+    void coverAll();
+    bool anyOpaque() const;
+    // Restores every saved pixel the opaque map leaves clear.
+    void finish(u8 *canvas, int canvasWidth) const;
+
+private:
+    DirtyRect area_;
+    std::vector<u8> saved_;
+    std::vector<u8> opaque_;
+};
+
+} // namespace Doodle
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef DOODLE_MINIMAP_CACHE_H
+#define DOODLE_MINIMAP_CACHE_H
+
+#include <3ds.h>
+#include "canvas_state.h"
+
+namespace Doodle
+{
+
+static const int MINIMAP_WIDTH = 256;
+static const int MINIMAP_HEIGHT = 144;
+static const int MINIMAP_TILE_SIZE = 16;
+static const int MINIMAP_TILES_X = MINIMAP_WIDTH / MINIMAP_TILE_SIZE;
+static const int MINIMAP_TILES_Y = MINIMAP_HEIGHT / MINIMAP_TILE_SIZE;
+
+// RGB thumbnail of the canvas, split into 16x16 tiles that are rebuilt only
+// when the canvas pixels under them change. Each thumbnail pixel is the box
+// average of the canvas block it covers, so strokes thinner than the
+// downscale factor still show up instead of aliasing away.
+class MinimapCache
+{
+public:
+    MinimapCache();
+
+    void invalidate();
+    void invalidateCanvasRect(const DirtyRect &canvasRect);
+
+    // Rebuilds every dirty tile from the canvas. A canvas size change marks
+    // all tiles dirty first. Returns the number of tiles rebuilt.
+    int update(const u8 *canvasPixels, int canvasWidth, int canvasHeight);
+
+    const u8 *pixels() const { return pixels_; }
+
+private:
+    void rebuildTile(int tileX, int tileY, const u8 *canvasPixels);
+
+    u8 pixels_[MINIMAP_WIDTH * MINIMAP_HEIGHT * 3];
+    bool tileDirty_[MINIMAP_TILES_X * MINIMAP_TILES_Y];
+    bool anyDirty_;
+    int canvasWidth_;
+    int canvasHeight_;
+};
+
+} // namespace Doodle
+
+#endif
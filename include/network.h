@@ -7,6 +7,8 @@
 #include <string>
 #include <vector>
 
+#include "buffer_pool.h"
+
 #define SOC_ALIGN 0x1000
 #define SOC_BUFFERSIZE 0x100000
 
@@ -15,15 +17,23 @@ enum NetworkEventType
     NETWORK_EVENT_CONNECTED,
     NETWORK_EVENT_TEXT,
     NETWORK_EVENT_BINARY,
+    // One piece of a large binary message (a canvas snapshot), delivered
+    // while the rest is still arriving. See partOffset and partFinal.
+    NETWORK_EVENT_BINARY_PART,
     NETWORK_EVENT_DISCONNECTED,
     NETWORK_EVENT_ERROR
 };
 
 struct NetworkEvent
 {
+    NetworkEvent() : type(NETWORK_EVENT_ERROR), partOffset(0), partFinal(true) {}
+
     NetworkEventType type;
-    std::vector<uint8_t> payload;
+    // Pooled; text payloads are NUL-terminated and can be parsed in place.
+    Doodle::PooledBuffer payload;
     std::string detail;
+    size_t partOffset;
+    bool partFinal;
 };
 
 // Thread-safe facade used by the application. All DNS, TCP, TLS, WebSocket,
@@ -40,6 +50,12 @@ public:
     // Normal sends remain gated until this succeeds.
     static bool sendSessionHello(const void *text, size_t length);
     static bool sendBinary(const void *buffer, size_t length);
+    // Every message accepted by a send call is numbered, from 1, in the
+    // order it was queued. acknowledgedSequence() is the highest number the
+    // server is known to have received; messages dropped with a connection
+    // are never acknowledged. Both are for the main thread.
+    static uint32_t lastQueuedSequence();
+    static uint32_t acknowledgedSequence();
     static bool pollEvent(NetworkEvent &event);
     static bool waitEvent(NetworkEvent &event, int timeoutMs);
     static bool waitForConnected(int timeoutMs);
@@ -52,6 +68,9 @@ public:
     static bool isConnected();
     static bool isConnecting();
     static const char *lastError();
+    // Allocation counters of the pool that backs every event and outgoing
+    // message, for checking that steady traffic stays off the heap.
+    static Doodle::BufferPoolStats bufferPoolStats();
 };
 
 #endif
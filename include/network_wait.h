@@ -0,0 +1,18 @@
+#ifndef DOODLE_NETWORK_WAIT_H
+#define DOODLE_NETWORK_WAIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Doodle
+{
+
+// How long the network worker may block at now before the earliest of
+// deadlines needs it, in milliseconds. Deadlines of 0 are unset and ignored;
+// one already due gives 0. The result never exceeds limitMs, so a worker
+// with nothing scheduled still looks around now and then.
+int networkWaitMs(uint64_t now, const uint64_t *deadlines, size_t count, int limitMs);
+
+} // namespace Doodle
+
+#endif
@@ -36,11 +36,22 @@ struct RendererTopState {
     int pageSelected;
     const char *controlPreset;
     const char *controlBindings[6];
+    // Test builds only: draw packet rates and network buffer pool counters
+    // for the Connection page.
+    const char *uplinkStats;
+    const char *bufferStats;
 };
 
 class Renderer {
 public:
+    // Incremental unless forceFull: only the screen area covered by
+    // canvas.dirty and by invalidated overlay rectangles is re-blitted.
+    // Pan, zoom, and canvas reallocation are detected and redraw everything.
     static void renderViewport(CanvasState &canvas, u8 *buffer, int fbWidth, int fbHeight, bool forceFull);
+    static void invalidateViewport();
+    // Screen-space area that an overlay drew over in the staging buffer and
+    // that the next renderViewport must restore from the canvas.
+    static void invalidateViewportRect(int x, int y, int w, int h);
     static void renderTop(CanvasState &canvas, bool connected, bool updateAvailable, Color currentColor,
                           int brushSizeTenths, int brushShape, TopScreenMode mode,
                           char channels[][25], int channelCount, int selectedChannel,
@@ -64,6 +75,9 @@ public:
                           const RendererTopState *topState = NULL);
     static void presentTopFrame();
     static void invalidateMinimap();
+    // Marks the minimap tiles covering a canvas-space rect for rebuild on
+    // the next renderTop; cheaper than invalidateMinimap for small edits.
+    static void invalidateMinimapRect(const DirtyRect &canvasRect);
 };
 
 #endif
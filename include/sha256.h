@@ -0,0 +1,38 @@
+#ifndef DOODLE_SHA256_H
+#define DOODLE_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Doodle
+{
+
+// Incremental SHA-256, fed as bytes arrive so a download's digest is ready
+// when its last byte lands rather than after another pass over the file.
+class Sha256
+{
+public:
+    Sha256();
+
+    void reset();
+    void update(const void *data, size_t length);
+    // Lowercase hex digest and a terminator. Call reset() before reusing.
+    void finishHex(char out[65]);
+
+    uint64_t bytesHashed() const { return length_; }
+
+private:
+    void transform(const uint8_t *block);
+
+    uint32_t h_[8];
+    uint64_t length_;
+    uint8_t block_[64];
+    size_t blockLength_;
+};
+
+// Whether two hex digests name the same bytes, ignoring letter case.
+bool sameSha256Hex(const char *left, const char *right);
+
+} // namespace Doodle
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef DOODLE_SPSC_QUEUE_H
+#define DOODLE_SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+
+namespace Doodle
+{
+
+// Bounded ring between exactly one producer thread and one consumer thread.
+// head and tail count every item ever taken and added; the slot is the count
+// modulo Capacity, which must be a power of two. Items are moved in and out
+// of preconstructed slots, so a steady queue never allocates.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+    SpscQueue() : head_(0), tail_(0) {}
+
+    // Producer only. Returns false when full. wasEmpty reports that the
+    // consumer had taken every earlier item by the time this one was
+    // published, so it may have seen the queue empty and gone to sleep; the
+    // producer should wake it. Checking after publishing, rather than
+    // before, means a consumer that drains in between is never missed.
+    bool push(T &&item, bool *wasEmpty = NULL)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load() >= Capacity)
+            return false;
+        slots_[tail & (Capacity - 1)] = std::move(item);
+        tail_.store(tail + 1);
+        if (wasEmpty)
+            *wasEmpty = head_.load() == tail;
+        return true;
+    }
+
+    // Consumer only.
+    bool pop(T &item)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load())
+            return false;
+        item = std::move(slots_[head & (Capacity - 1)]);
+        head_.store(head + 1);
+        return true;
+    }
+
+    // Consumer only; the item stays queued until pop().
+    T *front()
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        return head == tail_.load() ? NULL : &slots_[head & (Capacity - 1)];
+    }
+
+    // Exact on either end for its own side; a snapshot from anywhere else.
+    size_t size() const { return tail_.load() - head_.load(); }
+    bool empty() const { return size() == 0; }
+    static size_t capacity() { return Capacity; }
+
+private:
+    SpscQueue(const SpscQueue &);
+    SpscQueue &operator=(const SpscQueue &);
+
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "SpscQueue capacity must be a power of two");
+
+    T slots_[Capacity];
+    std::atomic<size_t> head_;
+    std::atomic<size_t> tail_;
+};
+
+} // namespace Doodle
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef DOODLE_STROKE_JOURNAL_H
+#define DOODLE_STROKE_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Doodle
+{
+
+static const size_t STROKE_JOURNAL_DEFAULT_BYTES = 64 * 1024;
+// Sequence of a packet that was drawn locally but never reached the send
+// queue, such as the rest of a stroke cut off by a lost connection or one
+// refused by a full queue.
+static const uint32_t STROKE_JOURNAL_UNSENT = 0xffffffffu;
+
+// Draw packets of one channel that the server has not yet confirmed, oldest
+// first. A packet is recorded with the outgoing message sequence it was sent
+// as and forgotten once the network reports that sequence acknowledged.
+// When the connection goes, everything left is marked stale: stale packets
+// are replayed, in order, once the next snapshot of the channel has loaded,
+// and each is recorded again under its new sequence as it goes out.
+// Unsent packets recorded while connected are already on the canvas; they
+// wait to be sent again, in order, once the send queue has room.
+// Past byteLimit the oldest packets are dropped.
+class StrokeJournal
+{
+public:
+    explicit StrokeJournal(size_t byteLimit = STROKE_JOURNAL_DEFAULT_BYTES);
+
+    // Packets belong to the channel they were drawn on; switching to a
+    // different one empties the journal.
+    void setChannel(const char *channel);
+    const std::string &channel() const { return channel_; }
+
+    bool record(uint32_t sequence, const uint8_t *packet, size_t length);
+    // Forgets packets sent up to and including sequence; sequences start at
+    // 1, so 0 acknowledges nothing. Stale packets are ahead of every live
+    // one, so trimming waits until they are replayed. Unsent packets are
+    // kept and acknowledged ones behind them are still forgotten.
+    void acknowledge(uint32_t sequence);
+    void markStale();
+
+    // Oldest stale packet, for replay. popStale() removes it.
+    bool peekStale(const uint8_t *&packet, size_t &length) const;
+    void popStale();
+
+    // Oldest unsent packet that is not stale, for sending again; sent()
+    // records the sequence it finally went out as. Stale packets are
+    // replayed instead, and markStale() takes in every unsent one.
+    bool peekUnsent(const uint8_t *&packet, size_t &length) const;
+    void sent(uint32_t sequence);
+
+    // Walks every packet, stale ones first, oldest first. Start with cursor
+    // 0; each call hands out the next packet and advances the cursor.
+    bool next(size_t &cursor, uint32_t &sequence, const uint8_t *&packet, size_t &length) const;
+
+    size_t count() const { return count_; }
+    size_t staleCount() const { return stale_; }
+    size_t unsentCount() const { return unsent_; }
+    size_t bytes() const { return log_.size() - head_; }
+    size_t byteLimit() const { return byteLimit_; }
+    // Packets given up because the journal was full.
+    uint32_t dropped() const { return dropped_; }
+    void clear();
+
+    // The file keeps the channel and packets but not sequences; everything
+    // loaded is stale. save() of an empty journal removes the file, and
+    // load() leaves the journal empty unless the whole file is valid.
+    bool save(const char *path) const;
+    bool load(const char *path);
+
+private:
+    static const size_t RECORD_HEADER_BYTES = 6;
+
+    size_t recordLength(size_t offset) const;
+    uint32_t recordSequence(size_t offset) const;
+    size_t firstUnsent() const;
+    void dropOldest();
+    void trimAcknowledged();
+    void compact();
+
+    size_t byteLimit_;
+    std::string channel_;
+    // Records of [sequence u32 LE][length u16 LE][packet] from head_ on.
+    std::vector<uint8_t> log_;
+    size_t head_;
+    size_t count_;
+    size_t stale_;
+    size_t unsent_;
+    uint32_t acknowledged_;
+    uint32_t dropped_;
+};
+
+} // namespace Doodle
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef DOODLE_STROKE_SIMPLIFY_H
+#define DOODLE_STROKE_SIMPLIFY_H
+
+#include <stddef.h>
+#include <vector>
+#include "ui.h"
+
+namespace Doodle
+{
+
+// The build may set STROKE_SIMPLIFY_TOLERANCE_TENTHS to override the default.
+#ifdef STROKE_SIMPLIFY_TOLERANCE_TENTHS
+static const int STROKE_SIMPLIFY_DEFAULT_TOLERANCE_TENTHS = STROKE_SIMPLIFY_TOLERANCE_TENTHS;
+#else
+static const int STROKE_SIMPLIFY_DEFAULT_TOLERANCE_TENTHS = 5;
+#endif
+
+// Ramer-Douglas-Peucker over the stamp centers of one outgoing draw batch.
+// Remote clients re-interpolate between packet points, so a run of samples
+// that stays within the tolerance of its chord can be sent as the chord's
+// two ends. Endpoints are always kept. Sparse brushes (dither, spray) also
+// keep their stamp count: a chord is only taken when the receiver would
+// place as many stamps along it as along the samples it replaces, so the
+// brushStrokeSpacing rhythm survives. A negative tolerance disables it.
+class StrokeSimplifier
+{
+public:
+    explicit StrokeSimplifier(int toleranceTenths = STROKE_SIMPLIFY_DEFAULT_TOLERANCE_TENTHS);
+
+    int toleranceTenths() const { return toleranceTenths_; }
+    void setToleranceTenths(int toleranceTenths) { toleranceTenths_ = toleranceTenths; }
+
+    // Replaces out with the points to send for a stroke drawn with the given
+    // brush, in order. Scratch storage is reused between calls.
+    void simplify(const DrawPoint *points, size_t count, int sizeTenths, int shape,
+                  std::vector<DrawPoint> &out);
+
+private:
+    struct Span
+    {
+        size_t first;
+        size_t last;
+    };
+
+    int toleranceTenths_;
+    std::vector<Span> spans_;
+    std::vector<bool> keep_;
+    std::vector<int> stepsBefore_;
+};
+
+} // namespace Doodle
+
+#endif
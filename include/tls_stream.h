@@ -21,20 +21,35 @@ public:
     ~TlsStream();
 
     // Idempotent global setup/teardown for the 3DS system RNG and embedded CA
-    // trust store. initialize() returns false on any setup or CA parsing error.
+    // trust store. initialize() returns false on any setup error or a
+    // malformed trust-store table; roots themselves are parsed on demand.
     static bool initialize();
     static void shutdown();
 
     // TCP connect and the verified TLS handshake share timeoutMs and should
-    // run on a network/update worker. DNS uses the platform resolver.
+    // run on a network/update worker. DNS uses the platform resolver. A
+    // session from an earlier connection to the same host and port, by any
+    // stream, is offered for resumption; the server may still decline it.
     bool connect(const char* host, const char* port, int timeoutMs);
 
+    // Outcome of the last successful connect on this stream.
+    bool handshakeResumed() const;
+    unsigned long handshakeMilliseconds() const;
+    // "TLS resumed in 240 ms" or "TLS full handshake in 9100 ms".
+    const char* handshakeSummary() const;
+
     // Once connected, I/O is nonblocking and may complete only part of the
     // supplied buffer. A write retried after IO_WOULD_BLOCK must use the same
     // buffer and length until Mbed TLS reports progress.
     IoResult read(void* buffer, size_t capacity, size_t& bytesRead);
     IoResult write(const void* buffer, size_t length, size_t& bytesWritten);
 
+    // The connected socket, for waiting on readiness between reads, or -1.
+    int socketDescriptor() const;
+    // True when Mbed TLS already holds received bytes, decrypted or not, so
+    // the socket may never turn readable for data read() can return now.
+    bool hasPendingInput() const;
+
     void close();
     bool isOpen() const;
     const char* lastError() const;
@@ -50,6 +65,9 @@ private:
     struct Impl;
     Impl* impl_;
     char lastError_[192];
+    char handshakeSummary_[48];
+    bool handshakeResumed_;
+    unsigned long handshakeMs_;
 };
 
 #endif
@@ -0,0 +1,69 @@
+#ifndef DOODLE_TRUST_STORE_H
+#define DOODLE_TRUST_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct mbedtls_x509_crt;
+
+namespace Doodle
+{
+
+// The embedded CA bundle, converted at build time from PEM into a table of
+// DER certificates indexed by subject name, so startup neither decodes nor
+// parses a single root. Little-endian layout:
+//   "DTS1" | u32 count | count x { u32 subjectHash, u32 offset, u32 length }
+//   | certificates
+// The index is sorted by hash, keeping bundle order among equal hashes, and
+// offsets count from the start of the table.
+static const size_t TRUST_STORE_HEADER_BYTES = 8;
+static const size_t TRUST_STORE_ENTRY_BYTES = 12;
+
+// Hash of a DER Name that agrees with how Mbed TLS compares names: the same
+// attributes in the same sets, with UTF8String and PrintableString values
+// equal regardless of which of the two they use or of ASCII letter case.
+// Names Mbed TLS treats as equal always hash alike; the reverse need not hold.
+uint32_t trustStoreNameHash(const uint8_t *name, size_t length);
+
+// The subject Name of a DER certificate, tag and length included.
+bool certificateSubject(const uint8_t *der, size_t length,
+                        const uint8_t *&subject, size_t &subjectLength);
+
+// Decodes every certificate of a PEM bundle and writes the table. Returns
+// false, leaving table empty, if any certificate is malformed.
+bool buildTrustStore(const char *pem, size_t length, std::vector<uint8_t> &table,
+                     size_t *certificates = NULL);
+
+class TrustStore
+{
+public:
+    TrustStore();
+
+    // Checks the header, the ordering and every entry's bounds; the table
+    // must outlive the store.
+    bool attach(const uint8_t *table, size_t size);
+    size_t size() const { return count_; }
+
+    // The consecutive entries whose subject hashes like name. Returns how
+    // many and sets first. A hash match is a candidate, not a name match.
+    size_t findSubject(const uint8_t *name, size_t length, size_t &first) const;
+    bool certificate(size_t index, const uint8_t *&der, size_t &length) const;
+
+private:
+    uint32_t entryHash(size_t index) const;
+
+    const uint8_t *table_;
+    size_t size_;
+    size_t count_;
+};
+
+// Mbed TLS trusted-certificate callback over a TrustStore passed as context.
+// Parses only the entries that may have issued child, in place without
+// copying, into a list Mbed TLS frees.
+int trustStoreIssuers(void *store, const mbedtls_x509_crt *child,
+                      mbedtls_x509_crt **candidates);
+
+} // namespace Doodle
+
+#endif
@@ -12,6 +12,13 @@ struct UpdateManifest {
     char artifactType[8];
     char sha256[65];
     int artifactSize;
+    // A patch from the running version to this one; downloadUpdate applies
+    // it to the installed 3DSX and falls back to the artifact if it fails.
+    bool patchAvailable;
+    char patchUrl[256];
+    char patchName[64];
+    char patchSha256[65];
+    int patchSize;
 };
 
 typedef void (*UpdateProgressCallback)(int downloaded, int total, void *userData);
@@ -24,7 +31,9 @@ enum UpdateDownloadResult {
     UPDATE_DOWNLOAD_FAILED = 4,
     UPDATE_DOWNLOAD_SIZE_MISMATCH = 5,
     UPDATE_DOWNLOAD_CHECKSUM_MISMATCH = 6,
-    UPDATE_DOWNLOAD_INSTALL_FAILED = 7
+    UPDATE_DOWNLOAD_INSTALL_FAILED = 7,
+    // A streamed install lost its connection; nothing was installed.
+    UPDATE_DOWNLOAD_INTERRUPTED = 8
 };
 
 class Updater {
@@ -34,10 +43,20 @@ public:
                               const char *packageType, UpdateManifest &manifest);
     static UpdateDownloadResult downloadUpdate(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
                                                const char *targetPath, UpdateProgressCallback progress, void *userData);
+    // Stages the CIA in a resumable .part beside stagingPath, then installs
+    // it from the SD card.
     static UpdateDownloadResult downloadAndInstallCia(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
                                                       const char *stagingPath, unsigned long long expectedTitleId,
                                                       UpdateProgressCallback progress, void *userData);
+    // Pipes the download straight into an AM install without staging it on
+    // the SD card; a wrong size, checksum or title cancels the install, and
+    // a dropped connection returns UPDATE_DOWNLOAD_INTERRUPTED.
+    static UpdateDownloadResult streamInstallCia(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
+                                                 unsigned long long expectedTitleId,
+                                                 UpdateProgressCallback progress, void *userData);
     static UpdateDownloadResult downloadUpdate(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest);
+    // Whether an earlier download to targetPath left a .part to resume.
+    static bool hasStagedDownload(const char *targetPath);
     static bool checkForUpdate(const char *serverDomain, const char *httpPort, const char *currentVersion);
     static bool relaunchInstalledTitle(unsigned long long titleId);
     static const char *lastError();
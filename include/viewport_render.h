@@ -0,0 +1,69 @@
+#ifndef DOODLE_VIEWPORT_RENDER_H
+#define DOODLE_VIEWPORT_RENDER_H
+
+#include <3ds.h>
+#include "canvas_state.h"
+
+namespace Doodle
+{
+
+static const int VIEWPORT_SCREEN_WIDTH = 320;
+static const int VIEWPORT_SCREEN_HEIGHT = 240;
+static const u8 VIEWPORT_BACKDROP = 240;
+
+// The subset of CanvasState that determines what the bottom screen shows.
+// Keeping it a plain value lets the host fixtures and benchmarks drive the
+// blitter without linking zlib or libctru.
+struct ViewportSource
+{
+    const u8 *pixels;
+    int width;
+    int height;
+    int offsetX;
+    int offsetY;
+    int zoomLevel;
+};
+
+int viewportCanvasCoordinate(int offset, int zoomLevel, int screen);
+
+// Returns the inclusive screen rectangle whose samples read any canvas pixel
+// inside canvasRect, clipped to the 320x240 view. Invalid when off-screen.
+DirtyRect viewportScreenRectForCanvas(const ViewportSource &source,
+                                      const DirtyRect &canvasRect);
+
+// Re-blits an inclusive screen rectangle into a BGR framebuffer. Rotated
+// (240x320 storage) and unrotated layouts are both accepted.
+void renderViewportRect(const ViewportSource &source, u8 *buffer,
+                        int fbWidth, int fbHeight, const DirtyRect &screenRect);
+
+// Remembers the view that produced the staging buffer so later frames only
+// rewrite the screen area covered by canvas edits and by overlays drawn on
+// top of the previous frame. Pan, zoom, resize, or a new pixel allocation
+// still fall back to one full pass.
+class IncrementalViewport
+{
+public:
+    IncrementalViewport();
+
+    void invalidate();
+    void invalidateScreenRect(int x, int y, int w, int h);
+
+    // Returns the number of screen pixels written this frame.
+    int render(const ViewportSource &source, const DirtyRect &canvasDirty,
+               u8 *buffer, int fbWidth, int fbHeight, bool forceFull);
+
+private:
+    bool matches(const ViewportSource &source, const u8 *buffer,
+                 int fbWidth, int fbHeight) const;
+
+    ViewportSource last_;
+    const u8 *lastBuffer_;
+    int lastFbWidth_;
+    int lastFbHeight_;
+    bool valid_;
+    DirtyRect pendingScreen_;
+};
+
+} // namespace Doodle
+
+#endif
@@ -7,7 +7,9 @@
 #include <string>
 #include <vector>
 
+#include "buffer_pool.h"
 #include "tls_stream.h"
+#include "websocket_frame.h"
 
 class WebSocketClient
 {
@@ -18,13 +20,23 @@ public:
         MESSAGE_BINARY
     };
 
+    // Binary messages larger than STREAM_PIECE_BYTES are handed out in
+    // pieces as their bytes arrive instead of being reassembled first.
+    // offset is where this piece starts within the message and final marks
+    // its last piece; a message delivered whole has offset 0 and final set.
     struct Message
     {
         MessageType type;
-        std::vector<uint8_t> payload;
+        Doodle::PooledBuffer payload;
+        size_t offset;
+        bool final;
     };
 
-    WebSocketClient();
+    static const size_t STREAM_PIECE_BYTES = 64 * 1024;
+
+    // Received messages and queued frames are taken from bufferPool, which
+    // must outlive the client.
+    explicit WebSocketClient(Doodle::BufferPool &bufferPool);
     ~WebSocketClient();
 
     bool connect(const char *host, const char *port, const char *path, bool secure,
@@ -32,12 +44,31 @@ public:
     void close(uint16_t code = 1000);
     bool isConnected() const;
     const char *lastError() const;
+    // Empty for plain ws:// connections.
+    const char *handshakeSummary() const;
 
     bool sendText(const void *payload, size_t length);
     bool sendBinary(const void *payload, size_t length);
     bool update();
     bool pollMessage(Message &message);
 
+    // What the owner can wait on between update() calls: the socket (-1
+    // when closed), whether queued frames want it writable, whether input is
+    // already buffered so waiting would stall it, and the osGetTime() at
+    // which the heartbeat next needs update() (0 when closed).
+    int socketDescriptor() const;
+    bool hasPendingOutput() const;
+    bool hasPendingInput() const;
+    uint64_t nextDeadline() const;
+
+    // Data frames written on this connection that the server has since
+    // answered a ping for. A pong can only follow every frame written ahead
+    // of its ping, so these frames have reached the server. While newer
+    // frames wait for that proof, pings go out every ackIntervalMs instead
+    // of the heartbeat interval; 0 leaves only the heartbeat.
+    uint32_t acknowledgedDataFrames() const;
+    void setAckInterval(uint64_t ackIntervalMs);
+
 private:
     WebSocketClient(const WebSocketClient &);
     WebSocketClient &operator=(const WebSocketClient &);
@@ -50,6 +81,7 @@ private:
         STREAM_ERROR
     };
 
+    Doodle::BufferPool &bufferPool;
     TlsStream tlsStream;
     int plainSocket;
     bool secureTransport;
@@ -61,13 +93,21 @@ private:
     uint32_t pingSequence;
     uint64_t lastPingAt;
     uint64_t pongDeadline;
+    uint64_t ackIntervalMs;
+    uint32_t dataFramesWritten;
+    uint32_t pingCoversFrames;
+    uint32_t acknowledgedFrames;
 
-    std::vector<uint8_t> receiveBuffer;
-    std::deque<std::vector<uint8_t> > sendFrames;
+    Doodle::ReceiveBuffer receiveBuffer;
+    std::deque<Doodle::PooledBuffer> sendFrames;
     size_t sendOffset;
     size_t queuedSendBytes;
     std::vector<uint8_t> fragmentBuffer;
     uint8_t fragmentOpcode;
+    bool streamingMessage;
+    size_t streamOffset;
+    uint64_t frameRemaining;
+    bool frameFinal;
     std::deque<Message> messages;
     size_t queuedMessageBytes;
 
@@ -79,8 +119,11 @@ private:
     bool queueFrame(uint8_t opcode, const void *payload, size_t length);
     bool flushOutgoing();
     bool parseAvailableFrames();
-    bool queueMessage(uint8_t opcode, const uint8_t *payload, size_t length);
+    bool queueMessage(uint8_t opcode, const uint8_t *payload, size_t length,
+                      size_t offset = 0, bool final = true);
+    bool appendStreamBytes(const uint8_t *payload, size_t length, bool finalBytes);
     bool queueHeartbeatPing(uint64_t now);
+    uint64_t pingInterval() const;
     bool failProtocol(const char *message, uint16_t closeCode);
     void setError(const char *message);
 };
@@ -0,0 +1,65 @@
+#ifndef DOODLE_WEBSOCKET_FRAME_H
+#define DOODLE_WEBSOCKET_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Doodle
+{
+
+// Bytes received from the socket but not yet parsed. Consuming a frame only
+// advances a read cursor; unread bytes are moved to the front at most once
+// per refill, when the tail has no room for the next read. Parsing a burst
+// of small frames is therefore linear instead of shifting the remainder of
+// the buffer after every frame.
+class ReceiveBuffer
+{
+public:
+    ReceiveBuffer();
+
+    const uint8_t *data() const { return storage_.empty() ? NULL : &storage_[0] + readPos_; }
+    size_t size() const { return writePos_ - readPos_; }
+    bool empty() const { return writePos_ == readPos_; }
+
+    void clear();
+    void consume(size_t length);
+    void append(const uint8_t *bytes, size_t length);
+    // Returns room for at least length bytes after the unread data; commit
+    // then publishes how many of them the socket actually filled.
+    uint8_t *prepare(size_t length);
+    void commit(size_t length);
+
+private:
+    std::vector<uint8_t> storage_;
+    size_t readPos_;
+    size_t writePos_;
+};
+
+enum WebSocketFrameStatus
+{
+    WEBSOCKET_FRAME_INCOMPLETE,
+    WEBSOCKET_FRAME_READY,
+    WEBSOCKET_FRAME_INVALID
+};
+
+struct WebSocketFrameHeader
+{
+    bool final;
+    uint8_t opcode;
+    uint64_t payloadLength;
+    size_t headerLength;
+    // Set for WEBSOCKET_FRAME_INVALID: the reason and the close code to send.
+    const char *error;
+    uint16_t closeCode;
+};
+
+// Parses the header of a server-to-client frame at the start of data.
+// READY means the header is complete; the payload may still be arriving.
+WebSocketFrameStatus parseWebSocketFrameHeader(const uint8_t *data, size_t size,
+                                               uint64_t messageLimit,
+                                               WebSocketFrameHeader &header);
+
+} // namespace Doodle
+
+#endif
@@ -0,0 +1,57 @@
+param(
+    [string]$ProjectRoot = (Split-Path -Parent $PSScriptRoot),
+    [ValidateSet('make_trust_store', 'make_delta_patch')]
+    [string]$Tool = 'make_trust_store'
+)
+
+$ErrorActionPreference = 'Stop'
+$ProjectRoot = (Resolve-Path -LiteralPath $ProjectRoot).Path
+$BuildDir = Join-Path $ProjectRoot 'build\host-tools'
+New-Item -ItemType Directory -Force -Path $BuildDir | Out-Null
+
+$vswhere = Join-Path ${env:ProgramFiles(x86)} 'Microsoft Visual Studio\Installer\vswhere.exe'
+if (-not (Test-Path -LiteralPath $vswhere)) {
+    throw 'Visual Studio Build Tools were not found (vswhere.exe is missing).'
+}
+
+$installPath = (& $vswhere -latest -products * -requires Microsoft.VisualStudio.Component.VC.Tools.x86.x64 -property installationPath | Select-Object -First 1)
+if (-not $installPath) {
+    throw 'Visual Studio C++ Build Tools were not found.'
+}
+
+# Builds a tool for the machine running make. make_trust_store turns
+# data\cacert.pem into the trust-store table the client links in and the
+# Makefile runs it for each PEM bundle; make_delta_patch is run by hand when
+# publishing a release (see README).
+$devShell = Join-Path $installPath 'Common7\Tools\VsDevCmd.bat'
+$binary = Join-Path $BuildDir ($Tool + '.exe')
+if ($Tool -eq 'make_delta_patch') {
+    $sources = @(
+        (Join-Path $ProjectRoot 'tools\make_delta_patch.cpp'),
+        (Join-Path $ProjectRoot 'source\delta_patch.cpp'),
+        (Join-Path $ProjectRoot 'source\sha256.cpp')
+    )
+} else {
+    $sources = @(
+        (Join-Path $ProjectRoot 'tools\make_trust_store.cpp'),
+        (Join-Path $ProjectRoot 'source\trust_store.cpp')
+    )
+}
+$quotedSources = ($sources | ForEach-Object { '"' + $_ + '"' }) -join ' '
+$appInclude = Join-Path $ProjectRoot 'include'
+
+$command = @(
+    'call "' + $devShell + '" -no_logo -arch=x64',
+    '&& cd /d "' + $BuildDir + '"',
+    '&&',
+    'cl.exe /nologo /EHsc /std:c++14 /W4 /O2 /D_CRT_SECURE_NO_WARNINGS',
+    '/I"' + $appInclude + '"',
+    $quotedSources,
+    '/Fe:"' + $binary + '"',
+    '/link /INCREMENTAL:NO'
+) -join ' '
+
+& $env:ComSpec /d /c $command
+if ($LASTEXITCODE -ne 0) {
+    exit $LASTEXITCODE
+}
@@ -28,7 +28,8 @@ $requiredDefines = @(
     'MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256',
     'MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256',
     'MBEDTLS_NO_PLATFORM_ENTROPY',
-    'MBEDTLS_X509_CRT_PARSE_C'
+    'MBEDTLS_X509_CRT_PARSE_C',
+    'MBEDTLS_X509_TRUSTED_CERTIFICATE_CALLBACK'
 )
 foreach ($name in $requiredDefines) {
     if (-not $config.Contains($name)) {
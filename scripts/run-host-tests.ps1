@@ -1,5 +1,7 @@
 param(
-    [string]$ProjectRoot = (Split-Path -Parent $PSScriptRoot)
+    [string]$ProjectRoot = (Split-Path -Parent $PSScriptRoot),
+    [switch]$Benchmarks,
+    [switch]$Tls
 )
 
 $ErrorActionPreference = 'Stop'
@@ -18,29 +20,80 @@ if (-not $installPath) {
 }
 
 $devShell = Join-Path $installPath 'Common7\Tools\VsDevCmd.bat'
-$binary = Join-Path $BuildDir 'client_fixture_tests.exe'
-$sources = @(
-    (Join-Path $ProjectRoot 'tests\client_fixture_tests.cpp'),
-    (Join-Path $ProjectRoot 'source\client_settings.cpp'),
-    (Join-Path $ProjectRoot 'source\input_bindings.cpp'),
-    (Join-Path $ProjectRoot 'source\protocol.cpp'),
-    (Join-Path $ProjectRoot 'source\ui_canvas.cpp'),
-    (Join-Path $ProjectRoot 'source\ui_route.cpp')
-)
-$quotedSources = ($sources | ForEach-Object { '"' + $_ + '"' }) -join ' '
 $stubInclude = Join-Path $ProjectRoot 'tests\stubs'
 $appInclude = Join-Path $ProjectRoot 'include'
 $compat = Join-Path $stubInclude 'host_compat.h'
+$includes = @('/FI"' + $compat + '"', '/I"' + $stubInclude + '"', '/I"' + $appInclude + '"')
+if ($Tls) {
+    # The TLS checks link the vendored Mbed TLS, compiled as C with the
+    # client's configuration, and do not use the 3DS compatibility stubs.
+    $binary = Join-Path $BuildDir 'trust_store_tests.exe'
+    $optimize = '/O1'
+    $mbedtlsInclude = Join-Path $ProjectRoot 'vendor\mbedtls\include'
+    $includes = @('/I"' + $appInclude + '"', '/I"' + $mbedtlsInclude + '"')
+    $sources = @(
+        (Join-Path $ProjectRoot 'tests\trust_store_tests.cpp'),
+        (Join-Path $ProjectRoot 'source\trust_store.cpp'),
+        (Join-Path $ProjectRoot 'source\trust_store_issuers.cpp')
+    ) + @(Get-ChildItem -LiteralPath (Join-Path $ProjectRoot 'vendor\mbedtls\library') -Filter '*.c' |
+        ForEach-Object { $_.FullName })
+} elseif ($Benchmarks) {
+    $binary = Join-Path $BuildDir 'host_benchmarks.exe'
+    $optimize = '/O2'
+    $sources = @(
+        (Join-Path $ProjectRoot 'tests\host_benchmarks.cpp'),
+        (Join-Path $ProjectRoot 'source\protocol.cpp'),
+        (Join-Path $ProjectRoot 'source\viewport_render.cpp'),
+        (Join-Path $ProjectRoot 'source\minimap_cache.cpp'),
+        (Join-Path $ProjectRoot 'source\websocket_frame.cpp'),
+        (Join-Path $ProjectRoot 'source\draw_packet.cpp'),
+        (Join-Path $ProjectRoot 'source\brush_stamp.cpp'),
+        (Join-Path $ProjectRoot 'source\control_router.cpp'),
+        (Join-Path $ProjectRoot 'source\stroke_simplify.cpp'),
+        (Join-Path $ProjectRoot 'source\draw_batch.cpp'),
+        (Join-Path $ProjectRoot 'source\buffer_pool.cpp')
+    )
+} else {
+    $binary = Join-Path $BuildDir 'client_fixture_tests.exe'
+    $optimize = '/Od'
+    $sources = @(
+        (Join-Path $ProjectRoot 'tests\client_fixture_tests.cpp'),
+        (Join-Path $ProjectRoot 'source\client_settings.cpp'),
+        (Join-Path $ProjectRoot 'source\input_bindings.cpp'),
+        (Join-Path $ProjectRoot 'source\protocol.cpp'),
+        (Join-Path $ProjectRoot 'source\ui_canvas.cpp'),
+        (Join-Path $ProjectRoot 'source\ui_route.cpp'),
+        (Join-Path $ProjectRoot 'source\viewport_render.cpp'),
+        (Join-Path $ProjectRoot 'source\minimap_cache.cpp'),
+        (Join-Path $ProjectRoot 'source\websocket_frame.cpp'),
+        (Join-Path $ProjectRoot 'source\draw_packet.cpp'),
+        (Join-Path $ProjectRoot 'source\brush_stamp.cpp'),
+        (Join-Path $ProjectRoot 'source\control_router.cpp'),
+        (Join-Path $ProjectRoot 'source\stroke_simplify.cpp'),
+        (Join-Path $ProjectRoot 'source\draw_batch.cpp'),
+        (Join-Path $ProjectRoot 'source\buffer_pool.cpp'),
+        (Join-Path $ProjectRoot 'source\network_wait.cpp'),
+        (Join-Path $ProjectRoot 'source\stroke_journal.cpp'),
+        (Join-Path $ProjectRoot 'source\local_echo.cpp'),
+        (Join-Path $ProjectRoot 'source\sha256.cpp'),
+        (Join-Path $ProjectRoot 'source\cia_stream.cpp'),
+        (Join-Path $ProjectRoot 'source\http_response.cpp'),
+        (Join-Path $ProjectRoot 'source\download_resume.cpp'),
+        (Join-Path $ProjectRoot 'source\delta_patch.cpp')
+    )
+}
+# Sources go through a response file; with Mbed TLS they outgrow the
+# cmd.exe command-line limit.
+$responseFile = Join-Path $BuildDir 'sources.rsp'
+[System.IO.File]::WriteAllLines($responseFile, [string[]]($sources | ForEach-Object { '"' + $_ + '"' }))
 
 $command = @(
     'call "' + $devShell + '" -no_logo -arch=x64',
     '&& cd /d "' + $BuildDir + '"',
     '&&',
-    'cl.exe /nologo /EHsc /std:c++14 /W4 /D_CRT_SECURE_NO_WARNINGS',
-    '/FI"' + $compat + '"',
-    '/I"' + $stubInclude + '"',
-    '/I"' + $appInclude + '"',
-    $quotedSources,
+    'cl.exe /nologo /EHsc /std:c++14 /W4 ' + $optimize + ' /D_CRT_SECURE_NO_WARNINGS',
+    ($includes -join ' '),
+    ('@"' + $responseFile + '"'),
     '/Fe:"' + $binary + '"',
     '/link /INCREMENTAL:NO',
     '&& cd /d "' + $ProjectRoot + '"',
@@ -0,0 +1,390 @@
+#include "brush_stamp.h"
+#include "brush_render.h"
+#include "client_settings.h"
+#include <algorithm>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+namespace Doodle
+{
+
+namespace
+{
+
+const int BRUSH_STAMP_PHASES = 64;
+const int BRUSH_STAMP_SLOTS = 4 * BRUSH_STAMP_PHASES;
+
+bool brushPixelIsBoundaryAtWholeSize(int centerX, int centerY,
+                                     int x, int y, int size, int shape)
+{
+    if (!brushContainsPixelAtWholeSize(centerX, centerY, x, y, size, shape))
+        return false;
+    return !brushContainsPixelAtWholeSize(centerX, centerY, x - 1, y, size, shape) ||
+           !brushContainsPixelAtWholeSize(centerX, centerY, x + 1, y, size, shape) ||
+           !brushContainsPixelAtWholeSize(centerX, centerY, x, y - 1, size, shape) ||
+           !brushContainsPixelAtWholeSize(centerX, centerY, x, y + 1, size, shape);
+}
+
+// Only the sparse patterns and the ordered-dither size transition read the
+// pixel position; every other stamp looks the same wherever it lands.
+bool brushStampUsesPhase(int sizeTenths, int shape, bool feather)
+{
+    return brushUsesSparseSampling(shape) || (sizeTenths % 10 != 0 && !feather);
+}
+
+void buildMask(BrushStampMask &mask, int sizeTenths, int shape, bool feather,
+               int phaseX, int phaseY)
+{
+    const int upperSize = std::min(31, sizeTenths / 10 + (sizeTenths % 10 ? 1 : 0));
+    const int extent = upperSize / 2;
+    const int span = 2 * extent + 1;
+    mask.sizeTenths = sizeTenths;
+    mask.shape = shape;
+    mask.feather = feather;
+    mask.phaseX = phaseX;
+    mask.phaseY = phaseY;
+    mask.extent = extent;
+    mask.solid = true;
+    int firstRow = -1;
+    int lastRow = -1;
+    for (int row = 0; row < span; ++row)
+    {
+        int first = span;
+        int last = -1;
+        for (int column = 0; column < span; ++column)
+        {
+            const int coverage = brushStampCoverageTenths(
+                phaseX, phaseY, column - extent, row - extent, sizeTenths, shape, feather);
+            mask.coverage[row * span + column] = (u8)coverage;
+            if (coverage > 0)
+            {
+                first = std::min(first, column);
+                last = column;
+            }
+        }
+        mask.rowStart[row] = (u8)(last < 0 ? 0 : first);
+        mask.rowEnd[row] = (u8)(last + 1);
+        if (last < 0)
+            continue;
+        if (lastRow >= 0 && lastRow != row - 1)
+            mask.solid = false;
+        if (firstRow < 0)
+            firstRow = row;
+        lastRow = row;
+        if (first > extent || last < extent)
+            mask.solid = false;
+        for (int column = first; column <= last; ++column)
+        {
+            if (mask.coverage[row * span + column] != 10)
+                mask.solid = false;
+        }
+    }
+}
+
+inline int maxStep(const DrawPoint &a, const DrawPoint &b)
+{
+    return std::max(abs(a.x - b.x), abs(a.y - b.y));
+}
+
+// Length of the leading run that can be swept as one union: each center
+// within one pixel of the last and y never reversing direction. Those are
+// what make every scanline of the union a single unbroken span.
+size_t sweepableRun(const DrawPoint *centers, size_t count)
+{
+    int direction = 0;
+    size_t run = 1;
+    while (run < count)
+    {
+        const DrawPoint &previous = centers[run - 1];
+        const DrawPoint &next = centers[run];
+        if (maxStep(previous, next) > 1)
+            break;
+        const int step = next.y - previous.y;
+        if (step != 0)
+        {
+            if (direction != 0 && step != direction)
+                break;
+            direction = step;
+        }
+        ++run;
+    }
+    return run;
+}
+
+void sweepSolidStamps(const BrushStampMask &mask, std::vector<int> &spans,
+                      u8 *buffer, int width, const BrushClip &clip,
+                      const DrawPoint *centers, size_t count, u8 r, u8 g, u8 b)
+{
+    const int extent = mask.extent;
+    const int span = 2 * extent + 1;
+    int minY = centers[0].y;
+    int maxY = centers[0].y;
+    for (size_t i = 1; i < count; ++i)
+    {
+        minY = std::min(minY, centers[i].y);
+        maxY = std::max(maxY, centers[i].y);
+    }
+    const int top = std::max(clip.minY, minY - extent);
+    const int bottom = std::min(clip.maxY - 1, maxY + extent);
+    if (top > bottom)
+        return;
+    const int rows = bottom - top + 1;
+    spans.assign(2 * rows, 0);
+    for (int i = 0; i < rows; ++i)
+    {
+        spans[2 * i] = INT_MAX;
+        spans[2 * i + 1] = INT_MIN;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int left = centers[i].x - extent;
+        const int rowTop = centers[i].y - extent;
+        const int firstRow = std::max(0, top - rowTop);
+        const int lastRow = std::min(span, bottom + 1 - rowTop);
+        for (int row = firstRow; row < lastRow; ++row)
+        {
+            if (mask.rowEnd[row] <= mask.rowStart[row])
+                continue;
+            int *rowSpan = &spans[2 * (rowTop + row - top)];
+            rowSpan[0] = std::min(rowSpan[0], left + mask.rowStart[row]);
+            rowSpan[1] = std::max(rowSpan[1], left + mask.rowEnd[row]);
+        }
+    }
+    for (int i = 0; i < rows; ++i)
+    {
+        const int first = std::max(clip.minX, spans[2 * i]);
+        const int last = std::min(clip.maxX, spans[2 * i + 1]);
+        if (first >= last)
+            continue;
+        u8 *pixel = buffer + 3 * ((top + i) * width + first);
+        for (int x = first; x < last; ++x, pixel += 3)
+        {
+            pixel[0] = r;
+            pixel[1] = g;
+            pixel[2] = b;
+        }
+    }
+}
+
+void stampMask(const BrushStampMask &mask, u8 *buffer, int width, const BrushClip &clip,
+               int centerX, int centerY, u8 r, u8 g, u8 b)
+{
+    const int extent = mask.extent;
+    const int span = 2 * extent + 1;
+    const int firstRow = std::max(0, clip.minY - centerY + extent);
+    const int lastRow = std::min(span, clip.maxY - centerY + extent);
+    for (int row = firstRow; row < lastRow; ++row)
+    {
+        const int first = std::max((int)mask.rowStart[row], clip.minX - centerX + extent);
+        const int last = std::min((int)mask.rowEnd[row], clip.maxX - centerX + extent);
+        if (first >= last)
+            continue;
+        const u8 *coverage = mask.coverage + row * span;
+        u8 *pixel = buffer + 3 * ((centerY - extent + row) * width + centerX - extent + first);
+        for (int column = first; column < last; ++column, pixel += 3)
+        {
+            const int tenths = coverage[column];
+            if (tenths >= 10)
+            {
+                pixel[0] = r;
+                pixel[1] = g;
+                pixel[2] = b;
+            }
+            else if (tenths > 0)
+            {
+                pixel[0] = blendBrushChannel(pixel[0], r, tenths);
+                pixel[1] = blendBrushChannel(pixel[1], g, tenths);
+                pixel[2] = blendBrushChannel(pixel[2], b, tenths);
+            }
+        }
+    }
+}
+
+} // namespace
+
+bool brushContainsPixelAtWholeSize(int centerX, int centerY, int x, int y,
+                                   int size, int shape)
+{
+    static const int bayer4[4][4] = {
+        {0, 8, 2, 10},
+        {12, 4, 14, 6},
+        {3, 11, 1, 9},
+        {15, 7, 13, 5},
+    };
+    static const int spray8[8][8] = {
+        {17, 52, 3, 44, 29, 61, 11, 36},
+        {48, 7, 57, 22, 40, 1, 31, 54},
+        {13, 34, 20, 63, 9, 46, 26, 42},
+        {59, 24, 38, 5, 50, 15, 56, 0},
+        {30, 45, 10, 53, 18, 62, 4, 35},
+        {6, 51, 27, 41, 2, 47, 21, 58},
+        {43, 12, 60, 25, 37, 8, 49, 16},
+        {23, 55, 14, 39, 32, 19, 33, 28},
+    };
+    const int extent = size / 2;
+    if (abs(x) > extent || abs(y) > extent)
+        return false;
+
+    if (shape == BRUSH_RENDER_SQUARE_SHAPE)
+        return true;
+    if (shape == BRUSH_RENDER_DIAMOND_SHAPE)
+        return abs(x) + abs(y) <= extent;
+    if (shape == BRUSH_RENDER_CROSS_SHAPE)
+    {
+        const int arm = extent / 3;
+        return abs(x) <= arm || abs(y) <= arm;
+    }
+
+    const bool sparseShape = brushUsesSparseSampling(shape);
+    const int radius = sparseShape ? std::max(1, extent) : extent;
+    const int dist2 = x * x + y * y;
+    if (dist2 > radius * radius)
+        return false;
+    if (!sparseShape)
+        return true;
+
+    if (dist2 == 0)
+        return true;
+    const float dist = sqrtf((float)dist2);
+    const float coverage = 1.0f - (dist / (float)(radius + 1));
+    if (shape == BRUSH_RENDER_SPRAY_SHAPE)
+    {
+        const int density = (int)(18.0f + coverage * 38.0f);
+        return spray8[(centerY + y) & 7][(centerX + x) & 7] < density;
+    }
+    const int threshold = bayer4[(centerY + y) & 3][(centerX + x) & 3];
+    return (int)(coverage * 11.0f) > threshold;
+}
+
+int brushStampCoverageTenths(int centerX, int centerY, int x, int y,
+                             int sizeTenths, int shape, bool feather)
+{
+    const int lowerSize = sizeTenths / 10;
+    const int fraction = sizeTenths % 10;
+    const int upperSize = std::min(31, lowerSize + (fraction ? 1 : 0));
+    const bool lowerContains =
+        brushContainsPixelAtWholeSize(centerX, centerY, x, y, lowerSize, shape);
+    const bool upperContains = fraction > 0 &&
+        brushContainsPixelAtWholeSize(centerX, centerY, x, y, upperSize, shape);
+    const bool lowerBoundary = lowerContains &&
+        brushPixelIsBoundaryAtWholeSize(centerX, centerY, x, y, lowerSize, shape);
+    return fractionalBrushCoverageTenths(
+        lowerContains, upperContains, lowerBoundary, fraction, shape,
+        centerX + x, centerY + y, feather, x == 0 && y == 0);
+}
+
+BrushStampCache::BrushStampCache()
+    : builds_(0)
+{
+}
+
+const BrushStampMask &BrushStampCache::mask(int sizeTenths, int shape, bool feather,
+                                            int centerX, int centerY)
+{
+    if (slots_.empty())
+    {
+        slots_.resize(BRUSH_STAMP_SLOTS);
+        used_.assign(BRUSH_STAMP_SLOTS, false);
+    }
+    int phaseX = 0;
+    int phaseY = 0;
+    if (brushStampUsesPhase(sizeTenths, shape, feather))
+    {
+        phaseX = centerX & 7;
+        phaseY = centerY & 7;
+    }
+    const unsigned brushHash = (unsigned)sizeTenths * 7u + (unsigned)shape * 3u + (feather ? 1u : 0u);
+    const int slot = (int)(brushHash & 3u) * BRUSH_STAMP_PHASES + phaseY * 8 + phaseX;
+    BrushStampMask &entry = slots_[slot];
+    if (!used_[slot] || entry.sizeTenths != sizeTenths || entry.shape != shape ||
+        entry.feather != feather || entry.phaseX != phaseX || entry.phaseY != phaseY)
+    {
+        buildMask(entry, sizeTenths, shape, feather, phaseX, phaseY);
+        used_[slot] = true;
+        ++builds_;
+    }
+    return entry;
+}
+
+void drawBrushStamp(BrushStampCache &cache, u8 *buffer, int width, int height,
+                    int centerX, int centerY, int sizeTenths, int shape,
+                    u8 r, u8 g, u8 b, bool feather)
+{
+    sizeTenths = std::max(CLIENT_BRUSH_SIZE_MIN_TENTHS,
+                          std::min(sizeTenths, BRUSH_RENDER_MAX_SIZE_TENTHS));
+    const BrushClip clip = {0, 0, width, height};
+    stampMask(cache.mask(sizeTenths, shape, feather, centerX, centerY), buffer, width, clip,
+              centerX, centerY, r, g, b);
+}
+
+void drawBrushStamps(BrushStampCache &cache, u8 *buffer, int width, int height,
+                     const DrawPoint *centers, size_t count, int sizeTenths, int shape,
+                     u8 r, u8 g, u8 b, bool feather)
+{
+    const BrushClip clip = {0, 0, width, height};
+    drawBrushStamps(cache, buffer, width, height, clip, centers, count, sizeTenths, shape,
+                    r, g, b, feather);
+}
+
+void drawBrushStamps(BrushStampCache &cache, u8 *buffer, int width, int height,
+                     const BrushClip &bounds, const DrawPoint *centers, size_t count,
+                     int sizeTenths, int shape, u8 r, u8 g, u8 b, bool feather)
+{
+    const BrushClip clip = {std::max(0, bounds.minX), std::max(0, bounds.minY),
+                            std::min(width, bounds.maxX), std::min(height, bounds.maxY)};
+    if (clip.minX >= clip.maxX || clip.minY >= clip.maxY)
+        return;
+    sizeTenths = std::max(CLIENT_BRUSH_SIZE_MIN_TENTHS,
+                          std::min(sizeTenths, BRUSH_RENDER_MAX_SIZE_TENTHS));
+    const bool sweepable = count > 1 && !brushStampUsesPhase(sizeTenths, shape, feather) &&
+                           cache.mask(sizeTenths, shape, feather, 0, 0).solid;
+    size_t index = 0;
+    while (index < count)
+    {
+        const size_t run = sweepable ? sweepableRun(centers + index, count - index) : 1;
+        if (run > 1)
+            sweepSolidStamps(cache.mask(sizeTenths, shape, feather, 0, 0), cache.rowSpans(),
+                             buffer, width, clip, centers + index, run, r, g, b);
+        else
+            stampMask(cache.mask(sizeTenths, shape, feather, centers[index].x, centers[index].y),
+                      buffer, width, clip, centers[index].x, centers[index].y, r, g, b);
+        index += run;
+    }
+}
+
+void markOpaqueBrushStamps(BrushStampCache &cache, const BrushClip &clip,
+                           const DrawPoint *centers, size_t count,
+                           int sizeTenths, int shape, bool feather, u8 *opaque)
+{
+    const int clipWidth = clip.maxX - clip.minX;
+    if (clipWidth <= 0 || clip.minY >= clip.maxY)
+        return;
+    sizeTenths = std::max(CLIENT_BRUSH_SIZE_MIN_TENTHS,
+                          std::min(sizeTenths, BRUSH_RENDER_MAX_SIZE_TENTHS));
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int centerX = centers[i].x;
+        const int centerY = centers[i].y;
+        const BrushStampMask &mask = cache.mask(sizeTenths, shape, feather, centerX, centerY);
+        const int extent = mask.extent;
+        const int span = 2 * extent + 1;
+        const int firstRow = std::max(0, clip.minY - centerY + extent);
+        const int lastRow = std::min(span, clip.maxY - centerY + extent);
+        for (int row = firstRow; row < lastRow; ++row)
+        {
+            const int first = std::max((int)mask.rowStart[row], clip.minX - centerX + extent);
+            const int last = std::min((int)mask.rowEnd[row], clip.maxX - centerX + extent);
+            const u8 *coverage = mask.coverage + row * span;
+            u8 *marks = opaque + (centerY - extent + row - clip.minY) * clipWidth +
+                        (centerX - extent - clip.minX);
+            for (int column = first; column < last; ++column)
+            {
+                if (coverage[column] >= 10)
+                    marks[column] = 1;
+            }
+        }
+    }
+}
+
+} // namespace Doodle
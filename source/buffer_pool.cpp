@@ -0,0 +1,221 @@
+#include "buffer_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace Doodle
+{
+
+PooledBuffer::PooledBuffer()
+    : pool_(NULL), data_(NULL), size_(0), capacity_(0), sizeClass_(-1)
+{
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    reset();
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other)
+    : pool_(other.pool_), data_(other.data_), size_(other.size_), capacity_(other.capacity_),
+      sizeClass_(other.sizeClass_)
+{
+    other.pool_ = NULL;
+    other.data_ = NULL;
+    other.size_ = 0;
+    other.capacity_ = 0;
+    other.sizeClass_ = -1;
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other)
+{
+    if (this != &other)
+    {
+        reset();
+        pool_ = other.pool_;
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        sizeClass_ = other.sizeClass_;
+        other.pool_ = NULL;
+        other.data_ = NULL;
+        other.size_ = 0;
+        other.capacity_ = 0;
+        other.sizeClass_ = -1;
+    }
+    return *this;
+}
+
+bool PooledBuffer::resize(size_t size)
+{
+    if (!data_ || size > capacity_)
+        return false;
+    size_ = size;
+    data_[size] = 0;
+    return true;
+}
+
+void PooledBuffer::reset()
+{
+    if (data_ && pool_)
+        pool_->recycle(data_, sizeClass_);
+    pool_ = NULL;
+    data_ = NULL;
+    size_ = 0;
+    capacity_ = 0;
+    sizeClass_ = -1;
+}
+
+BufferPool::BufferPool()
+    : lock_(NULL), unlock_(NULL), lockContext_(NULL)
+{
+    for (int i = 0; i < BUFFER_POOL_CLASS_COUNT; ++i)
+    {
+        slabs_[i] = NULL;
+        free_[i] = NULL;
+    }
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+BufferPool::~BufferPool()
+{
+    for (int i = 0; i < BUFFER_POOL_CLASS_COUNT; ++i)
+        free(slabs_[i]);
+}
+
+bool BufferPool::reserve()
+{
+    lock();
+    bool reserved = true;
+    for (int i = 0; i < BUFFER_POOL_CLASS_COUNT; ++i)
+    {
+        if (slabs_[i])
+            continue;
+        const size_t blockBytes = BUFFER_POOL_BLOCK_BYTES[i];
+        slabs_[i] = (uint8_t *)malloc(blockBytes * BUFFER_POOL_BLOCK_COUNTS[i]);
+        if (!slabs_[i])
+        {
+            reserved = false;
+            continue;
+        }
+        // Thread the free list front to back so early blocks are reused first.
+        for (size_t block = BUFFER_POOL_BLOCK_COUNTS[i]; block-- > 0;)
+        {
+            FreeBlock *entry = (FreeBlock *)(slabs_[i] + block * blockBytes);
+            entry->next = free_[i];
+            free_[i] = entry;
+        }
+    }
+    unlock();
+    return reserved;
+}
+
+void BufferPool::setLock(LockFunction lockFunction, LockFunction unlockFunction, void *context)
+{
+    lock_ = lockFunction;
+    unlock_ = unlockFunction;
+    lockContext_ = context;
+}
+
+bool BufferPool::acquire(size_t size, PooledBuffer &buffer)
+{
+    buffer.reset();
+    int sizeClass = 0;
+    while (sizeClass < BUFFER_POOL_CLASS_COUNT && size >= BUFFER_POOL_BLOCK_BYTES[sizeClass])
+        ++sizeClass;
+
+    uint8_t *data = NULL;
+    size_t capacity = size;
+    lock();
+    if (sizeClass < BUFFER_POOL_CLASS_COUNT)
+    {
+        FreeBlock *entry = free_[sizeClass];
+        if (entry)
+        {
+            free_[sizeClass] = entry->next;
+            data = (uint8_t *)entry;
+            capacity = BUFFER_POOL_BLOCK_BYTES[sizeClass] - 1;
+        }
+        else if (slabs_[sizeClass])
+        {
+            ++stats_.exhausted;
+        }
+    }
+    if (!data)
+    {
+        sizeClass = -1;
+        ++stats_.heapAllocations;
+    }
+    ++stats_.acquired;
+    if (++stats_.inUse > stats_.peakInUse)
+        stats_.peakInUse = stats_.inUse;
+    unlock();
+
+    // malloc takes its own lock; keep it outside ours.
+    if (!data)
+    {
+        data = (uint8_t *)malloc(size + 1);
+        if (!data)
+        {
+            lock();
+            --stats_.inUse;
+            unlock();
+            return false;
+        }
+    }
+    buffer.pool_ = this;
+    buffer.data_ = data;
+    buffer.size_ = size;
+    buffer.capacity_ = capacity;
+    buffer.sizeClass_ = sizeClass;
+    data[size] = 0;
+    return true;
+}
+
+bool BufferPool::acquireCopy(const void *bytes, size_t size, PooledBuffer &buffer)
+{
+    if (size > 0 && !bytes)
+        return false;
+    if (!acquire(size, buffer))
+        return false;
+    if (size > 0)
+        memcpy(buffer.data(), bytes, size);
+    return true;
+}
+
+BufferPoolStats BufferPool::stats()
+{
+    lock();
+    const BufferPoolStats snapshot = stats_;
+    unlock();
+    return snapshot;
+}
+
+void BufferPool::recycle(uint8_t *data, int sizeClass)
+{
+    if (sizeClass < 0)
+        free(data);
+    lock();
+    if (sizeClass >= 0)
+    {
+        FreeBlock *entry = (FreeBlock *)data;
+        entry->next = free_[sizeClass];
+        free_[sizeClass] = entry;
+    }
+    --stats_.inUse;
+    unlock();
+}
+
+void BufferPool::lock()
+{
+    if (lock_)
+        lock_(lockContext_);
+}
+
+void BufferPool::unlock()
+{
+    if (unlock_)
+        unlock_(lockContext_);
+}
+
+} // namespace Doodle
@@ -3,7 +3,8 @@
 #include <cmath>
 
 CanvasState::CanvasState()
-    : width(0), height(0), size(0), capacity(0), offsetX(0), offsetY(0), zoomLevel(0), pixels(NULL)
+    : width(0), height(0), size(0), capacity(0), offsetX(0), offsetY(0), zoomLevel(0), pixels(NULL),
+      loadStream(NULL), loadStreamEnded(false)
 {
     channel[0] = '\0';
     clearDirty();
@@ -11,12 +12,15 @@ CanvasState::CanvasState()
 
 CanvasState::~CanvasState()
 {
+    cancelCompressedLoad();
     if (pixels)
         free(pixels);
 }
 
 bool CanvasState::allocate(int newWidth, int newHeight)
 {
+    // A realloc below would leave an in-progress inflate writing freed memory.
+    cancelCompressedLoad();
     if (newWidth <= 0 || newHeight <= 0)
         return false;
     const uint64_t newSize64 = (uint64_t)newWidth * (uint64_t)newHeight * 3ULL;
@@ -43,31 +47,110 @@ bool CanvasState::allocate(int newWidth, int newHeight)
 
 bool CanvasState::loadFromCompressed(const u8 *compressedData, size_t compressedSize)
 {
+    DirtyRect rows;
+    if (!beginCompressedLoad())
+        return false;
+    if (!appendCompressed(compressedData, compressedSize, rows))
+    {
+        cancelCompressedLoad();
+        return false;
+    }
+    if (!finishCompressedLoad())
+        return false;
+    markFullDirty();
+    return true;
+}
+
+bool CanvasState::beginCompressedLoad()
+{
+    cancelCompressedLoad();
     if (!pixels || size <= 0)
         return false;
 
-    z_stream strm;
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.avail_in = compressedSize;
-    strm.next_in = (Bytef *)compressedData;
-    strm.avail_out = size;
-    strm.next_out = pixels;
+    loadStream = (z_stream *)malloc(sizeof(z_stream));
+    if (!loadStream)
+        return false;
+    memset(loadStream, 0, sizeof(z_stream));
+    loadStream->zalloc = Z_NULL;
+    loadStream->zfree = Z_NULL;
+    loadStream->opaque = Z_NULL;
+    loadStream->next_out = pixels;
+    loadStream->avail_out = size;
+    if (inflateInit(loadStream) != Z_OK)
+    {
+        free(loadStream);
+        loadStream = NULL;
+        return false;
+    }
+    loadStreamEnded = false;
+    return true;
+}
 
-    if (inflateInit(&strm) != Z_OK)
+bool CanvasState::appendCompressed(const u8 *data, size_t length, DirtyRect &rowsWritten)
+{
+    rowsWritten.minX = rowsWritten.minY = rowsWritten.maxX = rowsWritten.maxY = 0;
+    rowsWritten.valid = false;
+    if (!loadStream)
         return false;
+    // Bytes after the end of the zlib stream are ignored, as Z_FINISH did.
+    if (loadStreamEnded || length == 0)
+        return true;
 
-    int ret = inflate(&strm, Z_FINISH);
-    inflateEnd(&strm);
+    const uLong startOut = loadStream->total_out;
+    loadStream->next_in = (Bytef *)data;
+    loadStream->avail_in = length;
+    while (loadStream->avail_in > 0)
+    {
+        // With pending input, Z_BUF_ERROR means the pixels are full but the
+        // stream is not: the snapshot is larger than the canvas.
+        int ret = inflate(loadStream, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+        {
+            loadStreamEnded = true;
+            break;
+        }
+        if (ret != Z_OK)
+            return false;
+    }
+    loadStream->next_in = Z_NULL;
+    loadStream->avail_in = 0;
 
-    if (ret == Z_STREAM_END && strm.total_out == (uLong)size)
+    const uLong endOut = loadStream->total_out;
+    if (endOut > startOut)
     {
-        markFullDirty();
-        return true;
+        const uLong rowBytes = (uLong)width * 3;
+        rowsWritten.minX = 0;
+        rowsWritten.maxX = width - 1;
+        rowsWritten.minY = (int)(startOut / rowBytes);
+        rowsWritten.maxY = (int)((endOut - 1) / rowBytes);
+        rowsWritten.valid = true;
+        markDirtyRect(rowsWritten);
     }
+    return true;
+}
 
-    return false;
+bool CanvasState::finishCompressedLoad()
+{
+    if (!loadStream)
+        return false;
+    const bool complete = loadStreamEnded && loadStream->total_out == (uLong)size;
+    cancelCompressedLoad();
+    return complete;
+}
+
+void CanvasState::cancelCompressedLoad()
+{
+    if (!loadStream)
+        return;
+    inflateEnd(loadStream);
+    free(loadStream);
+    loadStream = NULL;
+    loadStreamEnded = false;
+}
+
+bool CanvasState::compressedLoadActive() const
+{
+    return loadStream != NULL;
 }
 
 void CanvasState::markFullDirty()
@@ -81,10 +164,25 @@ void CanvasState::markFullDirty()
 
 void CanvasState::markDirty(int x, int y, int radius)
 {
-    int minX = std::max(0, x - radius);
-    int minY = std::max(0, y - radius);
-    int maxX = std::min(width - 1, x + radius);
-    int maxY = std::min(height - 1, y + radius);
+    DirtyRect rect;
+    rect.minX = x - radius;
+    rect.minY = y - radius;
+    rect.maxX = x + radius;
+    rect.maxY = y + radius;
+    rect.valid = true;
+    markDirtyRect(rect);
+}
+
+void CanvasState::markDirtyRect(const DirtyRect &rect)
+{
+    if (!rect.valid)
+        return;
+    int minX = std::max(0, rect.minX);
+    int minY = std::max(0, rect.minY);
+    int maxX = std::min(width - 1, rect.maxX);
+    int maxY = std::min(height - 1, rect.maxY);
+    if (minX > maxX || minY > maxY)
+        return;
 
     if (!dirty.valid)
     {
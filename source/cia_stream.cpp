@@ -0,0 +1,201 @@
+#include "cia_stream.h"
+#include "byte_order.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace Doodle
+{
+
+namespace
+{
+// CIA header fields, little-endian.
+const size_t CIA_HEADER_SIZE_OFFSET = 0x00;
+const size_t CIA_CERT_SIZE_OFFSET = 0x08;
+const size_t CIA_TICKET_SIZE_OFFSET = 0x0c;
+const size_t CIA_TMD_SIZE_OFFSET = 0x10;
+const size_t CIA_HEADER_FIELDS_BYTES = 0x20;
+// Title ID within the TMD header that follows the signature.
+const size_t TMD_TITLE_ID_OFFSET = 0x4c;
+
+uint32_t big32(const uint8_t *bytes)
+{
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) |
+           (uint32_t)bytes[3];
+}
+
+uint64_t align64(uint64_t value)
+{
+    return (value + 63) & ~(uint64_t)63;
+}
+
+// Signature plus padding ahead of the TMD header, by signature type.
+bool tmdSignatureBytes(uint32_t type, uint64_t &bytes)
+{
+    switch (type)
+    {
+    case 0x010000:
+    case 0x010003:
+        bytes = 4 + 0x200 + 0x3c;
+        return true;
+    case 0x010001:
+    case 0x010004:
+        bytes = 4 + 0x100 + 0x3c;
+        return true;
+    case 0x010002:
+    case 0x010005:
+        bytes = 4 + 0x3c + 0x40;
+        return true;
+    default:
+        return false;
+    }
+}
+} // namespace
+
+bool ciaTitleId(const uint8_t *cia, size_t length, uint64_t &titleId, bool &needMore)
+{
+    needMore = true;
+    if (length < CIA_HEADER_FIELDS_BYTES)
+        return false;
+    const uint64_t tmdOffset = align64(getLittle32(cia + CIA_HEADER_SIZE_OFFSET)) +
+                               align64(getLittle32(cia + CIA_CERT_SIZE_OFFSET)) +
+                               align64(getLittle32(cia + CIA_TICKET_SIZE_OFFSET));
+    const uint64_t tmdSize = getLittle32(cia + CIA_TMD_SIZE_OFFSET);
+    if (length < tmdOffset + 4)
+        return false;
+
+    needMore = false;
+    uint64_t signatureBytes;
+    if (!tmdSignatureBytes(big32(cia + tmdOffset), signatureBytes) ||
+        tmdSize < signatureBytes + TMD_TITLE_ID_OFFSET + 8)
+        return false;
+    const uint64_t titleOffset = tmdOffset + signatureBytes + TMD_TITLE_ID_OFFSET;
+    if (length < titleOffset + 8)
+    {
+        needMore = true;
+        return false;
+    }
+    titleId = ((uint64_t)big32(cia + titleOffset) << 32) | big32(cia + titleOffset + 4);
+    return true;
+}
+
+CiaStreamInstall::CiaStreamInstall(CiaInstallService &service, uint64_t expectedTitleId,
+                                   uint64_t expectedSize, const char *expectedSha256)
+    : service_(service), expectedTitleId_(expectedTitleId), expectedSize_(expectedSize),
+      received_(0), written_(0), begun_(false), failed_(false), status_(CIA_STREAM_OK)
+{
+    snprintf(expectedSha256_, sizeof(expectedSha256_), "%s", expectedSha256 ? expectedSha256 : "");
+    pending_.reserve(CIA_STREAM_CHUNK_BYTES);
+    error_[0] = '\0';
+}
+
+CiaStreamInstall::~CiaStreamInstall()
+{
+    cancel();
+}
+
+bool CiaStreamInstall::write(const uint8_t *data, size_t length)
+{
+    if (failed_)
+        return false;
+    if (length > expectedSize_ - received_)
+        return fail(CIA_STREAM_SIZE_MISMATCH, "DOWNLOAD SIZE OVER %lu",
+                    (unsigned long)expectedSize_);
+    hash_.update(data, length);
+    received_ += length;
+    while (length > 0)
+    {
+        const size_t room = CIA_STREAM_CHUNK_BYTES - pending_.size();
+        const size_t take = length < room ? length : room;
+        pending_.insert(pending_.end(), data, data + take);
+        data += take;
+        length -= take;
+        if (pending_.size() == CIA_STREAM_CHUNK_BYTES && !flush())
+            return false;
+    }
+    return true;
+}
+
+CiaStreamStatus CiaStreamInstall::finish()
+{
+    if (failed_)
+        return status_;
+    if (received_ != expectedSize_)
+    {
+        fail(CIA_STREAM_SIZE_MISMATCH, "DOWNLOAD SIZE %lu EXPECTED %lu",
+             (unsigned long)received_, (unsigned long)expectedSize_);
+        return status_;
+    }
+    char digest[65];
+    hash_.finishHex(digest);
+    if (!sameSha256Hex(digest, expectedSha256_))
+    {
+        fail(CIA_STREAM_CHECKSUM_MISMATCH, "DOWNLOAD CHECKSUM MISMATCH");
+        return status_;
+    }
+    if (!pending_.empty() && !flush())
+        return status_;
+
+    const int32_t result = service_.finish();
+    if (result != 0)
+    {
+        fail(CIA_STREAM_INSTALL_FAILED, "AM FINISH 0x%08lX", (unsigned long)(uint32_t)result);
+        return status_;
+    }
+    begun_ = false;
+    return CIA_STREAM_OK;
+}
+
+void CiaStreamInstall::cancel()
+{
+    if (!begun_)
+        return;
+    service_.cancel();
+    begun_ = false;
+}
+
+bool CiaStreamInstall::flush()
+{
+    if (!begun_)
+    {
+        // The TMD sits behind the certificate chain and ticket, a few KiB
+        // in, so the first chunk always holds the title ID.
+        uint64_t titleId = 0;
+        bool needMore = false;
+        if (!ciaTitleId(&pending_[0], pending_.size(), titleId, needMore))
+            return fail(CIA_STREAM_INSTALL_FAILED, "CIA HEADER INVALID");
+        if (titleId != expectedTitleId_)
+            return fail(CIA_STREAM_INSTALL_FAILED, "TITLE MISMATCH GOT %08lX%08lX EXP %08lX%08lX",
+                        (unsigned long)(titleId >> 32), (unsigned long)(titleId & 0xffffffff),
+                        (unsigned long)(expectedTitleId_ >> 32),
+                        (unsigned long)(expectedTitleId_ & 0xffffffff));
+        const int32_t result = service_.begin(titleId);
+        if (result != 0)
+            return fail(CIA_STREAM_INSTALL_FAILED, "AM START 0x%08lX",
+                        (unsigned long)(uint32_t)result);
+        begun_ = true;
+    }
+
+    const int32_t result = service_.write(written_, &pending_[0], pending_.size());
+    if (result != 0)
+        return fail(CIA_STREAM_INSTALL_FAILED, "CIA WRITE 0x%08lX AT %lu",
+                    (unsigned long)(uint32_t)result, (unsigned long)written_);
+    written_ += pending_.size();
+    pending_.clear();
+    return true;
+}
+
+bool CiaStreamInstall::fail(CiaStreamStatus status, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error_, sizeof(error_), format, args);
+    va_end(args);
+    failed_ = true;
+    status_ = status;
+    pending_.clear();
+    cancel();
+    return false;
+}
+
+} // namespace Doodle
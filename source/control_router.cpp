@@ -0,0 +1,99 @@
+#include "control_router.h"
+
+#include <string.h>
+
+namespace Doodle
+{
+
+namespace
+{
+
+// Indexed by ControlMessageType. Every name after the unknown entry is in
+// strcmp order, which the enum mirrors, so the table is also the search key.
+const char *const CONTROL_MESSAGE_NAMES[CONTROL_MESSAGE_TYPE_COUNT] = {
+    "",
+    "accessRestored",
+    "adminCanvasResult",
+    "banned",
+    "channels",
+    "disconnected",
+    "displayNameChanged",
+    "displayNameRejected",
+    "error",
+    "identityAccepted",
+    "identityBackupCode",
+    "identityNeedsDisplayName",
+    "moderationResult",
+    "muted",
+    "onboardingState",
+    "presence",
+    "recoveryFailed",
+    "rulesAccepted",
+    "rulesRejected",
+    "rulesRequired",
+    "serverRestarting",
+    "staffChatEnd",
+    "staffChatMessage",
+    "staffChatResult",
+    "staffChatStart",
+    "supportOnly",
+    "ticketCounts",
+    "ticketListEnd",
+    "ticketListStart",
+    "ticketMessage",
+    "ticketResult",
+    "ticketSummary",
+    "ticketThreadEnd",
+    "ticketThreadStart",
+    "ticketUpdated",
+};
+
+// strcmp of a NUL-terminated name against a length-delimited value.
+int compareName(const char *name, const char *value, size_t length)
+{
+    const int prefix = strncmp(name, value, length);
+    if (prefix != 0)
+        return prefix;
+    return name[length] == '\0' ? 0 : 1;
+}
+
+} // namespace
+
+ControlMessageType controlMessageType(const char *json)
+{
+    static const char TYPE_KEY[] = "\"type\":\"";
+    if (!json)
+        return CONTROL_MESSAGE_UNKNOWN;
+    const char *value = strstr(json, TYPE_KEY);
+    if (!value)
+        return CONTROL_MESSAGE_UNKNOWN;
+    value += sizeof(TYPE_KEY) - 1;
+    const char *end = strchr(value, '"');
+    if (!end)
+        return CONTROL_MESSAGE_UNKNOWN;
+    const size_t length = (size_t)(end - value);
+
+    int low = CONTROL_MESSAGE_UNKNOWN + 1;
+    int high = CONTROL_MESSAGE_TYPE_COUNT - 1;
+    while (low <= high)
+    {
+        const int middle = (low + high) / 2;
+        const int order = compareName(CONTROL_MESSAGE_NAMES[middle], value, length);
+        if (order == 0)
+            return (ControlMessageType)middle;
+        if (order < 0)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+    return CONTROL_MESSAGE_UNKNOWN;
+}
+
+const char *controlMessageTypeName(ControlMessageType type)
+{
+    if (type <= CONTROL_MESSAGE_UNKNOWN || type >= CONTROL_MESSAGE_TYPE_COUNT)
+        return "";
+    return CONTROL_MESSAGE_NAMES[type];
+}
+
+} // namespace Doodle
@@ -0,0 +1,434 @@
+#include "delta_patch.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+
+namespace Doodle
+{
+
+namespace
+{
+const uint8_t DELTA_MAGIC[4] = {'D', 'P', 'T', '1'};
+// Matches are seeded from windows this long, indexed at every
+// INDEX_STEP bytes of the base; ARM code is word aligned anyway.
+const size_t MATCH_BYTES = 16;
+const size_t INDEX_STEP = 4;
+// An inexact extension stops this far past its best point.
+const size_t EXTEND_SLACK = 64;
+// Unchanged bytes inside an ADD shorter than this stay in the changed run;
+// a new run would cost more than the zeros.
+const size_t ADD_RUN_GAP = 3;
+
+uint64_t windowHash(const uint8_t *bytes)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < MATCH_BYTES; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void putVarint(std::vector<uint8_t> &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+void putInsert(std::vector<uint8_t> &out, const uint8_t *target, size_t start, size_t end)
+{
+    if (end <= start)
+        return;
+    putVarint(out, DELTA_OP_INSERT);
+    putVarint(out, end - start);
+    out.insert(out.end(), target + start, target + end);
+}
+
+size_t equalRun(const uint8_t *base, const uint8_t *target, size_t from, size_t length)
+{
+    size_t run = 0;
+    while (from + run < length && base[from + run] == target[from + run])
+        ++run;
+    return run;
+}
+
+void putMatch(std::vector<uint8_t> &out, const uint8_t *base, size_t baseOffset, const uint8_t *target,
+              size_t targetOffset, size_t length)
+{
+    const uint8_t *from = base + baseOffset;
+    const uint8_t *to = target + targetOffset;
+    if (memcmp(from, to, length) == 0)
+    {
+        putVarint(out, DELTA_OP_COPY);
+        putVarint(out, baseOffset);
+        putVarint(out, length);
+        return;
+    }
+    putVarint(out, DELTA_OP_ADD);
+    putVarint(out, baseOffset);
+    putVarint(out, length);
+    size_t i = 0;
+    while (i < length)
+    {
+        const size_t unchanged = equalRun(from, to, i, length);
+        putVarint(out, unchanged);
+        i += unchanged;
+        if (i == length)
+            break;
+        size_t changed = 0;
+        while (i + changed < length)
+        {
+            const size_t gap = equalRun(from, to, i + changed, length);
+            if (gap == 0)
+                ++changed;
+            else if (gap < ADD_RUN_GAP && i + changed + gap < length)
+                changed += gap;
+            else
+                break;
+        }
+        putVarint(out, changed);
+        for (size_t k = i; k < i + changed; ++k)
+            out.push_back((uint8_t)(to[k] - from[k]));
+        i += changed;
+    }
+}
+} // namespace
+
+void buildDeltaPatch(const uint8_t *base, size_t baseSize, const uint8_t *target, size_t targetSize,
+                     std::vector<uint8_t> &patch)
+{
+    patch.assign(DELTA_MAGIC, DELTA_MAGIC + sizeof(DELTA_MAGIC));
+    putVarint(patch, baseSize);
+    putVarint(patch, targetSize);
+
+    std::unordered_map<uint64_t, size_t> index;
+    if (baseSize >= MATCH_BYTES)
+    {
+        index.reserve(baseSize / INDEX_STEP + 1);
+        for (size_t b = 0; b + MATCH_BYTES <= baseSize; b += INDEX_STEP)
+            index.insert(std::make_pair(windowHash(base + b), b));
+    }
+
+    size_t pending = 0;
+    size_t t = 0;
+    while (t + MATCH_BYTES <= targetSize)
+    {
+        std::unordered_map<uint64_t, size_t>::const_iterator found = index.find(windowHash(target + t));
+        if (found == index.end() || memcmp(base + found->second, target + t, MATCH_BYTES) != 0)
+        {
+            ++t;
+            continue;
+        }
+        size_t b = found->second;
+        while (t > pending && b > 0 && base[b - 1] == target[t - 1])
+        {
+            --t;
+            --b;
+        }
+        size_t length = MATCH_BYTES;
+        while (b + length < baseSize && t + length < targetSize && base[b + length] == target[t + length])
+            ++length;
+        // Carry on through scattered differences while more bytes match
+        // than not, as relocated code does.
+        long score = 0;
+        long best = 0;
+        size_t bestLength = length;
+        for (size_t i = length; b + i < baseSize && t + i < targetSize && i - bestLength <= EXTEND_SLACK; ++i)
+        {
+            score += base[b + i] == target[t + i] ? 1 : -1;
+            if (score > best)
+            {
+                best = score;
+                bestLength = i + 1;
+            }
+        }
+        putInsert(patch, target, pending, t);
+        putMatch(patch, base, b, target, t, bestLength);
+        t += bestLength;
+        pending = t;
+    }
+    putInsert(patch, target, pending, targetSize);
+    putVarint(patch, DELTA_OP_END);
+}
+
+DeltaPatchApplier::DeltaPatchApplier(FILE *base, DeltaOutputCallback output, void *userData,
+                                     uint64_t expectedPatchSize, const char *expectedPatchSha256,
+                                     uint64_t expectedTargetSize, const char *expectedTargetSha256)
+    : base_(base), baseSize_(0), basePosition_((uint64_t)-1), output_(output), userData_(userData),
+      expectedPatchSize_(expectedPatchSize), expectedTargetSize_(expectedTargetSize),
+      state_(READ_MAGIC), magicLength_(0), varint_(0), varintShift_(0), op_(0), offset_(0),
+      opRemaining_(0), runRemaining_(0), outLength_(0), patchBytes_(0), planned_(0), produced_(0),
+      failed_(false), status_(DELTA_PATCH_OK)
+{
+    snprintf(expectedPatchSha256_, sizeof(expectedPatchSha256_), "%s", expectedPatchSha256 ? expectedPatchSha256 : "");
+    snprintf(expectedTargetSha256_, sizeof(expectedTargetSha256_), "%s",
+             expectedTargetSha256 ? expectedTargetSha256 : "");
+    error_[0] = '\0';
+    long length = -1;
+    if (base_ && fseek(base_, 0, SEEK_END) == 0)
+        length = ftell(base_);
+    if (length < 0)
+        fail(DELTA_PATCH_IO_FAILED, "PATCH BASE UNREADABLE");
+    else
+        baseSize_ = (uint64_t)length;
+}
+
+bool DeltaPatchApplier::write(const uint8_t *data, size_t length)
+{
+    if (failed_)
+        return false;
+    if (length > expectedPatchSize_ - patchBytes_)
+        return fail(DELTA_PATCH_CHECKSUM_MISMATCH, "PATCH SIZE OVER %lu", (unsigned long)expectedPatchSize_);
+    patchHash_.update(data, length);
+    patchBytes_ += length;
+
+    while (length > 0)
+    {
+        if (state_ == INSERT_BYTES || state_ == CHANGED_BYTES)
+        {
+            if (outLength_ == sizeof(out_) && !flush())
+                return false;
+            size_t take = sizeof(out_) - outLength_;
+            if (take > length)
+                take = length;
+            if (take > runRemaining_)
+                take = (size_t)runRemaining_;
+            uint8_t *out = out_ + outLength_;
+            if (state_ == INSERT_BYTES)
+            {
+                memcpy(out, data, take);
+            }
+            else
+            {
+                if (!readBase(offset_, out, take))
+                    return false;
+                for (size_t i = 0; i < take; ++i)
+                    out[i] = (uint8_t)(out[i] + data[i]);
+                offset_ += take;
+                opRemaining_ -= take;
+            }
+            outLength_ += take;
+            produced_ += take;
+            data += take;
+            length -= take;
+            runRemaining_ -= take;
+            if (runRemaining_ == 0)
+                state_ = state_ == CHANGED_BYTES && opRemaining_ > 0 ? READ_UNCHANGED : READ_OP;
+            continue;
+        }
+
+        const uint8_t byte = *data++;
+        --length;
+        if (state_ == READ_MAGIC)
+        {
+            magic_[magicLength_++] = byte;
+            if (magicLength_ == sizeof(magic_))
+            {
+                if (memcmp(magic_, DELTA_MAGIC, sizeof(DELTA_MAGIC)) != 0)
+                    return fail(DELTA_PATCH_INVALID, "PATCH MAGIC INVALID");
+                state_ = READ_BASE_SIZE;
+            }
+            continue;
+        }
+        if (state_ == PATCH_DONE)
+            return fail(DELTA_PATCH_INVALID, "PATCH HAS TRAILING BYTES");
+
+        if (varintShift_ > 63 || (varintShift_ == 63 && (byte & 0x7e)))
+            return fail(DELTA_PATCH_INVALID, "PATCH NUMBER TOO LONG");
+        varint_ |= (uint64_t)(byte & 0x7f) << varintShift_;
+        if (byte & 0x80)
+        {
+            varintShift_ += 7;
+            continue;
+        }
+        const uint64_t value = varint_;
+        varint_ = 0;
+        varintShift_ = 0;
+        if (!field(value))
+            return false;
+    }
+    return true;
+}
+
+DeltaPatchStatus DeltaPatchApplier::finish()
+{
+    if (failed_)
+        return status_;
+    if (!flush())
+        return status_;
+    if (patchBytes_ != expectedPatchSize_)
+    {
+        fail(DELTA_PATCH_CHECKSUM_MISMATCH, "PATCH SIZE %lu EXPECTED %lu", (unsigned long)patchBytes_,
+             (unsigned long)expectedPatchSize_);
+        return status_;
+    }
+    char digest[65];
+    patchHash_.finishHex(digest);
+    if (!sameSha256Hex(digest, expectedPatchSha256_))
+    {
+        fail(DELTA_PATCH_CHECKSUM_MISMATCH, "PATCH CHECKSUM MISMATCH");
+        return status_;
+    }
+    if (state_ != PATCH_DONE)
+    {
+        fail(DELTA_PATCH_INVALID, "PATCH TRUNCATED");
+        return status_;
+    }
+    targetHash_.finishHex(digest);
+    if (produced_ != expectedTargetSize_ || !sameSha256Hex(digest, expectedTargetSha256_))
+    {
+        fail(DELTA_PATCH_TARGET_MISMATCH, "PATCHED CHECKSUM MISMATCH");
+        return status_;
+    }
+    return DELTA_PATCH_OK;
+}
+
+bool DeltaPatchApplier::field(uint64_t value)
+{
+    switch (state_)
+    {
+    case READ_BASE_SIZE:
+        // Another build of the running version cannot be patched.
+        if (value != baseSize_)
+            return fail(DELTA_PATCH_INVALID, "PATCH BASE SIZE %lu NOT %lu", (unsigned long)value,
+                        (unsigned long)baseSize_);
+        state_ = READ_TARGET_SIZE;
+        return true;
+    case READ_TARGET_SIZE:
+        if (value != expectedTargetSize_)
+            return fail(DELTA_PATCH_INVALID, "PATCH TARGET SIZE %lu NOT %lu", (unsigned long)value,
+                        (unsigned long)expectedTargetSize_);
+        state_ = READ_OP;
+        return true;
+    case READ_OP:
+        op_ = value;
+        if (op_ == DELTA_OP_END)
+        {
+            if (planned_ != expectedTargetSize_)
+                return fail(DELTA_PATCH_INVALID, "PATCH ENDS AT %lu OF %lu", (unsigned long)planned_,
+                            (unsigned long)expectedTargetSize_);
+            state_ = PATCH_DONE;
+            return true;
+        }
+        if (op_ == DELTA_OP_COPY || op_ == DELTA_OP_ADD)
+            state_ = READ_OFFSET;
+        else if (op_ == DELTA_OP_INSERT)
+            state_ = READ_LENGTH;
+        else
+            return fail(DELTA_PATCH_INVALID, "PATCH OP %lu UNKNOWN", (unsigned long)op_);
+        return true;
+    case READ_OFFSET:
+        offset_ = value;
+        state_ = READ_LENGTH;
+        return true;
+    case READ_LENGTH:
+        if (!plan(value))
+            return false;
+        if (op_ == DELTA_OP_INSERT)
+        {
+            runRemaining_ = value;
+            state_ = value > 0 ? INSERT_BYTES : READ_OP;
+            return true;
+        }
+        if (offset_ > baseSize_ || value > baseSize_ - offset_)
+            return fail(DELTA_PATCH_INVALID, "PATCH READS PAST BASE");
+        if (op_ == DELTA_OP_COPY)
+        {
+            state_ = READ_OP;
+            return copyBase(offset_, value);
+        }
+        opRemaining_ = value;
+        state_ = value > 0 ? READ_UNCHANGED : READ_OP;
+        return true;
+    case READ_UNCHANGED:
+        if (value > opRemaining_)
+            return fail(DELTA_PATCH_INVALID, "PATCH RUN PAST ADD");
+        if (!copyBase(offset_, value))
+            return false;
+        offset_ += value;
+        opRemaining_ -= value;
+        state_ = opRemaining_ > 0 ? READ_CHANGED : READ_OP;
+        return true;
+    case READ_CHANGED:
+        if (value == 0 || value > opRemaining_)
+            return fail(DELTA_PATCH_INVALID, "PATCH RUN PAST ADD");
+        runRemaining_ = value;
+        state_ = CHANGED_BYTES;
+        return true;
+    default:
+        return fail(DELTA_PATCH_INVALID, "PATCH STATE INVALID");
+    }
+}
+
+bool DeltaPatchApplier::copyBase(uint64_t offset, uint64_t length)
+{
+    while (length > 0)
+    {
+        if (outLength_ == sizeof(out_) && !flush())
+            return false;
+        size_t take = sizeof(out_) - outLength_;
+        if (take > length)
+            take = (size_t)length;
+        if (!readBase(offset, out_ + outLength_, take))
+            return false;
+        outLength_ += take;
+        produced_ += take;
+        offset += take;
+        length -= take;
+    }
+    return true;
+}
+
+bool DeltaPatchApplier::readBase(uint64_t offset, uint8_t *out, size_t length)
+{
+    if (offset > baseSize_ || length > baseSize_ - offset)
+        return fail(DELTA_PATCH_INVALID, "PATCH READS PAST BASE");
+    if (basePosition_ != offset && fseek(base_, (long)offset, SEEK_SET) != 0)
+        return fail(DELTA_PATCH_IO_FAILED, "PATCH BASE SEEK FAILED");
+    if (fread(out, 1, length, base_) != length)
+    {
+        basePosition_ = (uint64_t)-1;
+        return fail(DELTA_PATCH_IO_FAILED, "PATCH BASE READ FAILED");
+    }
+    basePosition_ = offset + length;
+    return true;
+}
+
+bool DeltaPatchApplier::plan(uint64_t length)
+{
+    if (length > expectedTargetSize_ - planned_)
+        return fail(DELTA_PATCH_INVALID, "PATCH WRITES PAST %lu", (unsigned long)expectedTargetSize_);
+    planned_ += length;
+    return true;
+}
+
+bool DeltaPatchApplier::flush()
+{
+    if (outLength_ == 0)
+        return true;
+    targetHash_.update(out_, outLength_);
+    if (output_ && !output_(out_, outLength_, userData_))
+        return fail(DELTA_PATCH_IO_FAILED, "PATCHED FILE WRITE FAILED");
+    outLength_ = 0;
+    return true;
+}
+
+bool DeltaPatchApplier::fail(DeltaPatchStatus status, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error_, sizeof(error_), format, args);
+    va_end(args);
+    failed_ = true;
+    status_ = status;
+    return false;
+}
+
+} // namespace Doodle
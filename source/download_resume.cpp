@@ -0,0 +1,243 @@
+#include "download_resume.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+
+namespace Doodle
+{
+
+namespace
+{
+const size_t REHASH_BUFFER_BYTES = 4096;
+
+// Length of the file at path, or -1 when it cannot be read.
+long fileLength(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return -1;
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+        length = ftell(file);
+    fclose(file);
+    return length;
+}
+
+void trimLine(char *line)
+{
+    size_t length = strlen(line);
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        line[--length] = '\0';
+}
+} // namespace
+
+ResumableDownload::ResumableDownload()
+    : file_(NULL), expectedSize_(0), kept_(0), size_(0), started_(false), hashed_(false)
+{
+    partPath_[0] = '\0';
+    tagPath_[0] = '\0';
+    expectedSha256_[0] = '\0';
+    validator_[0] = '\0';
+    error_[0] = '\0';
+}
+
+ResumableDownload::~ResumableDownload()
+{
+    close();
+}
+
+bool ResumableDownload::open(const char *partPath, const char *expectedSha256, uint64_t expectedSize)
+{
+    // A retry within the same update can skip re-reading what this object
+    // just wrote, as long as the file is still exactly that long.
+    const bool stillHashed = hashed_ && strcmp(partPath, partPath_) == 0 &&
+                             sameSha256Hex(expectedSha256, expectedSha256_) && expectedSize == expectedSize_;
+    close();
+    hashed_ = false;
+    error_[0] = '\0';
+    const int partWritten = snprintf(partPath_, sizeof(partPath_), "%s", partPath);
+    const int tagWritten = snprintf(tagPath_, sizeof(tagPath_), "%s.tag", partPath);
+    if (partWritten <= 0 || partWritten >= (int)sizeof(partPath_) ||
+        tagWritten <= 0 || tagWritten >= (int)sizeof(tagPath_))
+        return fail("UPDATE TARGET PATH TOO LONG");
+    snprintf(expectedSha256_, sizeof(expectedSha256_), "%s", expectedSha256);
+    expectedSize_ = expectedSize;
+    started_ = false;
+    validator_[0] = '\0';
+    kept_ = 0;
+
+    if (readTag())
+    {
+        const long length = fileLength(partPath_);
+        if (stillHashed && length >= 0 && (uint64_t)length == size_)
+            kept_ = size_;
+        else
+            kept_ = rehash();
+    }
+    if (kept_ == 0 || kept_ >= expectedSize_)
+    {
+        kept_ = 0;
+        size_ = 0;
+        hash_.reset();
+        validator_[0] = '\0';
+        remove(tagPath_);
+        file_ = fopen(partPath_, "wb");
+    }
+    else
+    {
+        size_ = kept_;
+        file_ = fopen(partPath_, "ab");
+    }
+    if (!file_)
+        return fail("OPEN UPDATE FILE ERR %d", errno);
+    return true;
+}
+
+HttpsRange ResumableDownload::range() const
+{
+    HttpsRange range;
+    range.start = kept_;
+    range.validator = validator_[0] ? validator_ : NULL;
+    return range;
+}
+
+bool ResumableDownload::write(const HttpsResponse &response, const uint8_t *data, size_t length)
+{
+    if (!file_)
+        return fail("UPDATE FILE NOT OPEN");
+    if (!started_)
+    {
+        started_ = true;
+        if (response.partial)
+        {
+            if (kept_ == 0 || response.rangeStart != kept_)
+                return fail("RANGE AT %lu NOT %lu", (unsigned long)response.rangeStart,
+                            (unsigned long)kept_);
+        }
+        else
+        {
+            // The server ignored the range or the file changed under it.
+            if (kept_ > 0)
+            {
+                fclose(file_);
+                file_ = fopen(partPath_, "wb");
+                if (!file_)
+                    return fail("OPEN UPDATE FILE ERR %d", errno);
+                kept_ = 0;
+                size_ = 0;
+                hash_.reset();
+            }
+            writeTag(response.validator);
+        }
+    }
+    if (length > expectedSize_ - size_)
+        return fail("DOWNLOAD SIZE OVER %lu", (unsigned long)expectedSize_);
+    if (fwrite(data, 1, length, file_) != length)
+        return fail("WRITE UPDATE FILE ERR %d", errno);
+    hash_.update(data, length);
+    size_ += length;
+    return true;
+}
+
+bool ResumableDownload::close()
+{
+    if (!file_)
+        return true;
+    const bool flushed = fflush(file_) == 0;
+    const bool closed = fclose(file_) == 0;
+    file_ = NULL;
+    hashed_ = flushed && closed;
+    if (!hashed_)
+        return fail("CLOSE UPDATE FILE ERR %d", errno);
+    return true;
+}
+
+void ResumableDownload::discard()
+{
+    if (file_)
+        fclose(file_);
+    file_ = NULL;
+    if (partPath_[0])
+        remove(partPath_);
+    if (tagPath_[0])
+        remove(tagPath_);
+    hashed_ = false;
+    kept_ = 0;
+    size_ = 0;
+}
+
+void ResumableDownload::finishHex(char out[65])
+{
+    hash_.finishHex(out);
+    hashed_ = false;
+}
+
+bool ResumableDownload::readTag()
+{
+    FILE *file = fopen(tagPath_, "rb");
+    if (!file)
+        return false;
+    char digest[80];
+    char validator[sizeof(validator_) + 2];
+    bool matches = fgets(digest, sizeof(digest), file) != NULL;
+    validator[0] = '\0';
+    if (matches && !fgets(validator, sizeof(validator), file))
+        validator[0] = '\0';
+    fclose(file);
+    if (!matches)
+        return false;
+    trimLine(digest);
+    trimLine(validator);
+    const size_t validatorLength = strlen(validator);
+    if (!sameSha256Hex(digest, expectedSha256_) || validatorLength >= sizeof(validator_))
+        return false;
+    memcpy(validator_, validator, validatorLength + 1);
+    return true;
+}
+
+void ResumableDownload::writeTag(const char *validator)
+{
+    snprintf(validator_, sizeof(validator_), "%s", validator ? validator : "");
+    // Written before any body byte, so bytes on the card always have a tag
+    // that names their artifact; a tag that fails to save only costs the
+    // ability to resume.
+    FILE *file = fopen(tagPath_, "wb");
+    if (!file)
+        return;
+    const bool written = fprintf(file, "%s\n%s\n", expectedSha256_, validator_) > 0;
+    if (fclose(file) != 0 || !written)
+        remove(tagPath_);
+}
+
+uint64_t ResumableDownload::rehash()
+{
+    hash_.reset();
+    FILE *file = fopen(partPath_, "rb");
+    if (!file)
+        return 0;
+    uint8_t buffer[REHASH_BUFFER_BYTES];
+    uint64_t total = 0;
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        hash_.update(buffer, got);
+        total += got;
+        if (total >= expectedSize_)
+            break;
+    }
+    const bool readFailed = ferror(file) != 0;
+    fclose(file);
+    return readFailed ? 0 : total;
+}
+
+bool ResumableDownload::fail(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error_, sizeof(error_), format, args);
+    va_end(args);
+    return false;
+}
+
+} // namespace Doodle
@@ -0,0 +1,103 @@
+#include "draw_batch.h"
+#include "draw_packet.h"
+
+#include <string.h>
+
+namespace Doodle
+{
+
+DrawBatcher::DrawBatcher(int latencyMs, size_t byteBudget)
+    : latencyMs_(latencyMs < 0 ? 0 : latencyMs), byteBudget_(byteBudget), started_(false),
+      startedAt_(0), countedPoints_(0), pendingBytes_(0)
+{
+}
+
+bool DrawBatcher::due(const std::vector<DrawPoint> &pending, uint64_t nowMs)
+{
+    if (pending.size() < countedPoints_)
+        reset();
+    if (pending.empty())
+        return false;
+
+    if (!started_)
+    {
+        started_ = true;
+        startedAt_ = nowMs;
+    }
+    if (countedPoints_ == 0)
+    {
+        pendingBytes_ = DRAW_PACKET_DELTA_HEADER;
+        countedPoints_ = 1;
+    }
+    for (; countedPoints_ < pending.size(); ++countedPoints_)
+    {
+        const DrawPoint &point = pending[countedPoints_];
+        const DrawPoint &previous = pending[countedPoints_ - 1];
+        pendingBytes_ += deltaDrawPointBytes(point.x - previous.x, point.y - previous.y);
+    }
+
+    return nowMs - startedAt_ >= (uint64_t)latencyMs_ || pendingBytes_ >= byteBudget_ ||
+           pending.size() >= DRAW_PACKET_MAX_POINTS;
+}
+
+void DrawBatcher::reset()
+{
+    started_ = false;
+    startedAt_ = 0;
+    countedPoints_ = 0;
+    pendingBytes_ = 0;
+}
+
+SendRateCounter::SendRateCounter()
+    : currentBucket_(0), totalPackets_(0), totalBytes_(0)
+{
+    memset(packets_, 0, sizeof(packets_));
+    memset(bytes_, 0, sizeof(bytes_));
+}
+
+void SendRateCounter::advance(uint64_t nowMs)
+{
+    const uint64_t bucket = nowMs / BUCKET_MS;
+    if (bucket <= currentBucket_)
+        return;
+    // Empty every bucket the clock skipped, at most the whole ring.
+    const uint64_t skipped = bucket - currentBucket_;
+    const int clear = skipped >= (uint64_t)BUCKET_COUNT ? BUCKET_COUNT : (int)skipped;
+    for (int i = 1; i <= clear; ++i)
+    {
+        const int index = (int)((currentBucket_ + (uint64_t)i) % BUCKET_COUNT);
+        packets_[index] = 0;
+        bytes_[index] = 0;
+    }
+    currentBucket_ = bucket;
+}
+
+void SendRateCounter::record(size_t bytes, uint64_t nowMs)
+{
+    advance(nowMs);
+    const int index = (int)(currentBucket_ % BUCKET_COUNT);
+    ++packets_[index];
+    bytes_[index] += (unsigned)bytes;
+    ++totalPackets_;
+    totalBytes_ += bytes;
+}
+
+unsigned SendRateCounter::packetsPerSecond(uint64_t nowMs)
+{
+    advance(nowMs);
+    unsigned total = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+        total += packets_[i];
+    return total;
+}
+
+unsigned SendRateCounter::bytesPerSecond(uint64_t nowMs)
+{
+    advance(nowMs);
+    unsigned total = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+        total += bytes_[i];
+    return total;
+}
+
+} // namespace Doodle
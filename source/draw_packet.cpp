@@ -0,0 +1,171 @@
+#include "draw_packet.h"
+
+namespace Doodle
+{
+
+namespace
+{
+
+inline uint32_t zigzag(int value)
+{
+    return value < 0 ? ((uint32_t)(-value) << 1) - 1 : (uint32_t)value << 1;
+}
+
+inline int unzigzag(uint32_t value)
+{
+    return (value & 1) ? -(int)(value >> 1) - 1 : (int)(value >> 1);
+}
+
+uint64_t interleave(uint32_t x, uint32_t y)
+{
+    uint64_t result = 0;
+    for (int bit = 0; (x | y) != 0; ++bit, x >>= 1, y >>= 1)
+        result |= ((uint64_t)(x & 1) << (2 * bit)) | ((uint64_t)(y & 1) << (2 * bit + 1));
+    return result;
+}
+
+void deinterleave(uint64_t value, uint32_t &x, uint32_t &y)
+{
+    x = 0;
+    y = 0;
+    for (int bit = 0; value != 0; ++bit, value >>= 2)
+    {
+        x |= (uint32_t)(value & 1) << bit;
+        y |= (uint32_t)((value >> 1) & 1) << bit;
+    }
+}
+
+size_t varintLength(uint64_t value)
+{
+    size_t length = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        ++length;
+    }
+    return length;
+}
+
+inline bool validCoordinate(int value)
+{
+    return value >= 0 && value <= 0xffff;
+}
+
+} // namespace
+
+size_t deltaDrawPointBytes(int dx, int dy)
+{
+    return varintLength(interleave(zigzag(dx), zigzag(dy)));
+}
+
+size_t encodeDeltaDrawPacket(const DrawPacketStyle &style, const DrawPoint *points,
+                             size_t count, uint8_t *packet, size_t capacity,
+                             size_t &length)
+{
+    length = 0;
+    if (!points || count == 0 || !packet || capacity < DRAW_PACKET_DELTA_HEADER ||
+        !validCoordinate(points[0].x) || !validCoordinate(points[0].y))
+        return 0;
+    if (count > DRAW_PACKET_MAX_POINTS)
+        count = DRAW_PACKET_MAX_POINTS;
+
+    packet[0] = DRAW_PACKET_DELTA;
+    packet[1] = style.r;
+    packet[2] = style.g;
+    packet[3] = style.b;
+    packet[4] = (uint8_t)style.sizeTenths;
+    packet[5] = style.shape;
+    packet[6] = style.feather ? DRAW_PACKET_FLAG_FEATHER : 0;
+    writePacketU16(packet + 8, (uint16_t)points[0].x);
+    writePacketU16(packet + 10, (uint16_t)points[0].y);
+
+    size_t offset = DRAW_PACKET_DELTA_HEADER;
+    size_t encoded = 1;
+    while (encoded < count)
+    {
+        const DrawPoint &point = points[encoded];
+        const DrawPoint &previous = points[encoded - 1];
+        if (!validCoordinate(point.x) || !validCoordinate(point.y))
+            break;
+        uint64_t delta = interleave(zigzag(point.x - previous.x), zigzag(point.y - previous.y));
+        if (offset + varintLength(delta) > capacity)
+            break;
+        while (delta >= 0x80)
+        {
+            packet[offset++] = (uint8_t)(delta | 0x80);
+            delta >>= 7;
+        }
+        packet[offset++] = (uint8_t)delta;
+        ++encoded;
+    }
+    packet[7] = (uint8_t)encoded;
+    length = offset;
+    return encoded;
+}
+
+bool decodeDrawPacket(const uint8_t *packet, size_t length, DrawPacketStyle &style,
+                      DrawPoint *points, size_t &count)
+{
+    count = 0;
+    if (!packet || !points || length < DRAW_PACKET_ABSOLUTE_HEADER)
+        return false;
+
+    const uint8_t type = packet[0];
+    style.r = packet[1];
+    style.g = packet[2];
+    style.b = packet[3];
+    style.shape = packet[5];
+    if (type == DRAW_PACKET_WHOLE_SIZE || type == DRAW_PACKET_TENTHS || type == DRAW_PACKET_FEATHER)
+    {
+        style.sizeTenths = type == DRAW_PACKET_WHOLE_SIZE ? packet[4] * 10 : packet[4];
+        style.feather = type == DRAW_PACKET_FEATHER;
+        const size_t numPoints = packet[6];
+        if (length != DRAW_PACKET_ABSOLUTE_HEADER + numPoints * 4)
+            return false;
+        for (size_t i = 0; i < numPoints; ++i)
+        {
+            points[i].x = readPacketU16(packet + DRAW_PACKET_ABSOLUTE_HEADER + i * 4);
+            points[i].y = readPacketU16(packet + DRAW_PACKET_ABSOLUTE_HEADER + i * 4 + 2);
+        }
+        count = numPoints;
+        return true;
+    }
+    if (type != DRAW_PACKET_DELTA || length < DRAW_PACKET_DELTA_HEADER)
+        return false;
+
+    style.sizeTenths = packet[4];
+    style.feather = (packet[6] & DRAW_PACKET_FLAG_FEATHER) != 0;
+    const size_t numPoints = packet[7];
+    if (numPoints == 0)
+        return false;
+    points[0].x = readPacketU16(packet + 8);
+    points[0].y = readPacketU16(packet + 10);
+
+    size_t offset = DRAW_PACKET_DELTA_HEADER;
+    for (size_t i = 1; i < numPoints; ++i)
+    {
+        uint64_t delta = 0;
+        size_t bytes = 0;
+        for (;;)
+        {
+            if (offset >= length || bytes == DRAW_PACKET_MAX_DELTA_BYTES)
+                return false;
+            const uint8_t byte = packet[offset++];
+            delta |= (uint64_t)(byte & 0x7f) << (7 * bytes++);
+            if ((byte & 0x80) == 0)
+                break;
+        }
+        uint32_t zigzagX, zigzagY;
+        deinterleave(delta, zigzagX, zigzagY);
+        points[i].x = points[i - 1].x + unzigzag(zigzagX);
+        points[i].y = points[i - 1].y + unzigzag(zigzagY);
+        if (!validCoordinate(points[i].x) || !validCoordinate(points[i].y))
+            return false;
+    }
+    if (offset != length)
+        return false;
+    count = numPoints;
+    return true;
+}
+
+} // namespace Doodle
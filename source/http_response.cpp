@@ -0,0 +1,657 @@
+#include "http_response.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef APP_VERSION
+#define APP_VERSION "unknown"
+#endif
+
+namespace Doodle
+{
+
+namespace
+{
+const size_t MAX_HEADER_BYTES = 16 * 1024;
+const size_t MAX_CHUNK_LINE_BYTES = 128;
+const size_t MAX_TRAILER_BYTES = 8 * 1024;
+const int MAX_INFORMATIONAL_RESPONSES = 4;
+
+void setError(char *error, size_t errorSize, const char *message)
+{
+    if (!error || errorSize == 0)
+        return;
+    snprintf(error, errorSize, "%s", message ? message : "HTTPS request failed");
+}
+
+std::string lowerCopy(const std::string &value)
+{
+    std::string lower(value);
+    for (size_t i = 0; i < lower.size(); ++i)
+        lower[i] = (char)tolower((unsigned char)lower[i]);
+    return lower;
+}
+
+std::string trimCopy(const std::string &value)
+{
+    size_t first = 0;
+    while (first < value.size() && isspace((unsigned char)value[first]))
+        ++first;
+    size_t last = value.size();
+    while (last > first && isspace((unsigned char)value[last - 1]))
+        --last;
+    return value.substr(first, last - first);
+}
+
+bool parseDecimal(const std::string &text, unsigned long long &parsed)
+{
+    if (text.empty())
+        return false;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (!isdigit((unsigned char)text[i]))
+            return false;
+    }
+    char *end = NULL;
+    const unsigned long long result = strtoull(text.c_str(), &end, 10);
+    if (!end || *end != '\0' || result > 0x7fffffffffffffffULL)
+        return false;
+    parsed = result;
+    return true;
+}
+
+bool parseContentLength(const std::string &value, long long &parsed)
+{
+    unsigned long long result;
+    if (!parseDecimal(trimCopy(value), result))
+        return false;
+    parsed = (long long)result;
+    return true;
+}
+
+bool parseStatusLine(const std::string &line, int &statusCode)
+{
+    const char *prefixes[] = {"HTTP/1.0 ", "HTTP/1.1 "};
+    size_t statusStart = std::string::npos;
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i)
+    {
+        const size_t length = strlen(prefixes[i]);
+        if (line.compare(0, length, prefixes[i]) == 0)
+        {
+            statusStart = length;
+            break;
+        }
+    }
+    if (statusStart == std::string::npos || statusStart + 3 > line.size())
+        return false;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        if (!isdigit((unsigned char)line[statusStart + i]))
+            return false;
+    }
+    if (statusStart + 3 < line.size() && line[statusStart + 3] != ' ')
+        return false;
+    for (size_t i = statusStart + 3; i < line.size(); ++i)
+    {
+        const unsigned char value = (unsigned char)line[i];
+        if (value < 0x20 || value == 0x7f)
+            return false;
+    }
+    statusCode = (line[statusStart] - '0') * 100 +
+                 (line[statusStart + 1] - '0') * 10 +
+                 (line[statusStart + 2] - '0');
+    return statusCode >= 100 && statusCode <= 599;
+}
+
+void copyValidator(HttpsResponse &response, const std::string &value)
+{
+    if (value.size() < sizeof(response.validator))
+        snprintf(response.validator, sizeof(response.validator), "%s", value.c_str());
+}
+
+bool parseHeaders(const std::string &headerText, HttpsResponse &response,
+                  std::string &location, std::string &contentRange,
+                  char *error, size_t errorSize)
+{
+    response.statusCode = 0;
+    response.contentLength = -1;
+    response.bodyBytes = 0;
+    response.chunked = false;
+    response.partial = false;
+    response.rangeStart = 0;
+    response.completeLength = -1;
+    response.validator[0] = '\0';
+    location.clear();
+    contentRange.clear();
+    std::string etag;
+    std::string lastModified;
+    bool sawTransferEncoding = false;
+    bool sawLocation = false;
+
+    size_t lineEnd = headerText.find("\r\n");
+    if (lineEnd == std::string::npos)
+    {
+        setError(error, errorSize, "Malformed HTTPS status line");
+        return false;
+    }
+    std::string statusLine = headerText.substr(0, lineEnd);
+    if (!parseStatusLine(statusLine, response.statusCode))
+    {
+        setError(error, errorSize, "Invalid HTTPS status code");
+        return false;
+    }
+
+    size_t cursor = lineEnd + 2;
+    while (cursor < headerText.size())
+    {
+        lineEnd = headerText.find("\r\n", cursor);
+        if (lineEnd == std::string::npos)
+            break;
+        if (lineEnd == cursor)
+            break;
+        std::string line = headerText.substr(cursor, lineEnd - cursor);
+        cursor = lineEnd + 2;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0 || isspace((unsigned char)line[0]))
+        {
+            setError(error, errorSize, "Malformed HTTPS header line");
+            return false;
+        }
+        for (size_t i = 0; i < colon; ++i)
+        {
+            const unsigned char value = (unsigned char)line[i];
+            if (!(isalnum(value) || strchr("!#$%&'*+-.^_`|~", value)))
+            {
+                setError(error, errorSize, "Invalid HTTPS header name");
+                return false;
+            }
+        }
+        const std::string name = lowerCopy(trimCopy(line.substr(0, colon)));
+        const std::string value = trimCopy(line.substr(colon + 1));
+        for (size_t i = 0; i < value.size(); ++i)
+        {
+            const unsigned char byte = (unsigned char)value[i];
+            if ((byte < 0x20 && byte != '\t') || byte == 0x7f)
+            {
+                setError(error, errorSize, "Invalid HTTPS header value");
+                return false;
+            }
+        }
+        if (name == "content-length")
+        {
+            long long parsed = -1;
+            if (!parseContentLength(value, parsed) ||
+                (response.contentLength >= 0 && response.contentLength != parsed))
+            {
+                setError(error, errorSize, "Invalid HTTPS Content-Length");
+                return false;
+            }
+            response.contentLength = parsed;
+        }
+        else if (name == "transfer-encoding")
+        {
+            if (sawTransferEncoding || lowerCopy(value) != "chunked")
+            {
+                setError(error, errorSize, "Unsupported HTTPS Transfer-Encoding");
+                return false;
+            }
+            sawTransferEncoding = true;
+            response.chunked = true;
+        }
+        else if (name == "location")
+        {
+            if (sawLocation && location != value)
+            {
+                setError(error, errorSize, "Conflicting HTTPS Location headers");
+                return false;
+            }
+            sawLocation = true;
+            location = value;
+        }
+        else if (name == "content-range")
+        {
+            contentRange = value;
+        }
+        else if (name == "etag")
+        {
+            etag = value;
+        }
+        else if (name == "last-modified")
+        {
+            lastModified = value;
+        }
+    }
+
+    if (response.chunked && response.contentLength >= 0)
+    {
+        setError(error, errorSize, "Conflicting HTTPS body framing headers");
+        return false;
+    }
+    if (response.chunked)
+        response.contentLength = -1;
+    // If-Range only compares strong entity tags.
+    if (!etag.empty() && etag.compare(0, 2, "W/") != 0)
+        copyValidator(response, etag);
+    else if (!lastModified.empty())
+        copyValidator(response, lastModified);
+    return true;
+}
+} // namespace
+
+class BodyDecoder
+{
+public:
+    BodyDecoder(const HttpsResponse &response, long long rangeLength, size_t maximum,
+                HttpsBodyCallback callback, void *userData,
+                char *error, size_t errorSize)
+        : response_(response), rangeLength_(rangeLength), maximum_(maximum), callback_(callback),
+          userData_(userData), error_(error), errorSize_(errorSize), received_(0), chunkRemaining_(0),
+          state_(response.chunked ? CHUNK_SIZE : IDENTITY),
+          done_(!response.chunked && response.contentLength == 0)
+    {
+    }
+
+    bool feed(const unsigned char *data, size_t length)
+    {
+        if (done_ && length > 0)
+        {
+            setError(error_, errorSize_, "Unexpected bytes after HTTPS body");
+            return false;
+        }
+        if (!response_.chunked)
+        {
+            if (response_.contentLength >= 0)
+            {
+                const unsigned long long expected = (unsigned long long)response_.contentLength;
+                if ((unsigned long long)received_ + length > expected)
+                {
+                    setError(error_, errorSize_, "HTTPS body exceeds Content-Length");
+                    return false;
+                }
+            }
+            if (!emit(data, length))
+                return false;
+            if (response_.contentLength >= 0 && (unsigned long long)received_ == (unsigned long long)response_.contentLength)
+                done_ = true;
+            return true;
+        }
+
+        pending_.append((const char *)data, length);
+        while (!done_)
+        {
+            if (state_ == CHUNK_SIZE)
+            {
+                size_t end = pending_.find("\r\n");
+                if (end == std::string::npos)
+                {
+                    if (pending_.size() > MAX_CHUNK_LINE_BYTES)
+                    {
+                        setError(error_, errorSize_, "HTTPS chunk-size line is too long");
+                        return false;
+                    }
+                    break;
+                }
+                if (end == 0 || end > MAX_CHUNK_LINE_BYTES)
+                {
+                    setError(error_, errorSize_, "Invalid HTTPS chunk size");
+                    return false;
+                }
+                std::string line = pending_.substr(0, end);
+                pending_.erase(0, end + 2);
+                size_t extension = line.find(';');
+                if (extension != std::string::npos)
+                    line.erase(extension);
+                line = trimCopy(line);
+                for (size_t i = 0; i < line.size(); ++i)
+                {
+                    if (!isxdigit((unsigned char)line[i]))
+                    {
+                        setError(error_, errorSize_, "Invalid HTTPS chunk size");
+                        return false;
+                    }
+                }
+                char *parseEnd = NULL;
+                unsigned long long size = strtoull(line.c_str(), &parseEnd, 16);
+                if (line.empty() || !parseEnd || *parseEnd != '\0' || size > (unsigned long long)maximum_)
+                {
+                    setError(error_, errorSize_, "Invalid or oversized HTTPS chunk");
+                    return false;
+                }
+                chunkRemaining_ = (size_t)size;
+                state_ = chunkRemaining_ == 0 ? CHUNK_TRAILERS : CHUNK_DATA;
+            }
+            else if (state_ == CHUNK_DATA)
+            {
+                if (pending_.empty())
+                    break;
+                size_t count = std::min(chunkRemaining_, pending_.size());
+                if (!emit((const unsigned char *)pending_.data(), count))
+                    return false;
+                pending_.erase(0, count);
+                chunkRemaining_ -= count;
+                if (chunkRemaining_ == 0)
+                    state_ = CHUNK_DATA_END;
+            }
+            else if (state_ == CHUNK_DATA_END)
+            {
+                if (pending_.size() < 2)
+                    break;
+                if (pending_.compare(0, 2, "\r\n") != 0)
+                {
+                    setError(error_, errorSize_, "Malformed HTTPS chunk terminator");
+                    return false;
+                }
+                pending_.erase(0, 2);
+                state_ = CHUNK_SIZE;
+            }
+            else if (state_ == CHUNK_TRAILERS)
+            {
+                if (pending_.size() >= 2 && pending_.compare(0, 2, "\r\n") == 0)
+                {
+                    pending_.erase(0, 2);
+                    done_ = true;
+                    break;
+                }
+                size_t end = pending_.find("\r\n\r\n");
+                if (end == std::string::npos)
+                {
+                    if (pending_.size() > MAX_TRAILER_BYTES)
+                    {
+                        setError(error_, errorSize_, "HTTPS trailers are too large");
+                        return false;
+                    }
+                    break;
+                }
+                if (end + 4 > MAX_TRAILER_BYTES)
+                {
+                    setError(error_, errorSize_, "HTTPS trailers are too large");
+                    return false;
+                }
+                pending_.erase(0, end + 4);
+                done_ = true;
+            }
+        }
+        if (done_ && !pending_.empty())
+        {
+            setError(error_, errorSize_, "Unexpected bytes after HTTPS body");
+            return false;
+        }
+        if (done_ && !rangeComplete())
+            return false;
+        return true;
+    }
+
+    bool finishOnClose()
+    {
+        if (response_.chunked)
+        {
+            if (!done_)
+            {
+                setError(error_, errorSize_, "Truncated chunked HTTPS body");
+                return false;
+            }
+            return true;
+        }
+        if (response_.contentLength >= 0 && (unsigned long long)received_ != (unsigned long long)response_.contentLength)
+        {
+            setError(error_, errorSize_, "Truncated HTTPS body");
+            return false;
+        }
+        if (!rangeComplete())
+            return false;
+        done_ = true;
+        return true;
+    }
+
+    bool done() const { return done_; }
+    size_t received() const { return received_; }
+
+private:
+    enum State
+    {
+        IDENTITY,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        CHUNK_TRAILERS
+    };
+
+    // A 206 body must be exactly the span its Content-Range named, however
+    // it is framed.
+    bool rangeComplete()
+    {
+        if (rangeLength_ >= 0 && (unsigned long long)received_ != (unsigned long long)rangeLength_)
+        {
+            setError(error_, errorSize_, "HTTPS body does not match Content-Range");
+            return false;
+        }
+        return true;
+    }
+
+    bool emit(const unsigned char *data, size_t length)
+    {
+        if (length == 0)
+            return true;
+        if (length > maximum_ || received_ > maximum_ - length)
+        {
+            setError(error_, errorSize_, "HTTPS body exceeds configured limit");
+            return false;
+        }
+        if (rangeLength_ >= 0 && (unsigned long long)received_ + length > (unsigned long long)rangeLength_)
+        {
+            setError(error_, errorSize_, "HTTPS body exceeds Content-Range");
+            return false;
+        }
+        if (callback_ && !callback_(data, length, userData_))
+        {
+            setError(error_, errorSize_, "HTTPS body consumer failed");
+            return false;
+        }
+        received_ += length;
+        return true;
+    }
+
+    HttpsResponse response_;
+    long long rangeLength_;
+    size_t maximum_;
+    HttpsBodyCallback callback_;
+    void *userData_;
+    char *error_;
+    size_t errorSize_;
+    size_t received_;
+    size_t chunkRemaining_;
+    State state_;
+    bool done_;
+    std::string pending_;
+};
+
+size_t formatHttpGet(char *out, size_t outSize, const char *path, const char *hostHeader,
+                     const HttpsRange &range)
+{
+    char rangeHeaders[160] = "";
+    if (range.start > 0)
+    {
+        const bool conditional = range.validator && range.validator[0];
+        const int written = snprintf(rangeHeaders, sizeof(rangeHeaders), "Range: bytes=%llu-\r\n%s%s%s",
+                                     range.start, conditional ? "If-Range: " : "",
+                                     conditional ? range.validator : "", conditional ? "\r\n" : "");
+        if (written <= 0 || written >= (int)sizeof(rangeHeaders))
+            return 0;
+    }
+    const int length = snprintf(out, outSize,
+                                "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: CollabDoodle/%s\r\nAccept: */*\r\n%sConnection: close\r\n\r\n",
+                                path, hostHeader, APP_VERSION, rangeHeaders);
+    if (length <= 0 || length >= (int)outSize)
+        return 0;
+    return (size_t)length;
+}
+
+bool parseContentRange(const std::string &value, unsigned long long &first,
+                       unsigned long long &last, long long &complete)
+{
+    const std::string text = trimCopy(value);
+    const std::string unit = "bytes ";
+    if (lowerCopy(text.substr(0, std::min(unit.size(), text.size()))) != unit)
+        return false;
+    const size_t dash = text.find('-', unit.size());
+    const size_t slash = text.find('/', unit.size());
+    if (dash == std::string::npos || slash == std::string::npos || dash > slash)
+        return false;
+    unsigned long long length = 0;
+    if (!parseDecimal(text.substr(unit.size(), dash - unit.size()), first) ||
+        !parseDecimal(text.substr(dash + 1, slash - dash - 1), last) || last < first)
+        return false;
+    const std::string completeText = text.substr(slash + 1);
+    if (completeText == "*")
+    {
+        complete = -1;
+        return true;
+    }
+    if (!parseDecimal(completeText, length) || last >= length)
+        return false;
+    complete = (long long)length;
+    return true;
+}
+
+HttpResponseReader::HttpResponseReader(HttpsResponse &response, std::string &redirectLocation,
+                                       const HttpsRange &range, size_t maxBodyBytes,
+                                       HttpsBodyCallback callback, void *userData,
+                                       char *error, size_t errorSize)
+    : response_(response), redirectLocation_(redirectLocation), range_(range),
+      maxBodyBytes_(maxBodyBytes), callback_(callback), userData_(userData), error_(error),
+      errorSize_(errorSize), informationalResponses_(0), headersDone_(false), decoder_(NULL)
+{
+}
+
+HttpResponseReader::~HttpResponseReader()
+{
+    delete decoder_;
+}
+
+HttpResponseReader::Result HttpResponseReader::feed(const unsigned char *data, size_t length)
+{
+    if (headersDone_)
+    {
+        if (!decoder_ || !decoder_->feed(data, length))
+            return READ_FAILED;
+        return decoder_->done() ? READ_COMPLETE : READ_MORE;
+    }
+
+    headers_.append((const char *)data, length);
+    while (!headersDone_)
+    {
+        size_t headerEnd = headers_.find("\r\n\r\n");
+        if (headerEnd == std::string::npos)
+        {
+            if (headers_.size() > MAX_HEADER_BYTES)
+            {
+                setError(error_, errorSize_, "HTTPS response headers are too large");
+                return READ_FAILED;
+            }
+            return READ_MORE;
+        }
+        if (headerEnd + 4 > MAX_HEADER_BYTES)
+        {
+            setError(error_, errorSize_, "HTTPS response headers are too large");
+            return READ_FAILED;
+        }
+
+        std::string headerBlock = headers_.substr(0, headerEnd + 2);
+        headers_.erase(0, headerEnd + 4);
+        if (!parseHeaders(headerBlock, response_, redirectLocation_, contentRange_, error_, errorSize_))
+            return READ_FAILED;
+        if (response_.statusCode >= 100 && response_.statusCode < 200)
+        {
+            if (response_.statusCode == 101 || ++informationalResponses_ > MAX_INFORMATIONAL_RESPONSES)
+            {
+                setError(error_, errorSize_, "Unsupported HTTPS informational response");
+                return READ_FAILED;
+            }
+            continue;
+        }
+        headersDone_ = true;
+    }
+
+    const Result started = startBody();
+    if (started != READ_MORE)
+        return started;
+    if (!headers_.empty() && !decoder_->feed((const unsigned char *)headers_.data(), headers_.size()))
+        return READ_FAILED;
+    headers_.clear();
+    return decoder_->done() ? READ_COMPLETE : READ_MORE;
+}
+
+HttpResponseReader::Result HttpResponseReader::closed()
+{
+    if (!headersDone_)
+    {
+        setError(error_, errorSize_, "HTTPS connection closed before response headers");
+        return READ_FAILED;
+    }
+    return decoder_ && decoder_->finishOnClose() ? READ_COMPLETE : READ_FAILED;
+}
+
+size_t HttpResponseReader::bodyBytes() const
+{
+    return decoder_ ? decoder_->received() : 0;
+}
+
+HttpResponseReader::Result HttpResponseReader::startBody()
+{
+    const int status = response_.statusCode;
+    if (status == 301 || status == 302 || status == 303 || status == 307 || status == 308)
+        return READ_REDIRECT;
+
+    long long rangeLength = -1;
+    if (status == 206 && range_.start > 0)
+    {
+        unsigned long long first = 0;
+        unsigned long long last = 0;
+        long long complete = -1;
+        if (!parseContentRange(contentRange_, first, last, complete) || first != range_.start)
+        {
+            setError(error_, errorSize_, "HTTPS 206 without a matching Content-Range");
+            return READ_FAILED;
+        }
+        rangeLength = (long long)(last - first + 1);
+        if (response_.contentLength >= 0 && response_.contentLength != rangeLength)
+        {
+            setError(error_, errorSize_, "HTTPS Content-Length does not match Content-Range");
+            return READ_FAILED;
+        }
+        response_.partial = true;
+        response_.rangeStart = first;
+        response_.completeLength = complete;
+    }
+    else if (status == 200)
+    {
+        response_.completeLength = response_.chunked ? -1 : response_.contentLength;
+    }
+    else
+    {
+        char statusError[96];
+        snprintf(statusError, sizeof(statusError), "HTTPS server returned status %d", status);
+        setError(error_, errorSize_, statusError);
+        return READ_FAILED;
+    }
+    if (response_.contentLength >= 0 && (unsigned long long)response_.contentLength > (unsigned long long)maxBodyBytes_)
+    {
+        setError(error_, errorSize_, "HTTPS Content-Length exceeds configured limit");
+        return READ_FAILED;
+    }
+
+    decoder_ = new (std::nothrow) BodyDecoder(response_, rangeLength, maxBodyBytes_, callback_, userData_,
+                                              error_, errorSize_);
+    if (!decoder_)
+    {
+        setError(error_, errorSize_, "Out of memory creating HTTPS decoder");
+        return READ_FAILED;
+    }
+    return READ_MORE;
+}
+
+} // namespace Doodle
@@ -0,0 +1,153 @@
+#include "local_echo.h"
+#include <algorithm>
+#include <string.h>
+
+namespace Doodle
+{
+
+LocalEchoTiles::LocalEchoTiles()
+    : canvasWidth_(0), canvasHeight_(0), tilesX_(0), tilesY_(0), pendingTiles_(0), acknowledged_(0)
+{
+}
+
+void LocalEchoTiles::reset(int canvasWidth, int canvasHeight)
+{
+    canvasWidth_ = std::max(0, canvasWidth);
+    canvasHeight_ = std::max(0, canvasHeight);
+    tilesX_ = (canvasWidth_ + LOCAL_ECHO_TILE_SIZE - 1) / LOCAL_ECHO_TILE_SIZE;
+    tilesY_ = (canvasHeight_ + LOCAL_ECHO_TILE_SIZE - 1) / LOCAL_ECHO_TILE_SIZE;
+    newest_.assign((size_t)tilesX_ * tilesY_, 0);
+    pendingTiles_ = 0;
+}
+
+void LocalEchoTiles::markPending(const DirtyRect &bounds, uint32_t sequence)
+{
+    int minTileX, minTileY, maxTileX, maxTileY;
+    if (sequence == 0 || sequence <= acknowledged_ ||
+        !tileRange(bounds, minTileX, minTileY, maxTileX, maxTileY))
+        return;
+    for (int tileY = minTileY; tileY <= maxTileY; ++tileY)
+    {
+        uint32_t *tile = &newest_[(size_t)tileY * tilesX_ + minTileX];
+        for (int tileX = minTileX; tileX <= maxTileX; ++tileX, ++tile)
+        {
+            if (*tile == 0)
+                ++pendingTiles_;
+            *tile = std::max(*tile, sequence);
+        }
+    }
+}
+
+void LocalEchoTiles::acknowledge(uint32_t sequence)
+{
+    if (sequence <= acknowledged_)
+        return;
+    acknowledged_ = sequence;
+    if (pendingTiles_ == 0)
+        return;
+    for (size_t i = 0; i < newest_.size(); ++i)
+    {
+        if (newest_[i] != 0 && newest_[i] <= sequence)
+        {
+            newest_[i] = 0;
+            --pendingTiles_;
+        }
+    }
+}
+
+size_t LocalEchoTiles::pendingAreas(const DirtyRect &changed, std::vector<DirtyRect> &areas) const
+{
+    areas.clear();
+    int minTileX, minTileY, maxTileX, maxTileY;
+    if (pendingTiles_ == 0 || !tileRange(changed, minTileX, minTileY, maxTileX, maxTileY))
+        return 0;
+    for (int tileY = minTileY; tileY <= maxTileY; ++tileY)
+    {
+        const uint32_t *row = &newest_[(size_t)tileY * tilesX_];
+        int tileX = minTileX;
+        while (tileX <= maxTileX)
+        {
+            if (row[tileX] == 0)
+            {
+                ++tileX;
+                continue;
+            }
+            const int runStart = tileX;
+            while (tileX <= maxTileX && row[tileX] != 0)
+                ++tileX;
+            DirtyRect area;
+            area.minX = std::max(changed.minX, runStart * LOCAL_ECHO_TILE_SIZE);
+            area.maxX = std::min(std::min(changed.maxX, canvasWidth_ - 1),
+                                 tileX * LOCAL_ECHO_TILE_SIZE - 1);
+            area.minY = std::max(changed.minY, tileY * LOCAL_ECHO_TILE_SIZE);
+            area.maxY = std::min(std::min(changed.maxY, canvasHeight_ - 1),
+                                 (tileY + 1) * LOCAL_ECHO_TILE_SIZE - 1);
+            area.valid = true;
+            areas.push_back(area);
+        }
+    }
+    return areas.size();
+}
+
+bool LocalEchoTiles::tileRange(const DirtyRect &rect, int &minTileX, int &minTileY,
+                               int &maxTileX, int &maxTileY) const
+{
+    if (!rect.valid || tilesX_ == 0 || tilesY_ == 0)
+        return false;
+    const int minX = std::max(0, rect.minX);
+    const int minY = std::max(0, rect.minY);
+    const int maxX = std::min(canvasWidth_ - 1, rect.maxX);
+    const int maxY = std::min(canvasHeight_ - 1, rect.maxY);
+    if (minX > maxX || minY > maxY)
+        return false;
+    minTileX = minX / LOCAL_ECHO_TILE_SIZE;
+    minTileY = minY / LOCAL_ECHO_TILE_SIZE;
+    maxTileX = maxX / LOCAL_ECHO_TILE_SIZE;
+    maxTileY = maxY / LOCAL_ECHO_TILE_SIZE;
+    return true;
+}
+
+void LocalEchoRestack::begin(const u8 *canvas, int canvasWidth, const DirtyRect &area)
+{
+    area_ = area;
+    const size_t width = (size_t)(area.maxX - area.minX + 1);
+    const size_t height = (size_t)(area.maxY - area.minY + 1);
+    saved_.resize(width * height * 3);
+    opaque_.assign(width * height, 0);
+    for (size_t row = 0; row < height; ++row)
+        memcpy(&saved_[row * width * 3],
+               canvas + 3 * ((size_t)(area.minY + (int)row) * canvasWidth + area.minX), width * 3);
+}
+
+void LocalEchoRestack::coverAll()
+{
+    std::fill(opaque_.begin(), opaque_.end(), 1);
+}
+
+bool LocalEchoRestack::anyOpaque() const
+{
+    return std::find(opaque_.begin(), opaque_.end(), 1) != opaque_.end();
+}
+
+void LocalEchoRestack::finish(u8 *canvas, int canvasWidth) const
+{
+    const size_t width = (size_t)(area_.maxX - area_.minX + 1);
+    const size_t height = opaque_.size() / width;
+    for (size_t row = 0; row < height; ++row)
+    {
+        u8 *pixel = canvas + 3 * ((size_t)(area_.minY + (int)row) * canvasWidth + area_.minX);
+        const u8 *saved = &saved_[row * width * 3];
+        const u8 *opaque = &opaque_[row * width];
+        for (size_t x = 0; x < width; ++x, pixel += 3, saved += 3)
+        {
+            if (!opaque[x])
+            {
+                pixel[0] = saved[0];
+                pixel[1] = saved[1];
+                pixel[2] = saved[2];
+            }
+        }
+    }
+}
+
+} // namespace Doodle
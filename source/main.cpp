@@ -23,8 +23,15 @@
 #include "client_settings.h"
 #include "input_bindings.h"
 #include "brush_render.h"
+#include "brush_stamp.h"
 #include "canvas_sync.h"
+#include "control_router.h"
+#include "draw_batch.h"
+#include "draw_packet.h"
+#include "local_echo.h"
 #include "scoped_notice.h"
+#include "stroke_journal.h"
+#include "stroke_simplify.h"
 #include "ticket_flow.h"
 
 // TLS certificate verification can exceed libctru's 32 KiB default main
@@ -102,6 +109,7 @@ static char gIdentityStorageStatus[64] = "STORE UNKNOWN";
 static char gIdentityBootStatus[64] = "BOOT UNKNOWN";
 static const char *IDENTITY_PRIMARY_PATH = "sdmc:/3ds/CollabDoodle/identity.txt";
 static const char *IDENTITY_FALLBACK_PATH = "sdmc:/3ds/CollabDoodle.identity.txt";
+static const char *STROKE_JOURNAL_PATH = "sdmc:/3ds/CollabDoodle/strokes.journal";
 static int gLastPrimaryReadErr = 0;
 static int gLastFallbackReadErr = 0;
 static char gRequiredRulesVersion[32] = "";
@@ -130,6 +138,41 @@ static bool isValidCanvasMeta(const CanvasMeta &meta)
         meta.width, meta.height, meta.compressedSize);
 }
 
+// Snapshots larger than one WebSocket stream piece arrive as a run of
+// NETWORK_EVENT_BINARY_PART events. Each piece is inflated into the canvas
+// as soon as it arrives, so only one piece is ever held in memory. The
+// first piece (or a whole NETWORK_EVENT_BINARY) resizes the canvas.
+static bool appendCanvasSnapshotPiece(CanvasState &canvas, const CanvasMeta &meta,
+                                      const NetworkEvent &event, size_t &received,
+                                      DirtyRect &rowsWritten)
+{
+    rowsWritten.valid = false;
+    if (event.type == NETWORK_EVENT_BINARY || event.partOffset == 0)
+    {
+        received = 0;
+        canvas.setChannel(meta.channel);
+        if (!canvas.allocate(meta.width, meta.height) || !canvas.beginCompressedLoad())
+            return false;
+    }
+    if (!canvas.compressedLoadActive() || event.partOffset != received ||
+        event.payload.size() > (size_t)meta.compressedSize - received)
+        return false;
+    received += event.payload.size();
+    return canvas.appendCompressed(event.payload.data(), event.payload.size(), rowsWritten);
+}
+
+static bool isLastCanvasSnapshotPiece(const NetworkEvent &event)
+{
+    return event.type == NETWORK_EVENT_BINARY || event.partFinal;
+}
+
+static bool finishCanvasSnapshot(CanvasState &canvas, const CanvasMeta &meta, size_t received)
+{
+    const bool loaded = received == (size_t)meta.compressedSize && canvas.finishCompressedLoad();
+    canvas.cancelCompressedLoad();
+    return loaded;
+}
+
 static void handleAptEvent(APT_HookType hook, void *)
 {
     if (hook == APTHOOK_ONSLEEP)
@@ -507,16 +550,40 @@ static void drawRectOutline(u8 *fb, int fbWidth, int fbHeight, int x, int y, int
 
 static void drawMiniText(u8 *fb, int width, int height, int x, int y, const char *text, u8 r, u8 g, u8 b);
 
-static void applyCanvasRectLocal(CanvasState &canvas, int x, int y, int w, int h, Color color)
+static DirtyRect emptyDirtyRect()
 {
-    if (!canvas.pixels || w <= 0 || h <= 0)
+    DirtyRect rect = {0, 0, 0, 0, false};
+    return rect;
+}
+
+static void extendDirtyRect(DirtyRect &rect, int minX, int minY, int maxX, int maxY)
+{
+    if (!rect.valid)
+    {
+        rect.minX = minX;
+        rect.minY = minY;
+        rect.maxX = maxX;
+        rect.maxY = maxY;
+        rect.valid = true;
         return;
+    }
+    rect.minX = std::min(rect.minX, minX);
+    rect.minY = std::min(rect.minY, minY);
+    rect.maxX = std::max(rect.maxX, maxX);
+    rect.maxY = std::max(rect.maxY, maxY);
+}
+
+static DirtyRect applyCanvasRectLocal(CanvasState &canvas, int x, int y, int w, int h, Color color)
+{
+    DirtyRect changed = emptyDirtyRect();
+    if (!canvas.pixels || w <= 0 || h <= 0)
+        return changed;
     int minX = std::max(0, x);
     int minY = std::max(0, y);
     int maxX = std::min(canvas.width - 1, x + w - 1);
     int maxY = std::min(canvas.height - 1, y + h - 1);
     if (minX > maxX || minY > maxY)
-        return;
+        return changed;
     for (int py = minY; py <= maxY; py++)
     {
         for (int px = minX; px <= maxX; px++)
@@ -527,7 +594,9 @@ static void applyCanvasRectLocal(CanvasState &canvas, int x, int y, int w, int h
             canvas.pixels[idx + 2] = color.b;
         }
     }
-    canvas.markDirty((minX + maxX) / 2, (minY + maxY) / 2, std::max(maxX - minX, maxY - minY) / 2 + 2);
+    extendDirtyRect(changed, minX, minY, maxX, maxY);
+    canvas.markDirtyRect(changed);
+    return changed;
 }
 
 static void drawMiniGlyph(u8 *fb, int width, int height, int x, int y, char c, u8 r, u8 g, u8 b)
@@ -760,9 +829,25 @@ static HttpsUpdateAttempt offerHttpsUpdate(const char *packageType, const char *
 
     if (strcmp(packageType, "cia") == 0)
     {
-        attempt.result = Updater::downloadAndInstallCia(
-            SERVER_HTTPS_HOST, SERVER_HTTPS_PORT, manifest, updateTargetPath,
-            installedTitleId, updateProgress, NULL);
+        // A stream keeps nothing when the connection drops, so from then on
+        // the CIA is staged in a resumable .part under sdmc:/cias/ instead,
+        // for as long as that file is there to pick up.
+        bool staged = Updater::hasStagedDownload(updateTargetPath);
+        if (!staged)
+        {
+            attempt.result = Updater::streamInstallCia(
+                SERVER_HTTPS_HOST, SERVER_HTTPS_PORT, manifest,
+                installedTitleId, updateProgress, NULL);
+            staged = attempt.result == UPDATE_DOWNLOAD_INTERRUPTED;
+            if (staged)
+                printf("%s; STAGING UPDATE ON SD CARD\n", Updater::lastError());
+        }
+        if (staged)
+        {
+            attempt.result = Updater::downloadAndInstallCia(
+                SERVER_HTTPS_HOST, SERVER_HTTPS_PORT, manifest, updateTargetPath,
+                installedTitleId, updateProgress, NULL);
+        }
     }
     else
     {
@@ -837,6 +922,8 @@ static void drawZoomOverlay(u8 *buffer, int fbWidth, int fbHeight, bool leftSide
     fillBufferScreenRect(buffer, fbWidth, fbHeight, x + 12, upY + 27, 18, 4, 94, 234, 212);
     fillBufferScreenRect(buffer, fbWidth, fbHeight, x + 19, upY + 20, 4, 18, 94, 234, 212);
     fillBufferScreenRect(buffer, fbWidth, fbHeight, x + 12, downY + 27, 18, 4, 255, 115, 115);
+    Renderer::invalidateViewportRect(x, upY, w, h);
+    Renderer::invalidateViewportRect(x, downY, w, h);
 }
 
 static bool pointInRect(int px, int py, int x, int y, int w, int h)
@@ -858,7 +945,16 @@ static int brushDirtyRadius(int sizeTenths)
 static int clampRenderedBrushSizeTenths(int sizeTenths)
 {
     return std::max(Doodle::CLIENT_BRUSH_SIZE_MIN_TENTHS,
-                    std::min(sizeTenths, 310));
+                    std::min(sizeTenths, Doodle::BRUSH_RENDER_MAX_SIZE_TENTHS));
+}
+
+// Half-width of the square drawBrush may touch around its center.
+static int brushStampExtent(int sizeTenths)
+{
+    sizeTenths = clampRenderedBrushSizeTenths(sizeTenths);
+    const int lowerSize = sizeTenths / 10;
+    const int upperSize = std::min(31, lowerSize + (sizeTenths % 10 ? 1 : 0));
+    return upperSize / 2;
 }
 
 void drawPointOnBuffer(u8 *buffer, int fbWidth, int fbHeight, int x, int y, u8 r, u8 g, u8 b)
@@ -872,19 +968,6 @@ void drawPointOnBuffer(u8 *buffer, int fbWidth, int fbHeight, int x, int y, u8 r
     }
 }
 
-static void blendPointOnBuffer(u8 *buffer, int fbWidth, int fbHeight,
-                               int x, int y, u8 r, u8 g, u8 b,
-                               int coverageTenths)
-{
-    if (x < 0 || x >= fbWidth || y < 0 || y >= fbHeight)
-        return;
-
-    const int idx = 3 * (y * fbWidth + x);
-    buffer[idx] = Doodle::blendBrushChannel(buffer[idx], r, coverageTenths);
-    buffer[idx + 1] = Doodle::blendBrushChannel(buffer[idx + 1], g, coverageTenths);
-    buffer[idx + 2] = Doodle::blendBrushChannel(buffer[idx + 2], b, coverageTenths);
-}
-
 static Color effectiveDrawColor()
 {
     if (currentBrushShape == BRUSH_ERASER)
@@ -943,104 +1026,16 @@ u8 clampColor(float colorValue)
     return static_cast<u8>(std::max(0.0f, std::min(255.0f, colorValue)));
 }
 
-static bool brushContainsPixelAtWholeSize(int centerX, int centerY,
-                                         int x, int y, int size, int shape)
-{
-    static const int bayer4[4][4] = {
-        {0, 8, 2, 10},
-        {12, 4, 14, 6},
-        {3, 11, 1, 9},
-        {15, 7, 13, 5},
-    };
-    static const int spray8[8][8] = {
-        {17, 52, 3, 44, 29, 61, 11, 36},
-        {48, 7, 57, 22, 40, 1, 31, 54},
-        {13, 34, 20, 63, 9, 46, 26, 42},
-        {59, 24, 38, 5, 50, 15, 56, 0},
-        {30, 45, 10, 53, 18, 62, 4, 35},
-        {6, 51, 27, 41, 2, 47, 21, 58},
-        {43, 12, 60, 25, 37, 8, 49, 16},
-        {23, 55, 14, 39, 32, 19, 33, 28},
-    };
-    const int extent = size / 2;
-    if (abs(x) > extent || abs(y) > extent)
-        return false;
-
-    if (shape == BRUSH_SQUARE)
-        return true;
-    if (shape == BRUSH_DIAMOND)
-        return abs(x) + abs(y) <= extent;
-    if (shape == BRUSH_CROSS)
-    {
-        const int arm = extent / 3;
-        return abs(x) <= arm || abs(y) <= arm;
-    }
-
-    const bool sparseShape = shape == BRUSH_DITHER || shape == BRUSH_SPRAY;
-    const int radius = sparseShape ? std::max(1, extent) : extent;
-    const int dist2 = x * x + y * y;
-    if (dist2 > radius * radius)
-        return false;
-    if (!sparseShape)
-        return true;
-
-    if (dist2 == 0)
-        return true;
-    const float dist = sqrtf((float)dist2);
-    const float coverage = 1.0f - (dist / (float)(radius + 1));
-    if (shape == BRUSH_SPRAY)
-    {
-        const int density = (int)(18.0f + coverage * 38.0f);
-        return spray8[(centerY + y) & 7][(centerX + x) & 7] < density;
-    }
-    const int threshold = bayer4[(centerY + y) & 3][(centerX + x) & 3];
-    return (int)(coverage * 11.0f) > threshold;
-}
-
-static bool brushPixelIsBoundaryAtWholeSize(int centerX, int centerY,
-                                            int x, int y, int size, int shape)
-{
-    if (!brushContainsPixelAtWholeSize(centerX, centerY, x, y, size, shape))
-        return false;
-    return !brushContainsPixelAtWholeSize(centerX, centerY, x - 1, y, size, shape) ||
-           !brushContainsPixelAtWholeSize(centerX, centerY, x + 1, y, size, shape) ||
-           !brushContainsPixelAtWholeSize(centerX, centerY, x, y - 1, size, shape) ||
-           !brushContainsPixelAtWholeSize(centerX, centerY, x, y + 1, size, shape);
-}
+static Doodle::BrushStampCache gBrushStamps;
+// Stamp centers of the segment being drawn; main thread only.
+static std::vector<DrawPoint> gStrokeStamps;
 
 void drawBrush(u8 *buffer, int fbWidth, int fbHeight, int centerX, int centerY,
                int sizeTenths, int shape, u8 r, u8 g, u8 b,
                bool feather = false)
 {
-    sizeTenths = clampRenderedBrushSizeTenths(sizeTenths);
-    const int lowerSize = sizeTenths / 10;
-    const int fraction = sizeTenths % 10;
-    const int upperSize = std::min(31, lowerSize + (fraction ? 1 : 0));
-    const int extent = upperSize / 2;
-
-    for (int y = -extent; y <= extent; y++)
-    {
-        for (int x = -extent; x <= extent; x++)
-        {
-            const bool lowerContains =
-                brushContainsPixelAtWholeSize(centerX, centerY, x, y, lowerSize, shape);
-            const bool upperContains = fraction > 0 &&
-                brushContainsPixelAtWholeSize(centerX, centerY, x, y, upperSize, shape);
-            const bool lowerBoundary = lowerContains &&
-                brushPixelIsBoundaryAtWholeSize(
-                    centerX, centerY, x, y, lowerSize, shape);
-            const int coverageTenths = Doodle::fractionalBrushCoverageTenths(
-                lowerContains, upperContains, lowerBoundary, fraction, shape,
-                centerX + x, centerY + y, feather, x == 0 && y == 0);
-            if (coverageTenths >= 10)
-                drawPointOnBuffer(buffer, fbWidth, fbHeight,
-                                  centerX + x, centerY + y, r, g, b);
-            else if (coverageTenths > 0)
-                blendPointOnBuffer(buffer, fbWidth, fbHeight,
-                                   centerX + x, centerY + y, r, g, b,
-                                   coverageTenths);
-        }
-    }
+    Doodle::drawBrushStamp(gBrushStamps, buffer, fbWidth, fbHeight, centerX, centerY,
+                           clampRenderedBrushSizeTenths(sizeTenths), shape, r, g, b, feather);
 }
 
 static void resetBrushStrokeSampling()
@@ -1063,23 +1058,49 @@ static bool shouldDrawBrushSample(int x, int y, bool force)
     return force || distance >= spacing;
 }
 
-static void drawStrokeCanvasPoint(u8 *fullCanvas, int canvasWidth, int canvasHeight,
-                                  int canvasX, int canvasY, CanvasState &canvas,
-                                  bool force = false)
+// Records a stroke sample that passes the spacing rules and marks the area
+// its stamp will cover. The caller draws the stamp.
+static bool acceptStrokeCanvasPoint(int canvasWidth, int canvasHeight,
+                                    int canvasX, int canvasY, CanvasState &canvas,
+                                    bool force = false)
 {
     if (canvasX < 0 || canvasX >= canvasWidth ||
         canvasY < 0 || canvasY >= canvasHeight ||
         !shouldDrawBrushSample(canvasX, canvasY, force))
+        return false;
+
+    const int dirtyRadius = brushDirtyRadius(currentBrushSizeTenths);
+    DirtyRect stamp = {canvasX - dirtyRadius, canvasY - dirtyRadius,
+                       canvasX + dirtyRadius, canvasY + dirtyRadius, true};
+    canvas.markDirtyRect(stamp);
+    Renderer::invalidateMinimapRect(stamp);
+    UIState::addPoint(canvasX, canvasY);
+    gLastBrushSampleX = canvasX;
+    gLastBrushSampleY = canvasY;
+    return true;
+}
+
+static void drawStrokeStamps(u8 *fullCanvas, int canvasWidth, int canvasHeight)
+{
+    if (gStrokeStamps.empty())
         return;
+    Color drawColor = effectiveDrawColor();
+    Doodle::drawBrushStamps(gBrushStamps, fullCanvas, canvasWidth, canvasHeight,
+                            &gStrokeStamps[0], gStrokeStamps.size(),
+                            clampRenderedBrushSizeTenths(currentBrushSizeTenths),
+                            effectiveBrushShape(), drawColor.r, drawColor.g, drawColor.b,
+                            gFeatherEnabled);
+}
 
+static void drawStrokeCanvasPoint(u8 *fullCanvas, int canvasWidth, int canvasHeight,
+                                  int canvasX, int canvasY, CanvasState &canvas)
+{
+    if (!acceptStrokeCanvasPoint(canvasWidth, canvasHeight, canvasX, canvasY, canvas))
+        return;
     Color drawColor = effectiveDrawColor();
     drawBrush(fullCanvas, canvasWidth, canvasHeight, canvasX, canvasY,
               currentBrushSizeTenths, effectiveBrushShape(),
               drawColor.r, drawColor.g, drawColor.b, gFeatherEnabled);
-    canvas.markDirty(canvasX, canvasY, brushDirtyRadius(currentBrushSizeTenths));
-    UIState::addPoint(canvasX, canvasY);
-    gLastBrushSampleX = canvasX;
-    gLastBrushSampleY = canvasY;
 }
 
 static void drawStrokeSample(u8 *fullCanvas, int canvasWidth, int canvasHeight,
@@ -1101,14 +1122,18 @@ static void drawStrokeLine(u8 *fullCanvas, int canvasWidth, int canvasHeight,
     float cx1 = (float)canvas.offsetX + x1 / zoom;
     float cy1 = (float)canvas.offsetY + y1 / zoom;
     int steps = std::max(1, (int)std::ceil(std::max(fabsf(cx1 - cx0), fabsf(cy1 - cy0))));
+    gStrokeStamps.clear();
     for (int i = 0; i <= steps; i++)
     {
         float t = (float)i / (float)steps;
         int x = (int)std::round(cx0 + (cx1 - cx0) * t);
         int y = (int)std::round(cy0 + (cy1 - cy0) * t);
-        drawStrokeCanvasPoint(fullCanvas, canvasWidth, canvasHeight,
-                              x, y, canvas, forceEnd && i == steps);
+        DrawPoint stamp = {x, y};
+        if (acceptStrokeCanvasPoint(canvasWidth, canvasHeight, x, y, canvas,
+                                    forceEnd && i == steps))
+            gStrokeStamps.push_back(stamp);
     }
+    drawStrokeStamps(fullCanvas, canvasWidth, canvasHeight);
 }
 
 static void drawStrokeCurve(u8 *fullCanvas, int canvasWidth, int canvasHeight,
@@ -1124,48 +1149,66 @@ static void drawStrokeCurve(u8 *fullCanvas, int canvasWidth, int canvasHeight,
     float c1y = (float)canvas.offsetY + y1 / zoom;
     float lengthEstimate = hypotf(ccx - c0x, ccy - c0y) + hypotf(c1x - ccx, c1y - ccy);
     int steps = std::max(2, (int)std::ceil(lengthEstimate * 1.25f));
+    gStrokeStamps.clear();
     for (int i = 0; i <= steps; i++)
     {
         float t = (float)i / (float)steps;
         float inv = 1.0f - t;
         int x = (int)std::round(inv * inv * c0x + 2.0f * inv * t * ccx + t * t * c1x);
         int y = (int)std::round(inv * inv * c0y + 2.0f * inv * t * ccy + t * t * c1y);
-        drawStrokeCanvasPoint(fullCanvas, canvasWidth, canvasHeight,
-                              x, y, canvas);
+        DrawPoint stamp = {x, y};
+        if (acceptStrokeCanvasPoint(canvasWidth, canvasHeight, x, y, canvas))
+            gStrokeStamps.push_back(stamp);
     }
+    drawStrokeStamps(fullCanvas, canvasWidth, canvasHeight);
 }
 
-void processDrawPacket(const uint8_t *packet, size_t length, u8 *buffer, int fbWidth, int fbHeight,
-                       u8 *fullCanvas, int canvasWidth, int canvasHeight)
+static void stampDrawPacket(u8 *fullCanvas, int canvasWidth, int canvasHeight, const Doodle::BrushClip &bounds,
+                            u8 *opaque, int sizeTenths, int shape, u8 r, u8 g, u8 b, bool feather)
 {
-    if (length < 7)
-        return; // Packet too short
-
-    uint8_t r = packet[1];
-    uint8_t g = packet[2];
-    uint8_t b = packet[3];
-    int sizeTenths = packet[0] == 4 || packet[0] == 5
-                         ? packet[4]
-                         : packet[4] * 10;
-    const bool feather = packet[0] == 5;
-    uint8_t shape = packet[5];
-    uint8_t numPoints = packet[6];
-
-    if (length != static_cast<size_t>(7 + numPoints * 4))
-        return; // Invalid packet length
-
-    if (numPoints == 0)
-        return;
-
-    int prevX = *(uint16_t *)(packet + 7);
-    int prevY = *(uint16_t *)(packet + 9);
-    drawBrush(fullCanvas, canvasWidth, canvasHeight, prevX, prevY,
-              sizeTenths, shape, r, g, b, feather);
+    if (opaque)
+        Doodle::markOpaqueBrushStamps(gBrushStamps, bounds, &gStrokeStamps[0], gStrokeStamps.size(),
+                                      clampRenderedBrushSizeTenths(sizeTenths), shape, feather, opaque);
+    else
+        Doodle::drawBrushStamps(gBrushStamps, fullCanvas, canvasWidth, canvasHeight, bounds,
+                                &gStrokeStamps[0], gStrokeStamps.size(),
+                                clampRenderedBrushSizeTenths(sizeTenths), shape, r, g, b, feather);
+}
 
-    for (int i = 1; i < numPoints; i++)
+// Returns the canvas area the packet's stamps touched, clipped to the canvas
+// and, when one is given, to clip; pixels outside clip are left alone. With
+// opaque (which needs clip inside the canvas) nothing is drawn; the pixels
+// of clip the packet would cover fully are marked in it instead.
+DirtyRect processDrawPacket(const uint8_t *packet, size_t length, u8 *buffer, int fbWidth, int fbHeight,
+                            u8 *fullCanvas, int canvasWidth, int canvasHeight,
+                            const Doodle::BrushClip *clip = NULL, u8 *opaque = NULL)
+{
+    const Doodle::BrushClip bounds = clip ? *clip : Doodle::BrushClip{0, 0, canvasWidth, canvasHeight};
+    DirtyRect changed = emptyDirtyRect();
+    Doodle::DrawPacketStyle style;
+    DrawPoint points[Doodle::DRAW_PACKET_MAX_POINTS];
+    size_t numPoints = 0;
+    if (!Doodle::decodeDrawPacket(packet, length, style, points, numPoints) || numPoints == 0)
+        return changed;
+
+    const uint8_t r = style.r;
+    const uint8_t g = style.g;
+    const uint8_t b = style.b;
+    const int sizeTenths = style.sizeTenths;
+    const bool feather = style.feather;
+    const uint8_t shape = style.shape;
+
+    const int extent = brushStampExtent(sizeTenths);
+    int prevX = points[0].x;
+    int prevY = points[0].y;
+    gStrokeStamps.clear();
+    gStrokeStamps.push_back(points[0]);
+    extendDirtyRect(changed, prevX - extent, prevY - extent, prevX + extent, prevY + extent);
+
+    for (size_t i = 1; i < numPoints; i++)
     {
-        int x = *(uint16_t *)(packet + 7 + i * 4);
-        int y = *(uint16_t *)(packet + 9 + i * 4);
+        int x = points[i].x;
+        int y = points[i].y;
         const int deltaX = x - prevX;
         const int deltaY = y - prevY;
         const int steps = Doodle::brushStrokeSegmentSteps(
@@ -1178,26 +1221,48 @@ void processDrawPacket(const uint8_t *packet, size_t length, u8 *buffer, int fbW
                 prevY + (float)deltaY * step / steps);
             if (drawX == prevX && drawY == prevY)
                 continue;
-            drawBrush(fullCanvas, canvasWidth, canvasHeight, drawX, drawY,
-                      sizeTenths, shape, r, g, b, feather);
+            DrawPoint stamp = {drawX, drawY};
+            gStrokeStamps.push_back(stamp);
+            // Segments can span the whole 16-bit range; draw in bounded batches.
+            if (gStrokeStamps.size() >= 4096)
+            {
+                stampDrawPacket(fullCanvas, canvasWidth, canvasHeight, bounds, opaque,
+                                sizeTenths, shape, r, g, b, feather);
+                gStrokeStamps.clear();
+            }
         }
+        // Interpolated stamps lie on the segment, so its endpoints bound them.
+        extendDirtyRect(changed, std::min(prevX, x) - extent, std::min(prevY, y) - extent,
+                        std::max(prevX, x) + extent, std::max(prevY, y) + extent);
 
         prevX = x;
         prevY = y;
     }
+    if (!gStrokeStamps.empty())
+        stampDrawPacket(fullCanvas, canvasWidth, canvasHeight, bounds, opaque,
+                        sizeTenths, shape, r, g, b, feather);
+
+    changed.minX = std::max(std::max(0, bounds.minX), changed.minX);
+    changed.minY = std::max(std::max(0, bounds.minY), changed.minY);
+    changed.maxX = std::min(std::min(canvasWidth, bounds.maxX) - 1, changed.maxX);
+    changed.maxY = std::min(std::min(canvasHeight, bounds.maxY) - 1, changed.maxY);
+    changed.valid = changed.minX <= changed.maxX && changed.minY <= changed.maxY;
+    return changed;
 }
 
-static bool processRectPacket(const uint8_t *packet, size_t length, CanvasState &canvas)
+static bool processRectPacket(const uint8_t *packet, size_t length, CanvasState &canvas,
+                              DirtyRect &changed)
 {
+    changed = emptyDirtyRect();
     if (length < 12 || packet[0] != 2)
         return false;
 
     Color color = { packet[1], packet[2], packet[3] };
-    uint16_t x = *(uint16_t *)(packet + 4);
-    uint16_t y = *(uint16_t *)(packet + 6);
-    uint16_t w = *(uint16_t *)(packet + 8);
-    uint16_t h = *(uint16_t *)(packet + 10);
-    applyCanvasRectLocal(canvas, x, y, w, h, color);
+    uint16_t x = Doodle::readPacketU16(packet + 4);
+    uint16_t y = Doodle::readPacketU16(packet + 6);
+    uint16_t w = Doodle::readPacketU16(packet + 8);
+    uint16_t h = Doodle::readPacketU16(packet + 10);
+    changed = applyCanvasRectLocal(canvas, x, y, w, h, color);
     return true;
 }
 
@@ -1247,8 +1312,8 @@ static bool processDrawAttributionPacket(const uint8_t *packet, size_t length, A
 {
     if (!packet || length < 6 || packet[0] != 3)
         return false;
-    uint16_t x = *(uint16_t *)(packet + 1);
-    uint16_t y = *(uint16_t *)(packet + 3);
+    uint16_t x = Doodle::readPacketU16(packet + 1);
+    uint16_t y = Doodle::readPacketU16(packet + 3);
     uint8_t nameLen = packet[5];
     if (length < (size_t)(6 + nameLen))
         return false;
@@ -1261,22 +1326,23 @@ static bool processDrawAttributionPacket(const uint8_t *packet, size_t length, A
     return true;
 }
 
+// Returns true when canvas pixels changed; changed then holds their bounds.
 static bool processBinaryCanvasPackets(const uint8_t *packets, size_t length, CanvasState &canvas,
                                        u8 *fullCanvas, int canvasWidth, int canvasHeight,
-                                       ActiveDrawLabel *labels)
+                                       ActiveDrawLabel *labels, DirtyRect &changed)
 {
+    changed = emptyDirtyRect();
     if (!packets || length == 0)
         return false;
     uint8_t type = packets[0];
-    if (type == 1 || type == 4 || type == 5)
+    if (type == Doodle::DRAW_PACKET_WHOLE_SIZE || type == Doodle::DRAW_PACKET_TENTHS ||
+        type == Doodle::DRAW_PACKET_FEATHER || type == Doodle::DRAW_PACKET_DELTA)
     {
-        if (length < 7 || length != 7 + (size_t)packets[6] * 4)
-            return false;
-        processDrawPacket(packets, length, NULL, 0, 0, fullCanvas, canvasWidth, canvasHeight);
-        return true;
+        changed = processDrawPacket(packets, length, NULL, 0, 0, fullCanvas, canvasWidth, canvasHeight);
+        return changed.valid;
     }
     if (type == 2)
-        return length == 12 && processRectPacket(packets, length, canvas);
+        return length == 12 && processRectPacket(packets, length, canvas, changed) && changed.valid;
     if (type == 3)
     {
         if (length < 6 || length != 6 + (size_t)packets[5])
@@ -1316,47 +1382,198 @@ static void drawActiveDrawLabels(u8 *buffer, int fbWidth, int fbHeight, CanvasSt
         screenX = std::max(2, std::min(318 - textW, screenX));
         screenY = std::max(2, std::min(230, screenY));
         drawMiniText(buffer, fbWidth, fbHeight, screenX, screenY, labels[i].name, 13, 122, 117);
+        Renderer::invalidateViewportRect(screenX, screenY, textW, 7);
     }
 }
 
-static void sendDrawBatchCommand(const std::vector<DrawPoint> &points, const Color &color,
+static Doodle::StrokeSimplifier gStrokeSimplifier;
+static Doodle::DrawBatcher gDrawBatcher;
+// Draw packets handed to the network, shown on the Connection page of test
+// builds.
+static Doodle::SendRateCounter gDrawSendRate;
+// Draw packets not yet confirmed by the server, replayed after a reconnect
+// once the new connection's snapshot has loaded.
+static Doodle::StrokeJournal gStrokeJournal;
+static bool gStrokeReplayReady = false;
+// Tiles under journaled packets that are drawn locally but not confirmed.
+static Doodle::LocalEchoTiles gLocalEchoTiles;
+static std::vector<DirtyRect> gLocalEchoAreas;
+static Doodle::LocalEchoRestack gLocalEchoRestack;
+// Points of the batch being sent after simplification; main thread only.
+static std::vector<DrawPoint> gUplinkPoints;
+
+// Marks the tiles under a local packet's stamps as pending until sequence is
+// confirmed.
+static void markLocalEchoPending(const DrawPoint *points, size_t count, int sizeTenths, uint32_t sequence)
+{
+    const int extent = brushStampExtent(sizeTenths);
+    DirtyRect covered = emptyDirtyRect();
+    for (size_t i = 0; i < count; ++i)
+        extendDirtyRect(covered, points[i].x - extent, points[i].y - extent,
+                        points[i].x + extent, points[i].y + extent);
+    gLocalEchoTiles.markPending(covered, sequence);
+}
+
+// Packets that cannot be sent go to the stroke journal unsent. After a lost
+// connection they are replayed over the next snapshot; while connected, as
+// when the send queue is full, resendUnsentStrokes sends them once it has
+// room and later packets wait behind them to keep the server's order.
+static void sendDrawBatchCommand(const std::vector<DrawPoint> &strokePoints, const Color &color,
                                  int sizeTenths, int shape)
 {
-    if (!NetworkManager::checkConnection() || points.empty())
+    gDrawBatcher.reset();
+    if (strokePoints.empty())
         return;
+    bool online = NetworkManager::checkConnection();
+
+    Doodle::DrawPacketStyle style;
+    style.r = color.r;
+    style.g = color.g;
+    style.b = color.b;
+    style.sizeTenths = clampBrushSizeTenths(sizeTenths);
+    style.shape = (uint8_t)shape;
+    style.feather = gFeatherEnabled;
+
+    gStrokeSimplifier.simplify(&strokePoints[0], strokePoints.size(), style.sizeTenths, shape,
+                               gUplinkPoints);
+    const std::vector<DrawPoint> &points = gUplinkPoints;
 
-    const size_t maxPointsPerPacket = 64;
     size_t start = 0;
     while (start < points.size())
     {
-        size_t count = std::min(maxPointsPerPacket, points.size() - start);
-        uint8_t packet[7 + maxPointsPerPacket * 4];
-        packet[0] = gFeatherEnabled ? 5 : 4;
-        packet[1] = color.r;
-        packet[2] = color.g;
-        packet[3] = color.b;
-        packet[4] = (uint8_t)clampBrushSizeTenths(sizeTenths);
-        packet[5] = shape;
-        packet[6] = (uint8_t)count;
-
-        for (size_t i = 0; i < count; i++)
+        uint8_t packet[Doodle::DRAW_PACKET_MAX_BYTES];
+        size_t length = 0;
+        size_t count = Doodle::encodeDeltaDrawPacket(style, &points[start], points.size() - start,
+                                                     packet, sizeof(packet), length);
+        if (count == 0)
         {
-            *(uint16_t *)(packet + 7 + i * 4) = points[start + i].x;
-            *(uint16_t *)(packet + 9 + i * 4) = points[start + i].y;
+            printf("Failed to encode draw batch.\n");
+            return;
         }
-
-        if (!NetworkManager::sendBinary(packet, 7 + count * 4))
+        if (online && gStrokeJournal.unsentCount() == 0 && NetworkManager::sendBinary(packet, length))
         {
-            printf("Failed to send draw batch.\n");
-            return;
+            const uint32_t sequence = NetworkManager::lastQueuedSequence();
+            gDrawSendRate.record(length, osGetTime());
+            gStrokeJournal.record(sequence, packet, length);
+            markLocalEchoPending(&points[start], count, style.sizeTenths, sequence);
+        }
+        else
+        {
+            online = false;
+            gStrokeJournal.record(Doodle::STROKE_JOURNAL_UNSENT, packet, length);
         }
 
-        if (start + count >= points.size())
+        if (start + count >= points.size() || count < 2)
             break;
         start += count - 1; // Overlap one point so remote clients keep a continuous line.
     }
 }
 
+// Sends the journal's stale packets again, a few per frame, drawing each into
+// the canvas that just replaced the strokes. Returns the area repainted.
+static DirtyRect replayStrokeJournal(u8 *fullCanvas, int canvasWidth, int canvasHeight)
+{
+    DirtyRect replayed = emptyDirtyRect();
+    const uint8_t *stale = NULL;
+    size_t length = 0;
+    for (int sent = 0; sent < 16 && gStrokeJournal.peekStale(stale, length); ++sent)
+    {
+        uint8_t packet[Doodle::DRAW_PACKET_MAX_BYTES];
+        if (length > sizeof(packet))
+        {
+            gStrokeJournal.popStale();
+            continue;
+        }
+        memcpy(packet, stale, length);
+        if (!NetworkManager::sendBinary(packet, length))
+            break;
+        const uint32_t sequence = NetworkManager::lastQueuedSequence();
+        gStrokeJournal.popStale();
+        gStrokeJournal.record(sequence, packet, length);
+        gDrawSendRate.record(length, osGetTime());
+        DirtyRect changed = processDrawPacket(packet, length, NULL, 0, 0, fullCanvas, canvasWidth, canvasHeight);
+        if (!changed.valid)
+            continue;
+        gLocalEchoTiles.markPending(changed, sequence);
+        if (!replayed.valid)
+        {
+            replayed = changed;
+            continue;
+        }
+        replayed.minX = std::min(replayed.minX, changed.minX);
+        replayed.minY = std::min(replayed.minY, changed.minY);
+        replayed.maxX = std::max(replayed.maxX, changed.maxX);
+        replayed.maxY = std::max(replayed.maxY, changed.maxY);
+    }
+    return replayed;
+}
+
+// Sends the packets the queue refused while connected, oldest first and a
+// few per frame. They are on the canvas already, so nothing is drawn.
+static void resendUnsentStrokes()
+{
+    const uint8_t *unsent = NULL;
+    size_t length = 0;
+    for (int sent = 0; sent < 16 && gStrokeJournal.peekUnsent(unsent, length); ++sent)
+    {
+        if (!NetworkManager::sendBinary(unsent, length))
+            break;
+        const uint32_t sequence = NetworkManager::lastQueuedSequence();
+        Doodle::DrawPacketStyle style;
+        DrawPoint points[Doodle::DRAW_PACKET_MAX_POINTS];
+        size_t count = 0;
+        if (Doodle::decodeDrawPacket(unsent, length, style, points, count))
+            markLocalEchoPending(points, count, style.sizeTenths, sequence);
+        gStrokeJournal.sent(sequence);
+        gDrawSendRate.record(length, osGetTime());
+    }
+}
+
+// Draws pending local packets again where a remote packet, drawn over the
+// parts of the canvas on their tiles, overwrote them outright. The server had
+// the remote packet before ours, so ours belong on top. Pixels the remote
+// packet blended or missed keep what they had (see LocalEchoRestack).
+static void restackLocalEcho(const uint8_t *remotePacket, size_t remoteLength, const DirtyRect &remoteChange,
+                             u8 *fullCanvas, int canvasWidth, int canvasHeight)
+{
+    if (gLocalEchoTiles.pendingAreas(remoteChange, gLocalEchoAreas) == 0)
+        return;
+    const uint32_t acknowledged = gLocalEchoTiles.acknowledged();
+    for (size_t i = 0; i < gLocalEchoAreas.size(); ++i)
+    {
+        const DirtyRect &area = gLocalEchoAreas[i];
+        const Doodle::BrushClip clip = {area.minX, area.minY, area.maxX + 1, area.maxY + 1};
+        gLocalEchoRestack.begin(fullCanvas, canvasWidth, area);
+        // Rectangle fills are opaque throughout.
+        if (remotePacket[0] == 2)
+            gLocalEchoRestack.coverAll();
+        else
+            processDrawPacket(remotePacket, remoteLength, NULL, 0, 0, fullCanvas, canvasWidth, canvasHeight,
+                              &clip, gLocalEchoRestack.opaque());
+        if (!gLocalEchoRestack.anyOpaque())
+            continue;
+        // Stale packets are not on this canvas until they are replayed.
+        size_t skip = gStrokeJournal.staleCount();
+        size_t cursor = 0;
+        uint32_t sequence = 0;
+        const uint8_t *packet = NULL;
+        size_t length = 0;
+        while (gStrokeJournal.next(cursor, sequence, packet, length))
+        {
+            if (skip > 0)
+            {
+                --skip;
+                continue;
+            }
+            // Unsent packets will reach the server after this one as well.
+            if (sequence != Doodle::STROKE_JOURNAL_UNSENT && sequence <= acknowledged)
+                continue;
+            processDrawPacket(packet, length, NULL, 0, 0, fullCanvas, canvasWidth, canvasHeight, &clip);
+        }
+        gLocalEchoRestack.finish(fullCanvas, canvasWidth);
+    }
+}
+
 static void drawColorSquare(u8 *framebuffer, int fbWidth, int fbHeight, int x, int y, int w, int h,
                             float hue, float saturation, float value)
 {
@@ -2200,6 +2417,12 @@ int main(int argc, char **argv)
     printf("Identity: %s\n", gIdentity.deviceId);
     printf("Hardware: %s\n", gHardwareId);
     printf("Identity boot: %s\n", gIdentityBootStatus);
+    // Strokes still unconfirmed when the app last closed; they are replayed
+    // once that channel's snapshot loads, and saved again on exit if needed.
+    if (gStrokeJournal.load(STROKE_JOURNAL_PATH))
+        printf("Stroke journal: %u packets for %s\n", (unsigned)gStrokeJournal.count(),
+               gStrokeJournal.channel().c_str());
+    remove(STROKE_JOURNAL_PATH);
 
     if (!NetworkManager::initialize())
     {
@@ -2233,6 +2456,7 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    printf("Connected: %s\n", NetworkManager::lastError());
     if (!sendClientHello(packageType))
     {
         failExit("Failed to send client hello.");
@@ -2701,7 +2925,11 @@ int main(int argc, char **argv)
         char parsedSupportReason[81] = "";
         char parsedBlockTypes[24] = "";
         int parsedRestrictionSeconds = 0;
-        if (Protocol::parseSupportOnly(jsonLine, parsedSupportReason, sizeof(parsedSupportReason), parsedBlockTypes, sizeof(parsedBlockTypes), parsedRestrictionSeconds))
+        const Doodle::ControlMessageType messageType = Doodle::controlMessageType(jsonLine);
+        if (messageType == Doodle::CONTROL_MESSAGE_UNKNOWN)
+            return false;
+        if (messageType == Doodle::CONTROL_MESSAGE_SUPPORT_ONLY &&
+            Protocol::parseSupportOnly(jsonLine, parsedSupportReason, sizeof(parsedSupportReason), parsedBlockTypes, sizeof(parsedBlockTypes), parsedRestrictionSeconds))
         {
             supportOnlyMode = true;
             snprintf(supportOnlyReasonText, sizeof(supportOnlyReasonText), "%s", parsedSupportReason[0] ? parsedSupportReason : "Access restricted");
@@ -2720,7 +2948,8 @@ int main(int argc, char **argv)
         int parsedMineOpen = 0;
         int parsedStaffNeedsReply = 0;
         int parsedStaffChatUnread = 0;
-        if (Protocol::parseTicketCounts(jsonLine, parsedMineOpen, parsedStaffNeedsReply, parsedStaffChatUnread))
+        if (messageType == Doodle::CONTROL_MESSAGE_TICKET_COUNTS &&
+            Protocol::parseTicketCounts(jsonLine, parsedMineOpen, parsedStaffNeedsReply, parsedStaffChatUnread))
         {
             ticketMineOpen = parsedMineOpen;
             ticketStaffNeedsReply = parsedStaffNeedsReply;
@@ -2729,14 +2958,16 @@ int main(int argc, char **argv)
             return true;
         }
         int expectedStaffMessages = 0;
-        if (Protocol::parseStaffChatStart(jsonLine, expectedStaffMessages))
+        if (messageType == Doodle::CONTROL_MESSAGE_STAFF_CHAT_START &&
+            Protocol::parseStaffChatStart(jsonLine, expectedStaffMessages))
         {
             (void)expectedStaffMessages;
             staffChatMessageCount = 0;
             return true;
         }
         StaffChatMessage parsedStaffMessage;
-        if (Protocol::parseStaffChatMessage(jsonLine, parsedStaffMessage))
+        if (messageType == Doodle::CONTROL_MESSAGE_STAFF_CHAT_MESSAGE &&
+            Protocol::parseStaffChatMessage(jsonLine, parsedStaffMessage))
         {
             bool duplicate = false;
             for (int i = 0; i < staffChatMessageCount; i++) duplicate = duplicate || staffChatMessages[i].id == parsedStaffMessage.id;
@@ -2759,7 +2990,8 @@ int main(int argc, char **argv)
             return true;
         }
         int parsedStaffNextBeforeId = 0;
-        if (Protocol::parseStaffChatEnd(jsonLine, parsedStaffNextBeforeId))
+        if (messageType == Doodle::CONTROL_MESSAGE_STAFF_CHAT_END &&
+            Protocol::parseStaffChatEnd(jsonLine, parsedStaffNextBeforeId))
         {
             staffChatNextBeforeId = parsedStaffNextBeforeId;
             ticketView = 4;
@@ -2769,14 +3001,16 @@ int main(int argc, char **argv)
         }
         bool staffChatOk = false;
         char staffChatError[48] = "";
-        if (Protocol::parseStaffChatResult(jsonLine, staffChatOk, staffChatError, sizeof(staffChatError)))
+        if (messageType == Doodle::CONTROL_MESSAGE_STAFF_CHAT_RESULT &&
+            Protocol::parseStaffChatResult(jsonLine, staffChatOk, staffChatError, sizeof(staffChatError)))
         {
             setTicketNotice(staffChatOk ? "STAFF MESSAGE SENT" : (staffChatError[0] ? staffChatError : "STAFF CHAT FAILED"));
             return true;
         }
         char listScope[12] = "";
         int expectedTicketCount = 0;
-        if (Protocol::parseTicketListStart(jsonLine, listScope, sizeof(listScope), expectedTicketCount))
+        if (messageType == Doodle::CONTROL_MESSAGE_TICKET_LIST_START &&
+            Protocol::parseTicketListStart(jsonLine, listScope, sizeof(listScope), expectedTicketCount))
         {
             (void)expectedTicketCount;
             ticketListCount = 0;
@@ -2785,15 +3019,18 @@ int main(int argc, char **argv)
             return true;
         }
         SupportTicketSummary parsedTicket;
-        if (Protocol::parseTicketSummary(jsonLine, parsedTicket))
+        if ((messageType == Doodle::CONTROL_MESSAGE_TICKET_SUMMARY ||
+             messageType == Doodle::CONTROL_MESSAGE_TICKET_THREAD_START ||
+             messageType == Doodle::CONTROL_MESSAGE_TICKET_UPDATED) &&
+            Protocol::parseTicketSummary(jsonLine, parsedTicket))
         {
-            if (strstr(jsonLine, "\"type\":\"ticketThreadStart\""))
+            if (messageType == Doodle::CONTROL_MESSAGE_TICKET_THREAD_START)
             {
                 activeTicket = parsedTicket;
                 ticketMessageCount = 0;
                 ticketView = 2;
             }
-            else if (strstr(jsonLine, "\"type\":\"ticketSummary\""))
+            else if (messageType == Doodle::CONTROL_MESSAGE_TICKET_SUMMARY)
             {
                 if (ticketListCount < 6)
                     ticketList[ticketListCount++] = parsedTicket;
@@ -2810,7 +3047,8 @@ int main(int argc, char **argv)
             return true;
         }
         SupportTicketMessage parsedMessage;
-        if (Protocol::parseTicketMessage(jsonLine, parsedMessage))
+        if (messageType == Doodle::CONTROL_MESSAGE_TICKET_MESSAGE &&
+            Protocol::parseTicketMessage(jsonLine, parsedMessage))
         {
             if (ticketMessageCount < 6)
                 ticketMessages[ticketMessageCount++] = parsedMessage;
@@ -2819,7 +3057,8 @@ int main(int argc, char **argv)
         }
         TicketCursor parsedNextCursor;
         memset(&parsedNextCursor, 0, sizeof(parsedNextCursor));
-        if (Protocol::parseTicketListEnd(jsonLine, parsedNextCursor))
+        if (messageType == Doodle::CONTROL_MESSAGE_TICKET_LIST_END &&
+            Protocol::parseTicketListEnd(jsonLine, parsedNextCursor))
         {
             ticketNextCursor = parsedNextCursor;
             if (ticketListLoading)
@@ -2838,7 +3077,8 @@ int main(int argc, char **argv)
         }
         int parsedThreadId = 0;
         int parsedNextMessage = 0;
-        if (Protocol::parseTicketThreadEnd(jsonLine, parsedThreadId, parsedNextMessage))
+        if (messageType == Doodle::CONTROL_MESSAGE_TICKET_THREAD_END &&
+            Protocol::parseTicketThreadEnd(jsonLine, parsedThreadId, parsedNextMessage))
         {
             (void)parsedThreadId;
             ticketNextBeforeMessageId = parsedNextMessage;
@@ -2851,7 +3091,8 @@ int main(int argc, char **argv)
         char ticketAction[24] = "";
         char ticketError[48] = "";
         int resultTicketId = 0;
-        if (Protocol::parseTicketResult(jsonLine, ticketOk, ticketAction, sizeof(ticketAction), ticketError, sizeof(ticketError), resultTicketId))
+        if (messageType == Doodle::CONTROL_MESSAGE_TICKET_RESULT &&
+            Protocol::parseTicketResult(jsonLine, ticketOk, ticketAction, sizeof(ticketAction), ticketError, sizeof(ticketError), resultTicketId))
         {
             if (ticketOk)
             {
@@ -2897,7 +3138,7 @@ int main(int argc, char **argv)
             }
             return true;
         }
-        if (strstr(jsonLine, "\"type\":\"accessRestored\""))
+        if (messageType == Doodle::CONTROL_MESSAGE_ACCESS_RESTORED)
         {
             supportOnlyMode = false;
             snprintf(gDisconnectReason, sizeof(gDisconnectReason), "ACCESS RESTORED - PRESS A");
@@ -2905,7 +3146,7 @@ int main(int argc, char **argv)
             setTicketNotice("ACCESS RESTORED");
             return true;
         }
-        if (pendingChannelSwitch[0] && strstr(jsonLine, "\"type\":\"error\""))
+        if (pendingChannelSwitch[0] && messageType == Doodle::CONTROL_MESSAGE_ERROR)
         {
             pendingChannelSwitch[0] = '\0';
             pendingChannelSwitchDeadline = 0;
@@ -2915,13 +3156,14 @@ int main(int argc, char **argv)
             topRenderFrame = 10;
             return true;
         }
-        if (ticketListLoading && strstr(jsonLine, "\"type\":\"error\""))
+        if (ticketListLoading && messageType == Doodle::CONTROL_MESSAGE_ERROR)
         {
             ticketListLoading = false;
             setTicketNotice("TICKET PAGE LOAD FAILED");
             return true;
         }
-        if (Protocol::parseChannels(jsonLine, availableChannels, availableChannelInfo,
+        if (messageType == Doodle::CONTROL_MESSAGE_CHANNELS &&
+            Protocol::parseChannels(jsonLine, availableChannels, availableChannelInfo,
                                     8, availableChannelCount, currentChannel))
         {
             if (currentChannel[0])
@@ -2930,7 +3172,8 @@ int main(int argc, char **argv)
             topRenderFrame = 10;
             return true;
         }
-        if (Protocol::parsePresence(jsonLine, connectedUsers, 24, connectedUserCount,
+        if (messageType == Doodle::CONTROL_MESSAGE_PRESENCE &&
+            Protocol::parsePresence(jsonLine, connectedUsers, 24, connectedUserCount,
                                     connectedPresenceInfo))
         {
             topRenderFrame = 10;
@@ -2939,7 +3182,8 @@ int main(int argc, char **argv)
         bool authoritativeNeedsDisplayName = false;
         bool authoritativeNeedsRules = false;
         char authoritativeRulesVersion[32] = "";
-        if (Protocol::parseOnboardingState(jsonLine, authoritativeNeedsDisplayName, authoritativeNeedsRules,
+        if (messageType == Doodle::CONTROL_MESSAGE_ONBOARDING_STATE &&
+            Protocol::parseOnboardingState(jsonLine, authoritativeNeedsDisplayName, authoritativeNeedsRules,
                                            authoritativeRulesVersion, sizeof(authoritativeRulesVersion)))
         {
             OnboardingStage previousStage = onboardingStage;
@@ -3030,7 +3274,8 @@ int main(int argc, char **argv)
             topRenderFrame = 10;
             return true;
         }
-        if (Protocol::parseIdentityAccepted(jsonLine, identityInfo))
+        if (messageType == Doodle::CONTROL_MESSAGE_IDENTITY_ACCEPTED &&
+            Protocol::parseIdentityAccepted(jsonLine, identityInfo))
         {
             applyIdentityAccepted(identityInfo);
             if (strcmp(identityInfo.status, "muted") == 0 || strcmp(identityInfo.status, "banned") == 0)
@@ -3060,7 +3305,7 @@ int main(int argc, char **argv)
             setIdentityNotice("ACCOUNT OK");
             return true;
         }
-        if (strstr(jsonLine, "\"type\":\"identityNeedsDisplayName\""))
+        if (messageType == Doodle::CONTROL_MESSAGE_IDENTITY_NEEDS_DISPLAY_NAME)
         {
             gNeedsDisplayName = true;
             if (onboardingStage != ONBOARDING_SUBMITTING_DISPLAY_NAME)
@@ -3069,7 +3314,8 @@ int main(int argc, char **argv)
             setIdentityNotice("CHOOSE A NAME");
             return true;
         }
-        if (Protocol::parseDisplayNameRejected(jsonLine, rejectionReason, sizeof(rejectionReason)))
+        if (messageType == Doodle::CONTROL_MESSAGE_DISPLAY_NAME_REJECTED &&
+            Protocol::parseDisplayNameRejected(jsonLine, rejectionReason, sizeof(rejectionReason)))
         {
             gNeedsDisplayName = true;
             onboardingStage = ONBOARDING_WAITING_DISPLAY_NAME;
@@ -3083,7 +3329,7 @@ int main(int argc, char **argv)
                 setIdentityNotice("NAME REJECTED");
             return true;
         }
-        if (strstr(jsonLine, "\"type\":\"displayNameChanged\""))
+        if (messageType == Doodle::CONTROL_MESSAGE_DISPLAY_NAME_CHANGED)
         {
             gNeedsDisplayName = false;
             onboardingStage = gNeedsRules ? ONBOARDING_WAITING_RULES : ONBOARDING_READY;
@@ -3093,7 +3339,8 @@ int main(int argc, char **argv)
         }
         char rulesRejectedReason[48] = "";
         char rejectedRulesVersion[32] = "";
-        if (Protocol::parseRulesRejected(jsonLine, rulesRejectedReason, sizeof(rulesRejectedReason),
+        if (messageType == Doodle::CONTROL_MESSAGE_RULES_REJECTED &&
+            Protocol::parseRulesRejected(jsonLine, rulesRejectedReason, sizeof(rulesRejectedReason),
                                          rejectedRulesVersion, sizeof(rejectedRulesVersion)))
         {
             if (rejectedRulesVersion[0])
@@ -3113,7 +3360,8 @@ int main(int argc, char **argv)
                 setIdentityNotice("RULES NOT ACCEPTED - PRESS A TO RETRY");
             return true;
         }
-        if (Protocol::parseRulesRequired(jsonLine, gateVersion, sizeof(gateVersion)))
+        if (messageType == Doodle::CONTROL_MESSAGE_RULES_REQUIRED &&
+            Protocol::parseRulesRequired(jsonLine, gateVersion, sizeof(gateVersion)))
         {
             snprintf(gRequiredRulesVersion, sizeof(gRequiredRulesVersion), "%s", gateVersion[0] ? gateVersion : "1");
             gNeedsRules = true;
@@ -3123,7 +3371,7 @@ int main(int argc, char **argv)
             topRenderFrame = 10;
             return true;
         }
-        if (strstr(jsonLine, "\"type\":\"rulesAccepted\""))
+        if (messageType == Doodle::CONTROL_MESSAGE_RULES_ACCEPTED)
         {
             if (Protocol::parseRulesRequired(jsonLine, gateVersion, sizeof(gateVersion)) && gateVersion[0])
                 snprintf(gRequiredRulesVersion, sizeof(gRequiredRulesVersion), "%s", gateVersion);
@@ -3140,7 +3388,8 @@ int main(int argc, char **argv)
         }
         char mutedReason[81] = "";
         int mutedSeconds = 0;
-        if (Protocol::parseMuted(jsonLine, mutedReason, sizeof(mutedReason), mutedSeconds))
+        if (messageType == Doodle::CONTROL_MESSAGE_MUTED &&
+            Protocol::parseMuted(jsonLine, mutedReason, sizeof(mutedReason), mutedSeconds))
         {
             restrictionActive = true;
             restrictionHasDuration = mutedSeconds > 0;
@@ -3151,20 +3400,25 @@ int main(int argc, char **argv)
             topRenderFrame = 10;
             return true;
         }
-        if (Protocol::parseDisconnected(jsonLine, disconnectReason, sizeof(disconnectReason)))
+        if ((messageType == Doodle::CONTROL_MESSAGE_DISCONNECTED ||
+             messageType == Doodle::CONTROL_MESSAGE_BANNED ||
+             messageType == Doodle::CONTROL_MESSAGE_SERVER_RESTARTING) &&
+            Protocol::parseDisconnected(jsonLine, disconnectReason, sizeof(disconnectReason)))
         {
             snprintf(gDisconnectReason, sizeof(gDisconnectReason), "%s", disconnectReason);
             setAdminNotice(gDisconnectReason);
             topMode = TOP_MODE_STATUS;
             return true;
         }
-        if (Protocol::parseIdentityBackupCode(jsonLine, identityInfo))
+        if (messageType == Doodle::CONTROL_MESSAGE_IDENTITY_BACKUP_CODE &&
+            Protocol::parseIdentityBackupCode(jsonLine, identityInfo))
         {
             applyBackupCode(identityInfo);
             setIdentityNotice("BACKUP SAVED");
             return true;
         }
-        if (Protocol::parseRecoveryFailed(jsonLine, recoveryReason, sizeof(recoveryReason)))
+        if (messageType == Doodle::CONTROL_MESSAGE_RECOVERY_FAILED &&
+            Protocol::parseRecoveryFailed(jsonLine, recoveryReason, sizeof(recoveryReason)))
         {
             if (strcmp(recoveryReason, "recovery-device-in-use") == 0)
                 setIdentityNotice("DEVICE ALREADY HAS AN ACCOUNT");
@@ -3173,16 +3427,16 @@ int main(int argc, char **argv)
             printf("Recovery failed: %s\n", recoveryReason);
             return true;
         }
-        if (strstr(jsonLine, "\"type\":\"adminCanvasResult\""))
+        if (messageType == Doodle::CONTROL_MESSAGE_ADMIN_CANVAS_RESULT)
         {
             if (strstr(jsonLine, "\"ok\":true"))
             {
                 if (pendingAdminLocalApply)
                 {
-                    applyCanvasRectLocal(canvas, pendingAdminApplyX, pendingAdminApplyY,
-                                         pendingAdminApplyW, pendingAdminApplyH,
-                                         pendingAdminApplyColor);
-                    Renderer::invalidateMinimap();
+                    Renderer::invalidateMinimapRect(
+                        applyCanvasRectLocal(canvas, pendingAdminApplyX, pendingAdminApplyY,
+                                             pendingAdminApplyW, pendingAdminApplyH,
+                                             pendingAdminApplyColor));
                 }
                 if (strcmp(pendingAdminAction, "snapshot") == 0)
                     setAdminNotice("SNAPSHOT SAVED");
@@ -3206,7 +3460,8 @@ int main(int argc, char **argv)
             return true;
         }
         ModerationResult moderationResult;
-        if (Protocol::parseModerationResult(jsonLine, moderationResult))
+        if (messageType == Doodle::CONTROL_MESSAGE_MODERATION_RESULT &&
+            Protocol::parseModerationResult(jsonLine, moderationResult))
         {
             if (moderationResult.ok)
             {
@@ -3228,7 +3483,8 @@ int main(int argc, char **argv)
         CanvasMeta meta;
         bool receivedMeta = false;
         bool initialHelloSent = true;
-        std::vector<uint8_t> initialCanvas;
+        bool initialCanvasLoaded = false;
+        size_t initialCanvasReceived = 0;
         u64 initialDeadline = osGetTime() + 30000;
         NetworkEvent event;
         while (osGetTime() < initialDeadline)
@@ -3240,7 +3496,8 @@ int main(int argc, char **argv)
                 printf("Initial connection failed: %s\n", event.detail.c_str());
                 receivedMeta = false;
                 initialHelloSent = false;
-                initialCanvas.clear();
+                initialCanvasReceived = 0;
+                canvas.cancelCompressedLoad();
                 continue;
             }
             if (event.type == NETWORK_EVENT_CONNECTED)
@@ -3253,11 +3510,17 @@ int main(int argc, char **argv)
                 }
                 continue;
             }
-            if (event.type == NETWORK_EVENT_BINARY)
+            if (event.type == NETWORK_EVENT_BINARY || event.type == NETWORK_EVENT_BINARY_PART)
             {
                 if (receivedMeta)
                 {
-                    initialCanvas = std::move(event.payload);
+                    DirtyRect rowsWritten;
+                    const bool appended = appendCanvasSnapshotPiece(canvas, meta, event,
+                                                                    initialCanvasReceived, rowsWritten);
+                    if (appended && !isLastCanvasSnapshotPiece(event))
+                        continue;
+                    initialCanvasLoaded = appended &&
+                        finishCanvasSnapshot(canvas, meta, initialCanvasReceived);
                     break;
                 }
                 continue;
@@ -3265,10 +3528,10 @@ int main(int argc, char **argv)
             if (event.type != NETWORK_EVENT_TEXT || event.payload.size() >= CONTROL_LINE_CAPACITY)
                 continue;
 
-            std::string line(event.payload.begin(), event.payload.end());
+            const char *line = event.payload.c_str();
             char latestVersion[32] = "";
             char updateReason[48] = "";
-            if (Protocol::parseUpdateRequired(line.c_str(), latestVersion, sizeof(latestVersion), updateReason, sizeof(updateReason)))
+            if (Protocol::parseUpdateRequired(line, latestVersion, sizeof(latestVersion), updateReason, sizeof(updateReason)))
             {
                 printf("Update required: %s Latest: %s\n", updateReason, latestVersion);
 #if !UPDATER_ENABLED
@@ -3286,14 +3549,14 @@ int main(int argc, char **argv)
 #endif
             }
 
-            if (handleJsonControl(line.c_str()))
+            if (handleJsonControl(line))
             {
                 if (supportOnlyMode)
                     break;
                 continue;
             }
 
-            if (Protocol::parseCanvasMeta(line.c_str(), meta))
+            if (Protocol::parseCanvasMeta(line, meta))
             {
                 if (!isValidCanvasMeta(meta))
                 {
@@ -3328,20 +3591,21 @@ int main(int argc, char **argv)
             canvas.setChannel(meta.channel);
             printf("Received canvas dimensions: W=%d, H=%d, Compressed Size=%d\n", canvasWidth, canvasHeight, meta.compressedSize);
 
-            if (initialCanvas.size() == (size_t)meta.compressedSize)
+            if (initialCanvasLoaded)
             {
-                if (canvas.allocate(canvasWidth, canvasHeight) && canvas.loadFromCompressed(initialCanvas.data(), initialCanvas.size()))
-                {
-                    fullCanvas = canvas.pixels;
-                    Renderer::invalidateMinimap();
-                    rememberSuccessfulChannel(canvas.channel);
-                    printf("Canvas decompressed successfully (%dx%d, capacity %d bytes).\n",
-                           canvas.width, canvas.height, canvas.capacity);
-                }
-                else
-                {
-                    printf("Failed to decompress canvas data.\n");
-                }
+                fullCanvas = canvas.pixels;
+                canvas.markFullDirty();
+                Renderer::invalidateMinimap();
+                rememberSuccessfulChannel(canvas.channel);
+                gStrokeJournal.setChannel(canvas.channel);
+                gStrokeReplayReady = true;
+                gLocalEchoTiles.reset(canvas.width, canvas.height);
+                printf("Canvas decompressed successfully (%dx%d, capacity %d bytes).\n",
+                       canvas.width, canvas.height, canvas.capacity);
+            }
+            else if (initialCanvasReceived == (size_t)meta.compressedSize)
+            {
+                printf("Failed to decompress canvas data.\n");
             }
             else
             {
@@ -3358,6 +3622,7 @@ int main(int argc, char **argv)
             canvas.allocate(canvasWidth, canvasHeight);
             canvas.setChannel("main");
             fullCanvas = canvas.pixels;
+            Renderer::invalidateMinimap();
             if (!gDisconnectReason[0])
                 snprintf(gDisconnectReason, sizeof(gDisconnectReason), "SYNC FAILED - RETRYING");
             topMode = TOP_MODE_STATUS;
@@ -3377,6 +3642,8 @@ int main(int argc, char **argv)
     CanvasMeta realtimeCanvasMeta;
     memset(&realtimeCanvasMeta, 0, sizeof(realtimeCanvasMeta));
     bool realtimeCanvasPending = false;
+    bool realtimeCanvasResetViewport = false;
+    size_t realtimeCanvasReceived = 0;
     bool sessionAwaitingSnapshot = false;
     u64 sessionSnapshotDeadline = 0;
     int circleNavRepeatFrames = 0;
@@ -3396,6 +3663,7 @@ int main(int argc, char **argv)
         bool wasSupportOnly = supportOnlyMode;
         supportOnlyMode = false;
         realtimeCanvasPending = false;
+        canvas.cancelCompressedLoad();
         sessionAwaitingSnapshot = false;
         sessionSnapshotDeadline = 0;
         ticketListLoading = false;
@@ -5276,7 +5544,6 @@ int main(int argc, char **argv)
                 canvas.offsetX = offsetX;
                 canvas.offsetY = offsetY;
                 canvas.markFullDirty();
-                Renderer::invalidateMinimap();
                 topRenderFrame = 10;
                 prevTouchX = prevTouchY = -1;
                 prevPrevTouchX = prevPrevTouchY = -1;
@@ -5424,7 +5691,6 @@ int main(int argc, char **argv)
                 offsetX = canvas.offsetX;
                 offsetY = canvas.offsetY;
                 canvas.markFullDirty();
-                Renderer::invalidateMinimap();
                 topRenderFrame = 10;
                 prevTouchX = prevTouchY = -1;
                 prevPrevTouchX = prevPrevTouchY = -1;
@@ -5819,6 +6085,9 @@ int main(int argc, char **argv)
                     {
                         if (!NetworkManager::checkConnection())
                         {
+                            // Journaled for replay once reconnected.
+                            sendDrawBatchCommand(UIState::getPoints(), gRainbowStrokeColor,
+                                                 currentBrushSizeTenths, effectiveBrushShape());
                             reconnectSession("draw-reconnect");
                             UIState::clearPoints();
                             gRainbowStrokeColorValid = false;
@@ -5872,10 +6141,12 @@ int main(int argc, char **argv)
                         lastStrokeY = endY;
                     }
 
-                    if (UIState::getPoints().size() >= 32)
+                    if (gDrawBatcher.due(UIState::getPoints(), osGetTime()))
                     {
                         if (!NetworkManager::checkConnection()) {
                             printf("Connection lost while drawing! Attempting to reconnect...\n");
+                            sendDrawBatchCommand(UIState::getPoints(), effectiveDrawColor(),
+                                                 currentBrushSizeTenths, effectiveBrushShape());
                             reconnectSession("draw-reconnect");
                             UIState::clearPoints();
                             continue;
@@ -5907,6 +6178,8 @@ int main(int argc, char **argv)
                 {
                     if (!NetworkManager::checkConnection()) {
                         printf("Connection lost while drawing! Attempting to reconnect...\n");
+                        sendDrawBatchCommand(UIState::getPoints(), effectiveDrawColor(),
+                                             currentBrushSizeTenths, effectiveBrushShape());
                         reconnectSession("draw-reconnect");
                         UIState::clearPoints();
                         continue;
@@ -5924,10 +6197,11 @@ int main(int argc, char **argv)
             }
         }
 
-        // WebSocket messages are already framed and copied out of the network
-        // worker. Keep a per-frame event budget so drawing/rendering cannot be
-        // starved by a busy connection; a canvas snapshot is allowed through as
-        // one large event.
+        // WebSocket messages arrive framed, in pooled buffers handed over by
+        // the network worker; text is parsed in place. Keep a per-frame event
+        // budget so drawing/rendering cannot be starved by a busy connection;
+        // a large canvas snapshot arrives as stream pieces, inflated one per
+        // frame when they back up.
         NetworkEvent networkEvent;
         size_t networkBytesThisFrame = 0;
         int networkEventsThisFrame = 0;
@@ -5940,7 +6214,12 @@ int main(int argc, char **argv)
 
             if (networkEvent.type == NETWORK_EVENT_CONNECTED)
             {
+                // Whatever the last connection left unconfirmed waits for
+                // this one's snapshot.
+                gStrokeJournal.markStale();
+                gStrokeReplayReady = false;
                 realtimeCanvasPending = false;
+                canvas.cancelCompressedLoad();
                 sessionAwaitingSnapshot = sendClientHello(packageType);
                 sessionSnapshotDeadline = sessionAwaitingSnapshot ? osGetTime() + 30000 : 0;
                 if (!sessionAwaitingSnapshot)
@@ -5962,8 +6241,11 @@ int main(int argc, char **argv)
             if (networkEvent.type == NETWORK_EVENT_DISCONNECTED || networkEvent.type == NETWORK_EVENT_ERROR)
             {
                 realtimeCanvasPending = false;
+                canvas.cancelCompressedLoad();
                 sessionAwaitingSnapshot = false;
                 sessionSnapshotDeadline = 0;
+                sendDrawBatchCommand(UIState::getPoints(), effectiveDrawColor(),
+                                     currentBrushSizeTenths, effectiveBrushShape());
                 UIState::clearPoints();
                 snprintf(gDisconnectReason, sizeof(gDisconnectReason), "%s",
                          networkEvent.type == NETWORK_EVENT_ERROR ? "NETWORK ERROR - RETRYING" : "CONNECTION LOST - RETRYING");
@@ -5983,9 +6265,9 @@ int main(int argc, char **argv)
                     topRenderFrame = 10;
                     continue;
                 }
-                std::string line(networkEvent.payload.begin(), networkEvent.payload.end());
+                const char *line = networkEvent.payload.c_str();
                 CanvasMeta meta;
-                if (Protocol::parseCanvasMeta(line.c_str(), meta))
+                if (Protocol::parseCanvasMeta(line, meta))
                 {
                     if (!isValidCanvasMeta(meta))
                     {
@@ -6012,14 +6294,14 @@ int main(int argc, char **argv)
 
                 char latestVersion[32] = "";
                 char updateReason[48] = "";
-                if (Protocol::parseUpdateRequired(line.c_str(), latestVersion, sizeof(latestVersion),
+                if (Protocol::parseUpdateRequired(line, latestVersion, sizeof(latestVersion),
                                                   updateReason, sizeof(updateReason)))
                 {
                     updateAvailable = true;
                     setAdminNotice("UPDATE AVAILABLE");
                     continue;
                 }
-                handleJsonControl(line.c_str());
+                handleJsonControl(line);
                 // Support-only sessions intentionally have no drawing canvas.
                 // Receiving that gate completes their reconnect handshake.
                 if (supportOnlyMode)
@@ -6031,32 +6313,43 @@ int main(int argc, char **argv)
                 continue;
             }
 
-            if (networkEvent.type == NETWORK_EVENT_BINARY)
+            if (networkEvent.type == NETWORK_EVENT_BINARY || networkEvent.type == NETWORK_EVENT_BINARY_PART)
             {
                 if (realtimeCanvasPending)
                 {
-                    size_t expectedSize = (size_t)realtimeCanvasMeta.compressedSize;
-                    bool loaded = networkEvent.payload.size() == expectedSize;
-                    const bool resetViewport = Doodle::shouldResetCanvasViewport(
-                        canvas.channel, realtimeCanvasMeta.channel);
-                    if (loaded)
+                    const bool firstPiece = networkEvent.type == NETWORK_EVENT_BINARY ||
+                                            networkEvent.partOffset == 0;
+                    if (firstPiece)
+                        realtimeCanvasResetViewport = Doodle::shouldResetCanvasViewport(
+                            canvas.channel, realtimeCanvasMeta.channel);
+                    DirtyRect rowsWritten;
+                    bool loaded = appendCanvasSnapshotPiece(canvas, realtimeCanvasMeta, networkEvent,
+                                                            realtimeCanvasReceived, rowsWritten);
+                    if (firstPiece)
                     {
-                        canvasWidth = realtimeCanvasMeta.width;
-                        canvasHeight = realtimeCanvasMeta.height;
-                        canvas.setChannel(realtimeCanvasMeta.channel);
-                        loaded = canvas.allocate(canvasWidth, canvasHeight) &&
-                                 canvas.loadFromCompressed(networkEvent.payload.data(), networkEvent.payload.size());
+                        // allocate may have moved the pixels; the rows below
+                        // show up on the bottom screen while the rest streams.
+                        canvasWidth = canvas.width;
+                        canvasHeight = canvas.height;
+                        fullCanvas = canvas.pixels;
+                        Renderer::invalidateMinimap();
+                        if (realtimeCanvasResetViewport)
+                            offsetX = offsetY = 0;
+                        clampOffsets(offsetX, offsetY);
                     }
+                    if (loaded)
+                        Renderer::invalidateMinimapRect(rowsWritten);
+                    if (loaded && !isLastCanvasSnapshotPiece(networkEvent))
+                        continue;
+                    loaded = loaded && finishCanvasSnapshot(canvas, realtimeCanvasMeta, realtimeCanvasReceived);
                     realtimeCanvasPending = false;
                     if (loaded)
                     {
-                        fullCanvas = canvas.pixels;
-                        if (resetViewport)
-                            offsetX = offsetY = 0;
-                        clampOffsets(offsetX, offsetY);
                         canvas.markFullDirty();
-                        Renderer::invalidateMinimap();
                         syncSelectedChannel();
+                        gStrokeJournal.setChannel(canvas.channel);
+                        gStrokeReplayReady = true;
+                        gLocalEchoTiles.reset(canvas.width, canvas.height);
                         sessionAwaitingSnapshot = false;
                         sessionSnapshotDeadline = 0;
                         gDisconnectReason[0] = '\0';
@@ -6095,22 +6388,47 @@ int main(int argc, char **argv)
                     continue;
                 }
 
+                // No draw batch comes close to a stream piece; a stray
+                // piece is the tail of a snapshot that already failed.
+                if (networkEvent.type == NETWORK_EVENT_BINARY_PART)
+                    continue;
+                DirtyRect remoteChange;
                 if (!networkEvent.payload.empty() &&
                     processBinaryCanvasPackets(networkEvent.payload.data(), networkEvent.payload.size(), canvas,
-                                               fullCanvas, canvasWidth, canvasHeight, activeDrawLabels))
+                                               fullCanvas, canvasWidth, canvasHeight, activeDrawLabels,
+                                               remoteChange))
                 {
-                    canvas.markFullDirty();
-                    Renderer::invalidateMinimap();
+                    restackLocalEcho(networkEvent.payload.data(), networkEvent.payload.size(), remoteChange,
+                                     fullCanvas, canvasWidth, canvasHeight);
+                    canvas.markDirtyRect(remoteChange);
+                    Renderer::invalidateMinimapRect(remoteChange);
                 }
             }
         }
 
+        gStrokeJournal.acknowledge(NetworkManager::acknowledgedSequence());
+        gLocalEchoTiles.acknowledge(NetworkManager::acknowledgedSequence());
+        if (gStrokeReplayReady && gStrokeJournal.staleCount() > 0 &&
+            !sessionAwaitingSnapshot && !realtimeCanvasPending)
+        {
+            DirtyRect replayed = replayStrokeJournal(fullCanvas, canvasWidth, canvasHeight);
+            if (replayed.valid)
+            {
+                canvas.markDirtyRect(replayed);
+                Renderer::invalidateMinimapRect(replayed);
+            }
+        }
+        if (gStrokeReplayReady && gStrokeJournal.staleCount() == 0 && gStrokeJournal.unsentCount() > 0 &&
+            !sessionAwaitingSnapshot && !realtimeCanvasPending && NetworkManager::isConnected())
+            resendUnsentStrokes();
+
         if (sessionAwaitingSnapshot && !supportOnlyMode &&
             sessionSnapshotDeadline > 0 && osGetTime() >= sessionSnapshotDeadline)
         {
             sessionAwaitingSnapshot = false;
             sessionSnapshotDeadline = 0;
             realtimeCanvasPending = false;
+            canvas.cancelCompressedLoad();
             UIState::clearPoints();
             snprintf(gDisconnectReason, sizeof(gDisconnectReason), "SYNC TIMED OUT - RETRYING");
             setAdminNotice("SYNC TIMED OUT - RETRYING");
@@ -6190,6 +6508,7 @@ int main(int argc, char **argv)
             if (rectMaxX >= rectX && rectMaxY >= rectY)
             {
                 drawRectOutline(buffer, fbWidth, fbHeight, rectX, rectY, rectMaxX - rectX + 1, rectMaxY - rectY + 1, 24, 33, 38);
+                Renderer::invalidateViewportRect(rectX, rectY, rectMaxX - rectX + 1, rectMaxY - rectY + 1);
                 if (rectMaxX - rectX > 4 && rectMaxY - rectY > 4)
                 {
                     const u8 previewR = pendingAdminRectTool == ADMIN_RECT_ERASE ? 196 : currentColor.r;
@@ -6213,6 +6532,7 @@ int main(int argc, char **argv)
             restrictedUi.stroke(UiRect(12, 12, 296, 62), UiTheme::Warning, 2);
             restrictedUi.textClipped(24, 24, remaining, UiTheme::Danger, 272);
             restrictedUi.textClipped(24, 46, restrictionReason, UiTheme::Secondary, 272);
+            Renderer::invalidateViewportRect(12, 12, 296, 62);
         }
         canvas.clearDirty();
 
@@ -6268,6 +6588,18 @@ int main(int argc, char **argv)
                          Doodle::buttonLabel(binding.button[1]));
                 rendererState.controlBindings[action] = bindingLabels[action];
             }
+#if TEST_MODE
+            char uplinkStats[48];
+            const u64 statsNow = osGetTime();
+            snprintf(uplinkStats, sizeof(uplinkStats), "Draw %u pkt/s, %u B/s",
+                     gDrawSendRate.packetsPerSecond(statsNow), gDrawSendRate.bytesPerSecond(statsNow));
+            rendererState.uplinkStats = uplinkStats;
+            char bufferStats[48];
+            const Doodle::BufferPoolStats pool = NetworkManager::bufferPoolStats();
+            snprintf(bufferStats, sizeof(bufferStats), "Heap buffers: %lu of %lu",
+                     (unsigned long)pool.heapAllocations, (unsigned long)pool.acquired);
+            rendererState.bufferStats = bufferStats;
+#endif
             Renderer::renderTop(canvas, NetworkManager::isConnected(), updateAvailable, currentColor,
                                 currentBrushSizeTenths, currentBrushShape, topMode,
                                 availableChannels, availableChannelCount, selectedChannel,
@@ -6506,6 +6838,9 @@ int main(int argc, char **argv)
 
     if (clientSettingsDirty)
         flushClientSettings();
+    gStrokeJournal.acknowledge(NetworkManager::acknowledgedSequence());
+    if (!gStrokeJournal.save(STROKE_JOURNAL_PATH))
+        printf("Unable to save the stroke journal.\n");
     NetworkManager::disconnect();
     free(buffer);
     aptUnhook(&aptCookie);
@@ -0,0 +1,139 @@
+#include "minimap_cache.h"
+#include <algorithm>
+#include <string.h>
+
+namespace Doodle
+{
+
+namespace
+{
+
+// Canvas column (or row) where minimap cell i starts. Cells always cover at
+// least one canvas pixel, so a canvas smaller than the minimap repeats pixels.
+inline int cellStart(int cell, int canvasSize, int mapSize)
+{
+    return cell * canvasSize / mapSize;
+}
+
+inline int cellEnd(int cell, int canvasSize, int mapSize)
+{
+    return std::max(cellStart(cell, canvasSize, mapSize) + 1,
+                    cellStart(cell + 1, canvasSize, mapSize));
+}
+
+// Inclusive range of cells whose box contains any of [minPixel, maxPixel].
+inline void cellRange(int minPixel, int maxPixel, int canvasSize, int mapSize,
+                      int &minCell, int &maxCell)
+{
+    minCell = minPixel * mapSize / canvasSize;
+    maxCell = std::min(mapSize - 1, ((maxPixel + 1) * mapSize - 1) / canvasSize);
+}
+
+} // namespace
+
+MinimapCache::MinimapCache()
+    : anyDirty_(true), canvasWidth_(0), canvasHeight_(0)
+{
+    memset(pixels_, 0, sizeof(pixels_));
+    invalidate();
+}
+
+void MinimapCache::invalidate()
+{
+    for (int i = 0; i < MINIMAP_TILES_X * MINIMAP_TILES_Y; ++i)
+        tileDirty_[i] = true;
+    anyDirty_ = true;
+}
+
+void MinimapCache::invalidateCanvasRect(const DirtyRect &canvasRect)
+{
+    if (!canvasRect.valid || canvasWidth_ <= 0 || canvasHeight_ <= 0)
+        return;
+    const int minX = std::max(0, canvasRect.minX);
+    const int minY = std::max(0, canvasRect.minY);
+    const int maxX = std::min(canvasWidth_ - 1, canvasRect.maxX);
+    const int maxY = std::min(canvasHeight_ - 1, canvasRect.maxY);
+    if (minX > maxX || minY > maxY)
+        return;
+
+    int minCellX, maxCellX, minCellY, maxCellY;
+    cellRange(minX, maxX, canvasWidth_, MINIMAP_WIDTH, minCellX, maxCellX);
+    cellRange(minY, maxY, canvasHeight_, MINIMAP_HEIGHT, minCellY, maxCellY);
+    for (int tileY = minCellY / MINIMAP_TILE_SIZE; tileY <= maxCellY / MINIMAP_TILE_SIZE; ++tileY)
+    {
+        for (int tileX = minCellX / MINIMAP_TILE_SIZE; tileX <= maxCellX / MINIMAP_TILE_SIZE; ++tileX)
+            tileDirty_[tileY * MINIMAP_TILES_X + tileX] = true;
+    }
+    anyDirty_ = true;
+}
+
+int MinimapCache::update(const u8 *canvasPixels, int canvasWidth, int canvasHeight)
+{
+    if (!canvasPixels || canvasWidth <= 0 || canvasHeight <= 0)
+        return 0;
+    if (canvasWidth != canvasWidth_ || canvasHeight != canvasHeight_)
+    {
+        canvasWidth_ = canvasWidth;
+        canvasHeight_ = canvasHeight;
+        invalidate();
+    }
+    if (!anyDirty_)
+        return 0;
+
+    int rebuilt = 0;
+    for (int tileY = 0; tileY < MINIMAP_TILES_Y; ++tileY)
+    {
+        for (int tileX = 0; tileX < MINIMAP_TILES_X; ++tileX)
+        {
+            bool &dirty = tileDirty_[tileY * MINIMAP_TILES_X + tileX];
+            if (!dirty)
+                continue;
+            rebuildTile(tileX, tileY, canvasPixels);
+            dirty = false;
+            ++rebuilt;
+        }
+    }
+    anyDirty_ = false;
+    return rebuilt;
+}
+
+void MinimapCache::rebuildTile(int tileX, int tileY, const u8 *canvasPixels)
+{
+    const int firstX = tileX * MINIMAP_TILE_SIZE;
+    const int firstY = tileY * MINIMAP_TILE_SIZE;
+    int columnStart[MINIMAP_TILE_SIZE + 1];
+    for (int i = 0; i <= MINIMAP_TILE_SIZE; ++i)
+        columnStart[i] = cellStart(firstX + i, canvasWidth_, MINIMAP_WIDTH);
+
+    for (int y = firstY; y < firstY + MINIMAP_TILE_SIZE; ++y)
+    {
+        const int rowStart = cellStart(y, canvasHeight_, MINIMAP_HEIGHT);
+        const int rowEnd = cellEnd(y, canvasHeight_, MINIMAP_HEIGHT);
+        u8 *dest = pixels_ + 3 * (y * MINIMAP_WIDTH + firstX);
+        for (int i = 0; i < MINIMAP_TILE_SIZE; ++i, dest += 3)
+        {
+            const int colStart = columnStart[i];
+            const int colEnd = std::max(colStart + 1, columnStart[i + 1]);
+            u32 sumR = 0, sumG = 0, sumB = 0;
+            for (int cy = rowStart; cy < rowEnd; ++cy)
+            {
+                const u8 *src = canvasPixels + 3 * (cy * canvasWidth_ + colStart);
+                for (int cx = colStart; cx < colEnd; ++cx, src += 3)
+                {
+                    sumR += src[0];
+                    sumG += src[1];
+                    sumB += src[2];
+                }
+            }
+            // One divide per cell; the ARM11 has no hardware divider, so the
+            // three channel averages share a rounded 16.16 reciprocal.
+            const u32 count = (u32)((rowEnd - rowStart) * (colEnd - colStart));
+            const u32 reciprocal = (65536u + count / 2) / count;
+            dest[0] = (u8)((sumR * reciprocal + 32768u) >> 16);
+            dest[1] = (u8)((sumG * reciprocal + 32768u) >> 16);
+            dest[2] = (u8)((sumB * reciprocal + 32768u) >> 16);
+        }
+    }
+}
+
+} // namespace Doodle
@@ -1,23 +1,45 @@
 #include "network.h"
+#include "network_wait.h"
+#include "spsc_queue.h"
 #include "tls_stream.h"
 #include "websocket_client.h"
 
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <algorithm>
-#include <deque>
+#include <atomic>
 #include <utility>
 
 namespace
 {
 struct OutgoingMessage
 {
+    OutgoingMessage() : text(false), sequence(0) {}
+
     bool text;
-    std::vector<uint8_t> payload;
+    uint32_t sequence;
+    Doodle::PooledBuffer payload;
+};
+
+// An event and the incoming generation it was queued under.
+struct IncomingEvent
+{
+    IncomingEvent() : generation(0) {}
+
+    uint32_t generation;
+    NetworkEvent event;
 };
 
 static const size_t OUTGOING_QUEUE_LIMIT = 64 * 1024;
+static const size_t OUTGOING_COUNT_LIMIT = 256;
 static const size_t INCOMING_QUEUE_LIMIT = 12 * 1024 * 1024;
 static const size_t EVENT_COUNT_LIMIT = 128;
 // mbedTLS certificate verification has a deep call chain on ARM11. Leave
@@ -31,6 +53,17 @@ static const int CONNECT_TIMEOUT_MS = 30000;
 static const int RECONNECT_DELAYS_MS[] = {500, 1000, 2000, 4000, 8000, 15000};
 static const u64 WIFI_STATUS_POLL_MS = 250;
 static const u64 WIFI_RESTORE_SETTLE_MS = 1000;
+// Longest the worker blocks with nothing scheduled, and the slice it falls
+// back to while connected if the wakeup socket could not be opened.
+static const int WORKER_IDLE_WAIT_MS = 1000;
+static const int WORKER_FALLBACK_WAIT_MS = 5;
+// How soon sent messages are confirmed with a ping once written.
+static const u64 ACK_PING_INTERVAL_MS = 1000;
+
+// Backs every event, outgoing message and WebSocket frame. Blocks are taken
+// and returned on both threads, so the pool has a lock of its own.
+static Doodle::BufferPool gBufferPool;
+static LightLock gBufferPoolLock;
 
 static u32 *gSocBuffer = NULL;
 static Thread gWorker = NULL;
@@ -40,77 +73,227 @@ static CondVar gCondition;
 static bool gSynchronizationReady = false;
 static bool gInitialized = false;
 static bool gStopRequested = false;
-static bool gDisconnectRequested = false;
-static bool gReconnectRequested = false;
+// Written under gLock with the rest of the connection state, but read
+// without it where the queues are fed and drained.
+static std::atomic<bool> gDisconnectRequested(false);
+static std::atomic<bool> gReconnectRequested(false);
 static bool gAutoReconnect = true;
 static bool gConnected = false;
 static bool gConnecting = false;
 static bool gSessionReady = false;
-static size_t gOutgoingBytes = 0;
-static size_t gIncomingBytes = 0;
-static std::deque<OutgoingMessage> gOutgoing;
-static std::deque<NetworkEvent> gIncoming;
+// The main thread is the only producer of gOutgoing and the only consumer
+// of gIncoming; the worker is the other end of each. Neither queue takes
+// gLock. A side that needs to throw away the other side's items cannot
+// touch them directly: the main thread leaves gOutgoing for the worker to
+// drain when it handles the disconnect, and the worker bumps
+// gIncomingGeneration so pollEvent skips events from an older connection.
+static Doodle::SpscQueue<OutgoingMessage, OUTGOING_COUNT_LIMIT> gOutgoing;
+static Doodle::SpscQueue<IncomingEvent, EVENT_COUNT_LIMIT> gIncoming;
+static std::atomic<size_t> gOutgoingBytes(0);
+static std::atomic<size_t> gIncomingBytes(0);
+static std::atomic<uint32_t> gIncomingGeneration(0);
+// Outgoing messages are numbered from 1 as the main thread queues them;
+// the worker publishes the highest one the server has confirmed.
+static uint32_t gLastQueuedSequence = 0;
+static std::atomic<uint32_t> gAcknowledgedSequence(0);
+// Loopback datagram pair standing in for an eventfd: the main thread writes
+// a byte to gWakeSender and a worker blocked in select() on the WebSocket
+// sees gWakeReceiver turn readable. -1 when unavailable.
+static int gWakeReceiver = -1;
+static int gWakeSender = -1;
 static char gLastError[160] = "offline";
 static char gLastErrorSnapshot[160] = "offline";
 
-static void setLastErrorLocked(const char *message)
+static void lockBufferPool(void *context)
 {
-    snprintf(gLastError, sizeof(gLastError), "%s", message ? message : "network error");
+    LightLock_Lock((LightLock *)context);
 }
 
-static bool enqueueEvent(NetworkEventType type, const void *payload, size_t length, const char *detail)
+static void unlockBufferPool(void *context)
 {
-    NetworkEvent event;
-    event.type = type;
-    if (payload && length)
-        event.payload.assign((const uint8_t *)payload, (const uint8_t *)payload + length);
-    if (detail)
-        event.detail = detail;
+    LightLock_Unlock((LightLock *)context);
+}
 
-    LightLock_Lock(&gLock);
-    if (gDisconnectRequested || gReconnectRequested)
+static bool setNonBlocking(int socketFd)
+{
+    const int flags = fcntl(socketFd, F_GETFL, 0);
+    return flags >= 0 && fcntl(socketFd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+static void drainWakeSocket()
+{
+    if (gWakeReceiver < 0)
+        return;
+    uint8_t bytes[16];
+    while (recv(gWakeReceiver, bytes, sizeof(bytes), 0) > 0)
     {
-        LightLock_Unlock(&gLock);
-        return true;
     }
-    if (gIncoming.size() >= EVENT_COUNT_LIMIT || gIncomingBytes + event.payload.size() > INCOMING_QUEUE_LIMIT)
+}
+
+static void closeWakeSockets()
+{
+    if (gWakeSender >= 0)
+        ::close(gWakeSender);
+    if (gWakeReceiver >= 0)
+        ::close(gWakeReceiver);
+    gWakeSender = -1;
+    gWakeReceiver = -1;
+}
+
+// Opens the wakeup pair and proves a byte makes it across, so a stack that
+// accepts loopback sockets but never delivers on them is caught here rather
+// than as stalled sends.
+static bool openWakeSockets()
+{
+    gWakeReceiver = socket(AF_INET, SOCK_DGRAM, 0);
+    gWakeSender = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(0x7f000001); // 127.0.0.1
+    address.sin_port = 0;
+    socklen_t addressLength = sizeof(address);
+    if (gWakeReceiver < 0 || gWakeSender < 0 ||
+        bind(gWakeReceiver, (sockaddr *)&address, sizeof(address)) != 0 ||
+        getsockname(gWakeReceiver, (sockaddr *)&address, &addressLength) != 0 ||
+        connect(gWakeSender, (sockaddr *)&address, sizeof(address)) != 0 ||
+        !setNonBlocking(gWakeReceiver) || !setNonBlocking(gWakeSender))
     {
-        setLastErrorLocked("network receive queue full");
-        LightLock_Unlock(&gLock);
+        closeWakeSockets();
         return false;
     }
-    gIncomingBytes += event.payload.size();
-    gIncoming.push_back(std::move(event));
-    CondVar_WakeUp(&gCondition, 1);
-    LightLock_Unlock(&gLock);
+
+    const uint8_t probe = 1;
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(gWakeReceiver, &readSet);
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 200000;
+    if (send(gWakeSender, &probe, sizeof(probe), 0) != (int)sizeof(probe) ||
+        select(gWakeReceiver + 1, &readSet, NULL, NULL, &timeout) <= 0)
+    {
+        closeWakeSockets();
+        return false;
+    }
+    drainWakeSocket();
     return true;
 }
 
-static bool enqueueMessageEvent(NetworkEventType type, std::vector<uint8_t> &&payload)
+// Wakes the worker wherever it waits: on gCondition while offline, or in
+// select() while connected. A full socket buffer already holds a wakeup.
+static void wakeWorkerLocked(bool all = false)
 {
-    size_t payloadSize = payload.size();
-    LightLock_Lock(&gLock);
-    if (gDisconnectRequested || gReconnectRequested)
+    CondVar_WakeUp(&gCondition, all ? ARBITRATION_SIGNAL_ALL : 1);
+    if (gWakeSender >= 0)
     {
-        LightLock_Unlock(&gLock);
+        const uint8_t byte = 1;
+        send(gWakeSender, &byte, sizeof(byte), 0);
+    }
+}
+
+// Blocks until the socket or the wakeup pair is ready, or for waitMs.
+// False when select() itself failed rather than timed out.
+static bool waitForSocket(const WebSocketClient &websocket, int waitMs)
+{
+    const int socketFd = websocket.socketDescriptor();
+    if (socketFd < 0)
         return true;
+    fd_set readSet;
+    fd_set writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    FD_SET(socketFd, &readSet);
+    if (websocket.hasPendingOutput())
+        FD_SET(socketFd, &writeSet);
+    int highest = socketFd;
+    if (gWakeReceiver >= 0)
+    {
+        FD_SET(gWakeReceiver, &readSet);
+        highest = std::max(highest, gWakeReceiver);
     }
-    if (gIncoming.size() >= EVENT_COUNT_LIMIT || gIncomingBytes + payloadSize > INCOMING_QUEUE_LIMIT)
+    timeval timeout;
+    timeout.tv_sec = waitMs / 1000;
+    timeout.tv_usec = (waitMs % 1000) * 1000;
+    // A dead WebSocket is reported by update(); the caller handles the rest.
+    return select(highest + 1, &readSet, &writeSet, NULL, &timeout) >= 0;
+}
+
+// Worker only. A select() that fails at once, as it does when sleep or a
+// Wi-Fi teardown invalidated the wakeup pair, would otherwise spin the
+// worker: back off, then replace the pair or fall back to polling.
+static void recoverFromFailedWait()
+{
+    svcSleepThread((s64)WORKER_FALLBACK_WAIT_MS * 1000000LL);
+    if (gWakeReceiver < 0)
+        return;
+    LightLock_Lock(&gLock);
+    closeWakeSockets();
+    const bool reopened = openWakeSockets();
+    LightLock_Unlock(&gLock);
+    if (!reopened)
+        printf("Network wakeup socket lost; polling every %d ms while connected.\n",
+               WORKER_FALLBACK_WAIT_MS);
+}
+
+static void setLastErrorLocked(const char *message)
+{
+    snprintf(gLastError, sizeof(gLastError), "%s", message ? message : "network error");
+}
+
+static void reportIncomingFull()
+{
+    LightLock_Lock(&gLock);
+    setLastErrorLocked("network receive queue full");
+    LightLock_Unlock(&gLock);
+}
+
+// Worker only. Nobody waits for incoming events; the main loop polls.
+static bool pushIncoming(IncomingEvent &incoming)
+{
+    const size_t payloadSize = incoming.event.payload.size();
+    if (gIncomingBytes.load() + payloadSize > INCOMING_QUEUE_LIMIT)
     {
-        setLastErrorLocked("network receive queue full");
-        LightLock_Unlock(&gLock);
+        reportIncomingFull();
         return false;
     }
-    NetworkEvent event;
-    event.type = type;
-    event.payload = std::move(payload);
+    incoming.generation = gIncomingGeneration.load(std::memory_order_relaxed);
     gIncomingBytes += payloadSize;
-    gIncoming.push_back(std::move(event));
-    CondVar_WakeUp(&gCondition, 1);
-    LightLock_Unlock(&gLock);
+    if (!gIncoming.push(std::move(incoming)))
+    {
+        gIncomingBytes -= payloadSize;
+        reportIncomingFull();
+        return false;
+    }
     return true;
 }
 
+static bool enqueueEvent(NetworkEventType type, const void *payload, size_t length, const char *detail)
+{
+    if (gDisconnectRequested || gReconnectRequested)
+        return true;
+    IncomingEvent incoming;
+    incoming.event.type = type;
+    if (payload && length && !gBufferPool.acquireCopy(payload, length, incoming.event.payload))
+        return false;
+    if (detail)
+        incoming.event.detail = detail;
+    return pushIncoming(incoming);
+}
+
+static bool enqueueMessageEvent(NetworkEventType type, Doodle::PooledBuffer &&payload,
+                                size_t partOffset, bool partFinal)
+{
+    if (gDisconnectRequested || gReconnectRequested)
+        return true;
+    IncomingEvent incoming;
+    incoming.event.type = type;
+    incoming.event.payload = std::move(payload);
+    incoming.event.partOffset = partOffset;
+    incoming.event.partFinal = partFinal;
+    return pushIncoming(incoming);
+}
+
 static void setConnectionState(bool connected, bool connecting, const char *error)
 {
     LightLock_Lock(&gLock);
@@ -124,35 +307,37 @@ static void setConnectionState(bool connected, bool connecting, const char *erro
     LightLock_Unlock(&gLock);
 }
 
+// Worker only.
 static bool takeOutgoing(OutgoingMessage &message)
 {
-    LightLock_Lock(&gLock);
-    if (gDisconnectRequested || gReconnectRequested || gOutgoing.empty())
-    {
-        LightLock_Unlock(&gLock);
+    if (gDisconnectRequested || gReconnectRequested || !gOutgoing.pop(message))
         return false;
-    }
-    message = std::move(gOutgoing.front());
     gOutgoingBytes -= message.payload.size();
-    gOutgoing.pop_front();
-    LightLock_Unlock(&gLock);
     return true;
 }
 
+// Worker only: the consumer end of gOutgoing.
 static void discardOutgoing()
 {
-    LightLock_Lock(&gLock);
-    gOutgoing.clear();
-    gOutgoingBytes = 0;
-    LightLock_Unlock(&gLock);
+    OutgoingMessage message;
+    while (gOutgoing.pop(message))
+        gOutgoingBytes -= message.payload.size();
 }
 
+// Worker only. Events already queued stay put until pollEvent reaches them
+// and sees they belong to an earlier generation.
 static void discardIncoming()
 {
-    LightLock_Lock(&gLock);
-    gIncoming.clear();
-    gIncomingBytes = 0;
-    LightLock_Unlock(&gLock);
+    gIncomingGeneration.fetch_add(1);
+}
+
+// Main thread only, or while the worker is not running: the consumer end
+// of gIncoming.
+static void drainIncoming()
+{
+    IncomingEvent incoming;
+    while (gIncoming.pop(incoming))
+        gIncomingBytes -= incoming.event.payload.size();
 }
 
 static bool queryWifiConnected(bool &connected)
@@ -169,7 +354,12 @@ static bool queryWifiConnected(bool &connected)
 
 static void networkWorker(void *)
 {
-    WebSocketClient websocket;
+    WebSocketClient websocket(gBufferPool);
+    websocket.setAckInterval(ACK_PING_INTERVAL_MS);
+    // Sequence of the first message handed to the current connection. Each
+    // connection sends a contiguous run of the queue, so its Nth data frame
+    // is message firstSequence + N - 1.
+    uint32_t firstSequence = 0;
     unsigned int retryIndex = 0;
     u64 nextAttemptAt = 0;
     u64 nextWifiStatusAt = 0;
@@ -245,9 +435,13 @@ static void networkWorker(void *)
             if (didConnect)
             {
                 retryIndex = 0;
-                setConnectionState(true, false, "connected");
+                firstSequence = 0;
+                // The handshake summary shows whether the cached TLS
+                // session was reused and what the handshake cost.
+                const char *handshake = websocket.handshakeSummary();
+                setConnectionState(true, false, handshake[0] ? handshake : "connected");
                 discardIncoming();
-                if (!enqueueEvent(NETWORK_EVENT_CONNECTED, NULL, 0, NULL))
+                if (!enqueueEvent(NETWORK_EVENT_CONNECTED, NULL, 0, handshake))
                 {
                     websocket.close(1011);
                     setConnectionState(false, false, "unable to announce WebSocket connection");
@@ -287,6 +481,8 @@ static void networkWorker(void *)
                     nextAttemptAt = osGetTime() + RECONNECT_DELAYS_MS[0];
                     break;
                 }
+                if (firstSequence == 0)
+                    firstSequence = outgoing.sequence;
                 sentMessages++;
             }
 
@@ -302,6 +498,10 @@ static void networkWorker(void *)
                     retryIndex++;
             }
 
+            const uint32_t acknowledgedFrames = websocket.acknowledgedDataFrames();
+            if (firstSequence != 0 && acknowledgedFrames > 0)
+                gAcknowledgedSequence.store(firstSequence + acknowledgedFrames - 1);
+
             WebSocketClient::Message message;
             bool acceptMessages = websocket.isConnected();
             while (websocket.pollMessage(message))
@@ -311,10 +511,11 @@ static void networkWorker(void *)
                 // instead of letting a stale snapshot overwrite reconnect UI.
                 if (!acceptMessages)
                     continue;
-                NetworkEventType type = message.type == WebSocketClient::MESSAGE_TEXT
-                                            ? NETWORK_EVENT_TEXT
-                                            : NETWORK_EVENT_BINARY;
-                if (!enqueueMessageEvent(type, std::move(message.payload)))
+                NetworkEventType type = NETWORK_EVENT_TEXT;
+                if (message.type == WebSocketClient::MESSAGE_BINARY)
+                    type = message.offset == 0 && message.final ? NETWORK_EVENT_BINARY
+                                                                : NETWORK_EVENT_BINARY_PART;
+                if (!enqueueMessageEvent(type, std::move(message.payload), message.offset, message.final))
                 {
                     websocket.close(1009);
                     setConnectionState(false, false, "network receive queue full");
@@ -327,10 +528,36 @@ static void networkWorker(void *)
             }
         }
 
+        // Sleep until the next thing this loop has to do: a heartbeat, a
+        // reconnect attempt, a Wi-Fi check, incoming bytes or a wakeup from
+        // the main thread for new sends and requests.
+        u64 deadlines[3] = {0, 0, 0};
+        if (gAcInitialized)
+            deadlines[0] = nextWifiStatusAt;
+        if (!websocket.isConnected() && autoReconnect && wifiConnected)
+            deadlines[1] = std::max<u64>(nextAttemptAt, 1);
+        deadlines[2] = websocket.nextDeadline();
+        int waitMs = Doodle::networkWaitMs(osGetTime(), deadlines, 3, WORKER_IDLE_WAIT_MS);
+
         LightLock_Lock(&gLock);
-        if (!gStopRequested && !gDisconnectRequested && !gReconnectRequested && gOutgoing.empty())
-            CondVar_WaitTimeout(&gCondition, &gLock, 5000000LL);
+        const bool pendingWork = gStopRequested || gDisconnectRequested || gReconnectRequested ||
+                                 !gOutgoing.empty();
+        if (pendingWork)
+            waitMs = 0;
+        if (waitMs > 0 && !websocket.isConnected())
+            CondVar_WaitTimeout(&gCondition, &gLock, (s64)waitMs * 1000000LL);
         LightLock_Unlock(&gLock);
+
+        if (waitMs > 0 && websocket.isConnected())
+        {
+            if (websocket.hasPendingInput())
+                waitMs = 0;
+            else if (gWakeReceiver < 0)
+                waitMs = std::min(waitMs, WORKER_FALLBACK_WAIT_MS);
+            if (waitMs > 0 && !waitForSocket(websocket, waitMs))
+                recoverFromFailedWait();
+        }
+        drainWakeSocket();
     }
 
     websocket.close();
@@ -353,24 +580,41 @@ static bool queueOutgoing(bool text, const void *buffer, size_t length, bool ses
             return false;
     }
 
+    // Copy before taking the queue lock; a rejected message just goes back.
+    OutgoingMessage message;
+    message.text = text;
+    const uint32_t sequence = gLastQueuedSequence + 1;
+    message.sequence = sequence;
+    if (!gBufferPool.acquireCopy(buffer, length, message.payload))
+        return false;
+
+    // The session checks and the hello's gSessionReady update stay under
+    // gLock; the queue itself does not need it.
     LightLock_Lock(&gLock);
     if (!gInitialized || !gConnected ||
         (!sessionHello && !gSessionReady) || (sessionHello && gSessionReady) ||
-        gOutgoingBytes + length > OUTGOING_QUEUE_LIMIT)
+        gOutgoingBytes.load() + length > OUTGOING_QUEUE_LIMIT)
     {
-        if (gOutgoingBytes + length > OUTGOING_QUEUE_LIMIT)
+        if (gOutgoingBytes.load() + length > OUTGOING_QUEUE_LIMIT)
             setLastErrorLocked("network send queue full");
         LightLock_Unlock(&gLock);
         return false;
     }
-    OutgoingMessage message;
-    message.text = text;
-    message.payload.assign((const uint8_t *)buffer, (const uint8_t *)buffer + length);
     gOutgoingBytes += length;
-    gOutgoing.push_back(std::move(message));
+    bool wasEmpty = false;
+    if (!gOutgoing.push(std::move(message), &wasEmpty))
+    {
+        gOutgoingBytes -= length;
+        setLastErrorLocked("network send queue full");
+        LightLock_Unlock(&gLock);
+        return false;
+    }
+    gLastQueuedSequence = sequence;
     if (sessionHello)
         gSessionReady = true;
-    CondVar_WakeUp(&gCondition, 1);
+    // A worker with messages still queued has not gone to sleep on them.
+    if (wasEmpty)
+        wakeWorkerLocked();
     LightLock_Unlock(&gLock);
     return true;
 }
@@ -383,7 +627,11 @@ bool NetworkManager::initialize()
 
     LightLock_Init(&gLock);
     CondVar_Init(&gCondition);
+    LightLock_Init(&gBufferPoolLock);
+    gBufferPool.setLock(lockBufferPool, unlockBufferPool, &gBufferPoolLock);
     gSynchronizationReady = true;
+    if (!gBufferPool.reserve())
+        printf("Network buffer pool unavailable; using the heap.\n");
 
     gSocBuffer = (u32 *)memalign(SOC_ALIGN, SOC_BUFFERSIZE);
     if (!gSocBuffer)
@@ -419,6 +667,13 @@ bool NetworkManager::initialize()
         return false;
     }
 
+    if (!openWakeSockets())
+        printf("Network wakeup socket unavailable; polling every %d ms while connected.\n",
+               WORKER_FALLBACK_WAIT_MS);
+
+    // No worker yet, so this thread may empty both ends.
+    discardOutgoing();
+    drainIncoming();
     LightLock_Lock(&gLock);
     gStopRequested = false;
     gDisconnectRequested = false;
@@ -427,10 +682,6 @@ bool NetworkManager::initialize()
     gConnected = false;
     gConnecting = true;
     gSessionReady = false;
-    gOutgoing.clear();
-    gIncoming.clear();
-    gOutgoingBytes = 0;
-    gIncomingBytes = 0;
     setLastErrorLocked("connecting");
     gInitialized = true;
     LightLock_Unlock(&gLock);
@@ -446,6 +697,7 @@ bool NetworkManager::initialize()
         gInitialized = false;
         setLastErrorLocked("network worker creation failed");
         LightLock_Unlock(&gLock);
+        closeWakeSockets();
         TlsStream::shutdown();
         if (gAcInitialized)
         {
@@ -472,7 +724,7 @@ void NetworkManager::shutdown()
     }
     gStopRequested = true;
     gAutoReconnect = false;
-    CondVar_WakeUp(&gCondition, ARBITRATION_SIGNAL_ALL);
+    wakeWorkerLocked(true);
     LightLock_Unlock(&gLock);
 
     if (gWorker)
@@ -483,11 +735,11 @@ void NetworkManager::shutdown()
     }
     LightLock_Lock(&gLock);
     gInitialized = false;
-    gOutgoing.clear();
-    gIncoming.clear();
-    gOutgoingBytes = 0;
-    gIncomingBytes = 0;
     LightLock_Unlock(&gLock);
+    // The worker has exited; this thread now owns both ends.
+    discardOutgoing();
+    drainIncoming();
+    closeWakeSockets();
     TlsStream::shutdown();
     if (gAcInitialized)
     {
@@ -519,19 +771,28 @@ bool NetworkManager::sendBinary(const void *buffer, size_t length)
     return queueOutgoing(false, buffer, length);
 }
 
+uint32_t NetworkManager::lastQueuedSequence()
+{
+    return gLastQueuedSequence;
+}
+
+uint32_t NetworkManager::acknowledgedSequence()
+{
+    return gAcknowledgedSequence.load();
+}
+
 bool NetworkManager::pollEvent(NetworkEvent &event)
 {
-    LightLock_Lock(&gLock);
-    if (gIncoming.empty())
+    IncomingEvent incoming;
+    while (gIncoming.pop(incoming))
     {
-        LightLock_Unlock(&gLock);
-        return false;
+        gIncomingBytes -= incoming.event.payload.size();
+        if (incoming.generation != gIncomingGeneration.load())
+            continue;
+        event = std::move(incoming.event);
+        return true;
     }
-    event = std::move(gIncoming.front());
-    gIncomingBytes -= event.payload.size();
-    gIncoming.pop_front();
-    LightLock_Unlock(&gLock);
-    return true;
+    return false;
 }
 
 bool NetworkManager::waitEvent(NetworkEvent &event, int timeoutMs)
@@ -587,12 +848,10 @@ bool NetworkManager::disconnect()
     gAutoReconnect = false;
     gDisconnectRequested = true;
     gSessionReady = false;
-    gOutgoing.clear();
-    gOutgoingBytes = 0;
-    gIncoming.clear();
-    gIncomingBytes = 0;
-    CondVar_WakeUp(&gCondition, 1);
+    // No more sends are accepted; the worker drops what is still queued.
+    wakeWorkerLocked();
     LightLock_Unlock(&gLock);
+    drainIncoming();
     return true;
 }
 
@@ -608,15 +867,12 @@ bool NetworkManager::reconnect()
     gReconnectRequested = true;
     gConnecting = true;
     gSessionReady = false;
-    gOutgoing.clear();
-    gOutgoingBytes = 0;
-    // Anything already queued belongs to the socket generation being replaced.
-    // The worker clears once more when it observes this request to close the
-    // small producer/consumer race between this call and the next worker tick.
-    gIncoming.clear();
-    gIncomingBytes = 0;
-    CondVar_WakeUp(&gCondition, 1);
+    wakeWorkerLocked();
     LightLock_Unlock(&gLock);
+    // Anything already queued belongs to the socket generation being replaced.
+    // The worker bumps the incoming generation when it observes this request,
+    // which also covers events it queued between this drain and that tick.
+    drainIncoming();
     return true;
 }
 
@@ -653,3 +909,8 @@ const char *NetworkManager::lastError()
     LightLock_Unlock(&gLock);
     return gLastErrorSnapshot;
 }
+
+Doodle::BufferPoolStats NetworkManager::bufferPoolStats()
+{
+    return gBufferPool.stats();
+}
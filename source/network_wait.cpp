@@ -0,0 +1,23 @@
+#include "network_wait.h"
+
+namespace Doodle
+{
+
+int networkWaitMs(uint64_t now, const uint64_t *deadlines, size_t count, int limitMs)
+{
+    if (limitMs <= 0)
+        return 0;
+    uint64_t wait = (uint64_t)limitMs;
+    for (size_t i = 0; deadlines && i < count; ++i)
+    {
+        if (deadlines[i] == 0)
+            continue;
+        if (deadlines[i] <= now)
+            return 0;
+        if (deadlines[i] - now < wait)
+            wait = deadlines[i] - now;
+    }
+    return (int)wait;
+}
+
+} // namespace Doodle
@@ -24,17 +24,12 @@ static const char *findInRange(const char *start, const char *end, const char *k
     return NULL;
 }
 
-static bool jsonStringRange(const char *start, const char *end, const char *key, char *out, size_t outSize)
+// Copies the body of a JSON string that starts at ptr, just past its opening
+// quote. \n, \r and \t become spaces and any other escape keeps the escaped
+// character. Text beyond outSize - 1 is consumed but dropped, and out may be
+// NULL to skip a string. Returns the closing quote, or where the input ended.
+static const char *jsonCopyString(const char *ptr, const char *end, char *out, size_t outSize)
 {
-    if (!out || outSize == 0)
-        return false;
-    out[0] = '\0';
-
-    const char *ptr = findInRange(start, end, key);
-    if (!ptr)
-        return false;
-    ptr += strlen(key);
-
     size_t used = 0;
     while ((!end || ptr < end) && *ptr && *ptr != '"')
     {
@@ -47,10 +42,24 @@ static bool jsonStringRange(const char *start, const char *end, const char *key,
             else
                 value = escaped;
         }
-        if (used + 1 < outSize)
+        if (out && used + 1 < outSize)
             out[used++] = value;
     }
-    out[used] = '\0';
+    if (out && outSize > 0)
+        out[used] = '\0';
+    return ptr;
+}
+
+static bool jsonStringRange(const char *start, const char *end, const char *key, char *out, size_t outSize)
+{
+    if (!out || outSize == 0)
+        return false;
+    out[0] = '\0';
+
+    const char *ptr = findInRange(start, end, key);
+    if (!ptr)
+        return false;
+    jsonCopyString(ptr + strlen(key), end, out, outSize);
     return true;
 }
 
@@ -87,6 +96,181 @@ static bool jsonBoolRange(const char *start, const char *end, const char *key, b
     return false;
 }
 
+enum JsonFieldKind
+{
+    JSON_FIELD_STRING,
+    JSON_FIELD_INT,
+    JSON_FIELD_BOOL
+};
+
+struct JsonField
+{
+    const char *key;
+    JsonFieldKind kind;
+    void *value;
+    size_t size;
+};
+
+static JsonField jsonStringField(const char *key, char *out, size_t outSize)
+{
+    JsonField field = {key, JSON_FIELD_STRING, out, outSize};
+    return field;
+}
+
+static JsonField jsonIntField(const char *key, int &value)
+{
+    JsonField field = {key, JSON_FIELD_INT, &value, 0};
+    return field;
+}
+
+static JsonField jsonBoolField(const char *key, bool &value)
+{
+    JsonField field = {key, JSON_FIELD_BOOL, &value, 0};
+    return field;
+}
+
+static const size_t JSON_MAX_FIELDS = 32;
+
+static inline bool jsonStopsWalk(char c)
+{
+    switch (c)
+    {
+        case '\0': case '"': case '{': case '}': case '[': case ']':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns the closing quote of the string whose body starts at ptr, or where
+// the input ended.
+static const char *jsonSkipString(const char *ptr, const char *end)
+{
+    for (;;)
+    {
+        while (*ptr && *ptr != '"' && *ptr != '\\')
+            ptr++;
+        if (end && ptr >= end)
+            return end;
+        if (*ptr != '\\')
+            return ptr;
+        if (!ptr[1])
+            return ptr + 1;
+        ptr += 2;
+    }
+}
+
+// One pass over the JSON text at start that fills every field from the
+// first key of that name at any depth, in document order, the same value
+// the key-by-key searches find. String fields only take string values; a
+// key with another value leaves the field looking for a later match. Int
+// and bool fields take the first occurrence whatever it holds, and are left
+// untouched when the key is missing. String fields start out empty.
+//
+// With toObjectEnd the walk continues past the last field to the brace
+// closing the object at start and returns it, or NULL if the object is
+// unterminated. Otherwise it stops as soon as every field is filled.
+static const char *jsonWalkFields(const char *start, const char *end, const JsonField *fields,
+                                  size_t fieldCount, bool toObjectEnd)
+{
+    if (!start || fieldCount > JSON_MAX_FIELDS)
+        return NULL;
+    unsigned long pending = fieldCount == JSON_MAX_FIELDS ? 0xffffffffUL : (1UL << fieldCount) - 1;
+    for (size_t i = 0; i < fieldCount; i++)
+    {
+        if (fields[i].kind == JSON_FIELD_STRING && fields[i].value && fields[i].size > 0)
+            ((char *)fields[i].value)[0] = '\0';
+    }
+
+    const bool object = toObjectEnd && *start == '{';
+    size_t nextField = 0;
+    int depth = 0;
+    const char *ptr = start;
+    for (;;)
+    {
+        while (!jsonStopsWalk(*ptr))
+            ptr++;
+        if ((end && ptr >= end) || !*ptr)
+            break;
+        const char c = *ptr;
+        if (c == '{' || c == '[')
+        {
+            depth++;
+            ptr++;
+            continue;
+        }
+        if (c == '}' || c == ']')
+        {
+            if (--depth == 0 && object)
+                return ptr;
+            ptr++;
+            continue;
+        }
+
+        const char *token = ptr + 1;
+        ptr = jsonSkipString(token, end);
+        if ((end && ptr >= end) || !*ptr)
+            break;
+        const size_t tokenLength = (size_t)(ptr - token);
+        ptr++;
+        if (!pending)
+        {
+            if (!object)
+                return NULL;
+            continue;
+        }
+        if ((end && ptr >= end) || *ptr != ':')
+            continue;
+
+        // Servers send keys in a stable order, so the search starts after
+        // the last field filled and usually matches on its first compare.
+        const char *value = ptr + 1;
+        for (size_t n = 0, i = nextField; n < fieldCount; n++, i = i + 1 < fieldCount ? i + 1 : 0)
+        {
+            const JsonField &field = fields[i];
+            if (!(pending & (1UL << i)) || field.key[0] != token[0] ||
+                strncmp(field.key, token, tokenLength) != 0 || field.key[tokenLength] != '\0')
+                continue;
+
+            if (field.kind == JSON_FIELD_STRING)
+            {
+                if ((end && value >= end) || *value != '"')
+                    break;
+                ptr = jsonCopyString(value + 1, end, (char *)field.value, field.size);
+                if ((!end || ptr < end) && *ptr == '"')
+                    ptr++;
+            }
+            else
+            {
+                while ((!end || value < end) && (*value == ' ' || *value == '\t'))
+                    value++;
+                if (field.kind == JSON_FIELD_INT)
+                    *(int *)field.value = atoi(value);
+                else if ((!end || value + 4 <= end) && strncmp(value, "true", 4) == 0)
+                    *(bool *)field.value = true;
+                else if ((!end || value + 5 <= end) && strncmp(value, "false", 5) == 0)
+                    *(bool *)field.value = false;
+            }
+            pending &= ~(1UL << i);
+            nextField = i + 1 < fieldCount ? i + 1 : 0;
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void jsonReadFields(const char *start, const char *end, const JsonField *fields, size_t fieldCount)
+{
+    jsonWalkFields(start, end, fields, fieldCount, false);
+}
+
+// Fills fields from the object at start, which must begin with '{', and
+// returns its closing brace or NULL when it is unterminated.
+static const char *jsonReadObject(const char *start, const JsonField *fields, size_t fieldCount)
+{
+    return jsonWalkFields(start, NULL, fields, fieldCount, true);
+}
+
 static const char *jsonObjectEnd(const char *start)
 {
     if (!start || *start != '{')
@@ -169,16 +353,21 @@ static void parseIdentityFields(const char *start, const char *end, IdentityInfo
 {
     identity.muteSecondsRemaining = 0;
     identity.banSecondsRemaining = 0;
-    jsonStringRange(start, end, "\"id\":\"", identity.identityId, sizeof(identity.identityId));
+    char identityId[sizeof(identity.identityId)];
+    const JsonField fields[] = {
+        jsonStringField("id", identity.identityId, sizeof(identity.identityId)),
+        jsonStringField("identityId", identityId, sizeof(identityId)),
+        jsonStringField("username", identity.username, sizeof(identity.username)),
+        jsonStringField("displayName", identity.displayName, sizeof(identity.displayName)),
+        jsonStringField("role", identity.role, sizeof(identity.role)),
+        jsonStringField("status", identity.status, sizeof(identity.status)),
+        jsonIntField("muteSecondsRemaining", identity.muteSecondsRemaining),
+        jsonIntField("banSecondsRemaining", identity.banSecondsRemaining),
+        jsonStringField("banReason", identity.restrictionReason, sizeof(identity.restrictionReason)),
+    };
+    jsonReadFields(start, end, fields, sizeof(fields) / sizeof(fields[0]));
     if (!identity.identityId[0])
-        jsonStringRange(start, end, "\"identityId\":\"", identity.identityId, sizeof(identity.identityId));
-    jsonStringRange(start, end, "\"username\":\"", identity.username, sizeof(identity.username));
-    jsonStringRange(start, end, "\"displayName\":\"", identity.displayName, sizeof(identity.displayName));
-    jsonStringRange(start, end, "\"role\":\"", identity.role, sizeof(identity.role));
-    jsonStringRange(start, end, "\"status\":\"", identity.status, sizeof(identity.status));
-    jsonIntRange(start, end, "\"muteSecondsRemaining\":", identity.muteSecondsRemaining);
-    jsonIntRange(start, end, "\"banSecondsRemaining\":", identity.banSecondsRemaining);
-    jsonStringRange(start, end, "\"banReason\":\"", identity.restrictionReason, sizeof(identity.restrictionReason));
+        memcpy(identity.identityId, identityId, sizeof(identityId));
 }
 
 bool Protocol::parseCanvasMeta(const char *line, CanvasMeta &meta)
@@ -249,19 +438,20 @@ bool Protocol::parseChannels(const char *line, char channels[][25], ChannelInfo
             ptr++;
         if (!*ptr || *ptr == ']')
             break;
-        const char *end = jsonObjectEnd(ptr);
-        if (!end)
-            break;
-
         ChannelInfo parsed;
         memset(&parsed, 0, sizeof(parsed));
-        jsonStringRange(ptr, end, "\"name\":\"", parsed.name, sizeof(parsed.name));
-        jsonIntRange(ptr, end, "\"userCount\":", parsed.userCount);
-        jsonIntRange(ptr, end, "\"width\":", parsed.width);
-        jsonIntRange(ptr, end, "\"height\":", parsed.height);
-        jsonBoolRange(ptr, end, "\"staffOnly\":", parsed.staffOnly);
-        jsonBoolRange(ptr, end, "\"adminOnly\":", parsed.adminOnly);
-        jsonBoolRange(ptr, end, "\"readOnly\":", parsed.readOnly);
+        const JsonField fields[] = {
+            jsonStringField("name", parsed.name, sizeof(parsed.name)),
+            jsonIntField("userCount", parsed.userCount),
+            jsonIntField("width", parsed.width),
+            jsonIntField("height", parsed.height),
+            jsonBoolField("staffOnly", parsed.staffOnly),
+            jsonBoolField("adminOnly", parsed.adminOnly),
+            jsonBoolField("readOnly", parsed.readOnly),
+        };
+        const char *end = jsonReadObject(ptr, fields, sizeof(fields) / sizeof(fields[0]));
+        if (!end)
+            break;
 
         int target = -1;
         for (int i = 0; i < count; i++)
@@ -312,9 +502,15 @@ bool Protocol::parsePresence(const char *line, PresenceUser *users, int maxUsers
     memset(&presence, 0, sizeof(presence));
     const char *usersStart = strstr(line, "\"users\":[");
     const char *envelopeEnd = usersStart ? usersStart : NULL;
-    jsonStringRange(line, envelopeEnd, "\"channel\":\"", presence.channel, sizeof(presence.channel));
-    jsonIntRange(line, NULL, "\"total\":", presence.total);
-    jsonBoolRange(line, NULL, "\"truncated\":", presence.truncated);
+    const JsonField envelope[] = {
+        jsonStringField("channel", presence.channel, sizeof(presence.channel)),
+    };
+    jsonReadFields(line, envelopeEnd, envelope, 1);
+    const JsonField totals[] = {
+        jsonIntField("total", presence.total),
+        jsonBoolField("truncated", presence.truncated),
+    };
+    jsonReadFields(line, NULL, totals, 2);
 
     if (!users || maxUsers <= 0 || !usersStart)
         return true;
@@ -326,25 +522,27 @@ bool Protocol::parsePresence(const char *line, PresenceUser *users, int maxUsers
             ptr++;
         if (!*ptr || *ptr == ']')
             break;
-        const char *end = jsonObjectEnd(ptr);
+        PresenceUser &user = users[count];
+        memset(&user, 0, sizeof(user));
+        const JsonField fields[] = {
+            jsonStringField("id", user.id, sizeof(user.id)),
+            jsonStringField("identityId", user.identityId, sizeof(user.identityId)),
+            jsonStringField("username", user.username, sizeof(user.username)),
+            jsonStringField("displayName", user.displayName, sizeof(user.displayName)),
+            jsonStringField("role", user.role, sizeof(user.role)),
+            jsonStringField("status", user.status, sizeof(user.status)),
+            jsonStringField("channel", user.channel, sizeof(user.channel)),
+            jsonStringField("clientType", user.clientType, sizeof(user.clientType)),
+            jsonStringField("deviceModel", user.deviceModel, sizeof(user.deviceModel)),
+            jsonStringField("deviceModelLabel", user.deviceModelLabel, sizeof(user.deviceModelLabel)),
+            jsonIntField("sessionCount", user.sessionCount),
+            jsonIntField("muteSecondsRemaining", user.muteSecondsRemaining),
+            jsonIntField("banSecondsRemaining", user.banSecondsRemaining),
+            jsonBoolField("readOnly", user.readOnly),
+        };
+        const char *end = jsonReadObject(ptr, fields, sizeof(fields) / sizeof(fields[0]));
         if (!end)
             break;
-
-        memset(&users[count], 0, sizeof(users[count]));
-        jsonStringRange(ptr, end, "\"id\":\"", users[count].id, sizeof(users[count].id));
-        jsonStringRange(ptr, end, "\"identityId\":\"", users[count].identityId, sizeof(users[count].identityId));
-        jsonStringRange(ptr, end, "\"username\":\"", users[count].username, sizeof(users[count].username));
-        jsonStringRange(ptr, end, "\"displayName\":\"", users[count].displayName, sizeof(users[count].displayName));
-        jsonStringRange(ptr, end, "\"role\":\"", users[count].role, sizeof(users[count].role));
-        jsonStringRange(ptr, end, "\"status\":\"", users[count].status, sizeof(users[count].status));
-        jsonStringRange(ptr, end, "\"channel\":\"", users[count].channel, sizeof(users[count].channel));
-        jsonStringRange(ptr, end, "\"clientType\":\"", users[count].clientType, sizeof(users[count].clientType));
-        jsonStringRange(ptr, end, "\"deviceModel\":\"", users[count].deviceModel, sizeof(users[count].deviceModel));
-        jsonStringRange(ptr, end, "\"deviceModelLabel\":\"", users[count].deviceModelLabel, sizeof(users[count].deviceModelLabel));
-        jsonIntRange(ptr, end, "\"sessionCount\":", users[count].sessionCount);
-        jsonIntRange(ptr, end, "\"muteSecondsRemaining\":", users[count].muteSecondsRemaining);
-        jsonIntRange(ptr, end, "\"banSecondsRemaining\":", users[count].banSecondsRemaining);
-        jsonBoolRange(ptr, end, "\"readOnly\":", users[count].readOnly);
         if (!users[count].displayName[0])
             snprintf(users[count].displayName, sizeof(users[count].displayName), "USER");
         if (!users[count].role[0])
@@ -492,18 +690,21 @@ bool Protocol::parseTicketSummary(const char *line, SupportTicketSummary &ticket
                   !strstr(line, "\"type\":\"ticketUpdated\"")))
         return false;
     memset(&ticket, 0, sizeof(ticket));
-    ticket.id = jsonInt(line, "\"id\":");
-    ticket.messageCount = jsonInt(line, "\"messageCount\":");
-    jsonString(line, "\"category\":\"", ticket.category, sizeof(ticket.category));
-    jsonString(line, "\"status\":\"", ticket.status, sizeof(ticket.status));
-    jsonString(line, "\"subject\":\"", ticket.subject, sizeof(ticket.subject));
-    jsonString(line, "\"identityId\":\"", ticket.identityId, sizeof(ticket.identityId));
-    jsonString(line, "\"username\":\"", ticket.username, sizeof(ticket.username));
-    jsonString(line, "\"displayName\":\"", ticket.displayName, sizeof(ticket.displayName));
-    jsonString(line, "\"banReason\":\"", ticket.banReason, sizeof(ticket.banReason));
-    jsonString(line, "\"createdAt\":\"", ticket.createdAt, sizeof(ticket.createdAt));
-    jsonString(line, "\"updatedAt\":\"", ticket.updatedAt, sizeof(ticket.updatedAt));
-    jsonString(line, "\"lastMessage\":\"", ticket.lastMessage, sizeof(ticket.lastMessage));
+    const JsonField fields[] = {
+        jsonIntField("id", ticket.id),
+        jsonIntField("messageCount", ticket.messageCount),
+        jsonStringField("category", ticket.category, sizeof(ticket.category)),
+        jsonStringField("status", ticket.status, sizeof(ticket.status)),
+        jsonStringField("subject", ticket.subject, sizeof(ticket.subject)),
+        jsonStringField("identityId", ticket.identityId, sizeof(ticket.identityId)),
+        jsonStringField("username", ticket.username, sizeof(ticket.username)),
+        jsonStringField("displayName", ticket.displayName, sizeof(ticket.displayName)),
+        jsonStringField("banReason", ticket.banReason, sizeof(ticket.banReason)),
+        jsonStringField("createdAt", ticket.createdAt, sizeof(ticket.createdAt)),
+        jsonStringField("updatedAt", ticket.updatedAt, sizeof(ticket.updatedAt)),
+        jsonStringField("lastMessage", ticket.lastMessage, sizeof(ticket.lastMessage)),
+    };
+    jsonReadFields(line, NULL, fields, sizeof(fields) / sizeof(fields[0]));
     const char *types = strstr(line, "\"blockTypes\":[");
     if (types)
     {
@@ -519,13 +720,16 @@ bool Protocol::parseTicketMessage(const char *line, SupportTicketMessage &messag
     if (!line || !strstr(line, "\"type\":\"ticketMessage\""))
         return false;
     memset(&message, 0, sizeof(message));
-    message.id = jsonInt(line, "\"id\":");
-    message.ticketId = jsonInt(line, "\"ticketId\":");
-    jsonString(line, "\"authorKind\":\"", message.authorKind, sizeof(message.authorKind));
-    jsonString(line, "\"displayName\":\"", message.displayName, sizeof(message.displayName));
-    jsonString(line, "\"role\":\"", message.role, sizeof(message.role));
-    jsonString(line, "\"createdAt\":\"", message.createdAt, sizeof(message.createdAt));
-    jsonString(line, "\"message\":\"", message.message, sizeof(message.message));
+    const JsonField fields[] = {
+        jsonIntField("id", message.id),
+        jsonIntField("ticketId", message.ticketId),
+        jsonStringField("authorKind", message.authorKind, sizeof(message.authorKind)),
+        jsonStringField("displayName", message.displayName, sizeof(message.displayName)),
+        jsonStringField("role", message.role, sizeof(message.role)),
+        jsonStringField("createdAt", message.createdAt, sizeof(message.createdAt)),
+        jsonStringField("message", message.message, sizeof(message.message)),
+    };
+    jsonReadFields(line, NULL, fields, sizeof(fields) / sizeof(fields[0]));
     return message.id > 0;
 }
 
@@ -602,13 +806,16 @@ bool Protocol::parseStaffChatMessage(const char *line, StaffChatMessage &message
     if (!line || !strstr(line, "\"type\":\"staffChatMessage\""))
         return false;
     memset(&message, 0, sizeof(message));
-    message.id = jsonInt(line, "\"id\":");
-    jsonString(line, "\"identityId\":\"", message.identityId, sizeof(message.identityId));
-    jsonString(line, "\"username\":\"", message.username, sizeof(message.username));
-    jsonString(line, "\"displayName\":\"", message.displayName, sizeof(message.displayName));
-    jsonString(line, "\"role\":\"", message.role, sizeof(message.role));
-    jsonString(line, "\"createdAt\":\"", message.createdAt, sizeof(message.createdAt));
-    jsonString(line, "\"message\":\"", message.message, sizeof(message.message));
+    const JsonField fields[] = {
+        jsonIntField("id", message.id),
+        jsonStringField("identityId", message.identityId, sizeof(message.identityId)),
+        jsonStringField("username", message.username, sizeof(message.username)),
+        jsonStringField("displayName", message.displayName, sizeof(message.displayName)),
+        jsonStringField("role", message.role, sizeof(message.role)),
+        jsonStringField("createdAt", message.createdAt, sizeof(message.createdAt)),
+        jsonStringField("message", message.message, sizeof(message.message)),
+    };
+    jsonReadFields(line, NULL, fields, sizeof(fields) / sizeof(fields[0]));
     return message.id > 0;
 }
 
@@ -700,7 +907,7 @@ void Protocol::buildHello(char *buffer, size_t size, const char *appId, const ch
 
     const char *capabilities =
         "\"capabilities\":[\"ui2-channel-info\",\"ui2-presence-compact\",\"ui2-ticket-cursor\","
-        "\"draw-size-tenths\",\"brush-feather\",\"brush-suite-v2\"]";
+        "\"draw-size-tenths\",\"brush-feather\",\"brush-suite-v2\",\"draw-delta\"]";
     if (safePreferredChannel[0])
     {
         snprintf(buffer, size,
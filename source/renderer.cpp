@@ -1,58 +1,63 @@
 #include "renderer.h"
+#include "minimap_cache.h"
 #include "timestamp_format.h"
 #include "ui_canvas.h"
+#include "viewport_render.h"
 #include <algorithm>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
-static const int MINIMAP_W = 256;
-static const int MINIMAP_H = 144;
+static const int MINIMAP_W = Doodle::MINIMAP_WIDTH;
+static const int MINIMAP_H = Doodle::MINIMAP_HEIGHT;
 static const int TOP_SCREEN_W = 400;
 static const int TOP_SCREEN_H = 240;
-static u8 minimapCache[MINIMAP_W * MINIMAP_H * 3];
 static u8 topFrame[TOP_SCREEN_W * TOP_SCREEN_H * 3];
-static bool minimapCacheValid = false;
 static bool topFrameValid = false;
-static int minimapFrameCounter = 0;
-static const int BOTTOM_SCREEN_W = 320;
-static const int BOTTOM_SCREEN_H = 240;
+// Bumped each time renderTop composes topFrame. presentTopFrame rotates a
+// generation once into topFrameRotated, laid out like the 240x400 BGR top
+// framebuffer, and copies it only to eyes that do not already show it.
+static u32 topFrameGeneration = 0;
+static u32 rotatedGeneration = 0;
+static u8 topFrameRotated[TOP_SCREEN_W * TOP_SCREEN_H * 3];
+struct TopEyePresent
+{
+    u8 *framebuffer;
+    u32 generation;
+};
+static TopEyePresent leftEyePresent = {NULL, 0};
+static TopEyePresent rightEyePresent = {NULL, 0};
 static int topBatteryPercent = -1;
 static bool topBatteryCharging = false;
 static u64 topBatteryReadAt = 0;
 
+static Doodle::IncrementalViewport bottomViewport;
+static Doodle::MinimapCache minimap;
+
 void Renderer::renderViewport(CanvasState &canvas, u8 *buffer, int fbWidth, int fbHeight, bool forceFull)
 {
     if (!canvas.pixels)
         return;
 
-    const bool rotatedFramebuffer = fbWidth < fbHeight;
-    for (int screenY = 0; screenY < BOTTOM_SCREEN_H; screenY++)
-    {
-        for (int screenX = 0; screenX < BOTTOM_SCREEN_W; screenX++)
-        {
-            int fbX = rotatedFramebuffer ? fbWidth - 1 - screenY : screenX;
-            int fbY = rotatedFramebuffer ? screenX : screenY;
-            if (fbX < 0 || fbX >= fbWidth || fbY < 0 || fbY >= fbHeight)
-                continue;
+    Doodle::ViewportSource source;
+    source.pixels = canvas.pixels;
+    source.width = canvas.width;
+    source.height = canvas.height;
+    source.offsetX = canvas.offsetX;
+    source.offsetY = canvas.offsetY;
+    source.zoomLevel = canvas.zoomLevel;
+    bottomViewport.render(source, canvas.dirty, buffer, fbWidth, fbHeight, forceFull);
+}
 
-            int canvasX = canvas.screenToCanvasX(screenX);
-            int canvasY = canvas.screenToCanvasY(screenY);
-            int bufferIdx = 3 * (fbY * fbWidth + fbX);
-            if (canvasX >= 0 && canvasX < canvas.width && canvasY >= 0 && canvasY < canvas.height)
-            {
-                int canvasIdx = 3 * (canvasY * canvas.width + canvasX);
-                buffer[bufferIdx] = canvas.pixels[canvasIdx + 2];
-                buffer[bufferIdx + 1] = canvas.pixels[canvasIdx + 1];
-                buffer[bufferIdx + 2] = canvas.pixels[canvasIdx];
-            }
-            else
-            {
-                buffer[bufferIdx] = buffer[bufferIdx + 1] = buffer[bufferIdx + 2] = 240;
-            }
-        }
-    }
+void Renderer::invalidateViewport()
+{
+    bottomViewport.invalidate();
+}
+
+void Renderer::invalidateViewportRect(int x, int y, int w, int h)
+{
+    bottomViewport.invalidateScreenRect(x, y, w, h);
 }
 
 static void setTopPixel(u8 *target, int width, int height, int screenX, int screenY, u8 r, u8 g, u8 b)
@@ -241,29 +246,13 @@ static void drawTopChrome(bool connected, bool updateAvailable)
 
 void Renderer::invalidateMinimap()
 {
-    minimapCacheValid = false;
+    minimap.invalidate();
     topFrameValid = false;
 }
 
-static void updateMinimapCache(CanvasState &canvas)
+void Renderer::invalidateMinimapRect(const DirtyRect &canvasRect)
 {
-    if (!canvas.pixels || canvas.width <= 0 || canvas.height <= 0)
-        return;
-
-    for (int y = 0; y < MINIMAP_H; y++)
-    {
-        for (int x = 0; x < MINIMAP_W; x++)
-        {
-            int cx = x * canvas.width / MINIMAP_W;
-            int cy = y * canvas.height / MINIMAP_H;
-            int canvasIdx = 3 * (cy * canvas.width + cx);
-            int cacheIdx = 3 * (y * MINIMAP_W + x);
-            minimapCache[cacheIdx] = canvas.pixels[canvasIdx];
-            minimapCache[cacheIdx + 1] = canvas.pixels[canvasIdx + 1];
-            minimapCache[cacheIdx + 2] = canvas.pixels[canvasIdx + 2];
-        }
-    }
-    minimapCacheValid = true;
+    minimap.invalidateCanvasRect(canvasRect);
 }
 
 static void formatBrushSize(int sizeTenths, char *buffer, size_t capacity)
@@ -296,9 +285,9 @@ static void composeCanvasTopFrame(CanvasState &canvas, bool connected, bool upda
     {
         for (int x = 0; x < mapW; x++)
         {
-            int idx = 3 * (y * MINIMAP_W + x);
+            const u8 *cell = minimap.pixels() + 3 * (y * MINIMAP_W + x);
             setTopPixel(topFrame, TOP_SCREEN_W, TOP_SCREEN_H, mapX + x, mapY + y,
-                        minimapCache[idx], minimapCache[idx + 1], minimapCache[idx + 2]);
+                        cell[0], cell[1], cell[2]);
         }
     }
     strokeTopRect(topFrame, TOP_SCREEN_W, TOP_SCREEN_H, mapX, mapY, mapW, mapH, 216, 224, 232);
@@ -1032,9 +1021,16 @@ static void composeOptionsTopFrame(CanvasState &canvas, bool connected, bool upd
         snprintf(version, sizeof(version), "Client %s", APP_BUILD_LABEL);
         ui.textClipped(196, 88, state, connected ? UiTheme::Accent : UiTheme::Danger, 180);
         ui.textClipped(196, 108, version, UiTheme::Ink, 180);
-        ui.wrappedText(196, 132,
-                       "Connection recovery and updates appear automatically when attention is needed.",
-                       UiTheme::Secondary, 180, 4);
+        if (topState && topState->uplinkStats && topState->uplinkStats[0])
+        {
+            ui.textClipped(196, 132, topState->uplinkStats, UiTheme::Secondary, 180);
+            if (topState->bufferStats && topState->bufferStats[0])
+                ui.textClipped(196, 148, topState->bufferStats, UiTheme::Secondary, 180);
+        }
+        else
+            ui.wrappedText(196, 132,
+                           "Connection recovery and updates appear automatically when attention is needed.",
+                           UiTheme::Secondary, 180, 4);
     }
     drawFooterHint("A OPEN", "B BACK");
     topFrameValid = true;
@@ -1230,10 +1226,30 @@ static void composeIdentityTopFrame(bool connected, bool updateAvailable,
     topFrameValid = true;
 }
 
+static void rotateTopFrame()
+{
+    for (int x = 0; x < TOP_SCREEN_W; x++)
+    {
+        u8 *dst = topFrameRotated + 3 * x * TOP_SCREEN_H;
+        const u8 *src = topFrame + 3 * ((TOP_SCREEN_H - 1) * TOP_SCREEN_W + x);
+        for (int fbX = 0; fbX < TOP_SCREEN_H; fbX++, dst += 3, src -= 3 * TOP_SCREEN_W)
+        {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+        }
+    }
+}
+
 static void presentTopFrameToFramebuffer(u8 *fb, u16 fbWidth, u16 fbHeight)
 {
     if (!fb || !topFrameValid)
         return;
+    if (fbWidth == TOP_SCREEN_H && fbHeight == TOP_SCREEN_W)
+    {
+        memcpy(fb, topFrameRotated, sizeof(topFrameRotated));
+        return;
+    }
 
     const int screenWidth = fbHeight;
     const int screenHeight = fbWidth;
@@ -1276,12 +1292,8 @@ void Renderer::renderTop(CanvasState &canvas, bool connected, bool updateAvailab
                          bool restrictionHasDuration, const char *restrictionReason,
                          const RendererTopState *topState)
 {
-    minimapFrameCounter++;
-    if (mode == TOP_MODE_CANVAS && (!minimapCacheValid || minimapFrameCounter >= 15))
-    {
-        updateMinimapCache(canvas);
-        minimapFrameCounter = 0;
-    }
+    if (mode == TOP_MODE_CANVAS)
+        minimap.update(canvas.pixels, canvas.width, canvas.height);
 
     if (mode == TOP_MODE_CHANNELS)
         composeChannelTopFrame(canvas, connected, updateAvailable, channels, channelCount, selectedChannel,
@@ -1330,15 +1342,34 @@ void Renderer::renderTop(CanvasState &canvas, bool connected, bool updateAvailab
                                ticketNeedsReplyCount, staffChatUnreadCount, users, userCount,
                                topState ? topState->channelInfo : NULL,
                                topState ? topState->channelInfoCount : 0);
+    ++topFrameGeneration;
 }
 
-void Renderer::presentTopFrame()
+static void presentTopEye(gfx3dSide_t side, TopEyePresent &eye)
 {
-    u16 leftWidth, leftHeight;
-    u16 rightWidth, rightHeight;
-    u8 *left = gfxGetFramebuffer(GFX_TOP, GFX_LEFT, &leftWidth, &leftHeight);
-    u8 *right = gfxGetFramebuffer(GFX_TOP, GFX_RIGHT, &rightWidth, &rightHeight);
+    u16 width, height;
+    u8 *fb = gfxGetFramebuffer(GFX_TOP, side, &width, &height);
+    // The top screen is single-buffered, so a framebuffer that already
+    // holds this generation needs no copy.
+    if (!fb || (fb == eye.framebuffer && eye.generation == topFrameGeneration))
+        return;
+    presentTopFrameToFramebuffer(fb, width, height);
+    eye.framebuffer = fb;
+    eye.generation = topFrameGeneration;
+}
 
-    presentTopFrameToFramebuffer(left, leftWidth, leftHeight);
-    presentTopFrameToFramebuffer(right, rightWidth, rightHeight);
+void Renderer::presentTopFrame()
+{
+    if (!topFrameValid)
+        return;
+    if (rotatedGeneration != topFrameGeneration)
+    {
+        rotateTopFrame();
+        rotatedGeneration = topFrameGeneration;
+    }
+    presentTopEye(GFX_LEFT, leftEyePresent);
+    // The right eye is only scanned out in stereo mode with the slider up;
+    // it is caught up from the rotated cache when that changes.
+    if (gfxIs3D() && osGet3DSliderState() > 0.0f)
+        presentTopEye(GFX_RIGHT, rightEyePresent);
 }
@@ -0,0 +1,275 @@
+#include "stroke_journal.h"
+#include "byte_order.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace Doodle
+{
+
+namespace
+{
+const char JOURNAL_MAGIC[4] = {'D', 'J', 'N', '1'};
+const size_t JOURNAL_CHANNEL_MAX = 255;
+} // namespace
+
+const size_t StrokeJournal::RECORD_HEADER_BYTES;
+
+StrokeJournal::StrokeJournal(size_t byteLimit)
+    : byteLimit_(byteLimit), head_(0), count_(0), stale_(0), unsent_(0), acknowledged_(0),
+      dropped_(0)
+{
+}
+
+void StrokeJournal::setChannel(const char *channel)
+{
+    const char *name = channel ? channel : "";
+    if (channel_ == name)
+        return;
+    clear();
+    channel_ = name;
+}
+
+bool StrokeJournal::record(uint32_t sequence, const uint8_t *packet, size_t length)
+{
+    if (!packet || length == 0 || length > 0xffff || RECORD_HEADER_BYTES + length > byteLimit_)
+        return false;
+    while (count_ > 0 && bytes() + RECORD_HEADER_BYTES + length > byteLimit_)
+    {
+        dropOldest();
+        ++dropped_;
+    }
+    compact();
+
+    uint8_t header[RECORD_HEADER_BYTES];
+    putLittle32(header, sequence);
+    header[4] = (uint8_t)length;
+    header[5] = (uint8_t)(length >> 8);
+    log_.insert(log_.end(), header, header + RECORD_HEADER_BYTES);
+    log_.insert(log_.end(), packet, packet + length);
+    ++count_;
+    if (sequence == STROKE_JOURNAL_UNSENT)
+        ++unsent_;
+    return true;
+}
+
+void StrokeJournal::acknowledge(uint32_t sequence)
+{
+    if (sequence <= acknowledged_)
+        return;
+    acknowledged_ = sequence;
+    trimAcknowledged();
+}
+
+void StrokeJournal::markStale()
+{
+    stale_ = count_;
+    unsent_ = 0;
+}
+
+bool StrokeJournal::peekStale(const uint8_t *&packet, size_t &length) const
+{
+    if (stale_ == 0)
+        return false;
+    packet = &log_[head_ + RECORD_HEADER_BYTES];
+    length = recordLength(head_);
+    return true;
+}
+
+void StrokeJournal::popStale()
+{
+    if (stale_ == 0)
+        return;
+    dropOldest();
+    if (stale_ == 0)
+        trimAcknowledged();
+}
+
+bool StrokeJournal::peekUnsent(const uint8_t *&packet, size_t &length) const
+{
+    if (unsent_ == 0)
+        return false;
+    const size_t offset = firstUnsent();
+    packet = &log_[offset + RECORD_HEADER_BYTES];
+    length = recordLength(offset);
+    return true;
+}
+
+void StrokeJournal::sent(uint32_t sequence)
+{
+    if (unsent_ == 0 || sequence == STROKE_JOURNAL_UNSENT)
+        return;
+    putLittle32(&log_[firstUnsent()], sequence);
+    --unsent_;
+}
+
+bool StrokeJournal::next(size_t &cursor, uint32_t &sequence, const uint8_t *&packet,
+                         size_t &length) const
+{
+    const size_t offset = head_ + cursor;
+    if (offset >= log_.size())
+        return false;
+    sequence = recordSequence(offset);
+    length = recordLength(offset);
+    packet = &log_[offset + RECORD_HEADER_BYTES];
+    cursor += RECORD_HEADER_BYTES + length;
+    return true;
+}
+
+void StrokeJournal::clear()
+{
+    log_.clear();
+    head_ = 0;
+    count_ = 0;
+    stale_ = 0;
+    unsent_ = 0;
+}
+
+bool StrokeJournal::save(const char *path) const
+{
+    if (!path)
+        return false;
+    if (count_ == 0)
+    {
+        remove(path);
+        return true;
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+    uint8_t header[9];
+    memcpy(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    const size_t channelLength = channel_.size() < JOURNAL_CHANNEL_MAX ? channel_.size() : JOURNAL_CHANNEL_MAX;
+    header[4] = (uint8_t)channelLength;
+    putLittle32(header + 5, (uint32_t)bytes());
+    bool wroteAll = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                    fwrite(channel_.data(), 1, channelLength, file) == channelLength &&
+                    fwrite(&log_[head_], 1, bytes(), file) == bytes();
+    return fclose(file) == 0 && wroteAll;
+}
+
+bool StrokeJournal::load(const char *path)
+{
+    clear();
+    channel_.clear();
+    FILE *file = path ? fopen(path, "rb") : NULL;
+    if (!file)
+        return false;
+    uint8_t header[9];
+    char channel[JOURNAL_CHANNEL_MAX + 1];
+    std::vector<uint8_t> records;
+    bool valid = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+                 memcmp(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0;
+    const size_t recordBytes = valid ? getLittle32(header + 5) : 0;
+    valid = valid && recordBytes <= byteLimit_ &&
+            fread(channel, 1, header[4], file) == header[4];
+    if (valid)
+    {
+        records.resize(recordBytes);
+        valid = recordBytes == 0 || fread(&records[0], 1, recordBytes, file) == recordBytes;
+    }
+    fclose(file);
+    if (!valid)
+        return false;
+
+    size_t offset = 0;
+    size_t count = 0;
+    while (offset < records.size())
+    {
+        if (records.size() - offset < RECORD_HEADER_BYTES)
+            return false;
+        const size_t length = records[offset + 4] | ((size_t)records[offset + 5] << 8);
+        if (length == 0 || records.size() - offset - RECORD_HEADER_BYTES < length)
+            return false;
+        offset += RECORD_HEADER_BYTES + length;
+        ++count;
+    }
+    channel[header[4]] = '\0';
+    channel_ = channel;
+    log_.swap(records);
+    count_ = count;
+    stale_ = count;
+    return true;
+}
+
+size_t StrokeJournal::recordLength(size_t offset) const
+{
+    return log_[offset + 4] | ((size_t)log_[offset + 5] << 8);
+}
+
+uint32_t StrokeJournal::recordSequence(size_t offset) const
+{
+    return getLittle32(&log_[offset]);
+}
+
+// The first unsent record past the stale ones; only valid while unsent_ > 0.
+size_t StrokeJournal::firstUnsent() const
+{
+    size_t offset = head_;
+    for (size_t skipped = 0; skipped < stale_ || recordSequence(offset) != STROKE_JOURNAL_UNSENT; ++skipped)
+        offset += RECORD_HEADER_BYTES + recordLength(offset);
+    return offset;
+}
+
+void StrokeJournal::dropOldest()
+{
+    const bool unsent = stale_ == 0 && recordSequence(head_) == STROKE_JOURNAL_UNSENT;
+    head_ += RECORD_HEADER_BYTES + recordLength(head_);
+    --count_;
+    if (stale_ > 0)
+        --stale_;
+    else if (unsent)
+        --unsent_;
+    if (count_ == 0)
+    {
+        log_.clear();
+        head_ = 0;
+    }
+}
+
+void StrokeJournal::trimAcknowledged()
+{
+    if (stale_ > 0)
+        return;
+    while (count_ > 0)
+    {
+        const uint32_t sequence = recordSequence(head_);
+        if (sequence == STROKE_JOURNAL_UNSENT || sequence > acknowledged_)
+            break;
+        dropOldest();
+    }
+    if (unsent_ == 0)
+        return;
+    // Packets sent past an unsent one are confirmed behind it; close them
+    // out so they do not hold their bytes until the limit drops them.
+    size_t kept = head_;
+    for (size_t offset = head_; offset < log_.size();)
+    {
+        const size_t recordBytes = RECORD_HEADER_BYTES + recordLength(offset);
+        const uint32_t sequence = recordSequence(offset);
+        if (sequence != STROKE_JOURNAL_UNSENT && sequence <= acknowledged_)
+        {
+            --count_;
+        }
+        else
+        {
+            if (kept != offset)
+                memmove(&log_[kept], &log_[offset], recordBytes);
+            kept += recordBytes;
+        }
+        offset += recordBytes;
+    }
+    log_.resize(kept);
+}
+
+// Records are only ever removed from the front; slide the rest down once
+// the dead space outweighs them rather than on every removal.
+void StrokeJournal::compact()
+{
+    if (head_ == 0 || head_ < log_.size() - head_)
+        return;
+    log_.erase(log_.begin(), log_.begin() + head_);
+    head_ = 0;
+}
+
+} // namespace Doodle
@@ -0,0 +1,115 @@
+#include "stroke_simplify.h"
+#include "brush_render.h"
+
+namespace Doodle
+{
+
+namespace
+{
+
+// Squared distance from p to the segment a-b, in square pixels.
+double segmentDistanceSquared(const DrawPoint &p, const DrawPoint &a, const DrawPoint &b)
+{
+    const double dx = (double)(b.x - a.x);
+    const double dy = (double)(b.y - a.y);
+    const double px = (double)(p.x - a.x);
+    const double py = (double)(p.y - a.y);
+    const double lengthSquared = dx * dx + dy * dy;
+    const double along = px * dx + py * dy;
+    if (lengthSquared == 0.0 || along <= 0.0)
+        return px * px + py * py;
+    if (along >= lengthSquared)
+        return (px - dx) * (px - dx) + (py - dy) * (py - dy);
+    const double cross = px * dy - py * dx;
+    return cross * cross / lengthSquared;
+}
+
+} // namespace
+
+StrokeSimplifier::StrokeSimplifier(int toleranceTenths)
+    : toleranceTenths_(toleranceTenths)
+{
+}
+
+void StrokeSimplifier::simplify(const DrawPoint *points, size_t count, int sizeTenths, int shape,
+                                std::vector<DrawPoint> &out)
+{
+    out.clear();
+    if (!points || count == 0)
+        return;
+    if (count <= 2 || toleranceTenths_ < 0)
+    {
+        out.assign(points, points + count);
+        return;
+    }
+
+    const double tolerance = (double)toleranceTenths_ / 10.0;
+    const double toleranceSquared = tolerance * tolerance;
+    const bool sparse = brushUsesSparseSampling(shape);
+    if (sparse)
+    {
+        // Stamps a receiver places from the first point up to each point.
+        stepsBefore_.resize(count);
+        stepsBefore_[0] = 0;
+        for (size_t i = 1; i < count; ++i)
+            stepsBefore_[i] = stepsBefore_[i - 1] +
+                              brushStrokeSegmentSteps(points[i].x - points[i - 1].x,
+                                                      points[i].y - points[i - 1].y,
+                                                      sizeTenths, shape);
+    }
+
+    keep_.assign(count, false);
+    keep_[0] = true;
+    keep_[count - 1] = true;
+    spans_.clear();
+    Span whole = {0, count - 1};
+    spans_.push_back(whole);
+    while (!spans_.empty())
+    {
+        const Span span = spans_.back();
+        spans_.pop_back();
+        if (span.last - span.first < 2)
+            continue;
+
+        const DrawPoint &first = points[span.first];
+        const DrawPoint &last = points[span.last];
+        size_t farthest = span.first + 1;
+        double farthestDistance = -1.0;
+        for (size_t i = span.first + 1; i < span.last; ++i)
+        {
+            const double distance = segmentDistanceSquared(points[i], first, last);
+            if (distance > farthestDistance)
+            {
+                farthest = i;
+                farthestDistance = distance;
+            }
+        }
+
+        bool chordFits = farthestDistance <= toleranceSquared;
+        if (chordFits && sparse)
+        {
+            const int chordSteps = brushStrokeSegmentSteps(last.x - first.x, last.y - first.y,
+                                                           sizeTenths, shape);
+            chordFits = chordSteps == stepsBefore_[span.last] - stepsBefore_[span.first];
+            // Every sample is close to the chord, so any split will do.
+            if (!chordFits)
+                farthest = span.first + (span.last - span.first) / 2;
+        }
+        if (chordFits)
+            continue;
+
+        keep_[farthest] = true;
+        Span before = {span.first, farthest};
+        Span after = {farthest, span.last};
+        spans_.push_back(after);
+        spans_.push_back(before);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (keep_[i])
+            out.push_back(points[i]);
+    }
+}
+
+} // namespace Doodle
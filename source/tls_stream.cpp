@@ -15,7 +15,7 @@
 #include <unistd.h>
 #include <new>
 
-#include "cacert_pem.h"
+#include "cacert_dts.h"
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/entropy.h"
 #include "mbedtls/error.h"
@@ -23,6 +23,7 @@
 #include "mbedtls/platform_time.h"
 #include "mbedtls/ssl.h"
 #include "mbedtls/x509_crt.h"
+#include "trust_store.h"
 
 extern "C" mbedtls_ms_time_t mbedtls_ms_time(void)
 {
@@ -37,7 +38,28 @@ const char RNG_PERSONALIZATION[] = "CollabDoodle/TlsStream/1";
 bool g_initialized = false;
 bool g_sslcInitialized = false;
 bool g_caInitialized = false;
-mbedtls_x509_crt g_caChain;
+// Roots are looked up by issuer name during each verification and parsed
+// only then; see trust_store.h.
+Doodle::TrustStore g_trustStore;
+
+// Sessions worth resuming, shared by the WebSocket worker and the updater.
+// A resumed TLS 1.2 handshake skips the certificate chain and ECDHE work
+// that dominates a full handshake on Old 3DS hardware.
+const int SESSION_CACHE_SLOTS = 4;
+const u64 SESSION_CACHE_MAX_AGE_MS = 2ULL * 60ULL * 60ULL * 1000ULL;
+
+struct CachedSession
+{
+    bool used;
+    char host[256];
+    char port[8];
+    u64 savedAt;
+    mbedtls_ssl_session session;
+};
+
+CachedSession g_sessions[SESSION_CACHE_SLOTS];
+LightLock g_sessionLock;
+bool g_sessionCacheReady = false;
 
 const int ALLOWED_CIPHERSUITES[] = {
     MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
@@ -104,6 +126,87 @@ int systemEntropy(void*, unsigned char* output, size_t length, size_t* produced)
     return 0;
 }
 
+CachedSession* findCachedSessionLocked(const char* host, const char* port)
+{
+    for (int i = 0; i < SESSION_CACHE_SLOTS; ++i)
+    {
+        if (g_sessions[i].used && strcmp(g_sessions[i].host, host) == 0 &&
+            strcmp(g_sessions[i].port, port) == 0)
+            return &g_sessions[i];
+    }
+    return NULL;
+}
+
+void releaseCachedSessionLocked(CachedSession* entry)
+{
+    if (!entry->used)
+        return;
+    mbedtls_ssl_session_free(&entry->session);
+    entry->used = false;
+}
+
+// Returns true when a cached session was loaded into ssl.
+bool offerCachedSession(mbedtls_ssl_context* ssl, const char* host, const char* port)
+{
+    if (!g_sessionCacheReady)
+        return false;
+    bool offered = false;
+    LightLock_Lock(&g_sessionLock);
+    CachedSession* entry = findCachedSessionLocked(host, port);
+    if (entry && osGetTime() - entry->savedAt > SESSION_CACHE_MAX_AGE_MS)
+        releaseCachedSessionLocked(entry);
+    else if (entry)
+        offered = mbedtls_ssl_set_session(ssl, &entry->session) == 0;
+    LightLock_Unlock(&g_sessionLock);
+    return offered;
+}
+
+void storeCachedSession(const mbedtls_ssl_context* ssl, const char* host, const char* port)
+{
+    if (!g_sessionCacheReady || strlen(host) >= sizeof(g_sessions[0].host) ||
+        strlen(port) >= sizeof(g_sessions[0].port))
+        return;
+    LightLock_Lock(&g_sessionLock);
+    CachedSession* entry = findCachedSessionLocked(host, port);
+    for (int i = 0; !entry && i < SESSION_CACHE_SLOTS; ++i)
+    {
+        if (!g_sessions[i].used)
+            entry = &g_sessions[i];
+    }
+    if (!entry)
+    {
+        entry = &g_sessions[0];
+        for (int i = 1; i < SESSION_CACHE_SLOTS; ++i)
+        {
+            if (g_sessions[i].savedAt < entry->savedAt)
+                entry = &g_sessions[i];
+        }
+    }
+    releaseCachedSessionLocked(entry);
+    mbedtls_ssl_session_init(&entry->session);
+    if (mbedtls_ssl_get_session(ssl, &entry->session) == 0)
+    {
+        snprintf(entry->host, sizeof(entry->host), "%s", host);
+        snprintf(entry->port, sizeof(entry->port), "%s", port);
+        entry->savedAt = osGetTime();
+        entry->used = true;
+    }
+    else
+        mbedtls_ssl_session_free(&entry->session);
+    LightLock_Unlock(&g_sessionLock);
+}
+
+void forgetCachedSession(const char* host, const char* port)
+{
+    if (!g_sessionCacheReady)
+        return;
+    LightLock_Lock(&g_sessionLock);
+    CachedSession* entry = findCachedSessionLocked(host, port);
+    if (entry)
+        releaseCachedSessionLocked(entry);
+    LightLock_Unlock(&g_sessionLock);
+}
+
 u64 deadlineFromNow(int timeoutMs)
 {
     return osGetTime() + (u64)(timeoutMs > 0 ? timeoutMs : 0);
@@ -260,9 +363,11 @@ struct TlsStream::Impl
     }
 };
 
-TlsStream::TlsStream() : impl_(new (std::nothrow) Impl())
+TlsStream::TlsStream()
+    : impl_(new (std::nothrow) Impl()), handshakeResumed_(false), handshakeMs_(0)
 {
     lastError_[0] = '\0';
+    handshakeSummary_[0] = '\0';
     if (!impl_)
         copyError(lastError_, sizeof(lastError_), "Out of memory creating TLS stream");
 }
@@ -287,33 +392,19 @@ bool TlsStream::initialize()
     }
     g_sslcInitialized = true;
 
-    mbedtls_x509_crt_init(&g_caChain);
-    g_caInitialized = true;
-
-    unsigned char* nullTerminatedBundle =
-        static_cast<unsigned char*>(malloc(cacert_pem_size + 1));
-    if (!nullTerminatedBundle)
+    if (!g_sessionCacheReady)
     {
-        printf("TLS CA bundle allocation failed\n");
-        shutdown();
-        return false;
+        LightLock_Init(&g_sessionLock);
+        g_sessionCacheReady = true;
     }
-    memcpy(nullTerminatedBundle, cacert_pem, cacert_pem_size);
-    nullTerminatedBundle[cacert_pem_size] = '\0';
 
-    int parseResult = mbedtls_x509_crt_parse(&g_caChain, nullTerminatedBundle,
-                                             cacert_pem_size + 1);
-    free(nullTerminatedBundle);
-    if (parseResult != 0)
+    if (!g_trustStore.attach(cacert_dts, cacert_dts_size))
     {
-        char detail[128];
-        detail[0] = '\0';
-        if (parseResult < 0)
-            mbedtls_strerror(parseResult, detail, sizeof(detail));
-        printf("TLS CA bundle parse failed: %d %s\n", parseResult, detail);
+        printf("TLS trust store is malformed (%u bytes)\n", (unsigned)cacert_dts_size);
         shutdown();
         return false;
     }
+    g_caInitialized = true;
 
     // Prove the service produces entropy now, rather than discovering a broken
     // RNG only during the first connection handshake.
@@ -334,11 +425,14 @@ bool TlsStream::initialize()
 void TlsStream::shutdown()
 {
     g_initialized = false;
-    if (g_caInitialized)
+    if (g_sessionCacheReady)
     {
-        mbedtls_x509_crt_free(&g_caChain);
-        g_caInitialized = false;
+        LightLock_Lock(&g_sessionLock);
+        for (int i = 0; i < SESSION_CACHE_SLOTS; ++i)
+            releaseCachedSessionLocked(&g_sessions[i]);
+        LightLock_Unlock(&g_sessionLock);
     }
+    g_caInitialized = false;
     if (g_sslcInitialized)
     {
         sslcExit();
@@ -349,6 +443,9 @@ void TlsStream::shutdown()
 bool TlsStream::connect(const char* host, const char* port, int timeoutMs)
 {
     lastError_[0] = '\0';
+    handshakeSummary_[0] = '\0';
+    handshakeResumed_ = false;
+    handshakeMs_ = 0;
     if (!impl_)
     {
         copyError(lastError_, sizeof(lastError_), "TLS stream is unavailable");
@@ -455,7 +552,7 @@ bool TlsStream::connect(const char* host, const char* port, int timeoutMs)
     if (result == 0)
     {
         mbedtls_ssl_conf_authmode(&impl_->config, MBEDTLS_SSL_VERIFY_REQUIRED);
-        mbedtls_ssl_conf_ca_chain(&impl_->config, &g_caChain, NULL);
+        mbedtls_ssl_conf_ca_cb(&impl_->config, Doodle::trustStoreIssuers, &g_trustStore);
         mbedtls_ssl_conf_rng(&impl_->config, mbedtls_ctr_drbg_random, &impl_->ctrDrbg);
         mbedtls_ssl_conf_ciphersuites(&impl_->config, ALLOWED_CIPHERSUITES);
         mbedtls_ssl_conf_groups(&impl_->config, ALLOWED_GROUPS);
@@ -471,13 +568,21 @@ bool TlsStream::connect(const char* host, const char* port, int timeoutMs)
         close();
         return false;
     }
+    const bool offeredSession = offerCachedSession(&impl_->ssl, host, port);
 
     mbedtls_ssl_set_bio(&impl_->ssl, &impl_->socketFd, socketSend, socketReceive, NULL);
-    for (;;)
+    const u64 handshakeStart = osGetTime();
+    // Stepping the handshake lets us see whether the server sent its
+    // certificate; an abbreviated (resumed) handshake goes straight from
+    // ServerHello to ChangeCipherSpec.
+    bool sawServerCertificate = false;
+    while (!mbedtls_ssl_is_handshake_over(&impl_->ssl))
     {
-        result = mbedtls_ssl_handshake(&impl_->ssl);
+        result = mbedtls_ssl_handshake_step(&impl_->ssl);
+        if (impl_->ssl.MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_SERVER_CERTIFICATE)
+            sawServerCertificate = true;
         if (result == 0)
-            break;
+            continue;
         if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE)
         {
             uint32_t verifyFlags = mbedtls_ssl_get_verify_result(&impl_->ssl);
@@ -485,6 +590,8 @@ bool TlsStream::connect(const char* host, const char* port, int timeoutMs)
                 formatVerifyError(lastError_, sizeof(lastError_), verifyFlags);
             else
                 formatMbedError(lastError_, sizeof(lastError_), "TLS handshake failed", result);
+            if (offeredSession)
+                forgetCachedSession(host, port);
             close();
             return false;
         }
@@ -502,14 +609,39 @@ bool TlsStream::connect(const char* host, const char* port, int timeoutMs)
     if (verifyFlags != 0)
     {
         formatVerifyError(lastError_, sizeof(lastError_), verifyFlags);
+        forgetCachedSession(host, port);
         close();
         return false;
     }
 
+    handshakeResumed_ = offeredSession && !sawServerCertificate;
+    handshakeMs_ = (unsigned long)(osGetTime() - handshakeStart);
+    snprintf(handshakeSummary_, sizeof(handshakeSummary_), "TLS %s in %lu ms",
+             handshakeResumed_ ? "resumed" : "full handshake", handshakeMs_);
+    // A resumed session keeps its ID or ticket, so only a full handshake
+    // has anything new to cache.
+    if (!handshakeResumed_)
+        storeCachedSession(&impl_->ssl, host, port);
+
     impl_->open = true;
     return true;
 }
 
+bool TlsStream::handshakeResumed() const
+{
+    return handshakeResumed_;
+}
+
+unsigned long TlsStream::handshakeMilliseconds() const
+{
+    return handshakeMs_;
+}
+
+const char* TlsStream::handshakeSummary() const
+{
+    return handshakeSummary_[0] ? handshakeSummary_ : "no TLS handshake";
+}
+
 TlsStream::IoResult TlsStream::read(void* buffer, size_t capacity, size_t& bytesRead)
 {
     bytesRead = 0;
@@ -592,6 +724,17 @@ void TlsStream::close()
     impl_->resetTls();
 }
 
+int TlsStream::socketDescriptor() const
+{
+    return isOpen() ? impl_->socketFd : -1;
+}
+
+bool TlsStream::hasPendingInput() const
+{
+    return isOpen() && (mbedtls_ssl_get_bytes_avail(&impl_->ssl) > 0 ||
+                        mbedtls_ssl_check_pending(&impl_->ssl) != 0);
+}
+
 bool TlsStream::isOpen() const
 {
     return impl_ && impl_->open && impl_->socketFd >= 0;
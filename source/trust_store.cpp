@@ -0,0 +1,366 @@
+#include "trust_store.h"
+#include "byte_order.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace Doodle
+{
+
+namespace
+{
+const char TRUST_STORE_MAGIC[4] = {'D', 'T', 'S', '1'};
+const char PEM_BEGIN[] = "-----BEGIN CERTIFICATE-----";
+const char PEM_END[] = "-----END CERTIFICATE-----";
+
+const uint8_t DER_SEQUENCE = 0x30;
+const uint8_t DER_SET = 0x31;
+const uint8_t DER_OID = 0x06;
+const uint8_t DER_UTF8_STRING = 0x0c;
+const uint8_t DER_PRINTABLE_STRING = 0x13;
+const uint8_t DER_EXPLICIT_0 = 0xa0;
+
+const uint32_t FNV_OFFSET = 2166136261u;
+const uint32_t FNV_PRIME = 16777619u;
+
+struct PendingEntry
+{
+    uint32_t hash;
+    size_t order;
+    std::vector<uint8_t> der;
+};
+
+bool entryBefore(const PendingEntry *a, const PendingEntry *b)
+{
+    return a->hash != b->hash ? a->hash < b->hash : a->order < b->order;
+}
+
+// One DER element with a definite length. cursor moves past it.
+bool readElement(const uint8_t *&cursor, const uint8_t *end, uint8_t &tag,
+                 const uint8_t *&contents, size_t &length)
+{
+    if (end - cursor < 2)
+        return false;
+    tag = cursor[0];
+    size_t value = cursor[1];
+    cursor += 2;
+    if (value & 0x80)
+    {
+        size_t lengthBytes = value & 0x7f;
+        if (lengthBytes == 0 || lengthBytes > 4 || (size_t)(end - cursor) < lengthBytes)
+            return false;
+        value = 0;
+        while (lengthBytes-- > 0)
+            value = (value << 8) | *cursor++;
+    }
+    if ((size_t)(end - cursor) < value)
+        return false;
+    contents = cursor;
+    length = value;
+    cursor += value;
+    return true;
+}
+
+void mixByte(uint32_t &hash, uint8_t byte)
+{
+    hash = (hash ^ byte) * FNV_PRIME;
+}
+
+void mixLength(uint32_t &hash, size_t length)
+{
+    mixByte(hash, (uint8_t)(length >> 8));
+    mixByte(hash, (uint8_t)length);
+}
+
+bool hashAttribute(uint32_t &hash, const uint8_t *attribute, size_t length)
+{
+    const uint8_t *cursor = attribute;
+    const uint8_t *end = attribute + length;
+    uint8_t tag;
+    const uint8_t *oid;
+    const uint8_t *value;
+    size_t oidLength, valueLength;
+    if (!readElement(cursor, end, tag, oid, oidLength) || tag != DER_OID ||
+        !readElement(cursor, end, tag, value, valueLength))
+        return false;
+
+    mixLength(hash, oidLength);
+    for (size_t i = 0; i < oidLength; ++i)
+        mixByte(hash, oid[i]);
+
+    // Mbed TLS matches these two string types to each other, ignoring ASCII
+    // case; every other type must match exactly.
+    const bool folded = tag == DER_UTF8_STRING || tag == DER_PRINTABLE_STRING;
+    mixByte(hash, folded ? DER_UTF8_STRING : tag);
+    mixLength(hash, valueLength);
+    for (size_t i = 0; i < valueLength; ++i)
+    {
+        uint8_t byte = value[i];
+        if (folded && byte >= 'A' && byte <= 'Z')
+            byte = (uint8_t)(byte + ('a' - 'A'));
+        mixByte(hash, byte);
+    }
+    return true;
+}
+
+bool hashName(uint32_t &hash, const uint8_t *name, size_t length)
+{
+    const uint8_t *cursor = name;
+    const uint8_t *end = name + length;
+    uint8_t tag;
+    const uint8_t *sets;
+    size_t setsLength;
+    if (!readElement(cursor, end, tag, sets, setsLength) || tag != DER_SEQUENCE)
+        return false;
+
+    cursor = sets;
+    end = sets + setsLength;
+    while (cursor < end)
+    {
+        const uint8_t *set;
+        size_t setLength;
+        if (!readElement(cursor, end, tag, set, setLength) || tag != DER_SET)
+            return false;
+        mixByte(hash, DER_SET);
+        const uint8_t *attributeCursor = set;
+        const uint8_t *setEnd = set + setLength;
+        while (attributeCursor < setEnd)
+        {
+            const uint8_t *attribute;
+            size_t attributeLength;
+            if (!readElement(attributeCursor, setEnd, tag, attribute, attributeLength) ||
+                tag != DER_SEQUENCE || !hashAttribute(hash, attribute, attributeLength))
+                return false;
+        }
+    }
+    return true;
+}
+
+int base64Value(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '+')
+        return 62;
+    if (c == '/')
+        return 63;
+    return -1;
+}
+
+bool decodeBase64(const char *text, size_t length, std::vector<uint8_t> &bytes)
+{
+    bytes.clear();
+    uint32_t bits = 0;
+    int bitCount = 0;
+    size_t padding = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        const char c = text[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            continue;
+        if (c == '=')
+        {
+            ++padding;
+            continue;
+        }
+        const int value = base64Value(c);
+        if (value < 0 || padding > 0)
+            return false;
+        bits = (bits << 6) | (uint32_t)value;
+        bitCount += 6;
+        if (bitCount >= 8)
+        {
+            bitCount -= 8;
+            bytes.push_back((uint8_t)(bits >> bitCount));
+        }
+    }
+    return padding <= 2 && !bytes.empty();
+}
+
+const char *findText(const char *begin, const char *end, const char *text)
+{
+    const size_t length = strlen(text);
+    const char *found = std::search(begin, end, text, text + length);
+    return found == end ? NULL : found;
+}
+} // namespace
+
+uint32_t trustStoreNameHash(const uint8_t *name, size_t length)
+{
+    uint32_t hash = FNV_OFFSET;
+    if (name && hashName(hash, name, length))
+        return hash;
+    // Not a Name Mbed TLS would have parsed; hash the bytes so the result is
+    // still stable.
+    hash = FNV_OFFSET;
+    for (size_t i = 0; name && i < length; ++i)
+        mixByte(hash, name[i]);
+    return hash;
+}
+
+bool certificateSubject(const uint8_t *der, size_t length,
+                        const uint8_t *&subject, size_t &subjectLength)
+{
+    const uint8_t *cursor = der;
+    const uint8_t *end = der + length;
+    uint8_t tag;
+    const uint8_t *contents;
+    size_t contentsLength;
+    if (!der || !readElement(cursor, end, tag, contents, contentsLength) || tag != DER_SEQUENCE)
+        return false;
+    cursor = contents;
+    end = contents + contentsLength;
+    if (!readElement(cursor, end, tag, contents, contentsLength) || tag != DER_SEQUENCE)
+        return false;
+
+    // TBSCertificate: [0] version, serial, signature algorithm, issuer,
+    // validity, subject.
+    cursor = contents;
+    end = contents + contentsLength;
+    if (!readElement(cursor, end, tag, contents, contentsLength))
+        return false;
+    int skip = tag == DER_EXPLICIT_0 ? 4 : 3;
+    while (skip-- > 0)
+    {
+        if (!readElement(cursor, end, tag, contents, contentsLength))
+            return false;
+    }
+    const uint8_t *element = cursor;
+    if (!readElement(cursor, end, tag, contents, contentsLength) || tag != DER_SEQUENCE)
+        return false;
+    subject = element;
+    subjectLength = (size_t)(cursor - element);
+    return true;
+}
+
+bool buildTrustStore(const char *pem, size_t length, std::vector<uint8_t> &table,
+                     size_t *certificates)
+{
+    table.clear();
+    if (certificates)
+        *certificates = 0;
+    if (!pem)
+        return false;
+
+    std::vector<PendingEntry> entries;
+    const char *cursor = pem;
+    const char *end = pem + length;
+    while (const char *begin = findText(cursor, end, PEM_BEGIN))
+    {
+        const char *body = begin + strlen(PEM_BEGIN);
+        const char *bodyEnd = findText(body, end, PEM_END);
+        if (!bodyEnd)
+            return false;
+        PendingEntry entry;
+        const uint8_t *subject;
+        size_t subjectLength;
+        if (!decodeBase64(body, (size_t)(bodyEnd - body), entry.der) ||
+            !certificateSubject(&entry.der[0], entry.der.size(), subject, subjectLength))
+            return false;
+        entry.hash = trustStoreNameHash(subject, subjectLength);
+        entry.order = entries.size();
+        entries.push_back(entry);
+        cursor = bodyEnd + strlen(PEM_END);
+    }
+    if (entries.empty())
+        return false;
+
+    std::vector<const PendingEntry *> sorted;
+    for (size_t i = 0; i < entries.size(); ++i)
+        sorted.push_back(&entries[i]);
+    std::sort(sorted.begin(), sorted.end(), entryBefore);
+
+    size_t offset = TRUST_STORE_HEADER_BYTES + entries.size() * TRUST_STORE_ENTRY_BYTES;
+    table.resize(offset);
+    memcpy(&table[0], TRUST_STORE_MAGIC, sizeof(TRUST_STORE_MAGIC));
+    putLittle32(&table[4], (uint32_t)entries.size());
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        uint8_t *index = &table[TRUST_STORE_HEADER_BYTES + i * TRUST_STORE_ENTRY_BYTES];
+        putLittle32(index, sorted[i]->hash);
+        putLittle32(index + 4, (uint32_t)offset);
+        putLittle32(index + 8, (uint32_t)sorted[i]->der.size());
+        offset += sorted[i]->der.size();
+    }
+    for (size_t i = 0; i < sorted.size(); ++i)
+        table.insert(table.end(), sorted[i]->der.begin(), sorted[i]->der.end());
+    if (certificates)
+        *certificates = entries.size();
+    return true;
+}
+
+TrustStore::TrustStore()
+    : table_(NULL), size_(0), count_(0)
+{
+}
+
+bool TrustStore::attach(const uint8_t *table, size_t size)
+{
+    table_ = NULL;
+    size_ = 0;
+    count_ = 0;
+    if (!table || size < TRUST_STORE_HEADER_BYTES ||
+        memcmp(table, TRUST_STORE_MAGIC, sizeof(TRUST_STORE_MAGIC)) != 0)
+        return false;
+    const size_t count = getLittle32(table + 4);
+    if (count > (size - TRUST_STORE_HEADER_BYTES) / TRUST_STORE_ENTRY_BYTES)
+        return false;
+    const size_t indexEnd = TRUST_STORE_HEADER_BYTES + count * TRUST_STORE_ENTRY_BYTES;
+    uint32_t previousHash = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *index = table + TRUST_STORE_HEADER_BYTES + i * TRUST_STORE_ENTRY_BYTES;
+        const uint32_t hash = getLittle32(index);
+        const size_t offset = getLittle32(index + 4);
+        const size_t length = getLittle32(index + 8);
+        if ((i > 0 && hash < previousHash) || offset < indexEnd || length == 0 ||
+            offset > size || length > size - offset)
+            return false;
+        previousHash = hash;
+    }
+    table_ = table;
+    size_ = size;
+    count_ = count;
+    return true;
+}
+
+size_t TrustStore::findSubject(const uint8_t *name, size_t length, size_t &first) const
+{
+    const uint32_t hash = trustStoreNameHash(name, length);
+    size_t low = 0;
+    size_t high = count_;
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        if (entryHash(middle) < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    first = low;
+    size_t last = low;
+    while (last < count_ && entryHash(last) == hash)
+        ++last;
+    return last - low;
+}
+
+bool TrustStore::certificate(size_t index, const uint8_t *&der, size_t &length) const
+{
+    if (index >= count_)
+        return false;
+    const uint8_t *entry = table_ + TRUST_STORE_HEADER_BYTES + index * TRUST_STORE_ENTRY_BYTES;
+    der = table_ + getLittle32(entry + 4);
+    length = getLittle32(entry + 8);
+    return true;
+}
+
+uint32_t TrustStore::entryHash(size_t index) const
+{
+    return getLittle32(table_ + TRUST_STORE_HEADER_BYTES + index * TRUST_STORE_ENTRY_BYTES);
+}
+
+} // namespace Doodle
@@ -0,0 +1,43 @@
+#include "trust_store.h"
+
+#include "mbedtls/platform.h"
+#include "mbedtls/x509_crt.h"
+
+namespace Doodle
+{
+
+int trustStoreIssuers(void *store, const mbedtls_x509_crt *child,
+                      mbedtls_x509_crt **candidates)
+{
+    *candidates = NULL;
+    const TrustStore *trustStore = static_cast<const TrustStore *>(store);
+    size_t first = 0;
+    const size_t count = trustStore->findSubject(child->issuer_raw.p, child->issuer_raw.len, first);
+    if (count == 0)
+        return 0;
+
+    mbedtls_x509_crt *list =
+        static_cast<mbedtls_x509_crt *>(mbedtls_calloc(1, sizeof(mbedtls_x509_crt)));
+    if (!list)
+        return MBEDTLS_ERR_X509_ALLOC_FAILED;
+    mbedtls_x509_crt_init(list);
+    for (size_t i = first; i < first + count; ++i)
+    {
+        const uint8_t *der;
+        size_t length;
+        trustStore->certificate(i, der, length);
+        // The table is linked into the binary, so parsed certificates can
+        // point into it rather than copy their DER.
+        const int result = mbedtls_x509_crt_parse_der_nocopy(list, der, length);
+        if (result != 0)
+        {
+            mbedtls_x509_crt_free(list);
+            mbedtls_free(list);
+            return result;
+        }
+    }
+    *candidates = list;
+    return 0;
+}
+
+} // namespace Doodle
@@ -1,5 +1,9 @@
 #include "updater.h"
 #include "https_client.h"
+#include "cia_stream.h"
+#include "delta_patch.h"
+#include "download_resume.h"
+#include "sha256.h"
 #include <3ds.h>
 #include <stdio.h>
 #include <string.h>
@@ -13,6 +17,8 @@
 static const char *UPDATE_FINAL_PATH = "sdmc:/3ds/CollabDoodle-update.3dsx";
 static const int INSTALL_PROGRESS_OFFSET = 1000000;
 static const int MAX_ARTIFACT_BYTES = 64 * 1024 * 1024;
+// Attempts per update while each one moves the .part file forward.
+static const int MAX_DOWNLOAD_ATTEMPTS = 5;
 static const char *EXPECTED_APP_ID = "collab-doodle";
 static char gLastUpdateError[160] = "";
 
@@ -24,158 +30,6 @@ static void setUpdateError(const char *fmt, ...)
     va_end(ap);
 }
 
-static unsigned int rotr(unsigned int value, unsigned int bits)
-{
-    return (value >> bits) | (value << (32 - bits));
-}
-
-struct Sha256State
-{
-    unsigned int h[8];
-    unsigned long long length;
-    unsigned char block[64];
-    int blockLen;
-};
-
-static const unsigned int SHA256_K[64] = {
-    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
-
-static void sha256Transform(Sha256State &state, const unsigned char *block)
-{
-    unsigned int w[64];
-    for (int i = 0; i < 16; i++)
-    {
-        w[i] = ((unsigned int)block[i * 4] << 24) |
-               ((unsigned int)block[i * 4 + 1] << 16) |
-               ((unsigned int)block[i * 4 + 2] << 8) |
-               (unsigned int)block[i * 4 + 3];
-    }
-    for (int i = 16; i < 64; i++)
-    {
-        unsigned int s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
-        unsigned int s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
-        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
-    }
-
-    unsigned int a = state.h[0];
-    unsigned int b = state.h[1];
-    unsigned int c = state.h[2];
-    unsigned int d = state.h[3];
-    unsigned int e = state.h[4];
-    unsigned int f = state.h[5];
-    unsigned int g = state.h[6];
-    unsigned int h = state.h[7];
-
-    for (int i = 0; i < 64; i++)
-    {
-        unsigned int s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
-        unsigned int ch = (e & f) ^ ((~e) & g);
-        unsigned int temp1 = h + s1 + ch + SHA256_K[i] + w[i];
-        unsigned int s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
-        unsigned int maj = (a & b) ^ (a & c) ^ (b & c);
-        unsigned int temp2 = s0 + maj;
-        h = g;
-        g = f;
-        f = e;
-        e = d + temp1;
-        d = c;
-        c = b;
-        b = a;
-        a = temp1 + temp2;
-    }
-
-    state.h[0] += a;
-    state.h[1] += b;
-    state.h[2] += c;
-    state.h[3] += d;
-    state.h[4] += e;
-    state.h[5] += f;
-    state.h[6] += g;
-    state.h[7] += h;
-}
-
-static void sha256Init(Sha256State &state)
-{
-    state.h[0] = 0x6a09e667;
-    state.h[1] = 0xbb67ae85;
-    state.h[2] = 0x3c6ef372;
-    state.h[3] = 0xa54ff53a;
-    state.h[4] = 0x510e527f;
-    state.h[5] = 0x9b05688c;
-    state.h[6] = 0x1f83d9ab;
-    state.h[7] = 0x5be0cd19;
-    state.length = 0;
-    state.blockLen = 0;
-}
-
-static void sha256Update(Sha256State &state, const unsigned char *data, int len)
-{
-    state.length += (unsigned long long)len * 8;
-    for (int i = 0; i < len; i++)
-    {
-        state.block[state.blockLen++] = data[i];
-        if (state.blockLen == 64)
-        {
-            sha256Transform(state, state.block);
-            state.blockLen = 0;
-        }
-    }
-}
-
-static void sha256Final(Sha256State &state, char outHex[65])
-{
-    state.block[state.blockLen++] = 0x80;
-    if (state.blockLen > 56)
-    {
-        while (state.blockLen < 64)
-            state.block[state.blockLen++] = 0;
-        sha256Transform(state, state.block);
-        state.blockLen = 0;
-    }
-    while (state.blockLen < 56)
-        state.block[state.blockLen++] = 0;
-
-    for (int i = 7; i >= 0; i--)
-        state.block[state.blockLen++] = (state.length >> (i * 8)) & 0xff;
-    sha256Transform(state, state.block);
-
-    for (int i = 0; i < 8; i++)
-        sprintf(outHex + i * 8, "%08x", state.h[i]);
-    outHex[64] = '\0';
-}
-
-static bool fileSha256(const char *path, char outHex[65])
-{
-    FILE *file = fopen(path, "rb");
-    if (!file)
-        return false;
-
-    Sha256State state;
-    sha256Init(state);
-    unsigned char buffer[2048];
-    while (true)
-    {
-        size_t read = fread(buffer, 1, sizeof(buffer), file);
-        if (read > 0)
-            sha256Update(state, buffer, (int)read);
-        if (read < sizeof(buffer))
-            break;
-    }
-    bool ok = ferror(file) == 0;
-    fclose(file);
-    if (!ok)
-        return false;
-    sha256Final(state, outHex);
-    return true;
-}
-
 static void skipJsonWhitespace(const char *&ptr)
 {
     while (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n')
@@ -504,6 +358,40 @@ static bool artifactNameMatchesType(const char *name, const char *packageType)
     return nameLength > extensionLength && strcasecmp(name + nameLength - extensionLength, extension) == 0;
 }
 
+static bool isPatchName(const char *name)
+{
+    static const char *extension = ".dpatch";
+    if (!isSafeArtifactName(name))
+        return false;
+    size_t nameLength = strlen(name);
+    size_t extensionLength = strlen(extension);
+    return nameLength > extensionLength && strcasecmp(name + nameLength - extensionLength, extension) == 0;
+}
+
+// Only a patch from exactly the running version, and smaller than the
+// artifact it replaces, is worth trying. A bad patch entry leaves the full
+// artifact to download rather than failing the manifest.
+static void parseManifestPatch(const char *body, const char *currentVersion, UpdateManifest &manifest)
+{
+    char fromVersion[32];
+    if (!parseJsonString(body, "patchFromVersion", fromVersion, sizeof(fromVersion)) ||
+        strcmp(fromVersion, currentVersion) != 0 ||
+        !parseJsonString(body, "patchUrl", manifest.patchUrl, sizeof(manifest.patchUrl)) ||
+        !parseJsonString(body, "patchName", manifest.patchName, sizeof(manifest.patchName)) ||
+        !parseJsonString(body, "patchSha256", manifest.patchSha256, sizeof(manifest.patchSha256)) ||
+        !parseJsonPositiveInt(body, "patchSize", manifest.patchSize) ||
+        !manifest.patchUrl[0] || !isPatchName(manifest.patchName) || !isHexSha256(manifest.patchSha256) ||
+        manifest.patchSize >= manifest.artifactSize)
+    {
+        manifest.patchUrl[0] = '\0';
+        manifest.patchName[0] = '\0';
+        manifest.patchSha256[0] = '\0';
+        manifest.patchSize = 0;
+        return;
+    }
+    manifest.patchAvailable = true;
+}
+
 struct ManifestSink
 {
     char *buffer;
@@ -539,8 +427,14 @@ bool Updater::fetchManifest(const char *serverDomain, const char *httpPort, cons
     memset(&manifest, 0, sizeof(manifest));
 
     const char *cleanPackage = (packageType && strcmp(packageType, "cia") == 0) ? "cia" : "3dsx";
+    int currentParts[3];
+    const bool currentValid = parseVersion(currentVersion, currentParts);
+    // Naming the running version lets the server offer a patch from it.
     char path[96];
-    snprintf(path, sizeof(path), "/api/updates/latest?package=%s", cleanPackage);
+    if (currentValid)
+        snprintf(path, sizeof(path), "/api/updates/latest?package=%s&from=%s", cleanPackage, currentVersion);
+    else
+        snprintf(path, sizeof(path), "/api/updates/latest?package=%s", cleanPackage);
 
     char body[8192];
     ManifestSink sink = {body, sizeof(body) - 1, 0};
@@ -570,8 +464,7 @@ bool Updater::fetchManifest(const char *serverDomain, const char *httpPort, cons
     }
 
     int latestParts[3];
-    int currentParts[3];
-    if (!parseVersion(manifest.latestVersion, latestParts) || !parseVersion(currentVersion, currentParts))
+    if (!parseVersion(manifest.latestVersion, latestParts) || !currentValid)
     {
         setUpdateError("MANIFEST VERSION INVALID");
         return false;
@@ -595,6 +488,8 @@ bool Updater::fetchManifest(const char *serverDomain, const char *httpPort, cons
         memset(&manifest, 0, sizeof(manifest));
         return false;
     }
+    if (manifest.available && strcmp(cleanPackage, "3dsx") == 0)
+        parseManifestPatch(body, currentVersion, manifest);
     return true;
 }
 
@@ -652,8 +547,9 @@ static bool artifactPathFromUrl(const char *artifactUrl, const char *serverDomai
 
 struct DownloadSink
 {
-    FILE *file;
-    size_t written;
+    // Hashes as it writes, so the digest needs no second pass over SD.
+    Doodle::ResumableDownload *part;
+    const HttpsResponse *response;
     int expected;
     UpdateProgressCallback progress;
     void *progressUserData;
@@ -662,14 +558,10 @@ struct DownloadSink
 static bool writeDownloadBody(const unsigned char *data, size_t length, void *userData)
 {
     DownloadSink *sink = (DownloadSink *)userData;
-    if (!sink || !sink->file || length > (size_t)0x7fffffff ||
-        sink->written > (size_t)0x7fffffff - length)
+    if (!sink || !sink->part->write(*sink->response, data, length))
         return false;
-    if (fwrite(data, 1, length, sink->file) != length)
-        return false;
-    sink->written += length;
     if (sink->progress)
-        sink->progress((int)sink->written, sink->expected, sink->progressUserData);
+        sink->progress((int)sink->part->size(), sink->expected, sink->progressUserData);
     return true;
 }
 
@@ -761,6 +653,77 @@ static bool readCiaInfo(const char *ciaPath, AM_TitleEntry &info, FS_MediaType &
     return true;
 }
 
+// The console's AM service behind the interface a CIA install is written
+// against. Each install holds its own AM session until it finishes or is
+// cancelled.
+class AmCiaInstallService : public Doodle::CiaInstallService
+{
+public:
+    AmCiaInstallService() : handle_(0), amReady_(false) {}
+    ~AmCiaInstallService() { cancel(); }
+
+    int32_t begin(uint64_t titleId)
+    {
+        Result ret = amInit();
+        if (R_FAILED(ret))
+            return ret;
+        amReady_ = true;
+        FS_MediaType media = titleDestination(titleId);
+        ret = AM_StartCiaInstall(media, &handle_);
+        if (R_FAILED(ret))
+            ret = AM_StartCiaInstallOverwrite(&handle_, media);
+        if (R_FAILED(ret))
+        {
+            handle_ = 0;
+            release();
+            return ret;
+        }
+        return 0;
+    }
+
+    int32_t write(uint64_t offset, const uint8_t *data, size_t length)
+    {
+        u32 written = 0;
+        Result ret = FSFILE_Write(handle_, &written, offset, data, (u32)length, FS_WRITE_FLUSH);
+        if (R_SUCCEEDED(ret) && written != length)
+        {
+            printf("CIA SHORT WRITE W%lu R%lu\n", (unsigned long)written, (unsigned long)length);
+            return -1;
+        }
+        return R_FAILED(ret) ? ret : 0;
+    }
+
+    // A failed finish leaves the install open for cancel(), as AM expects.
+    int32_t finish()
+    {
+        Result ret = AM_FinishCiaInstall(handle_);
+        if (R_FAILED(ret))
+            return ret;
+        handle_ = 0;
+        release();
+        return 0;
+    }
+
+    void cancel()
+    {
+        if (handle_)
+            AM_CancelCIAInstall(handle_);
+        handle_ = 0;
+        release();
+    }
+
+private:
+    void release()
+    {
+        if (amReady_)
+            amExit();
+        amReady_ = false;
+    }
+
+    Handle handle_;
+    bool amReady_;
+};
+
 static UpdateDownloadResult installCiaFromFile(const char *ciaPath, unsigned long long expectedTitleId,
                                                UpdateProgressCallback progress, void *userData)
 {
@@ -826,11 +789,8 @@ static UpdateDownloadResult installCiaFromFile(const char *ciaPath, unsigned lon
         return UPDATE_DOWNLOAD_INSTALL_FAILED;
     }
 
-    Handle ciaHandle = 0;
-    ret = AM_StartCiaInstall(media, &ciaHandle);
-    if (R_FAILED(ret))
-        ret = AM_StartCiaInstallOverwrite(&ciaHandle, media);
-
+    AmCiaInstallService service;
+    ret = service.begin(info.titleID);
     if (R_FAILED(ret))
     {
         setUpdateError("AM START 0x%08lX MEDIA %d", (unsigned long)ret, (int)media);
@@ -840,11 +800,11 @@ static UpdateDownloadResult installCiaFromFile(const char *ciaPath, unsigned lon
         return UPDATE_DOWNLOAD_INSTALL_FAILED;
     }
 
-    unsigned char *buffer = (unsigned char *)malloc(64 * 1024);
+    unsigned char *buffer = (unsigned char *)malloc(Doodle::CIA_STREAM_CHUNK_BYTES);
     if (!buffer)
     {
         setUpdateError("INSTALL OOM");
-        AM_CancelCIAInstall(ciaHandle);
+        service.cancel();
         amExit();
         fclose(file);
         return UPDATE_DOWNLOAD_INSTALL_FAILED;
@@ -854,7 +814,7 @@ static UpdateDownloadResult installCiaFromFile(const char *ciaPath, unsigned lon
     bool ok = true;
     while (offset < fileSize)
     {
-        size_t read = fread(buffer, 1, 64 * 1024, file);
+        size_t read = fread(buffer, 1, Doodle::CIA_STREAM_CHUNK_BYTES, file);
         if (read == 0)
         {
             setUpdateError("CIA READ ERR %d", ferror(file) ? errno : 0);
@@ -862,11 +822,10 @@ static UpdateDownloadResult installCiaFromFile(const char *ciaPath, unsigned lon
             break;
         }
 
-        u32 written = 0;
-        ret = FSFILE_Write(ciaHandle, &written, (u64)offset, buffer, (u32)read, FS_WRITE_FLUSH);
-        if (R_FAILED(ret) || written != read)
+        ret = service.write((u64)offset, buffer, read);
+        if (R_FAILED(ret))
         {
-            setUpdateError("CIA WRITE 0x%08lX W%lu R%lu", (unsigned long)ret, (unsigned long)written, (unsigned long)read);
+            setUpdateError("CIA WRITE 0x%08lX AT %ld", (unsigned long)ret, offset);
             printf("%s\n", gLastUpdateError);
             ok = false;
             break;
@@ -887,14 +846,14 @@ static UpdateDownloadResult installCiaFromFile(const char *ciaPath, unsigned lon
 
     if (!ok)
     {
-        AM_CancelCIAInstall(ciaHandle);
+        service.cancel();
         amExit();
         return UPDATE_DOWNLOAD_INSTALL_FAILED;
     }
 
-    ret = AM_FinishCiaInstall(ciaHandle);
+    ret = service.finish();
     if (R_FAILED(ret))
-        AM_CancelCIAInstall(ciaHandle);
+        service.cancel();
     amExit();
     if (R_FAILED(ret))
     {
@@ -907,15 +866,11 @@ static UpdateDownloadResult installCiaFromFile(const char *ciaPath, unsigned lon
     return UPDATE_DOWNLOAD_OK;
 }
 
-const char *Updater::lastError()
+// Validates what the manifest says about its artifact and resolves the
+// same-origin path to fetch it from.
+static UpdateDownloadResult checkArtifact(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
+                                          char *downloadPath, size_t downloadPathSize)
 {
-    return gLastUpdateError[0] ? gLastUpdateError : "NO DETAIL";
-}
-
-UpdateDownloadResult Updater::downloadUpdate(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
-                                             const char *targetPath, UpdateProgressCallback progress, void *userData)
-{
-    setUpdateError("");
     if (!manifest.available)
         return UPDATE_DOWNLOAD_NO_UPDATE;
     if (!manifest.artifactUrl[0] || !isSafeArtifactName(manifest.artifactName) ||
@@ -933,74 +888,196 @@ UpdateDownloadResult Updater::downloadUpdate(const char *serverDomain, const cha
         return UPDATE_DOWNLOAD_SIZE_MISMATCH;
     }
 
-    char downloadPath[320];
     if (!artifactPathFromUrl(manifest.artifactUrl, serverDomain, httpPort,
-                             manifest.artifactName, downloadPath, sizeof(downloadPath)))
+                             manifest.artifactName, downloadPath, downloadPathSize))
     {
         setUpdateError("ARTIFACT URL MUST BE SAME-ORIGIN HTTPS");
         return UPDATE_DOWNLOAD_NO_ARTIFACT;
     }
+    return UPDATE_DOWNLOAD_OK;
+}
 
-    char partPath[320];
-    if (targetPath && strncmp(targetPath, "sdmc:/cias/", 11) == 0)
-        mkdir("sdmc:/cias", 0777);
-    if (!makeSiblingPath(targetPath, ".part", partPath, sizeof(partPath)))
+struct DeltaDownloadSink
+{
+    Doodle::DeltaPatchApplier *applier;
+    int expected;
+    UpdateProgressCallback progress;
+    void *progressUserData;
+};
+
+static bool writeDeltaBody(const unsigned char *data, size_t length, void *userData)
+{
+    DeltaDownloadSink *sink = (DeltaDownloadSink *)userData;
+    if (!sink->applier->write(data, length))
+        return false;
+    if (sink->progress)
+        sink->progress((int)sink->applier->patchBytes(), sink->expected, sink->progressUserData);
+    return true;
+}
+
+static bool writePatchedFile(const uint8_t *data, size_t length, void *userData)
+{
+    return fwrite(data, 1, length, (FILE *)userData) == length;
+}
+
+// Rebuilds the new 3DSX from the installed one while the patch downloads,
+// into a sibling .patched file that replaces the target only once both the
+// patch and the result match the manifest.
+static bool applyDeltaUpdate(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
+                             const char *targetPath, UpdateProgressCallback progress, void *userData)
+{
+    char patchPath[320];
+    char patchedPath[320];
+    if (!artifactPathFromUrl(manifest.patchUrl, serverDomain, httpPort, manifest.patchName,
+                             patchPath, sizeof(patchPath)))
+    {
+        setUpdateError("PATCH URL MUST BE SAME-ORIGIN HTTPS");
+        return false;
+    }
+    if (!makeSiblingPath(targetPath, ".patched", patchedPath, sizeof(patchedPath)))
     {
         setUpdateError("UPDATE TARGET PATH TOO LONG");
-        return UPDATE_DOWNLOAD_FAILED;
+        return false;
     }
-    remove(partPath);
-
-    FILE *file = fopen(partPath, "wb");
-    if (!file)
+    FILE *base = fopen(targetPath, "rb");
+    if (!base)
     {
-        setUpdateError("OPEN UPDATE FILE ERR %d", errno);
-        return UPDATE_DOWNLOAD_FAILED;
+        setUpdateError("OPEN INSTALLED 3DSX ERR %d", errno);
+        return false;
+    }
+    FILE *patched = fopen(patchedPath, "wb");
+    if (!patched)
+    {
+        setUpdateError("OPEN PATCHED FILE ERR %d", errno);
+        fclose(base);
+        return false;
     }
 
-    DownloadSink sink = {file, 0, manifest.artifactSize, progress, userData};
+    Doodle::DeltaPatchApplier applier(base, writePatchedFile, patched,
+                                      (uint64_t)manifest.patchSize, manifest.patchSha256,
+                                      (uint64_t)manifest.artifactSize, manifest.sha256);
+    DeltaDownloadSink sink = {&applier, manifest.patchSize, progress, userData};
     HttpsResponse response;
     char httpsError[160];
-    bool downloaded = HttpsClient::get(serverDomain, httpPort, downloadPath,
-                                       (size_t)manifest.artifactSize,
-                                       writeDownloadBody, &sink, response,
-                                       httpsError, sizeof(httpsError));
-    int closeResult = fclose(file);
+    const bool downloaded = HttpsClient::get(serverDomain, httpPort, patchPath, (size_t)manifest.patchSize,
+                                             writeDeltaBody, &sink, response,
+                                             httpsError, sizeof(httpsError));
+    const Doodle::DeltaPatchStatus status = downloaded ? applier.finish() : Doodle::DELTA_PATCH_IO_FAILED;
+    fclose(base);
+    const bool closed = fclose(patched) == 0;
     if (!downloaded)
+        setUpdateError("PATCH HTTPS: %s", applier.error()[0] ? applier.error() : httpsError);
+    else if (status != Doodle::DELTA_PATCH_OK)
+        setUpdateError("%s", applier.error());
+    else if (!closed)
+        setUpdateError("CLOSE PATCHED FILE ERR %d", errno);
+    if (status != Doodle::DELTA_PATCH_OK || !closed || !replaceWithBackup(patchedPath, targetPath))
+    {
+        remove(patchedPath);
+        return false;
+    }
+    return true;
+}
+
+const char *Updater::lastError()
+{
+    return gLastUpdateError[0] ? gLastUpdateError : "NO DETAIL";
+}
+
+UpdateDownloadResult Updater::downloadUpdate(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
+                                             const char *targetPath, UpdateProgressCallback progress, void *userData)
+{
+    setUpdateError("");
+    char downloadPath[320];
+    UpdateDownloadResult checked = checkArtifact(serverDomain, httpPort, manifest, downloadPath, sizeof(downloadPath));
+    if (checked != UPDATE_DOWNLOAD_OK)
+        return checked;
+
+    if (manifest.patchAvailable && strcmp(manifest.artifactType, "3dsx") == 0)
     {
-        setUpdateError("DOWNLOAD HTTPS: %s", httpsError);
-        remove(partPath);
-        return UPDATE_DOWNLOAD_FAILED;
+        if (applyDeltaUpdate(serverDomain, httpPort, manifest,
+                             targetPath && targetPath[0] ? targetPath : UPDATE_FINAL_PATH, progress, userData))
+            return UPDATE_DOWNLOAD_OK;
+        // Whatever went wrong with the patch, the full artifact still works.
+        printf("%s; DOWNLOADING FULL UPDATE\n", gLastUpdateError);
+        setUpdateError("");
     }
-    if (closeResult != 0)
+
+    char partPath[320];
+    if (targetPath && strncmp(targetPath, "sdmc:/cias/", 11) == 0)
+        mkdir("sdmc:/cias", 0777);
+    if (!makeSiblingPath(targetPath, ".part", partPath, sizeof(partPath)))
     {
-        setUpdateError("CLOSE UPDATE FILE ERR %d", errno);
-        remove(partPath);
+        setUpdateError("UPDATE TARGET PATH TOO LONG");
         return UPDATE_DOWNLOAD_FAILED;
     }
 
-    if (sink.written != (size_t)manifest.artifactSize)
+    // A dropped connection keeps the .part file; each retry, and the next
+    // update attempt after that, asks only for the bytes still missing.
+    Doodle::ResumableDownload part;
+    HttpsResponse response;
+    char httpsError[160];
+    for (int attempt = 1;; ++attempt)
     {
-        setUpdateError("DOWNLOAD SIZE %lu EXPECTED %d", (unsigned long)sink.written, manifest.artifactSize);
-        remove(partPath);
+        if (!part.open(partPath, manifest.sha256, (unsigned long long)manifest.artifactSize))
+        {
+            setUpdateError("%s", part.error());
+            return UPDATE_DOWNLOAD_FAILED;
+        }
+        const unsigned long long before = part.size();
+        if (progress && before > 0)
+            progress((int)before, manifest.artifactSize, userData);
+
+        DownloadSink sink;
+        sink.part = &part;
+        sink.response = &response;
+        sink.expected = manifest.artifactSize;
+        sink.progress = progress;
+        sink.progressUserData = userData;
+        const bool downloaded = HttpsClient::getRange(serverDomain, httpPort, downloadPath, part.range(),
+                                                      (size_t)manifest.artifactSize,
+                                                      writeDownloadBody, &sink, response,
+                                                      httpsError, sizeof(httpsError));
+        const bool closed = part.close();
+        if (downloaded && closed)
+            break;
+        if (part.error()[0])
+        {
+            setUpdateError("%s", part.error());
+            part.discard();
+            return UPDATE_DOWNLOAD_FAILED;
+        }
+        // 416: the kept bytes no longer fit the artifact; start over.
+        const bool unsatisfiable = response.statusCode == 416;
+        if (unsatisfiable)
+            part.discard();
+        if (attempt >= MAX_DOWNLOAD_ATTEMPTS || (!unsatisfiable && part.size() <= before))
+        {
+            setUpdateError("DOWNLOAD HTTPS: %s", httpsError);
+            return UPDATE_DOWNLOAD_FAILED;
+        }
+    }
+
+    if (part.size() != (unsigned long long)manifest.artifactSize)
+    {
+        setUpdateError("DOWNLOAD SIZE %lu EXPECTED %d", (unsigned long)part.size(), manifest.artifactSize);
+        part.discard();
         return UPDATE_DOWNLOAD_SIZE_MISMATCH;
     }
 
     char digest[65];
-    if (!fileSha256(partPath, digest) || strcasecmp(digest, manifest.sha256) != 0)
+    part.finishHex(digest);
+    if (strcasecmp(digest, manifest.sha256) != 0)
     {
         setUpdateError("DOWNLOAD CHECKSUM MISMATCH");
-        remove(partPath);
+        part.discard();
         return UPDATE_DOWNLOAD_CHECKSUM_MISMATCH;
     }
 
-    if (!replaceWithBackup(partPath, targetPath && targetPath[0] ? targetPath : UPDATE_FINAL_PATH))
-    {
-        remove(partPath);
-        return UPDATE_DOWNLOAD_FAILED;
-    }
-
-    return UPDATE_DOWNLOAD_OK;
+    const bool replaced = replaceWithBackup(partPath, targetPath && targetPath[0] ? targetPath : UPDATE_FINAL_PATH);
+    // After the rename this only drops the tag; on failure, the bytes too.
+    part.discard();
+    return replaced ? UPDATE_DOWNLOAD_OK : UPDATE_DOWNLOAD_FAILED;
 }
 
 UpdateDownloadResult Updater::downloadAndInstallCia(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
@@ -1013,11 +1090,85 @@ UpdateDownloadResult Updater::downloadAndInstallCia(const char *serverDomain, co
     return installCiaFromFile(stagingPath, expectedTitleId, progress, userData);
 }
 
+struct CiaStreamSink
+{
+    Doodle::CiaStreamInstall *install;
+    int expected;
+    UpdateProgressCallback progress;
+    void *progressUserData;
+};
+
+static bool writeCiaStreamBody(const unsigned char *data, size_t length, void *userData)
+{
+    CiaStreamSink *sink = (CiaStreamSink *)userData;
+    if (!sink->install->write(data, length))
+        return false;
+    // Downloading and installing are one step here, so progress reads as
+    // installing throughout.
+    if (sink->progress)
+        sink->progress(INSTALL_PROGRESS_OFFSET + (int)sink->install->received(), sink->expected,
+                       sink->progressUserData);
+    return true;
+}
+
+UpdateDownloadResult Updater::streamInstallCia(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest,
+                                               unsigned long long expectedTitleId,
+                                               UpdateProgressCallback progress, void *userData)
+{
+    setUpdateError("");
+    char downloadPath[320];
+    UpdateDownloadResult checked = checkArtifact(serverDomain, httpPort, manifest, downloadPath, sizeof(downloadPath));
+    if (checked != UPDATE_DOWNLOAD_OK)
+        return checked;
+    if (strcmp(manifest.artifactType, "cia") != 0)
+        return UPDATE_DOWNLOAD_NO_ARTIFACT;
+    if (expectedTitleId == 0)
+    {
+        setUpdateError("INSTALLED TITLE ID UNAVAILABLE");
+        return UPDATE_DOWNLOAD_INSTALL_FAILED;
+    }
+
+    AmCiaInstallService service;
+    Doodle::CiaStreamInstall install(service, expectedTitleId, (uint64_t)manifest.artifactSize, manifest.sha256);
+    CiaStreamSink sink = {&install, manifest.artifactSize, progress, userData};
+    HttpsResponse response;
+    char httpsError[160];
+    bool downloaded = HttpsClient::get(serverDomain, httpPort, downloadPath,
+                                       (size_t)manifest.artifactSize,
+                                       writeCiaStreamBody, &sink, response,
+                                       httpsError, sizeof(httpsError));
+    if (!downloaded && !install.failed())
+    {
+        const bool interrupted = install.interrupted();
+        install.cancel();
+        setUpdateError("DOWNLOAD HTTPS: %s", httpsError);
+        return interrupted ? UPDATE_DOWNLOAD_INTERRUPTED : UPDATE_DOWNLOAD_FAILED;
+    }
+
+    Doodle::CiaStreamStatus status = install.finish();
+    if (status == Doodle::CIA_STREAM_OK)
+        return UPDATE_DOWNLOAD_OK;
+    setUpdateError("%s", install.error());
+    printf("%s\n", gLastUpdateError);
+    if (status == Doodle::CIA_STREAM_SIZE_MISMATCH)
+        return UPDATE_DOWNLOAD_SIZE_MISMATCH;
+    if (status == Doodle::CIA_STREAM_CHECKSUM_MISMATCH)
+        return UPDATE_DOWNLOAD_CHECKSUM_MISMATCH;
+    return UPDATE_DOWNLOAD_INSTALL_FAILED;
+}
+
 UpdateDownloadResult Updater::downloadUpdate(const char *serverDomain, const char *httpPort, const UpdateManifest &manifest)
 {
     return downloadUpdate(serverDomain, httpPort, manifest, UPDATE_FINAL_PATH, NULL, NULL);
 }
 
+bool Updater::hasStagedDownload(const char *targetPath)
+{
+    char partPath[320];
+    struct stat partInfo;
+    return makeSiblingPath(targetPath, ".part", partPath, sizeof(partPath)) && stat(partPath, &partInfo) == 0;
+}
+
 bool Updater::checkForUpdate(const char *serverDomain, const char *httpPort, const char *currentVersion)
 {
     UpdateManifest manifest;
@@ -0,0 +1,367 @@
+#include "viewport_render.h"
+#include <algorithm>
+#include <string.h>
+
+namespace Doodle
+{
+
+namespace
+{
+
+int floorHalf(int value)
+{
+    return value >= 0 ? value / 2 : -((1 - value) / 2);
+}
+
+void extendRect(DirtyRect &rect, int minX, int minY, int maxX, int maxY)
+{
+    if (!rect.valid)
+    {
+        rect.minX = minX;
+        rect.minY = minY;
+        rect.maxX = maxX;
+        rect.maxY = maxY;
+        rect.valid = true;
+        return;
+    }
+    rect.minX = std::min(rect.minX, minX);
+    rect.minY = std::min(rect.minY, minY);
+    rect.maxX = std::max(rect.maxX, maxX);
+    rect.maxY = std::max(rect.maxY, maxY);
+}
+
+DirtyRect fullScreenRect()
+{
+    DirtyRect rect;
+    rect.minX = 0;
+    rect.minY = 0;
+    rect.maxX = VIEWPORT_SCREEN_WIDTH - 1;
+    rect.maxY = VIEWPORT_SCREEN_HEIGHT - 1;
+    rect.valid = true;
+    return rect;
+}
+
+DirtyRect emptyRect()
+{
+    DirtyRect rect;
+    rect.minX = rect.minY = rect.maxX = rect.maxY = 0;
+    rect.valid = false;
+    return rect;
+}
+
+// A screen column is one contiguous framebuffer row when the framebuffer is
+// stored rotated (the 3DS layout), walked backwards as screen Y increases.
+template <bool Rotated>
+inline u8 *screenPixel(u8 *buffer, int fbWidth, int x, int y)
+{
+    return Rotated ? buffer + 3 * (x * fbWidth + fbWidth - 1 - y)
+                   : buffer + 3 * (y * fbWidth + x);
+}
+
+template <bool Rotated>
+inline int screenRowStride(int fbWidth)
+{
+    return Rotated ? -3 : 3 * fbWidth;
+}
+
+inline void storeBackdropRun(u8 *dest, int stride, int count)
+{
+    for (int i = 0; i < count; ++i, dest += stride)
+        dest[0] = dest[1] = dest[2] = VIEWPORT_BACKDROP;
+}
+
+template <bool Rotated>
+inline void copyColumn(u8 *dest, const u8 *previous, int stride, int count)
+{
+    if (Rotated)
+    {
+        memcpy(dest - 3 * (count - 1), previous - 3 * (count - 1), 3 * count);
+        return;
+    }
+    for (int i = 0; i < count; ++i, dest += stride, previous += stride)
+    {
+        dest[0] = previous[0];
+        dest[1] = previous[1];
+        dest[2] = previous[2];
+    }
+}
+
+// 1x, 2x, and 4x: each canvas pixel covers a (1 << ZoomLevel) square, so a
+// single source read fills a vertical run and later columns are copies.
+template <int ZoomLevel>
+void blitScaledColumn(const ViewportSource &source, u8 *dest, int stride,
+                      int canvasX, int minY, int maxY)
+{
+    const int scale = 1 << ZoomLevel;
+    if (canvasX < 0 || canvasX >= source.width)
+    {
+        storeBackdropRun(dest, stride, maxY - minY + 1);
+        return;
+    }
+
+    const u8 *column = source.pixels + 3 * canvasX;
+    const int rowBytes = 3 * source.width;
+    for (int y = minY; y <= maxY;)
+    {
+        const int cell = y >> ZoomLevel;
+        const int runEnd = std::min(maxY, cell * scale + scale - 1);
+        const int run = runEnd - y + 1;
+        const int canvasY = source.offsetY + cell;
+        if (canvasY < 0 || canvasY >= source.height)
+        {
+            storeBackdropRun(dest, stride, run);
+        }
+        else
+        {
+            const u8 *src = column + canvasY * rowBytes;
+            const u8 b = src[2];
+            const u8 g = src[1];
+            const u8 r = src[0];
+            u8 *out = dest;
+            for (int i = 0; i < run; ++i, out += stride)
+            {
+                out[0] = b;
+                out[1] = g;
+                out[2] = r;
+            }
+        }
+        dest += stride * run;
+        y = runEnd + 1;
+    }
+}
+
+// 0.5x: box-average the 2x2 canvas block behind each screen pixel so thin
+// strokes stay visible instead of vanishing between point samples.
+void blitHalfColumn(const ViewportSource &source, u8 *dest, int stride,
+                    int canvasX, int minY, int maxY)
+{
+    const int rowBytes = 3 * source.width;
+    const bool leftInside = canvasX >= 0 && canvasX < source.width;
+    const bool rightInside = canvasX + 1 >= 0 && canvasX + 1 < source.width;
+    if (!leftInside && !rightInside)
+    {
+        storeBackdropRun(dest, stride, maxY - minY + 1);
+        return;
+    }
+
+    for (int y = minY; y <= maxY; ++y, dest += stride)
+    {
+        const int canvasY = source.offsetY + y * 2;
+        const bool topInside = canvasY >= 0 && canvasY < source.height;
+        const bool bottomInside = canvasY + 1 >= 0 && canvasY + 1 < source.height;
+        if (leftInside && rightInside && topInside && bottomInside)
+        {
+            const u8 *top = source.pixels + canvasY * rowBytes + 3 * canvasX;
+            const u8 *bottom = top + rowBytes;
+            dest[0] = (u8)((top[2] + top[5] + bottom[2] + bottom[5] + 2) >> 2);
+            dest[1] = (u8)((top[1] + top[4] + bottom[1] + bottom[4] + 2) >> 2);
+            dest[2] = (u8)((top[0] + top[3] + bottom[0] + bottom[3] + 2) >> 2);
+            continue;
+        }
+
+        int sumR = 0;
+        int sumG = 0;
+        int sumB = 0;
+        int samples = 0;
+        for (int dy = 0; dy < 2; ++dy)
+        {
+            if (!(dy ? bottomInside : topInside))
+                continue;
+            for (int dx = 0; dx < 2; ++dx)
+            {
+                if (!(dx ? rightInside : leftInside))
+                    continue;
+                const u8 *src = source.pixels + (canvasY + dy) * rowBytes + 3 * (canvasX + dx);
+                sumR += src[0];
+                sumG += src[1];
+                sumB += src[2];
+                ++samples;
+            }
+        }
+        if (!samples)
+        {
+            dest[0] = dest[1] = dest[2] = VIEWPORT_BACKDROP;
+            continue;
+        }
+        dest[0] = (u8)((sumB + samples / 2) / samples);
+        dest[1] = (u8)((sumG + samples / 2) / samples);
+        dest[2] = (u8)((sumR + samples / 2) / samples);
+    }
+}
+
+template <int ZoomLevel, bool Rotated>
+void blitColumns(const ViewportSource &source, u8 *buffer, int fbWidth,
+                 const DirtyRect &rect)
+{
+    const int shift = ZoomLevel > 0 ? ZoomLevel : 0;
+    const int stride = screenRowStride<Rotated>(fbWidth);
+    const int count = rect.maxY - rect.minY + 1;
+    const u8 *previous = NULL;
+    for (int x = rect.minX; x <= rect.maxX; ++x)
+    {
+        u8 *dest = screenPixel<Rotated>(buffer, fbWidth, x, rect.minY);
+        if (shift > 0 && previous && (x >> shift) == ((x - 1) >> shift))
+            copyColumn<Rotated>(dest, previous, stride, count);
+        else if (ZoomLevel < 0)
+            blitHalfColumn(source, dest, stride, source.offsetX + x * 2,
+                           rect.minY, rect.maxY);
+        else
+            blitScaledColumn<(ZoomLevel > 0 ? ZoomLevel : 0)>(
+                source, dest, stride, source.offsetX + (x >> shift),
+                rect.minY, rect.maxY);
+        previous = dest;
+    }
+}
+
+} // namespace
+
+int viewportCanvasCoordinate(int offset, int zoomLevel, int screen)
+{
+    if (zoomLevel <= -1) return offset + screen * 2;
+    if (zoomLevel == 1) return offset + screen / 2;
+    if (zoomLevel >= 2) return offset + screen / 4;
+    return offset + screen;
+}
+
+DirtyRect viewportScreenRectForCanvas(const ViewportSource &source,
+                                      const DirtyRect &canvasRect)
+{
+    DirtyRect screen = emptyRect();
+    if (!canvasRect.valid)
+        return screen;
+
+    const int relMinX = canvasRect.minX - source.offsetX;
+    const int relMinY = canvasRect.minY - source.offsetY;
+    const int relMaxX = canvasRect.maxX - source.offsetX;
+    const int relMaxY = canvasRect.maxY - source.offsetY;
+    if (source.zoomLevel <= -1)
+    {
+        screen.minX = floorHalf(relMinX);
+        screen.minY = floorHalf(relMinY);
+        screen.maxX = floorHalf(relMaxX);
+        screen.maxY = floorHalf(relMaxY);
+    }
+    else
+    {
+        const int scale = source.zoomLevel >= 2 ? 4 : (source.zoomLevel == 1 ? 2 : 1);
+        screen.minX = relMinX * scale;
+        screen.minY = relMinY * scale;
+        screen.maxX = relMaxX * scale + scale - 1;
+        screen.maxY = relMaxY * scale + scale - 1;
+    }
+
+    screen.minX = std::max(0, screen.minX);
+    screen.minY = std::max(0, screen.minY);
+    screen.maxX = std::min(VIEWPORT_SCREEN_WIDTH - 1, screen.maxX);
+    screen.maxY = std::min(VIEWPORT_SCREEN_HEIGHT - 1, screen.maxY);
+    screen.valid = screen.minX <= screen.maxX && screen.minY <= screen.maxY;
+    return screen;
+}
+
+void renderViewportRect(const ViewportSource &source, u8 *buffer,
+                        int fbWidth, int fbHeight, const DirtyRect &screenRect)
+{
+    if (!buffer || !source.pixels || !screenRect.valid)
+        return;
+
+    const bool rotatedFramebuffer = fbWidth < fbHeight;
+    DirtyRect rect = screenRect;
+    rect.minX = std::max(0, rect.minX);
+    rect.minY = std::max(0, rect.minY);
+    rect.maxX = std::min(rect.maxX, (rotatedFramebuffer ? fbHeight : fbWidth) - 1);
+    rect.maxY = std::min(rect.maxY, (rotatedFramebuffer ? fbWidth : fbHeight) - 1);
+    if (rect.minX > rect.maxX || rect.minY > rect.maxY)
+        return;
+
+    if (rotatedFramebuffer)
+    {
+        if (source.zoomLevel <= -1) blitColumns<-1, true>(source, buffer, fbWidth, rect);
+        else if (source.zoomLevel == 1) blitColumns<1, true>(source, buffer, fbWidth, rect);
+        else if (source.zoomLevel >= 2) blitColumns<2, true>(source, buffer, fbWidth, rect);
+        else blitColumns<0, true>(source, buffer, fbWidth, rect);
+    }
+    else
+    {
+        if (source.zoomLevel <= -1) blitColumns<-1, false>(source, buffer, fbWidth, rect);
+        else if (source.zoomLevel == 1) blitColumns<1, false>(source, buffer, fbWidth, rect);
+        else if (source.zoomLevel >= 2) blitColumns<2, false>(source, buffer, fbWidth, rect);
+        else blitColumns<0, false>(source, buffer, fbWidth, rect);
+    }
+}
+
+IncrementalViewport::IncrementalViewport()
+    : lastBuffer_(NULL), lastFbWidth_(0), lastFbHeight_(0), valid_(false),
+      pendingScreen_(emptyRect())
+{
+    last_.pixels = NULL;
+    last_.width = last_.height = 0;
+    last_.offsetX = last_.offsetY = 0;
+    last_.zoomLevel = 0;
+}
+
+void IncrementalViewport::invalidate()
+{
+    valid_ = false;
+}
+
+void IncrementalViewport::invalidateScreenRect(int x, int y, int w, int h)
+{
+    if (w <= 0 || h <= 0)
+        return;
+    const int minX = std::max(0, x);
+    const int minY = std::max(0, y);
+    const int maxX = std::min(VIEWPORT_SCREEN_WIDTH - 1, x + w - 1);
+    const int maxY = std::min(VIEWPORT_SCREEN_HEIGHT - 1, y + h - 1);
+    if (minX > maxX || minY > maxY)
+        return;
+    extendRect(pendingScreen_, minX, minY, maxX, maxY);
+}
+
+bool IncrementalViewport::matches(const ViewportSource &source, const u8 *buffer,
+                                  int fbWidth, int fbHeight) const
+{
+    return valid_ &&
+           last_.pixels == source.pixels &&
+           last_.width == source.width &&
+           last_.height == source.height &&
+           last_.offsetX == source.offsetX &&
+           last_.offsetY == source.offsetY &&
+           last_.zoomLevel == source.zoomLevel &&
+           lastBuffer_ == buffer &&
+           lastFbWidth_ == fbWidth &&
+           lastFbHeight_ == fbHeight;
+}
+
+int IncrementalViewport::render(const ViewportSource &source, const DirtyRect &canvasDirty,
+                                u8 *buffer, int fbWidth, int fbHeight, bool forceFull)
+{
+    if (!buffer || !source.pixels)
+        return 0;
+
+    DirtyRect region;
+    if (forceFull || !matches(source, buffer, fbWidth, fbHeight))
+    {
+        region = fullScreenRect();
+    }
+    else
+    {
+        region = viewportScreenRectForCanvas(source, canvasDirty);
+        if (pendingScreen_.valid)
+            extendRect(region, pendingScreen_.minX, pendingScreen_.minY,
+                       pendingScreen_.maxX, pendingScreen_.maxY);
+    }
+
+    pendingScreen_ = emptyRect();
+    last_ = source;
+    lastBuffer_ = buffer;
+    lastFbWidth_ = fbWidth;
+    lastFbHeight_ = fbHeight;
+    valid_ = true;
+    if (!region.valid)
+        return 0;
+
+    renderViewportRect(source, buffer, fbWidth, fbHeight, region);
+    return (region.maxX - region.minX + 1) * (region.maxY - region.minY + 1);
+}
+
+} // namespace Doodle
@@ -340,10 +340,14 @@ static bool validateHandshake(const std::vector<uint8_t> &response, size_t heade
 }
 }
 
-WebSocketClient::WebSocketClient()
-    : plainSocket(-1), secureTransport(true), connected(false), closeSent(false), awaitingPong(false),
-      pingSequence(0), lastPingAt(0), pongDeadline(0),
-      sendOffset(0), queuedSendBytes(0), fragmentOpcode(0), queuedMessageBytes(0)
+const size_t WebSocketClient::STREAM_PIECE_BYTES;
+
+WebSocketClient::WebSocketClient(Doodle::BufferPool &pool)
+    : bufferPool(pool), plainSocket(-1), secureTransport(true), connected(false), closeSent(false), awaitingPong(false),
+      pingSequence(0), lastPingAt(0), pongDeadline(0), ackIntervalMs(0),
+      dataFramesWritten(0), pingCoversFrames(0), acknowledgedFrames(0),
+      sendOffset(0), queuedSendBytes(0), fragmentOpcode(0), streamingMessage(false), streamOffset(0),
+      frameRemaining(0), frameFinal(false), queuedMessageBytes(0)
 {
     errorText[0] = '\0';
     memset(pingPayload, 0, sizeof(pingPayload));
@@ -364,6 +368,11 @@ const char *WebSocketClient::lastError() const
     return errorText[0] ? errorText : "network error";
 }
 
+const char *WebSocketClient::handshakeSummary() const
+{
+    return secureTransport ? tlsStream.handshakeSummary() : "";
+}
+
 bool WebSocketClient::connectPlain(const char *host, const char *port, int timeoutMs)
 {
     addrinfo hints;
@@ -510,11 +519,18 @@ bool WebSocketClient::connect(const char *host, const char *port, const char *pa
     sendOffset = 0;
     queuedSendBytes = 0;
     fragmentOpcode = 0;
+    streamingMessage = false;
+    streamOffset = 0;
+    frameRemaining = 0;
+    frameFinal = false;
     queuedMessageBytes = 0;
     closeSent = false;
     awaitingPong = false;
     lastPingAt = 0;
     pongDeadline = 0;
+    dataFramesWritten = 0;
+    pingCoversFrames = 0;
+    acknowledgedFrames = 0;
     errorText[0] = '\0';
     secureTransport = secure;
     if (!isSafeRequestValue(host, 253) || !isSafeRequestValue(port, 7) || !isSafeRequestValue(path, 255) || path[0] != '/')
@@ -655,7 +671,7 @@ bool WebSocketClient::performHandshake(const char *host, const char *port, const
         return false;
     }
     if (response.size() > headerEnd)
-        receiveBuffer.insert(receiveBuffer.end(), response.begin() + headerEnd, response.end());
+        receiveBuffer.append(response.data() + headerEnd, response.size() - headerEnd);
     return true;
 }
 
@@ -681,36 +697,41 @@ bool WebSocketClient::queueFrame(uint8_t opcode, const void *payloadValue, size_
         setError("secure random failed");
         return false;
     }
-    std::vector<uint8_t> frame;
-    frame.reserve(headerLength + length);
-    frame.push_back((uint8_t)(0x80 | (opcode & 0x0f)));
+    Doodle::PooledBuffer frame;
+    if (!bufferPool.acquire(headerLength + length, frame))
+    {
+        setError("out of memory for WebSocket frame");
+        return false;
+    }
+    uint8_t *bytes = frame.data();
+    size_t offset = 0;
+    bytes[offset++] = (uint8_t)(0x80 | (opcode & 0x0f));
     if (length <= 125)
-        frame.push_back((uint8_t)(0x80 | length));
+        bytes[offset++] = (uint8_t)(0x80 | length);
     else if (length <= 0xffff)
     {
-        frame.push_back(0x80 | 126);
-        frame.push_back((uint8_t)(length >> 8));
-        frame.push_back((uint8_t)length);
+        bytes[offset++] = 0x80 | 126;
+        bytes[offset++] = (uint8_t)(length >> 8);
+        bytes[offset++] = (uint8_t)length;
     }
     else
     {
-        frame.push_back(0x80 | 127);
+        bytes[offset++] = 0x80 | 127;
         uint64_t wireLength = (uint64_t)length;
         for (int shift = 56; shift >= 0; shift -= 8)
-            frame.push_back((uint8_t)(wireLength >> shift));
+            bytes[offset++] = (uint8_t)(wireLength >> shift);
     }
-    frame.insert(frame.end(), mask, mask + sizeof(mask));
-    size_t payloadStart = frame.size();
-    frame.resize(payloadStart + length);
+    memcpy(bytes + offset, mask, sizeof(mask));
+    offset += sizeof(mask);
     for (size_t i = 0; i < length; i++)
-        frame[payloadStart + i] = payload[i] ^ mask[i % 4];
+        bytes[offset + i] = payload[i] ^ mask[i % 4];
     queuedSendBytes += frame.size();
     if (control)
     {
         // Control frames must not wait behind a full drawing backlog. Never
         // interleave an in-progress frame, but otherwise place ping/pong/close
         // at the front as required for useful heartbeat deadlines.
-        std::deque<std::vector<uint8_t> >::iterator position = sendFrames.begin();
+        std::deque<Doodle::PooledBuffer>::iterator position = sendFrames.begin();
         if (sendOffset > 0 && position != sendFrames.end())
             ++position;
         sendFrames.insert(position, std::move(frame));
@@ -739,8 +760,13 @@ bool WebSocketClient::queueHeartbeatPing(u64 now)
     pingPayload[1] = (uint8_t)(pingSequence >> 16);
     pingPayload[2] = (uint8_t)(pingSequence >> 8);
     pingPayload[3] = (uint8_t)pingSequence;
+    // The ping goes ahead of every queued frame except one already partly
+    // written, so its pong vouches for that frame and those before it.
+    const bool partlyWrittenData = sendOffset > 0 && !sendFrames.empty() &&
+                                   (sendFrames.front().data()[0] & 0x08) == 0;
     if (!queueFrame(0x09, pingPayload, sizeof(pingPayload)))
         return false;
+    pingCoversFrames = dataFramesWritten + (partlyWrittenData ? 1 : 0);
     awaitingPong = true;
     lastPingAt = now;
     pongDeadline = now + HEARTBEAT_TIMEOUT_MS;
@@ -751,7 +777,7 @@ bool WebSocketClient::flushOutgoing()
 {
     while (connected && !sendFrames.empty())
     {
-        std::vector<uint8_t> &frame = sendFrames.front();
+        Doodle::PooledBuffer &frame = sendFrames.front();
         size_t written = 0;
         StreamResult result = streamWrite(frame.data() + sendOffset, frame.size() - sendOffset, written);
         if (result == STREAM_OK && written > 0)
@@ -759,6 +785,8 @@ bool WebSocketClient::flushOutgoing()
             sendOffset += written;
             if (sendOffset == frame.size())
             {
+                if ((frame.data()[0] & 0x08) == 0)
+                    ++dataFramesWritten;
                 queuedSendBytes -= frame.size();
                 sendFrames.pop_front();
                 sendOffset = 0;
@@ -775,7 +803,8 @@ bool WebSocketClient::flushOutgoing()
     return connected;
 }
 
-bool WebSocketClient::queueMessage(uint8_t opcode, const uint8_t *payload, size_t length)
+bool WebSocketClient::queueMessage(uint8_t opcode, const uint8_t *payload, size_t length,
+                                   size_t offset, bool final)
 {
     if (queuedMessageBytes + length > MESSAGE_QUEUE_LIMIT)
         return failProtocol("WebSocket receive queue full", 1009);
@@ -783,12 +812,47 @@ bool WebSocketClient::queueMessage(uint8_t opcode, const uint8_t *payload, size_
         return failProtocol("invalid UTF-8 message", 1007);
     Message message;
     message.type = opcode == 0x01 ? MESSAGE_TEXT : MESSAGE_BINARY;
-    message.payload.assign(payload, payload + length);
+    if (!bufferPool.acquireCopy(payload, length, message.payload))
+        return failProtocol("out of memory for WebSocket message", 1011);
+    message.offset = offset;
+    message.final = final;
     queuedMessageBytes += length;
     messages.push_back(std::move(message));
     return true;
 }
 
+// Adds payload bytes of a streamed binary message to the pending piece,
+// handing out every full STREAM_PIECE_BYTES piece, and the remainder once
+// finalBytes ends the message.
+bool WebSocketClient::appendStreamBytes(const uint8_t *payload, size_t length, bool finalBytes)
+{
+    if (streamOffset + fragmentBuffer.size() + length > MESSAGE_LIMIT)
+        return failProtocol("WebSocket message too large", 1009);
+    while (length > 0)
+    {
+        size_t take = std::min(length, STREAM_PIECE_BYTES - fragmentBuffer.size());
+        fragmentBuffer.insert(fragmentBuffer.end(), payload, payload + take);
+        payload += take;
+        length -= take;
+        if (fragmentBuffer.size() == STREAM_PIECE_BYTES && (length > 0 || !finalBytes))
+        {
+            if (!queueMessage(0x02, fragmentBuffer.data(), fragmentBuffer.size(), streamOffset, false))
+                return false;
+            streamOffset += fragmentBuffer.size();
+            fragmentBuffer.clear();
+        }
+    }
+    if (!finalBytes)
+        return true;
+    if (!queueMessage(0x02, fragmentBuffer.data(), fragmentBuffer.size(), streamOffset, true))
+        return false;
+    fragmentBuffer.clear();
+    fragmentOpcode = 0;
+    streamingMessage = false;
+    streamOffset = 0;
+    return true;
+}
+
 bool WebSocketClient::failProtocol(const char *message, uint16_t closeCode)
 {
     setError(message);
@@ -807,46 +871,47 @@ bool WebSocketClient::parseAvailableFrames()
 {
     while (connected)
     {
-        if (receiveBuffer.size() < 2)
-            return true;
-        uint8_t first = receiveBuffer[0];
-        uint8_t second = receiveBuffer[1];
-        bool finalFrame = (first & 0x80) != 0;
-        uint8_t opcode = first & 0x0f;
-        if ((first & 0x70) != 0)
-            return failProtocol("unsupported WebSocket extension", 1002);
-        if ((second & 0x80) != 0)
-            return failProtocol("masked server WebSocket frame", 1002);
-
-        uint64_t payloadLength = second & 0x7f;
-        size_t headerLength = 2;
-        if (payloadLength == 126)
+        if (frameRemaining > 0)
         {
-            if (receiveBuffer.size() < 4)
+            // Body of a streamed binary frame: forward whatever has arrived.
+            size_t take = (size_t)std::min<uint64_t>(frameRemaining, receiveBuffer.size());
+            if (take == 0)
                 return true;
-            payloadLength = ((uint64_t)receiveBuffer[2] << 8) | receiveBuffer[3];
-            if (payloadLength < 126)
-                return failProtocol("noncanonical WebSocket length", 1002);
-            headerLength = 4;
+            frameRemaining -= take;
+            if (!appendStreamBytes(receiveBuffer.data(), take, frameRemaining == 0 && frameFinal))
+                return false;
+            receiveBuffer.consume(take);
+            continue;
         }
-        else if (payloadLength == 127)
+        Doodle::WebSocketFrameHeader header;
+        Doodle::WebSocketFrameStatus status = Doodle::parseWebSocketFrameHeader(
+            receiveBuffer.data(), receiveBuffer.size(), MESSAGE_LIMIT, header);
+        if (status == Doodle::WEBSOCKET_FRAME_INCOMPLETE)
+            return true;
+        if (status == Doodle::WEBSOCKET_FRAME_INVALID)
+            return failProtocol(header.error, header.closeCode);
+        const bool finalFrame = header.final;
+        const uint8_t opcode = header.opcode;
+        const uint64_t payloadLength = header.payloadLength;
+        const size_t headerLength = header.headerLength;
+
+        // Large binary messages skip reassembly: once one outgrows a piece,
+        // frame bodies are forwarded as they arrive and never need to sit
+        // whole in receiveBuffer or fragmentBuffer.
+        const bool binaryData = opcode == 0x02 || (opcode == 0x00 && fragmentOpcode == 0x02);
+        if (binaryData && (opcode == 0x00 || fragmentOpcode == 0) &&
+            (streamingMessage || fragmentBuffer.size() + payloadLength > STREAM_PIECE_BYTES))
         {
-            if (receiveBuffer.size() < 10)
-                return true;
-            if ((receiveBuffer[2] & 0x80) != 0)
-                return failProtocol("invalid WebSocket length", 1002);
-            payloadLength = 0;
-            for (int i = 2; i < 10; i++)
-                payloadLength = (payloadLength << 8) | receiveBuffer[i];
-            if (payloadLength < 65536)
-                return failProtocol("noncanonical WebSocket length", 1002);
-            headerLength = 10;
+            if (opcode == 0x02)
+                fragmentOpcode = 0x02;
+            streamingMessage = true;
+            receiveBuffer.consume(headerLength);
+            frameRemaining = payloadLength;
+            frameFinal = finalFrame;
+            if (payloadLength == 0 && finalFrame && !appendStreamBytes(NULL, 0, true))
+                return false;
+            continue;
         }
-        if (payloadLength > MESSAGE_LIMIT)
-            return failProtocol("WebSocket message too large", 1009);
-        bool control = (opcode & 0x08) != 0;
-        if (control && (!finalFrame || payloadLength > 125))
-            return failProtocol("invalid WebSocket control frame", 1002);
         if (payloadLength > SIZE_MAX - headerLength || receiveBuffer.size() < headerLength + (size_t)payloadLength)
             return true;
 
@@ -878,7 +943,7 @@ bool WebSocketClient::parseAvailableFrames()
         {
             if (!queueFrame(0x0a, payload, (size_t)payloadLength))
                 return failProtocol("unable to queue WebSocket pong", 1011);
-            receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin() + completeLength);
+            receiveBuffer.consume(completeLength);
             continue;
         }
         if (opcode == 0x0a)
@@ -889,8 +954,9 @@ bool WebSocketClient::parseAvailableFrames()
                 awaitingPong = false;
                 pongDeadline = 0;
                 lastPingAt = osGetTime();
+                acknowledgedFrames = pingCoversFrames;
             }
-            receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin() + completeLength);
+            receiveBuffer.consume(completeLength);
             continue;
         }
         if (opcode != 0x00 && opcode != 0x01 && opcode != 0x02)
@@ -903,7 +969,7 @@ bool WebSocketClient::parseAvailableFrames()
             if (fragmentBuffer.size() + (size_t)payloadLength > MESSAGE_LIMIT)
                 return failProtocol("fragmented WebSocket message too large", 1009);
             fragmentBuffer.insert(fragmentBuffer.end(), payload, payload + payloadLength);
-            receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin() + completeLength);
+            receiveBuffer.consume(completeLength);
             if (finalFrame)
             {
                 uint8_t completeOpcode = fragmentOpcode;
@@ -920,12 +986,12 @@ bool WebSocketClient::parseAvailableFrames()
         {
             fragmentOpcode = opcode;
             fragmentBuffer.assign(payload, payload + payloadLength);
-            receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin() + completeLength);
+            receiveBuffer.consume(completeLength);
             continue;
         }
         if (!queueMessage(opcode, payload, (size_t)payloadLength))
             return false;
-        receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin() + completeLength);
+        receiveBuffer.consume(completeLength);
     }
     return false;
 }
@@ -941,7 +1007,7 @@ bool WebSocketClient::update()
         closeStream();
         return false;
     }
-    if (!awaitingPong && now - lastPingAt >= HEARTBEAT_INTERVAL_MS &&
+    if (!awaitingPong && now - lastPingAt >= pingInterval() &&
         !queueHeartbeatPing(now))
     {
         setError("unable to queue WebSocket ping");
@@ -953,16 +1019,17 @@ bool WebSocketClient::update()
     if (!parseAvailableFrames())
         return false;
 
-    uint8_t chunk[8192];
+    static const size_t READ_CHUNK = 8192;
     for (int reads = 0; reads < 4 && connected; reads++)
     {
+        // Read straight into the spare tail of the receive buffer.
         size_t received = 0;
-        StreamResult result = streamRead(chunk, sizeof(chunk), received);
+        StreamResult result = streamRead(receiveBuffer.prepare(READ_CHUNK), READ_CHUNK, received);
         if (result == STREAM_OK && received > 0)
         {
             if (receiveBuffer.size() + received > MESSAGE_LIMIT + 14)
                 return failProtocol("WebSocket receive buffer full", 1009);
-            receiveBuffer.insert(receiveBuffer.end(), chunk, chunk + received);
+            receiveBuffer.commit(received);
             if (!parseAvailableFrames())
                 return false;
             continue;
@@ -999,6 +1066,48 @@ void WebSocketClient::close(uint16_t code)
     closeStream();
 }
 
+int WebSocketClient::socketDescriptor() const
+{
+    if (!connected)
+        return -1;
+    return secureTransport ? tlsStream.socketDescriptor() : plainSocket;
+}
+
+bool WebSocketClient::hasPendingOutput() const
+{
+    return connected && !sendFrames.empty();
+}
+
+bool WebSocketClient::hasPendingInput() const
+{
+    return connected && secureTransport && tlsStream.hasPendingInput();
+}
+
+uint64_t WebSocketClient::nextDeadline() const
+{
+    if (!connected)
+        return 0;
+    return awaitingPong ? pongDeadline : lastPingAt + pingInterval();
+}
+
+uint32_t WebSocketClient::acknowledgedDataFrames() const
+{
+    return acknowledgedFrames;
+}
+
+void WebSocketClient::setAckInterval(uint64_t intervalMs)
+{
+    ackIntervalMs = intervalMs;
+}
+
+uint64_t WebSocketClient::pingInterval() const
+{
+    if (ackIntervalMs > 0 && ackIntervalMs < HEARTBEAT_INTERVAL_MS &&
+        dataFramesWritten != acknowledgedFrames)
+        return ackIntervalMs;
+    return HEARTBEAT_INTERVAL_MS;
+}
+
 bool WebSocketClient::isConnected() const
 {
     return connected;
@@ -0,0 +1,129 @@
+#include "websocket_frame.h"
+#include <string.h>
+
+namespace Doodle
+{
+
+ReceiveBuffer::ReceiveBuffer()
+    : readPos_(0), writePos_(0)
+{
+}
+
+void ReceiveBuffer::clear()
+{
+    readPos_ = 0;
+    writePos_ = 0;
+}
+
+void ReceiveBuffer::consume(size_t length)
+{
+    if (length >= size())
+    {
+        clear();
+        return;
+    }
+    readPos_ += length;
+}
+
+void ReceiveBuffer::append(const uint8_t *bytes, size_t length)
+{
+    if (length == 0)
+        return;
+    memcpy(prepare(length), bytes, length);
+    commit(length);
+}
+
+uint8_t *ReceiveBuffer::prepare(size_t length)
+{
+    if (storage_.empty() || storage_.size() - writePos_ < length)
+    {
+        const size_t unread = size();
+        if (readPos_ > 0 && unread > 0)
+            memmove(&storage_[0], &storage_[0] + readPos_, unread);
+        readPos_ = 0;
+        writePos_ = unread;
+        if (storage_.empty() || storage_.size() - writePos_ < length)
+            storage_.resize(writePos_ + (length > 0 ? length : 1));
+    }
+    return &storage_[0] + writePos_;
+}
+
+void ReceiveBuffer::commit(size_t length)
+{
+    writePos_ += length;
+}
+
+WebSocketFrameStatus parseWebSocketFrameHeader(const uint8_t *data, size_t size,
+                                               uint64_t messageLimit,
+                                               WebSocketFrameHeader &header)
+{
+    header.error = NULL;
+    header.closeCode = 0;
+    if (size < 2)
+        return WEBSOCKET_FRAME_INCOMPLETE;
+    const uint8_t first = data[0];
+    const uint8_t second = data[1];
+    header.final = (first & 0x80) != 0;
+    header.opcode = first & 0x0f;
+    header.closeCode = 1002;
+    if ((first & 0x70) != 0)
+    {
+        header.error = "unsupported WebSocket extension";
+        return WEBSOCKET_FRAME_INVALID;
+    }
+    if ((second & 0x80) != 0)
+    {
+        header.error = "masked server WebSocket frame";
+        return WEBSOCKET_FRAME_INVALID;
+    }
+
+    header.payloadLength = second & 0x7f;
+    header.headerLength = 2;
+    if (header.payloadLength == 126)
+    {
+        if (size < 4)
+            return WEBSOCKET_FRAME_INCOMPLETE;
+        header.payloadLength = ((uint64_t)data[2] << 8) | data[3];
+        if (header.payloadLength < 126)
+        {
+            header.error = "noncanonical WebSocket length";
+            return WEBSOCKET_FRAME_INVALID;
+        }
+        header.headerLength = 4;
+    }
+    else if (header.payloadLength == 127)
+    {
+        if (size < 10)
+            return WEBSOCKET_FRAME_INCOMPLETE;
+        if ((data[2] & 0x80) != 0)
+        {
+            header.error = "invalid WebSocket length";
+            return WEBSOCKET_FRAME_INVALID;
+        }
+        header.payloadLength = 0;
+        for (int i = 2; i < 10; i++)
+            header.payloadLength = (header.payloadLength << 8) | data[i];
+        if (header.payloadLength < 65536)
+        {
+            header.error = "noncanonical WebSocket length";
+            return WEBSOCKET_FRAME_INVALID;
+        }
+        header.headerLength = 10;
+    }
+    if (header.payloadLength > messageLimit)
+    {
+        header.error = "WebSocket message too large";
+        header.closeCode = 1009;
+        return WEBSOCKET_FRAME_INVALID;
+    }
+    const bool control = (header.opcode & 0x08) != 0;
+    if (control && (!header.final || header.payloadLength > 125))
+    {
+        header.error = "invalid WebSocket control frame";
+        return WEBSOCKET_FRAME_INVALID;
+    }
+    header.closeCode = 0;
+    return WEBSOCKET_FRAME_READY;
+}
+
+} // namespace Doodle
@@ -1,17 +1,44 @@
 #include "client_settings.h"
 #include "brush_render.h"
+#include "buffer_pool.h"
+#include "brush_stamp.h"
 #include "canvas_sync.h"
+#include "cia_stream.h"
+#include "control_router.h"
+#include "delta_patch.h"
+#include "download_resume.h"
+#include "draw_batch.h"
+#include "draw_packet.h"
+#include "http_response.h"
 #include "input_bindings.h"
+#include "local_echo.h"
+#include "minimap_cache.h"
+#include "network_wait.h"
 #include "protocol.h"
 #include "scoped_notice.h"
+#include "sha256.h"
+#include "spsc_queue.h"
+#include "stroke_journal.h"
+#include "stroke_simplify.h"
 #include "timestamp_format.h"
 #include "ticket_flow.h"
 #include "ui_canvas.h"
 #include "ui_route.h"
+#include "viewport_render.h"
+#include "websocket_frame.h"
 
+#include <ctype.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 using namespace Doodle;
@@ -375,6 +402,7 @@ void testProtocolAdditionsAndEscaping()
     CHECK(strstr(command, "\"draw-size-tenths\"") != NULL);
     CHECK(strstr(command, "\"brush-feather\"") != NULL);
     CHECK(strstr(command, "\"brush-suite-v2\"") != NULL);
+    CHECK(strstr(command, "\"draw-delta\"") != NULL);
 
     Protocol::buildTicketCreate(
         command, sizeof(command), "report", "A \"quoted\" title",
@@ -519,8 +547,2090 @@ void testBrushRenderingMath()
     CHECK(blendBrushChannel(42, 200, 10) == 200);
 }
 
+
+void testIncrementalViewportMatchesFullRender()
+{
+    const int canvasWidth = 700;
+    const int canvasHeight = 500;
+    std::vector<u8> pixels(canvasWidth * canvasHeight * 3);
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = (u8)(i * 7 + i / 3);
+
+    // The bottom framebuffer is stored rotated as 240x320.
+    const int fbWidth = 240;
+    const int fbHeight = 320;
+    for (int zoomLevel = -1; zoomLevel <= 2; ++zoomLevel)
+    {
+        ViewportSource source = {&pixels[0], canvasWidth, canvasHeight,
+                                 -5, 3, zoomLevel};
+        std::vector<u8> incremental(fbWidth * fbHeight * 3, 0);
+        std::vector<u8> full(fbWidth * fbHeight * 3, 0);
+        IncrementalViewport viewport;
+        DirtyRect none = {0, 0, 0, 0, false};
+        CHECK(viewport.render(source, none, &incremental[0],
+                              fbWidth, fbHeight, false) ==
+              VIEWPORT_SCREEN_WIDTH * VIEWPORT_SCREEN_HEIGHT);
+        CHECK(viewport.render(source, none, &incremental[0],
+                              fbWidth, fbHeight, false) == 0);
+
+        for (int y = 40; y <= 52; ++y)
+            for (int x = 20; x <= 31; ++x)
+                pixels[3 * (y * canvasWidth + x)] ^= 0x5A;
+        DirtyRect stroke = {20, 40, 31, 52, true};
+        const int written = viewport.render(source, stroke, &incremental[0],
+                                            fbWidth, fbHeight, false);
+        CHECK(written > 0);
+        CHECK(written < VIEWPORT_SCREEN_WIDTH * VIEWPORT_SCREEN_HEIGHT);
+
+        // Overlays drawn over the staging buffer are restored on request.
+        incremental[3 * (100 * fbWidth + 100)] ^= 0xFF;
+        viewport.invalidateScreenRect(100, fbWidth - 1 - 100, 1, 1);
+        viewport.render(source, none, &incremental[0], fbWidth, fbHeight, false);
+
+        DirtyRect everything = {0, 0, VIEWPORT_SCREEN_WIDTH - 1,
+                                VIEWPORT_SCREEN_HEIGHT - 1, true};
+        renderViewportRect(source, &full[0], fbWidth, fbHeight, everything);
+        CHECK(incremental == full);
+
+        // A pan is detected without any dirty rectangle.
+        source.offsetX += 9;
+        CHECK(viewport.render(source, none, &incremental[0],
+                              fbWidth, fbHeight, false) ==
+              VIEWPORT_SCREEN_WIDTH * VIEWPORT_SCREEN_HEIGHT);
+    }
+
+    ViewportSource halfZoom = {&pixels[0], canvasWidth, canvasHeight, 1, 0, -1};
+    DirtyRect oddColumn = {4, 0, 4, 0, true};
+    DirtyRect mapped = viewportScreenRectForCanvas(halfZoom, oddColumn);
+    CHECK(mapped.valid && mapped.minX == 1 && mapped.maxX == 1);
+    DirtyRect offscreen = {0, 0, 0, 0, true};
+    CHECK(!viewportScreenRectForCanvas(halfZoom, offscreen).valid);
+}
+
+void renderPointSampledReference(const ViewportSource &source, u8 *buffer,
+                                 int fbWidth, int fbHeight)
+{
+    const bool rotated = fbWidth < fbHeight;
+    for (int screenY = 0; screenY < VIEWPORT_SCREEN_HEIGHT; ++screenY)
+    {
+        for (int screenX = 0; screenX < VIEWPORT_SCREEN_WIDTH; ++screenX)
+        {
+            const int fbX = rotated ? fbWidth - 1 - screenY : screenX;
+            const int fbY = rotated ? screenX : screenY;
+            const int canvasX = viewportCanvasCoordinate(
+                source.offsetX, source.zoomLevel, screenX);
+            const int canvasY = viewportCanvasCoordinate(
+                source.offsetY, source.zoomLevel, screenY);
+            u8 *out = buffer + 3 * (fbY * fbWidth + fbX);
+            if (canvasX >= 0 && canvasX < source.width &&
+                canvasY >= 0 && canvasY < source.height)
+            {
+                const u8 *in = source.pixels + 3 * (canvasY * source.width + canvasX);
+                out[0] = in[2];
+                out[1] = in[1];
+                out[2] = in[0];
+            }
+            else
+            {
+                out[0] = out[1] = out[2] = VIEWPORT_BACKDROP;
+            }
+        }
+    }
+}
+
+void testViewportKernels()
+{
+    const int canvasWidth = 300;
+    const int canvasHeight = 200;
+    std::vector<u8> pixels(canvasWidth * canvasHeight * 3);
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = (u8)(i * 13 + i / 5);
+    DirtyRect everything = {0, 0, VIEWPORT_SCREEN_WIDTH - 1,
+                            VIEWPORT_SCREEN_HEIGHT - 1, true};
+
+    // Replicating zooms must stay pixel-identical to point sampling in both
+    // framebuffer orientations, including the backdrop around the canvas.
+    for (int rotated = 0; rotated < 2; ++rotated)
+    {
+        const int fbWidth = rotated ? 240 : 320;
+        const int fbHeight = rotated ? 320 : 240;
+        for (int zoomLevel = 0; zoomLevel <= 2; ++zoomLevel)
+        {
+            ViewportSource source = {&pixels[0], canvasWidth, canvasHeight,
+                                     -7, 5, zoomLevel};
+            std::vector<u8> kernel(fbWidth * fbHeight * 3, 1);
+            std::vector<u8> reference(fbWidth * fbHeight * 3, 2);
+            renderViewportRect(source, &kernel[0], fbWidth, fbHeight, everything);
+            renderPointSampledReference(source, &reference[0], fbWidth, fbHeight);
+            CHECK(kernel == reference);
+
+            // A partial rectangle starting mid-cell still replicates the
+            // canvas pixel it covers and leaves everything else untouched.
+            std::vector<u8> partial(fbWidth * fbHeight * 3, 0);
+            DirtyRect oddRect = {33, 17, 90, 61, true};
+            renderViewportRect(source, &partial[0], fbWidth, fbHeight, oddRect);
+            bool partialMatches = true;
+            for (int y = 0; y < VIEWPORT_SCREEN_HEIGHT; ++y)
+            {
+                for (int x = 0; x < VIEWPORT_SCREEN_WIDTH; ++x)
+                {
+                    const int index = rotated ? 3 * (x * fbWidth + fbWidth - 1 - y)
+                                              : 3 * (y * fbWidth + x);
+                    const bool inside = x >= oddRect.minX && x <= oddRect.maxX &&
+                                        y >= oddRect.minY && y <= oddRect.maxY;
+                    if (partial[index] != (inside ? reference[index] : 0))
+                        partialMatches = false;
+                }
+            }
+            CHECK(partialMatches);
+        }
+    }
+
+    // 0.5x averages each 2x2 block and ignores samples outside the canvas.
+    std::vector<u8> half(240 * 320 * 3, 0);
+    ViewportSource halfSource = {&pixels[0], canvasWidth, canvasHeight, -1, 0, -1};
+    renderViewportRect(halfSource, &half[0], 240, 320, everything);
+    const u8 *top = &pixels[3 * (0 * canvasWidth + 1)];
+    const u8 *bottom = top + 3 * canvasWidth;
+    const u8 *inner = &half[3 * (1 * 240 + 239)];
+    CHECK(inner[2] == (u8)((top[0] + top[3] + bottom[0] + bottom[3] + 2) / 4));
+    CHECK(inner[0] == (u8)((top[2] + top[5] + bottom[2] + bottom[5] + 2) / 4));
+    const u8 *edge = &half[3 * (0 * 240 + 239)];
+    CHECK(edge[2] == (u8)((pixels[0] + pixels[3 * canvasWidth] + 1) / 2));
+    const u8 *outside = &half[3 * (319 * 240 + 0)];
+    CHECK(outside[0] == VIEWPORT_BACKDROP && outside[2] == VIEWPORT_BACKDROP);
+}
+
 } // namespace
 
+void testMinimapCacheTiles()
+{
+    const int canvasWidth = 1920;
+    const int canvasHeight = 1080;
+    std::vector<u8> pixels(canvasWidth * canvasHeight * 3, 255);
+    MinimapCache *minimap = new MinimapCache();
+
+    CHECK(minimap->update(&pixels[0], canvasWidth, canvasHeight) ==
+          MINIMAP_TILES_X * MINIMAP_TILES_Y);
+    CHECK(minimap->pixels()[0] == 255);
+    CHECK(minimap->update(&pixels[0], canvasWidth, canvasHeight) == 0);
+
+    // A one-pixel black line is thinner than the 7.5x downscale; point
+    // sampling could skip it, the box filter must darken its cells.
+    const int lineY = 541;
+    for (int x = 100; x < 900; ++x)
+        memset(&pixels[3 * (lineY * canvasWidth + x)], 0, 3);
+    DirtyRect line = {100, lineY, 899, lineY, true};
+    minimap->invalidateCanvasRect(line);
+    const int rebuilt = minimap->update(&pixels[0], canvasWidth, canvasHeight);
+    CHECK(rebuilt > 0 && rebuilt <= MINIMAP_TILES_X);
+    const int cellY = lineY * MINIMAP_HEIGHT / canvasHeight;
+    const u8 *cell = minimap->pixels() + 3 * (cellY * MINIMAP_WIDTH + 40);
+    CHECK(cell[0] < 255 && cell[0] > 200);
+    CHECK(cell[0] == cell[1] && cell[1] == cell[2]);
+    CHECK(minimap->pixels()[3 * ((cellY - 1) * MINIMAP_WIDTH + 40)] == 255);
+
+    // Pixels changed outside every marked rect stay stale until invalidated.
+    memset(&pixels[0], 0, 3 * 16);
+    CHECK(minimap->update(&pixels[0], canvasWidth, canvasHeight) == 0);
+    CHECK(minimap->pixels()[0] == 255);
+    DirtyRect corner = {0, 0, 15, 0, true};
+    minimap->invalidateCanvasRect(corner);
+    CHECK(minimap->update(&pixels[0], canvasWidth, canvasHeight) == 1);
+    CHECK(minimap->pixels()[0] < 255);
+
+    // A canvas smaller than the minimap repeats pixels; uniform stays exact.
+    std::vector<u8> small(100 * 60 * 3, 37);
+    CHECK(minimap->update(&small[0], 100, 60) == MINIMAP_TILES_X * MINIMAP_TILES_Y);
+    CHECK(minimap->pixels()[3 * (MINIMAP_WIDTH * MINIMAP_HEIGHT - 1)] == 37);
+    DirtyRect lastPixel = {99, 59, 99, 59, true};
+    minimap->invalidateCanvasRect(lastPixel);
+    CHECK(minimap->update(&small[0], 100, 60) == 1);
+    delete minimap;
+}
+
+void testWebSocketFrameParsing()
+{
+    WebSocketFrameHeader header;
+    const uint8_t small[] = {0x82, 0x03, 1, 2, 3};
+    CHECK(parseWebSocketFrameHeader(small, 1, 1024, header) == WEBSOCKET_FRAME_INCOMPLETE);
+    CHECK(parseWebSocketFrameHeader(small, 2, 1024, header) == WEBSOCKET_FRAME_READY);
+    CHECK(header.final && header.opcode == 0x02);
+    CHECK(header.payloadLength == 3 && header.headerLength == 2);
+
+    const uint8_t medium[] = {0x01, 0x7e, 0x01, 0x00};
+    CHECK(parseWebSocketFrameHeader(medium, 3, 1024, header) == WEBSOCKET_FRAME_INCOMPLETE);
+    CHECK(parseWebSocketFrameHeader(medium, 4, 1024, header) == WEBSOCKET_FRAME_READY);
+    CHECK(!header.final && header.payloadLength == 256 && header.headerLength == 4);
+    CHECK(parseWebSocketFrameHeader(medium, 4, 255, header) == WEBSOCKET_FRAME_INVALID);
+    CHECK(header.closeCode == 1009);
+
+    const uint8_t noncanonical[] = {0x82, 0x7e, 0x00, 0x10};
+    CHECK(parseWebSocketFrameHeader(noncanonical, 4, 1024, header) == WEBSOCKET_FRAME_INVALID);
+    CHECK(header.closeCode == 1002 && strstr(header.error, "noncanonical"));
+    const uint8_t masked[] = {0x82, 0x83};
+    CHECK(parseWebSocketFrameHeader(masked, 2, 1024, header) == WEBSOCKET_FRAME_INVALID);
+    const uint8_t reserved[] = {0xc2, 0x00};
+    CHECK(parseWebSocketFrameHeader(reserved, 2, 1024, header) == WEBSOCKET_FRAME_INVALID);
+    const uint8_t fragmentedPing[] = {0x09, 0x00};
+    CHECK(parseWebSocketFrameHeader(fragmentedPing, 2, 1024, header) == WEBSOCKET_FRAME_INVALID);
+    const uint8_t large[] = {0x82, 0x7f, 0, 0, 0, 0, 0, 0x01, 0x00, 0x00};
+    CHECK(parseWebSocketFrameHeader(large, 10, 1 << 20, header) == WEBSOCKET_FRAME_READY);
+    CHECK(header.payloadLength == 65536 && header.headerLength == 10);
+
+    // Consuming frames only moves the read cursor; a refill compacts the
+    // unread tail to the front without losing or reordering bytes.
+    ReceiveBuffer buffer;
+    CHECK(buffer.empty() && buffer.size() == 0);
+    const uint8_t first[] = {1, 2, 3, 4, 5, 6};
+    buffer.append(first, sizeof(first));
+    const uint8_t *start = buffer.data();
+    buffer.consume(2);
+    CHECK(buffer.size() == 4 && buffer.data() == start + 2 && buffer.data()[0] == 3);
+    uint8_t *tail = buffer.prepare(64);
+    for (int i = 0; i < 64; ++i)
+        tail[i] = (uint8_t)(100 + i);
+    buffer.commit(10);
+    CHECK(buffer.size() == 14);
+    CHECK(buffer.data()[0] == 3 && buffer.data()[3] == 6 && buffer.data()[4] == 100 &&
+          buffer.data()[13] == 109);
+    buffer.consume(100);
+    CHECK(buffer.empty());
+}
+
+// The per-pixel stamp loop drawBrush ran before masks were cached.
+void drawBrushPerPixelReference(u8 *buffer, int width, int height, int centerX, int centerY,
+                                int sizeTenths, int shape, u8 r, u8 g, u8 b, bool feather)
+{
+    const int upperSize = std::min(31, sizeTenths / 10 + (sizeTenths % 10 ? 1 : 0));
+    const int extent = upperSize / 2;
+    for (int y = -extent; y <= extent; y++)
+    {
+        for (int x = -extent; x <= extent; x++)
+        {
+            const int px = centerX + x;
+            const int py = centerY + y;
+            const int coverage = brushStampCoverageTenths(centerX, centerY, x, y,
+                                                          sizeTenths, shape, feather);
+            if (coverage <= 0 || px < 0 || px >= width || py < 0 || py >= height)
+                continue;
+            u8 *pixel = buffer + 3 * (py * width + px);
+            pixel[0] = blendBrushChannel(pixel[0], r, coverage);
+            pixel[1] = blendBrushChannel(pixel[1], g, coverage);
+            pixel[2] = blendBrushChannel(pixel[2], b, coverage);
+        }
+    }
+}
+
+void testBrushStampMasks()
+{
+    const int width = 48;
+    const int height = 40;
+    const int sizes[] = {10, 14, 25, 45, 60, 95, 120, 205, 310};
+    BrushStampCache cache;
+    bool identical = true;
+    for (int shape = 0; shape < CLIENT_BRUSH_SHAPE_COUNT; ++shape)
+    {
+        for (size_t sizeIndex = 0; sizeIndex < sizeof(sizes) / sizeof(sizes[0]); ++sizeIndex)
+        {
+            for (int feather = 0; feather < 2; ++feather)
+            {
+                std::vector<u8> expected(width * height * 3);
+                for (size_t i = 0; i < expected.size(); ++i)
+                    expected[i] = (u8)(i * 13);
+                std::vector<u8> actual(expected);
+                // Every phase, plus centers that clip against each edge.
+                for (int center = -6; center < 54; center += 3)
+                {
+                    const int cx = center;
+                    const int cy = (center * 5 + 3) % 46 - 3;
+                    drawBrushPerPixelReference(&expected[0], width, height, cx, cy,
+                                               sizes[sizeIndex], shape, 250, 20, 90, feather != 0);
+                    drawBrushStamp(cache, &actual[0], width, height, cx, cy,
+                                   sizes[sizeIndex], shape, 250, 20, 90, feather != 0);
+                }
+                identical = identical && expected == actual;
+            }
+        }
+    }
+    CHECK(identical);
+
+    // Patternless whole-size stamps share one mask; dither keys on phase.
+    BrushStampCache counted;
+    for (int x = 0; x < 16; ++x)
+        counted.mask(60, 0, false, x, x * 3);
+    CHECK(counted.builds() == 1);
+    for (int x = 0; x < 16; ++x)
+        counted.mask(60, BRUSH_RENDER_DITHER_SHAPE, false, x, 0);
+    CHECK(counted.builds() == 9);
+    counted.mask(60, BRUSH_RENDER_DITHER_SHAPE, false, 8, 0);
+    CHECK(counted.builds() == 9);
+}
+
+void testBrushStrokeSweep()
+{
+    const int width = 64;
+    const int height = 48;
+    const int sizes[] = {10, 30, 45, 60, 120, 125, 310};
+    // A straight run, a U-turn, a diagonal leaving the buffer, and a sparse
+    // hop that must not be bridged.
+    std::vector<DrawPoint> path;
+    for (int i = 0; i < 30; ++i)
+    {
+        DrawPoint point = {5 + i, 10 + i / 3};
+        path.push_back(point);
+    }
+    for (int i = 0; i < 20; ++i)
+    {
+        DrawPoint point = {34 + i / 2, 20 - i + (i > 10 ? 2 * (i - 10) : 0)};
+        path.push_back(point);
+    }
+    for (int i = 0; i < 25; ++i)
+    {
+        DrawPoint point = {44 + i, 30 + i};
+        path.push_back(point);
+    }
+    DrawPoint hop = {10, 40};
+    path.push_back(hop);
+    hop.x = 11;
+    path.push_back(hop);
+
+    BrushStampCache cache;
+    bool identical = true;
+    bool clippedMatches = true;
+    for (int shape = 0; shape < CLIENT_BRUSH_SHAPE_COUNT; ++shape)
+    {
+        for (size_t sizeIndex = 0; sizeIndex < sizeof(sizes) / sizeof(sizes[0]); ++sizeIndex)
+        {
+            for (int feather = 0; feather < 2; ++feather)
+            {
+                std::vector<u8> expected(width * height * 3);
+                for (size_t i = 0; i < expected.size(); ++i)
+                    expected[i] = (u8)(i * 7);
+                std::vector<u8> actual(expected);
+                for (size_t i = 0; i < path.size(); ++i)
+                    drawBrushStamp(cache, &expected[0], width, height, path[i].x, path[i].y,
+                                   sizes[sizeIndex], shape, 30, 60, 250, feather != 0);
+                std::vector<u8> clipped(actual);
+                drawBrushStamps(cache, &actual[0], width, height, &path[0], path.size(),
+                                sizes[sizeIndex], shape, 30, 60, 250, feather != 0);
+                identical = identical && expected == actual;
+
+                // A clipped redraw matches the full one inside and leaves
+                // everything outside alone.
+                const BrushClip clip = {20, 25, 50, 41};
+                drawBrushStamps(cache, &clipped[0], width, height, clip, &path[0], path.size(),
+                                sizes[sizeIndex], shape, 30, 60, 250, feather != 0);
+                for (int y = 0; y < height; ++y)
+                {
+                    for (int x = 0; x < width; ++x)
+                    {
+                        const bool inside = x >= clip.minX && x < clip.maxX &&
+                                            y >= clip.minY && y < clip.maxY;
+                        for (size_t index = 3 * ((size_t)y * width + x), end = index + 3;
+                             index < end; ++index)
+                            clippedMatches = clippedMatches &&
+                                             clipped[index] == (inside ? actual[index] : (u8)(index * 7));
+                    }
+                }
+            }
+        }
+    }
+    CHECK(identical);
+    CHECK(clippedMatches);
+    CHECK(cache.mask(120, 0, false, 0, 0).solid);
+    CHECK(!cache.mask(120, 0, true, 0, 0).solid);
+    CHECK(!cache.mask(120, BRUSH_RENDER_SPRAY_SHAPE, false, 0, 0).solid);
+}
+
+void testDeltaDrawPackets()
+{
+    DrawPacketStyle style = {12, 34, 56, 45, 6, true};
+    DrawPoint points[300];
+    for (int i = 0; i < 300; ++i)
+    {
+        points[i].x = 400 + i / 2;
+        points[i].y = 200 - i / 3;
+    }
+    points[10].x = 0;
+    points[10].y = 65535;
+    points[11] = points[10];
+
+    uint8_t packet[DRAW_PACKET_MAX_BYTES];
+    size_t length = 0;
+    size_t encoded = encodeDeltaDrawPacket(style, points, 300, packet, sizeof(packet), length);
+    CHECK(encoded == DRAW_PACKET_MAX_POINTS);
+    CHECK(packet[0] == DRAW_PACKET_DELTA && packet[6] == DRAW_PACKET_FLAG_FEATHER && packet[7] == 255);
+
+    DrawPacketStyle decodedStyle;
+    DrawPoint decoded[DRAW_PACKET_MAX_POINTS];
+    size_t count = 0;
+    CHECK(decodeDrawPacket(packet, length, decodedStyle, decoded, count));
+    CHECK(count == encoded);
+    CHECK(decodedStyle.r == 12 && decodedStyle.g == 34 && decodedStyle.b == 56);
+    CHECK(decodedStyle.sizeTenths == 45 && decodedStyle.shape == 6 && decodedStyle.feather);
+    bool samePoints = true;
+    for (size_t i = 0; i < count; ++i)
+        samePoints = samePoints && decoded[i].x == points[i].x && decoded[i].y == points[i].y;
+    CHECK(samePoints);
+
+    // Neighbouring samples cost one byte each, a quarter of the absolute form.
+    length = 0;
+    CHECK(encodeDeltaDrawPacket(style, points + 20, 64, packet, sizeof(packet), length) == 64);
+    CHECK(length == DRAW_PACKET_DELTA_HEADER + 63);
+    CHECK(length * 3 < DRAW_PACKET_ABSOLUTE_HEADER + 64 * 4);
+
+    // A short buffer ends the packet early instead of truncating a varint;
+    // the jump to the far corner needs five bytes.
+    CHECK(encodeDeltaDrawPacket(style, points + 8, 4, packet, DRAW_PACKET_DELTA_HEADER + 3, length) == 2);
+    CHECK(length == DRAW_PACKET_DELTA_HEADER + 1);
+    CHECK(decodeDrawPacket(packet, length, decodedStyle, decoded, count) && count == 2);
+    CHECK(encodeDeltaDrawPacket(style, points + 8, 4, packet, DRAW_PACKET_DELTA_HEADER + 6, length) == 3);
+    CHECK(decodeDrawPacket(packet, length, decodedStyle, decoded, count) && count == 3);
+    CHECK(decoded[2].x == 0 && decoded[2].y == 65535);
+    CHECK(encodeDeltaDrawPacket(style, points, 4, packet, DRAW_PACKET_DELTA_HEADER - 1, length) == 0);
+
+    // Truncated, trailing, overlong and out-of-range deltas are rejected.
+    encodeDeltaDrawPacket(style, points, 5, packet, sizeof(packet), length);
+    CHECK(!decodeDrawPacket(packet, length - 1, decodedStyle, decoded, count));
+    packet[length] = 0;
+    CHECK(!decodeDrawPacket(packet, length + 1, decodedStyle, decoded, count));
+    const uint8_t overlong[] = {6, 0, 0, 0, 10, 0, 0, 2, 0, 0, 0, 0, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00};
+    CHECK(!decodeDrawPacket(overlong, sizeof(overlong), decodedStyle, decoded, count));
+    const uint8_t leftOfCanvas[] = {6, 0, 0, 0, 10, 0, 0, 2, 0, 0, 0, 0, 0x01};
+    CHECK(!decodeDrawPacket(leftOfCanvas, sizeof(leftOfCanvas), decodedStyle, decoded, count));
+    const uint8_t noPoints[] = {6, 0, 0, 0, 10, 0, 0, 0, 0, 0, 0, 0};
+    CHECK(!decodeDrawPacket(noPoints, sizeof(noPoints), decodedStyle, decoded, count));
+
+    // Absolute packets decode from any alignment; type 1 sizes are whole.
+    uint8_t absolute[1 + 7 + 8];
+    const uint8_t legacy[] = {1, 9, 8, 7, 3, 2, 2, 0x34, 0x12, 0x02, 0x00, 0xff, 0xff, 0x00, 0x01};
+    memcpy(absolute + 1, legacy, sizeof(legacy));
+    CHECK(decodeDrawPacket(absolute + 1, sizeof(legacy), decodedStyle, decoded, count));
+    CHECK(count == 2 && decodedStyle.sizeTenths == 30 && !decodedStyle.feather);
+    CHECK(decoded[0].x == 0x1234 && decoded[0].y == 2 && decoded[1].x == 0xffff && decoded[1].y == 0x100);
+    CHECK(!decodeDrawPacket(absolute + 1, sizeof(legacy) - 1, decodedStyle, decoded, count));
+}
+
+void testControlMessageRouting()
+{
+    // Every name round-trips, which also holds only while the table is sorted.
+    for (int type = CONTROL_MESSAGE_UNKNOWN + 1; type < CONTROL_MESSAGE_TYPE_COUNT; ++type)
+    {
+        const char *name = controlMessageTypeName((ControlMessageType)type);
+        char line[80];
+        snprintf(line, sizeof(line), "{\"type\":\"%s\",\"ok\":true}", name);
+        CHECK(controlMessageType(line) == type);
+        if (type > CONTROL_MESSAGE_UNKNOWN + 1)
+            CHECK(strcmp(controlMessageTypeName((ControlMessageType)(type - 1)), name) < 0);
+    }
+    CHECK(controlMessageTypeName(CONTROL_MESSAGE_UNKNOWN)[0] == '\0');
+    CHECK(controlMessageTypeName(CONTROL_MESSAGE_TYPE_COUNT)[0] == '\0');
+
+    CHECK(controlMessageType("{\"id\":4,\"type\":\"ticketCounts\",\"mineOpen\":1}") ==
+          CONTROL_MESSAGE_TICKET_COUNTS);
+    // Prefixes and extensions of known names are not matches.
+    CHECK(controlMessageType("{\"type\":\"ticketList\"}") == CONTROL_MESSAGE_UNKNOWN);
+    CHECK(controlMessageType("{\"type\":\"ticketListStarted\"}") == CONTROL_MESSAGE_UNKNOWN);
+    CHECK(controlMessageType("{\"type\":\"\"}") == CONTROL_MESSAGE_UNKNOWN);
+    CHECK(controlMessageType("{\"type\":\"presence") == CONTROL_MESSAGE_UNKNOWN);
+    CHECK(controlMessageType("{\"kind\":\"presence\"}") == CONTROL_MESSAGE_UNKNOWN);
+    CHECK(controlMessageType(NULL) == CONTROL_MESSAGE_UNKNOWN);
+
+    // The routed type selects the parser that accepts the line.
+    const char *thread = "{\"type\":\"ticketThreadStart\",\"ticket\":{\"id\":12,\"subject\":\"Hi\"}}";
+    SupportTicketSummary ticket;
+    CHECK(controlMessageType(thread) == CONTROL_MESSAGE_TICKET_THREAD_START);
+    CHECK(Protocol::parseTicketSummary(thread, ticket));
+    char reason[32];
+    CHECK(controlMessageType("{\"type\":\"banned\"}") == CONTROL_MESSAGE_BANNED);
+    CHECK(Protocol::parseDisconnected("{\"type\":\"banned\"}", reason, sizeof(reason)));
+}
+
+void testProtocolFieldCursor()
+{
+    // Users are read in one walk each: key order, nesting, escapes and
+    // truncation behave as the key-by-key searches did.
+    const char *presenceLine =
+        "{\"type\":\"presence\",\"channel\":\"art\",\"total\":5,\"users\":["
+        "{\"readOnly\":true,\"sessionCount\":2,\"displayName\":\"Tab\\tby \\\"Q\\\"\","
+        "\"id\":\"s1\",\"role\":{\"name\":\"nested\"},\"status\":\"muted\","
+        "\"meta\":{\"clientType\":\"web\",\"tags\":[\"a\",{\"x\":\"}\"}]},"
+        "\"clientType\":\"3ds\",\"deviceModel\":\"new-3ds-xl-with-a-very-long-model-name\"},"
+        "{\"id\":\"s2\",\"muteSecondsRemaining\": 30,\"channel\":\"main\"}"
+        "]}";
+    PresenceUser users[4];
+    PresenceInfo presence;
+    int count = 0;
+    CHECK(Protocol::parsePresence(presenceLine, users, 4, count, presence));
+    CHECK(count == 2);
+    CHECK(strcmp(presence.channel, "art") == 0);
+    CHECK(presence.total == 5 && presence.truncated);
+    CHECK(strcmp(users[0].id, "s1") == 0);
+    CHECK(strcmp(users[0].displayName, "Tab by \"Q\"") == 0);
+    CHECK(strcmp(users[0].role, "user") == 0);
+    CHECK(strcmp(users[0].status, "muted") == 0);
+    CHECK(strcmp(users[0].clientType, "web") == 0);
+    CHECK(strcmp(users[0].deviceModel, "new-3ds-xl-with-a-very-") == 0);
+    CHECK(strcmp(users[0].deviceModelLabel, users[0].deviceModel) == 0);
+    CHECK(users[0].readOnly && users[0].sessionCount == 2);
+    CHECK(strcmp(users[1].id, "s2") == 0);
+    CHECK(users[1].muteSecondsRemaining == 30 && users[1].sessionCount == 1);
+    CHECK(strcmp(users[1].channel, "main") == 0);
+    CHECK(strcmp(users[1].displayName, "USER") == 0);
+
+    // An unterminated user ends the list without counting it.
+    CHECK(Protocol::parsePresence(
+        "{\"type\":\"presence\",\"users\":[{\"id\":\"ok\"},{\"id\":\"cut", users, 4, count, presence));
+    CHECK(count == 1 && presence.total == 1 && !presence.truncated);
+
+    // The first string "message" wins over the wrapping object key.
+    StaffChatMessage staff;
+    CHECK(Protocol::parseStaffChatMessage(
+        "{\"type\":\"staffChatMessage\",\"message\":{\"id\":7,\"role\":\"mod\","
+        "\"message\":\"line 1\\nline 2 \\\\ path\"}}", staff));
+    CHECK(staff.id == 7 && strcmp(staff.role, "mod") == 0);
+    CHECK(strcmp(staff.message, "line 1 line 2 \\ path") == 0);
+
+    IdentityInfo identity;
+    memset(&identity, 0, sizeof(identity));
+    CHECK(Protocol::parseIdentityAccepted(
+        "{\"type\":\"identityAccepted\",\"identityId\":\"abc\",\"id\":\"\",\"banSecondsRemaining\":9}", identity));
+    CHECK(strcmp(identity.identityId, "abc") == 0);
+    CHECK(identity.banSecondsRemaining == 9 && strcmp(identity.displayName, "3DS User") == 0);
+}
+
+double distanceToPolyline(const DrawPoint &point, const std::vector<DrawPoint> &line)
+{
+    double best = 1e9;
+    for (size_t i = 1; i < line.size(); ++i)
+    {
+        const double dx = line[i].x - line[i - 1].x;
+        const double dy = line[i].y - line[i - 1].y;
+        const double px = point.x - line[i - 1].x;
+        const double py = point.y - line[i - 1].y;
+        const double lengthSquared = dx * dx + dy * dy;
+        double t = lengthSquared > 0.0 ? (px * dx + py * dy) / lengthSquared : 0.0;
+        t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+        const double ex = px - dx * t;
+        const double ey = py - dy * t;
+        best = std::min(best, sqrt(ex * ex + ey * ey));
+    }
+    return best;
+}
+
+void testStrokeSimplifier()
+{
+    StrokeSimplifier simplifier;
+    std::vector<DrawPoint> stroke;
+    std::vector<DrawPoint> sent;
+    for (int x = 10; x <= 50; ++x)
+    {
+        DrawPoint point = {x, 7};
+        stroke.push_back(point);
+    }
+    simplifier.simplify(&stroke[0], stroke.size(), 30, 0, sent);
+    CHECK(sent.size() == 2);
+    CHECK(sent[0].x == 10 && sent[1].x == 50 && sent[1].y == 7);
+
+    // Corners survive; a stroke that doubles back keeps its turning point.
+    for (int y = 8; y <= 30; ++y)
+    {
+        DrawPoint point = {50, y};
+        stroke.push_back(point);
+    }
+    for (int x = 49; x >= 30; --x)
+    {
+        DrawPoint point = {x, 30};
+        stroke.push_back(point);
+    }
+    simplifier.simplify(&stroke[0], stroke.size(), 30, 0, sent);
+    CHECK(sent.size() == 3 || sent.size() == 4);
+    CHECK(sent.front().x == 10 && sent.back().x == 30 && sent.back().y == 30);
+    bool keptCorner = false;
+    for (size_t i = 0; i < sent.size(); ++i)
+        keptCorner = keptCorner || (sent[i].x == 50 && sent[i].y == 7);
+    CHECK(keptCorner);
+
+    // A sampled arc stays within the tolerance of what is sent.
+    stroke.clear();
+    int lastX = -1, lastY = -1;
+    for (int step = 0; step <= 400; ++step)
+    {
+        const double angle = step * 1.5707963 / 400.0;
+        DrawPoint point = {(int)floor(200.0 + 120.0 * cos(angle) + 0.5),
+                           (int)floor(200.0 + 120.0 * sin(angle) + 0.5)};
+        if (point.x == lastX && point.y == lastY)
+            continue;
+        stroke.push_back(point);
+        lastX = point.x;
+        lastY = point.y;
+    }
+    simplifier.simplify(&stroke[0], stroke.size(), 30, 0, sent);
+    CHECK(sent.size() > 2 && sent.size() * 2 < stroke.size());
+    CHECK(sent.front().x == stroke.front().x && sent.back().y == stroke.back().y);
+    double worst = 0.0;
+    for (size_t i = 0; i < stroke.size(); ++i)
+        worst = std::max(worst, distanceToPolyline(stroke[i], sent));
+    CHECK(worst <= 0.5);
+
+    simplifier.setToleranceTenths(-1);
+    simplifier.simplify(&stroke[0], stroke.size(), 30, 0, sent);
+    CHECK(sent.size() == stroke.size());
+    simplifier.setToleranceTenths(STROKE_SIMPLIFY_DEFAULT_TOLERANCE_TENTHS);
+
+    // Sparse brushes keep the number of stamps a receiver places.
+    const int spraySize = 80;
+    CHECK(brushStrokeSpacing(spraySize, BRUSH_RENDER_SPRAY_SHAPE) == 4);
+    const int evenXs[] = {0, 4, 8, 12, 16, 21};
+    stroke.clear();
+    for (size_t i = 0; i < sizeof(evenXs) / sizeof(evenXs[0]); ++i)
+    {
+        DrawPoint point = {100 + evenXs[i], 40};
+        stroke.push_back(point);
+    }
+    simplifier.simplify(&stroke[0], stroke.size(), spraySize, BRUSH_RENDER_SPRAY_SHAPE, sent);
+    CHECK(sent.size() == 2);
+    const int crowdedXs[] = {0, 2, 4, 8};
+    stroke.clear();
+    for (size_t i = 0; i < sizeof(crowdedXs) / sizeof(crowdedXs[0]); ++i)
+    {
+        DrawPoint point = {100 + crowdedXs[i], 40};
+        stroke.push_back(point);
+    }
+    simplifier.simplify(&stroke[0], stroke.size(), spraySize, BRUSH_RENDER_SPRAY_SHAPE, sent);
+    int sentSteps = 0;
+    for (size_t i = 1; i < sent.size(); ++i)
+        sentSteps += brushStrokeSegmentSteps(sent[i].x - sent[i - 1].x, sent[i].y - sent[i - 1].y,
+                                             spraySize, BRUSH_RENDER_SPRAY_SHAPE);
+    CHECK(sentSteps == 3);
+    CHECK(sent.size() < stroke.size());
+}
+
+void testDrawBatching()
+{
+    CHECK(deltaDrawPointBytes(1, -1) == 1);
+    CHECK(deltaDrawPointBytes(40, 0) == 2);
+
+    DrawBatcher batcher(33, 64);
+    std::vector<DrawPoint> pending;
+    CHECK(!batcher.due(pending, 1000));
+
+    // Slow strokes wait out the latency target from their first sample.
+    DrawPoint point = {100, 100};
+    pending.push_back(point);
+    CHECK(!batcher.due(pending, 1000));
+    CHECK(batcher.pendingBytes() == DRAW_PACKET_DELTA_HEADER);
+    for (int i = 0; i < 10; ++i)
+    {
+        point.x += 1;
+        pending.push_back(point);
+    }
+    CHECK(!batcher.due(pending, 1016));
+    CHECK(batcher.pendingBytes() == DRAW_PACKET_DELTA_HEADER + 10);
+    CHECK(batcher.due(pending, 1033));
+
+    // The sender consumes the batch and resets it.
+    pending.clear();
+    batcher.reset();
+    pending.push_back(point);
+    CHECK(!batcher.due(pending, 2000));
+
+    // Fast strokes go out once their encoding reaches the byte budget.
+    for (int i = 0; i < 25; ++i)
+    {
+        point.x += 40;
+        pending.push_back(point);
+    }
+    CHECK(!batcher.due(pending, 2001));
+    point.x += 40;
+    pending.push_back(point);
+    CHECK(batcher.due(pending, 2001));
+    CHECK(batcher.pendingBytes() == DRAW_PACKET_DELTA_HEADER + 52);
+
+    // A batch cleared elsewhere, as on disconnect, starts over.
+    pending.clear();
+    CHECK(!batcher.due(pending, 2002));
+    pending.push_back(point);
+    CHECK(!batcher.due(pending, 5000));
+    CHECK(batcher.due(pending, 5033));
+
+    // Packet point limits also close a batch, whatever the budget.
+    DrawBatcher unbounded(1000, 1u << 20);
+    pending.assign(DRAW_PACKET_MAX_POINTS, point);
+    CHECK(unbounded.due(pending, 0));
+
+    DrawBatcher immediate(0, 1u << 20);
+    pending.assign(1, point);
+    CHECK(immediate.due(pending, 7));
+
+    SendRateCounter rate;
+    CHECK(rate.packetsPerSecond(0) == 0);
+    rate.record(40, 1000);
+    rate.record(60, 1050);
+    rate.record(20, 1900);
+    CHECK(rate.packetsPerSecond(1900) == 3);
+    CHECK(rate.bytesPerSecond(1900) == 120);
+    CHECK(rate.packetsPerSecond(2050) == 1);
+    CHECK(rate.bytesPerSecond(2050) == 20);
+    CHECK(rate.packetsPerSecond(60000) == 0);
+    CHECK(rate.totalPackets() == 3 && rate.totalBytes() == 120);
+}
+
+struct PoolLockCounts
+{
+    int locks;
+    int unlocks;
+};
+
+void countPoolLock(void *context)
+{
+    ++((PoolLockCounts *)context)->locks;
+}
+
+void countPoolUnlock(void *context)
+{
+    ++((PoolLockCounts *)context)->unlocks;
+}
+
+void testBufferPool()
+{
+    // Before reserve() every buffer is a counted heap allocation.
+    {
+        BufferPool heapOnly;
+        PooledBuffer buffer;
+        CHECK(heapOnly.acquireCopy("abc", 3, buffer));
+        CHECK(buffer.size() == 3 && strcmp(buffer.c_str(), "abc") == 0);
+        CHECK(heapOnly.stats().heapAllocations == 1);
+        CHECK(heapOnly.stats().exhausted == 0);
+        buffer.reset();
+        CHECK(heapOnly.stats().inUse == 0);
+    }
+
+    BufferPool pool;
+    PoolLockCounts lockCounts = {0, 0};
+    pool.setLock(countPoolLock, countPoolUnlock, &lockCounts);
+    CHECK(pool.reserve());
+
+    // Text lands NUL-terminated in the smallest block that leaves room.
+    const char line[] = "{\"type\":\"presence\"}";
+    PooledBuffer text;
+    CHECK(pool.acquireCopy(line, sizeof(line) - 1, text));
+    CHECK(text.size() == sizeof(line) - 1 && strcmp(text.c_str(), line) == 0);
+    CHECK(text.capacity() == BUFFER_POOL_BLOCK_BYTES[0] - 1);
+    CHECK(text.resize(4) && strcmp(text.c_str(), "{\"ty") == 0);
+    CHECK(!text.resize(text.capacity() + 1));
+    PooledBuffer edge;
+    CHECK(pool.acquire(BUFFER_POOL_BLOCK_BYTES[0], edge));
+    CHECK(edge.capacity() == BUFFER_POOL_BLOCK_BYTES[1] - 1);
+    edge.reset();
+
+    // Handles move without copying and give the block back once.
+    const uint8_t *block = text.data();
+    PooledBuffer moved(std::move(text));
+    CHECK(text.data() == NULL && text.empty() && text.c_str()[0] == '\0');
+    CHECK(moved.data() == block);
+    PooledBuffer assigned;
+    CHECK(pool.acquire(10, assigned));
+    assigned = std::move(moved);
+    CHECK(assigned.data() == block);
+    CHECK(pool.stats().inUse == 1);
+    assigned.reset();
+    CHECK(pool.stats().inUse == 0);
+
+    // Steady traffic reuses blocks and never reaches the heap.
+    std::vector<PooledBuffer> frames(16);
+    char frameBytes[32];
+    memset(frameBytes, 'f', sizeof(frameBytes));
+    for (int round = 0; round < 1000; ++round)
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+            CHECK(pool.acquireCopy(frameBytes, 12 + i, frames[i]));
+        for (size_t i = 0; i < frames.size(); ++i)
+            frames[i].reset();
+    }
+    BufferPoolStats stats = pool.stats();
+    CHECK(stats.heapAllocations == 0 && stats.exhausted == 0);
+    CHECK(stats.inUse == 0 && stats.peakInUse == 16);
+    CHECK(stats.acquired == 16 * 1000 + 3);
+
+    // An empty class and an oversize request both fall back to the heap.
+    std::vector<PooledBuffer> held(BUFFER_POOL_BLOCK_COUNTS[0] + 1);
+    for (size_t i = 0; i < held.size(); ++i)
+        CHECK(pool.acquire(32, held[i]));
+    PooledBuffer oversize;
+    CHECK(pool.acquire(BUFFER_POOL_BLOCK_BYTES[BUFFER_POOL_CLASS_COUNT - 1], oversize));
+    CHECK(oversize.capacity() == BUFFER_POOL_BLOCK_BYTES[BUFFER_POOL_CLASS_COUNT - 1]);
+    stats = pool.stats();
+    CHECK(stats.exhausted == 1 && stats.heapAllocations == 2);
+    held.clear();
+    oversize.reset();
+    CHECK(pool.stats().inUse == 0);
+    CHECK(lockCounts.locks > 0 && lockCounts.locks == lockCounts.unlocks);
+}
+
+struct QueuedFrame
+{
+    QueuedFrame() : sequence(0) {}
+
+    uint32_t sequence;
+    PooledBuffer payload;
+};
+
+void lockStressPool(void *context)
+{
+    ((std::mutex *)context)->lock();
+}
+
+void unlockStressPool(void *context)
+{
+    ((std::mutex *)context)->unlock();
+}
+
+void testSpscQueue()
+{
+    SpscQueue<int, 4> small;
+    bool wasEmpty = false;
+    int value = 1;
+    CHECK(small.empty() && small.front() == NULL);
+    CHECK(small.push(std::move(value), &wasEmpty) && wasEmpty);
+    for (value = 2; value <= 4; ++value)
+    {
+        int copy = value;
+        CHECK(small.push(std::move(copy), &wasEmpty) && !wasEmpty);
+    }
+    value = 5;
+    CHECK(!small.push(std::move(value)));
+    CHECK(small.size() == 4 && small.front() && *small.front() == 1);
+    int popped = 0;
+    CHECK(small.pop(popped) && popped == 1);
+    value = 5;
+    CHECK(small.push(std::move(value), &wasEmpty) && !wasEmpty);
+    for (int expected = 2; expected <= 5; ++expected)
+        CHECK(small.pop(popped) && popped == expected);
+    CHECK(!small.pop(popped));
+    value = 6;
+    CHECK(small.push(std::move(value), &wasEmpty) && wasEmpty);
+
+    // The worker/main-loop shape: one producer that signals only when the
+    // consumer may have gone to sleep, one consumer that sleeps on a
+    // condition variable whenever it finds the ring empty. A missed wakeup
+    // leaves the consumer asleep with items queued until its timeout.
+    const uint32_t FRAME_COUNT = 200000;
+    std::mutex poolMutex;
+    BufferPool pool;
+    pool.setLock(lockStressPool, unlockStressPool, &poolMutex);
+    CHECK(pool.reserve());
+    SpscQueue<QueuedFrame, 64> queue;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    uint32_t received = 0;
+    uint32_t corrupt = 0;
+    uint32_t lostWakeups = 0;
+
+    std::thread consumer([&]() {
+        QueuedFrame frame;
+        while (received < FRAME_COUNT)
+        {
+            if (queue.pop(frame))
+            {
+                uint32_t stamped = 0;
+                if (frame.sequence != received || frame.payload.size() < sizeof(stamped))
+                    ++corrupt;
+                else
+                {
+                    memcpy(&stamped, frame.payload.data(), sizeof(stamped));
+                    corrupt += stamped != frame.sequence ? 1u : 0u;
+                }
+                frame.payload.reset();
+                ++received;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            if (queue.empty() &&
+                wake.wait_for(lock, std::chrono::milliseconds(500)) == std::cv_status::timeout &&
+                !queue.empty())
+                ++lostWakeups;
+        }
+    });
+
+    for (uint32_t sequence = 0; sequence < FRAME_COUNT; ++sequence)
+    {
+        QueuedFrame frame;
+        frame.sequence = sequence;
+        uint8_t bytes[48];
+        memset(bytes, (int)(sequence & 0xff), sizeof(bytes));
+        memcpy(bytes, &sequence, sizeof(sequence));
+        CHECK(pool.acquireCopy(bytes, 4 + sequence % 44, frame.payload));
+        bool becameNonEmpty = false;
+        while (!queue.push(std::move(frame), &becameNonEmpty))
+            std::this_thread::yield();
+        if (becameNonEmpty)
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wake.notify_one();
+        }
+        // Let the consumer catch up and sleep now and then.
+        if (sequence % 4096 == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    consumer.join();
+
+    CHECK(received == FRAME_COUNT);
+    CHECK(corrupt == 0);
+    CHECK(lostWakeups == 0);
+    CHECK(queue.empty());
+    const BufferPoolStats stats = pool.stats();
+    CHECK(stats.inUse == 0);
+    CHECK(stats.heapAllocations == stats.exhausted);
+    CHECK(stats.acquired == FRAME_COUNT);
+}
+
+void testNetworkWait()
+{
+    CHECK(networkWaitMs(1000, NULL, 0, 500) == 500);
+    const uint64_t unset[] = {0, 0};
+    CHECK(networkWaitMs(1000, unset, 2, 500) == 500);
+    const uint64_t heartbeatAndWifi[] = {16000, 1250, 0};
+    CHECK(networkWaitMs(1000, heartbeatAndWifi, 3, 1000) == 250);
+    CHECK(networkWaitMs(1249, heartbeatAndWifi, 3, 1000) == 1);
+    CHECK(networkWaitMs(1250, heartbeatAndWifi, 3, 1000) == 0);
+    CHECK(networkWaitMs(9000, heartbeatAndWifi, 3, 1000) == 0);
+    const uint64_t farAway[] = {4000000000ULL};
+    CHECK(networkWaitMs(1000, farAway, 1, 1000) == 1000);
+    CHECK(networkWaitMs(1000, farAway, 1, 0) == 0);
+}
+
+void testStrokeJournal()
+{
+    const uint8_t first[] = {6, 1, 2, 3};
+    const uint8_t second[] = {6, 4, 5};
+    const uint8_t third[] = {6, 7, 8, 9, 10};
+    const uint8_t *packet = NULL;
+    size_t length = 0;
+
+    StrokeJournal journal(64);
+    journal.setChannel("main");
+    CHECK(journal.record(1, first, sizeof(first)));
+    CHECK(journal.record(2, second, sizeof(second)));
+    CHECK(journal.record(3, third, sizeof(third)));
+    CHECK(journal.count() == 3 && journal.staleCount() == 0);
+    CHECK(!journal.peekStale(packet, length));
+    journal.acknowledge(0);
+    CHECK(journal.count() == 3);
+    journal.acknowledge(1);
+    CHECK(journal.count() == 2);
+
+    // The connection drops with 2 and 3 unconfirmed and the rest of the
+    // stroke never sent; all of it waits for the next snapshot.
+    CHECK(journal.record(STROKE_JOURNAL_UNSENT, first, sizeof(first)));
+    journal.acknowledge(3);
+    CHECK(journal.count() == 1);
+    journal.markStale();
+    CHECK(journal.staleCount() == 1);
+    CHECK(journal.peekStale(packet, length));
+    CHECK(length == sizeof(first) && memcmp(packet, first, length) == 0);
+
+    // Replay re-records under new sequences; acknowledgements wait for it.
+    journal.setChannel("main");
+    CHECK(journal.record(4, second, sizeof(second)));
+    journal.acknowledge(4);
+    CHECK(journal.count() == 2 && journal.staleCount() == 1);
+    journal.popStale();
+    CHECK(journal.count() == 0 && journal.staleCount() == 0);
+
+    // Full journals drop the oldest packets, stale ones included.
+    for (uint32_t sequence = 10; sequence < 20; ++sequence)
+        CHECK(journal.record(sequence, third, sizeof(third)));
+    CHECK(journal.bytes() <= journal.byteLimit());
+    CHECK(journal.count() == 5 && journal.dropped() == 5);
+    journal.markStale();
+    CHECK(journal.record(20, first, sizeof(first)));
+    CHECK(journal.count() == 5 && journal.staleCount() == 4);
+    uint8_t huge[80] = {6};
+    CHECK(!journal.record(21, huge, sizeof(huge)));
+
+    // Saved packets come back stale and in order; a new channel drops them.
+    const char *path = "build/host-tests/stroke-journal.bin";
+    CHECK(journal.save(path));
+    StrokeJournal restored(64);
+    CHECK(restored.load(path));
+    CHECK(restored.channel() == "main");
+    CHECK(restored.count() == 5 && restored.staleCount() == 5);
+    for (int i = 0; i < 4; ++i)
+    {
+        CHECK(restored.peekStale(packet, length));
+        CHECK(length == sizeof(third) && memcmp(packet, third, length) == 0);
+        restored.popStale();
+    }
+    CHECK(restored.peekStale(packet, length));
+    CHECK(length == sizeof(first) && memcmp(packet, first, length) == 0);
+    restored.setChannel("other");
+    CHECK(restored.count() == 0);
+
+    CHECK(writeText(path, "DJN1\x04garbage"));
+    CHECK(!restored.load(path));
+    CHECK(restored.count() == 0);
+    journal.clear();
+    CHECK(journal.save(path));
+    CHECK(!fileExists(path));
+}
+
+// Stands in for the network's send queue: room for a few messages until
+// the worker drains it, numbering each one it takes.
+struct BoundedSendQueue
+{
+    explicit BoundedSendQueue(size_t capacity) : capacity(capacity), lastSequence(0) {}
+
+    bool send(const uint8_t *packet, size_t length)
+    {
+        if (queued.size() >= capacity)
+            return false;
+        queued.push_back(std::vector<uint8_t>(packet, packet + length));
+        ++lastSequence;
+        return true;
+    }
+
+    size_t capacity;
+    uint32_t lastSequence;
+    std::vector<std::vector<uint8_t> > queued;
+    std::vector<std::vector<uint8_t> > delivered;
+};
+
+// The client's rule: a packet goes out only when nothing unsent is ahead of
+// it, and the unsent ones are sent again as the queue makes room.
+void sendOrJournal(StrokeJournal &journal, BoundedSendQueue &queue, const uint8_t *packet, size_t length)
+{
+    if (journal.unsentCount() == 0 && queue.send(packet, length))
+        journal.record(queue.lastSequence, packet, length);
+    else
+        journal.record(STROKE_JOURNAL_UNSENT, packet, length);
+}
+
+void resendUnsent(StrokeJournal &journal, BoundedSendQueue &queue)
+{
+    const uint8_t *packet = NULL;
+    size_t length = 0;
+    while (journal.peekUnsent(packet, length) && queue.send(packet, length))
+        journal.sent(queue.lastSequence);
+}
+
+void testStrokeJournalQueueFull()
+{
+    StrokeJournal journal(1024);
+    journal.setChannel("main");
+    BoundedSendQueue queue(2);
+    uint8_t packets[6][4];
+    for (int i = 0; i < 6; ++i)
+    {
+        const uint8_t packet[] = {6, (uint8_t)i, (uint8_t)(i * 3), 9};
+        memcpy(packets[i], packet, sizeof(packet));
+    }
+
+    // The queue takes two packets and refuses the rest while still
+    // connected; the fourth waits behind the third even once there is room.
+    sendOrJournal(journal, queue, packets[0], 4);
+    sendOrJournal(journal, queue, packets[1], 4);
+    sendOrJournal(journal, queue, packets[2], 4);
+    queue.delivered.insert(queue.delivered.end(), queue.queued.begin(), queue.queued.end());
+    queue.queued.clear();
+    sendOrJournal(journal, queue, packets[3], 4);
+    CHECK(queue.lastSequence == 2 && journal.count() == 4 && journal.unsentCount() == 2);
+    CHECK(journal.staleCount() == 0);
+
+    resendUnsent(journal, queue);
+    CHECK(journal.unsentCount() == 0 && queue.lastSequence == 4);
+    sendOrJournal(journal, queue, packets[4], 4);
+    CHECK(journal.unsentCount() == 1);
+    queue.delivered.insert(queue.delivered.end(), queue.queued.begin(), queue.queued.end());
+    queue.queued.clear();
+    resendUnsent(journal, queue);
+    queue.delivered.insert(queue.delivered.end(), queue.queued.begin(), queue.queued.end());
+    CHECK(queue.delivered.size() == 5);
+    for (size_t i = 0; i < queue.delivered.size(); ++i)
+        CHECK(memcmp(&queue.delivered[i][0], packets[i], 4) == 0);
+    journal.acknowledge(queue.lastSequence);
+    CHECK(journal.count() == 0);
+
+    // Packets confirmed behind one still unsent are forgotten all the same.
+    CHECK(journal.record(STROKE_JOURNAL_UNSENT, packets[0], 4));
+    CHECK(journal.record(6, packets[1], 4));
+    CHECK(journal.record(7, packets[2], 4));
+    const size_t before = journal.bytes();
+    journal.acknowledge(6);
+    CHECK(journal.count() == 2 && journal.bytes() < before);
+    const uint8_t *packet = NULL;
+    size_t length = 0;
+    CHECK(journal.peekUnsent(packet, length) && memcmp(packet, packets[0], 4) == 0);
+    size_t cursor = 0;
+    uint32_t sequence = 0;
+    CHECK(journal.next(cursor, sequence, packet, length) && sequence == STROKE_JOURNAL_UNSENT);
+    CHECK(journal.next(cursor, sequence, packet, length) && sequence == 7 && memcmp(packet, packets[2], 4) == 0);
+    CHECK(!journal.next(cursor, sequence, packet, length));
+
+    // A lost connection turns them stale for replay over the next snapshot.
+    journal.markStale();
+    CHECK(journal.unsentCount() == 0 && journal.staleCount() == 2);
+    CHECK(!journal.peekUnsent(packet, length));
+}
+
+void testLocalEchoTiles()
+{
+    LocalEchoTiles tiles;
+    tiles.reset(100, 70);
+    std::vector<DirtyRect> areas;
+    DirtyRect stroke = {10, 10, 40, 20, true};
+    DirtyRect remote = {0, 0, 99, 69, true};
+    CHECK(tiles.pendingAreas(remote, areas) == 0);
+
+    // Tiles are 32 pixels: the stroke covers two in the top row.
+    tiles.markPending(stroke, 5);
+    CHECK(tiles.pendingTiles() == 2);
+    CHECK(tiles.pendingAreas(remote, areas) == 1);
+    CHECK(areas[0].minX == 0 && areas[0].maxX == 63 && areas[0].minY == 0 && areas[0].maxY == 31);
+
+    // Areas are clipped to the remote change and split by gaps in a row.
+    DirtyRect farStroke = {97, 5, 99, 8, true};
+    tiles.markPending(farStroke, 6);
+    DirtyRect band = {20, 30, 99, 40, true};
+    CHECK(tiles.pendingAreas(band, areas) == 2);
+    CHECK(areas[0].minX == 20 && areas[0].maxX == 63 && areas[0].minY == 30 && areas[0].maxY == 31);
+    CHECK(areas[1].minX == 96 && areas[1].maxX == 99);
+    DirtyRect below = {0, 40, 99, 69, true};
+    CHECK(tiles.pendingAreas(below, areas) == 0);
+
+    // Confirming 5 frees its tiles but not the one 6 still covers, and a
+    // confirmed sequence never marks a tile again.
+    tiles.acknowledge(5);
+    CHECK(tiles.pendingTiles() == 1);
+    tiles.markPending(stroke, 4);
+    CHECK(tiles.pendingTiles() == 1);
+    tiles.markPending(farStroke, 7);
+    tiles.acknowledge(6);
+    CHECK(tiles.pendingTiles() == 1);
+    tiles.acknowledge(7);
+    CHECK(tiles.pendingTiles() == 0);
+
+    tiles.markPending(stroke, 8);
+    tiles.reset(64, 64);
+    CHECK(tiles.pendingTiles() == 0);
+    DirtyRect outside = {200, 200, 220, 220, true};
+    tiles.markPending(outside, 9);
+    CHECK(tiles.pendingTiles() == 0);
+}
+
+// Restacks a local stroke the way the client does after a remote packet
+// lands on its tiles, and returns whether any pixel was redrawn.
+bool restackFixture(BrushStampCache &cache, std::vector<u8> &canvas, int size, const DirtyRect &area,
+                    const std::vector<DrawPoint> &remote, const std::vector<DrawPoint> &local,
+                    int localSizeTenths, bool feather)
+{
+    LocalEchoRestack restack;
+    const BrushClip clip = {area.minX, area.minY, area.maxX + 1, area.maxY + 1};
+    restack.begin(&canvas[0], size, area);
+    markOpaqueBrushStamps(cache, clip, &remote[0], remote.size(), 40, 0, false, restack.opaque());
+    if (!restack.anyOpaque())
+        return false;
+    drawBrushStamps(cache, &canvas[0], size, size, clip, &local[0], local.size(), localSizeTenths, 0,
+                    200, 40, 40, feather);
+    restack.finish(&canvas[0], size);
+    return true;
+}
+
+void testLocalEchoRestack()
+{
+    const int size = 64;
+    BrushStampCache cache;
+    std::vector<DrawPoint> local;
+    for (int x = 3; x <= 12; ++x)
+    {
+        const DrawPoint point = {x, 6};
+        local.push_back(point);
+    }
+    // A remote diagonal across the same tile whose bounds take in the local
+    // stroke, though none of its pixels touch it.
+    std::vector<DrawPoint> remote;
+    for (int i = 0; i <= 26; ++i)
+    {
+        const DrawPoint point = {4 + i, 30 - i};
+        remote.push_back(point);
+    }
+    LocalEchoTiles tiles;
+    tiles.reset(size, size);
+    tiles.markPending(DirtyRect{0, 2, 16, 10, true}, 1);
+    std::vector<DirtyRect> areas;
+    CHECK(tiles.pendingAreas(DirtyRect{2, 2, 32, 32, true}, areas) == 1);
+
+    // A feathered pending stroke keeps its soft edge exactly; redrawing it
+    // over the whole area would have blended that edge a second time.
+    std::vector<u8> canvas(size * size * 3, 255);
+    drawBrushStamps(cache, &canvas[0], size, size, &local[0], local.size(), 65, 0, 200, 40, 40, true);
+    drawBrushStamps(cache, &canvas[0], size, size, &remote[0], remote.size(), 40, 0, 20, 20, 220, false);
+    const std::vector<u8> drawn(canvas);
+    std::vector<u8> twice(canvas);
+    drawBrushStamps(cache, &twice[0], size, size, &local[0], local.size(), 65, 0, 200, 40, 40, true);
+    CHECK(twice != drawn);
+    restackFixture(cache, canvas, size, areas[0], remote, local, 65, true);
+    CHECK(canvas == drawn);
+
+    // Where the remote stroke crosses ours, ours goes back on top as the
+    // server drew them; elsewhere the canvas is as it was.
+    remote.clear();
+    for (int y = 0; y <= 14; ++y)
+    {
+        const DrawPoint point = {8, y};
+        remote.push_back(point);
+    }
+    CHECK(tiles.pendingAreas(DirtyRect{6, 0, 10, 16, true}, areas) == 1);
+    std::vector<u8> serverOrder(size * size * 3, 255);
+    drawBrushStamps(cache, &serverOrder[0], size, size, &remote[0], remote.size(), 40, 0, 20, 20, 220, false);
+    drawBrushStamps(cache, &serverOrder[0], size, size, &local[0], local.size(), 65, 0, 200, 40, 40, true);
+    canvas.assign(size * size * 3, 255);
+    drawBrushStamps(cache, &canvas[0], size, size, &local[0], local.size(), 65, 0, 200, 40, 40, true);
+    drawBrushStamps(cache, &canvas[0], size, size, &remote[0], remote.size(), 40, 0, 20, 20, 220, false);
+    const std::vector<u8> crossed(canvas);
+    CHECK(restackFixture(cache, canvas, size, areas[0], remote, local, 65, true));
+    const size_t crossing = 3 * (6 * size + 8);
+    CHECK(crossed[crossing] == 20 && canvas[crossing] == serverOrder[crossing] && canvas[crossing] == 200);
+    const size_t aside = 3 * (12 * size + 8);
+    CHECK(canvas[aside] == crossed[aside]);
+    const size_t farAway = 3 * (6 * size + 3);
+    CHECK(canvas[farAway] == crossed[farAway]);
+}
+
+void testSha256Streaming()
+{
+    char digest[65];
+    Sha256 hash;
+    hash.finishHex(digest);
+    CHECK(strcmp(digest, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855") == 0);
+
+    hash.reset();
+    hash.update("abc", 3);
+    hash.finishHex(digest);
+    CHECK(strcmp(digest, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0);
+
+    const char twoBlocks[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    hash.reset();
+    hash.update(twoBlocks, strlen(twoBlocks));
+    hash.finishHex(digest);
+    CHECK(strcmp(digest, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1") == 0);
+
+    // A million 'a's in the uneven pieces a network body arrives in, some
+    // shorter than a block and some spanning several.
+    std::vector<unsigned char> as(4099, 'a');
+    hash.reset();
+    size_t fed = 0;
+    for (size_t step = 1; fed < 1000000; step = step * 7 % 4099 + 1)
+    {
+        const size_t take = std::min(step, (size_t)1000000 - fed);
+        hash.update(&as[0], take);
+        fed += take;
+    }
+    CHECK(hash.bytesHashed() == 1000000);
+    hash.finishHex(digest);
+    CHECK(strcmp(digest, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") == 0);
+}
+
+// Records what a CIA install asked of AM, in order.
+class FakeCiaInstallService : public CiaInstallService
+{
+public:
+    FakeCiaInstallService()
+        : begins(0), finishes(0), cancels(0), titleId(0), failWriteAt(-1), failFinish(false),
+          contiguous(true)
+    {
+    }
+
+    int32_t begin(uint64_t title)
+    {
+        ++begins;
+        titleId = title;
+        return 0;
+    }
+
+    int32_t write(uint64_t offset, const uint8_t *data, size_t length)
+    {
+        if (offset != installed.size())
+            contiguous = false;
+        writeSizes.push_back(length);
+        if (failWriteAt >= 0 && (int)writeSizes.size() > failWriteAt)
+            return (int32_t)0xd8e0806a;
+        installed.insert(installed.end(), data, data + length);
+        events.push_back('w');
+        return 0;
+    }
+
+    int32_t finish()
+    {
+        ++finishes;
+        events.push_back('f');
+        return failFinish ? (int32_t)0xc8a044dc : 0;
+    }
+
+    void cancel()
+    {
+        ++cancels;
+        events.push_back('c');
+    }
+
+    int begins;
+    int finishes;
+    int cancels;
+    uint64_t titleId;
+    int failWriteAt;
+    bool failFinish;
+    bool contiguous;
+    std::vector<uint8_t> installed;
+    std::vector<size_t> writeSizes;
+    std::string events;
+};
+
+std::vector<uint8_t> makeFixtureCia(uint64_t titleId, size_t size)
+{
+    std::vector<uint8_t> cia(size);
+    uint32_t seed = 0x2545f491u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        cia[i] = (uint8_t)(seed >> 24);
+    }
+    const uint32_t sizes[4] = {0x2020, 0xa00, 0x350, 0xb34};
+    for (int field = 0; field < 4; ++field)
+    {
+        const size_t offset = field == 0 ? 0 : 4 + field * 4;
+        for (int i = 0; i < 4; ++i)
+            cia[offset + i] = (uint8_t)(sizes[field] >> (i * 8));
+    }
+    // TMD after the 64-byte aligned header, certificates and ticket, signed
+    // RSA-2048/SHA-256, with the title ID 0x4c into its header.
+    const size_t tmd = 0x2040 + 0xa00 + 0x380;
+    const uint8_t signatureType[4] = {0x00, 0x01, 0x00, 0x04};
+    memcpy(&cia[tmd], signatureType, 4);
+    for (int i = 0; i < 8; ++i)
+        cia[tmd + 0x140 + 0x4c + i] = (uint8_t)(titleId >> (56 - i * 8));
+    return cia;
+}
+
+std::string digestOf(const std::vector<uint8_t> &bytes)
+{
+    char digest[65];
+    Sha256 hash;
+    hash.update(&bytes[0], bytes.size());
+    hash.finishHex(digest);
+    return digest;
+}
+
+// Feeds bytes in the uneven pieces HTTPS bodies arrive in; stops when the
+// install refuses one.
+bool feedCia(CiaStreamInstall &install, const std::vector<uint8_t> &bytes)
+{
+    size_t offset = 0;
+    for (size_t step = 1000; offset < bytes.size(); step = step * 13 % 20011 + 500)
+    {
+        const size_t take = std::min(step, bytes.size() - offset);
+        if (!install.write(&bytes[offset], take))
+            return false;
+        offset += take;
+    }
+    return true;
+}
+
+void testCiaStreamInstall()
+{
+    const uint64_t title = 0x000400000ff3ff00ULL;
+    const std::vector<uint8_t> cia = makeFixtureCia(title, 3 * CIA_STREAM_CHUNK_BYTES + 12345);
+    const std::string digest = digestOf(cia);
+
+    uint64_t parsedTitle = 0;
+    bool needMore = false;
+    CHECK(ciaTitleId(&cia[0], cia.size(), parsedTitle, needMore) && parsedTitle == title);
+    CHECK(!ciaTitleId(&cia[0], 0x2800, parsedTitle, needMore) && needMore);
+
+    {
+        FakeCiaInstallService service;
+        CiaStreamInstall install(service, title, cia.size(), digest.c_str());
+        CHECK(feedCia(install, cia));
+        CHECK(install.finish() == CIA_STREAM_OK);
+        CHECK(service.begins == 1 && service.titleId == title);
+        CHECK(service.contiguous && service.installed == cia);
+        CHECK(service.writeSizes.size() == 4 && service.writeSizes[0] == CIA_STREAM_CHUNK_BYTES &&
+              service.writeSizes[3] == 12345);
+        CHECK(service.events == "wwwwf");
+    }
+
+    {
+        // The digest is only known at the end; chunks already handed to AM
+        // are thrown away with the install.
+        std::vector<uint8_t> corrupt(cia);
+        corrupt[CIA_STREAM_CHUNK_BYTES + 7] ^= 0x40;
+        FakeCiaInstallService service;
+        CiaStreamInstall install(service, title, corrupt.size(), digest.c_str());
+        CHECK(feedCia(install, corrupt));
+        CHECK(install.finish() == CIA_STREAM_CHECKSUM_MISMATCH);
+        CHECK(service.events == "wwwc");
+        CHECK(service.finishes == 0);
+        CHECK(strcmp(install.error(), "DOWNLOAD CHECKSUM MISMATCH") == 0);
+    }
+
+    {
+        std::vector<uint8_t> shortBody(cia.begin(), cia.end() - 100);
+        FakeCiaInstallService service;
+        CiaStreamInstall install(service, title, cia.size(), digest.c_str());
+        CHECK(feedCia(install, shortBody));
+        CHECK(install.finish() == CIA_STREAM_SIZE_MISMATCH);
+        CHECK(service.cancels == 1 && service.finishes == 0);
+    }
+
+    {
+        FakeCiaInstallService service;
+        CiaStreamInstall install(service, title, cia.size() - 1, digest.c_str());
+        CHECK(!feedCia(install, cia));
+        CHECK(install.failed());
+        CHECK(install.finish() == CIA_STREAM_SIZE_MISMATCH);
+        CHECK(service.cancels == 1 && service.finishes == 0);
+    }
+
+    {
+        // A different title is refused before AM is touched.
+        FakeCiaInstallService service;
+        CiaStreamInstall install(service, title + 0x100, cia.size(), digest.c_str());
+        CHECK(!feedCia(install, cia));
+        CHECK(install.finish() == CIA_STREAM_INSTALL_FAILED);
+        CHECK(service.begins == 0 && service.events.empty());
+        CHECK(strncmp(install.error(), "TITLE MISMATCH", 14) == 0);
+    }
+
+    {
+        FakeCiaInstallService service;
+        service.failWriteAt = 1;
+        CiaStreamInstall install(service, title, cia.size(), digest.c_str());
+        CHECK(!feedCia(install, cia));
+        CHECK(service.events == "wc");
+        CHECK(!install.write(&cia[0], 1));
+        CHECK(install.finish() == CIA_STREAM_INSTALL_FAILED);
+        CHECK(service.cancels == 1);
+    }
+
+    {
+        FakeCiaInstallService service;
+        service.failFinish = true;
+        CiaStreamInstall install(service, title, cia.size(), digest.c_str());
+        CHECK(feedCia(install, cia));
+        CHECK(install.finish() == CIA_STREAM_INSTALL_FAILED);
+        CHECK(service.events == "wwwwfc");
+    }
+
+    {
+        // A download that dies part way leaves the install to be cancelled
+        // when it goes out of scope.
+        FakeCiaInstallService service;
+        {
+            CiaStreamInstall install(service, title, cia.size(), digest.c_str());
+            CHECK(install.write(&cia[0], CIA_STREAM_CHUNK_BYTES + 1));
+        }
+        CHECK(service.events == "wc");
+    }
+}
+
+// Stands in for the update server's static file handler: answers the
+// request text the client formats, honouring Range and If-Range, and can
+// cut the connection part way through a response.
+struct StandInHttpServer
+{
+    StandInHttpServer()
+        : etag("\"v1\""), ranges(true), chunked(false), dropAfter(std::string::npos), requests(0)
+    {
+    }
+
+    std::string header(const std::string &name) const
+    {
+        const std::string prefix = "\r\n" + name + ": ";
+        const size_t start = lastRequest.find(prefix);
+        if (start == std::string::npos)
+            return std::string();
+        const size_t valueStart = start + prefix.size();
+        return lastRequest.substr(valueStart, lastRequest.find("\r\n", valueStart) - valueStart);
+    }
+
+    std::string respond(const std::string &request)
+    {
+        ++requests;
+        lastRequest = request;
+        char line[160];
+        std::string reply;
+        size_t start = 0;
+        const std::string range = header("Range");
+        const std::string ifRange = header("If-Range");
+        if (ranges && !range.empty() && (ifRange.empty() || ifRange == etag))
+        {
+            start = (size_t)strtoull(range.c_str() + strlen("bytes="), NULL, 10);
+            if (start >= body.size())
+            {
+                snprintf(line, sizeof(line), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%lu\r\nContent-Length: 0\r\n\r\n",
+                         (unsigned long)body.size());
+                return line;
+            }
+            snprintf(line, sizeof(line), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lu-%lu/%lu\r\n",
+                     (unsigned long)start, (unsigned long)body.size() - 1, (unsigned long)body.size());
+            reply = line;
+        }
+        else
+        {
+            reply = "HTTP/1.1 200 OK\r\n";
+        }
+        reply += "ETag: " + etag + "\r\n";
+        const std::string content = body.substr(start);
+        if (chunked)
+        {
+            reply += "Transfer-Encoding: chunked\r\n\r\n";
+            snprintf(line, sizeof(line), "%lx\r\n", (unsigned long)content.size());
+            reply += line + content + "\r\n0\r\n\r\n";
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "Content-Length: %lu\r\n\r\n", (unsigned long)content.size());
+            reply += line + content;
+        }
+        if (dropAfter != std::string::npos)
+            reply.resize(std::min(reply.size(), reply.find("\r\n\r\n") + 4 + dropAfter));
+        return reply;
+    }
+
+    std::string body;
+    std::string etag;
+    bool ranges;
+    bool chunked;
+    // Bytes after the headers sent before the connection drops.
+    size_t dropAfter;
+    int requests;
+    std::string lastRequest;
+};
+
+struct PartSink
+{
+    ResumableDownload *part;
+    const HttpsResponse *response;
+};
+
+bool writePartSink(const unsigned char *data, size_t length, void *userData)
+{
+    PartSink *sink = static_cast<PartSink *>(userData);
+    return sink->part->write(*sink->response, data, length);
+}
+
+// One updater attempt against the stand-in: the request formatting,
+// response reading and .part handling the console runs over TLS, fed in
+// the uneven pieces a socket delivers.
+bool fetchFromStandIn(StandInHttpServer &server, const HttpsRange &range, HttpsBodyCallback onBody,
+                      void *userData, HttpsResponse &response, char *error, size_t errorSize)
+{
+    char request[1024];
+    const size_t requestLength =
+        formatHttpGet(request, sizeof(request), "/builds/CollabDoodle.3dsx", "updates.doodle.test", range);
+    if (requestLength == 0)
+        return false;
+    const std::string reply = server.respond(std::string(request, requestLength));
+
+    memset(&response, 0, sizeof(response));
+    std::string location;
+    HttpResponseReader reader(response, location, range, server.body.size(), onBody, userData, error,
+                              errorSize);
+    HttpResponseReader::Result result = HttpResponseReader::READ_MORE;
+    size_t offset = 0;
+    for (size_t step = 700; result == HttpResponseReader::READ_MORE && offset < reply.size();
+         step = step * 7 % 3001 + 1)
+    {
+        const size_t take = std::min(step, reply.size() - offset);
+        result = reader.feed(reinterpret_cast<const unsigned char *>(reply.data()) + offset, take);
+        offset += take;
+    }
+    if (result == HttpResponseReader::READ_MORE)
+        result = reader.closed();
+    return result == HttpResponseReader::READ_COMPLETE;
+}
+
+bool fetchFromStandIn(StandInHttpServer &server, ResumableDownload &part, HttpsResponse &response,
+                      char *error, size_t errorSize)
+{
+    PartSink sink = {&part, &response};
+    return fetchFromStandIn(server, part.range(), writePartSink, &sink, response, error, errorSize);
+}
+
+bool writeCiaStream(const unsigned char *data, size_t length, void *userData)
+{
+    return static_cast<CiaStreamInstall *>(userData)->write(data, length);
+}
+
+std::string readFileText(const char *path)
+{
+    std::string text;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return text;
+    char buffer[4096];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        text.append(buffer, got);
+    fclose(file);
+    return text;
+}
+
+void testHttpRangeParsing()
+{
+    char request[512];
+    HttpsRange range = {0, NULL};
+    size_t length = formatHttpGet(request, sizeof(request), "/a.cia", "example.test", range);
+    CHECK(length > 0 && strstr(request, "Range:") == NULL);
+    range.start = 1234;
+    length = formatHttpGet(request, sizeof(request), "/a.cia", "example.test", range);
+    CHECK(length > 0 && strstr(request, "\r\nRange: bytes=1234-\r\n") && !strstr(request, "If-Range"));
+    range.validator = "\"abc\"";
+    length = formatHttpGet(request, sizeof(request), "/a.cia", "example.test", range);
+    CHECK(length == strlen(request) && strstr(request, "\r\nIf-Range: \"abc\"\r\n"));
+    CHECK(formatHttpGet(request, 64, "/a.cia", "example.test", range) == 0);
+
+    unsigned long long first = 0;
+    unsigned long long last = 0;
+    long long complete = 0;
+    CHECK(parseContentRange("bytes 100-199/1000", first, last, complete) && first == 100 && last == 199 &&
+          complete == 1000);
+    CHECK(parseContentRange("Bytes 5-5/*", first, last, complete) && complete == -1);
+    CHECK(!parseContentRange("bytes */1000", first, last, complete));
+    CHECK(!parseContentRange("bytes 200-100/1000", first, last, complete));
+    CHECK(!parseContentRange("bytes 0-1000/1000", first, last, complete));
+    CHECK(!parseContentRange("items 0-1/2", first, last, complete));
+}
+
+void testResumableDownload()
+{
+    const char *partPath = "build/host-tests/update-fixture.3dsx.part";
+    const char *tagPath = "build/host-tests/update-fixture.3dsx.part.tag";
+    remove(partPath);
+    remove(tagPath);
+
+    StandInHttpServer server;
+    for (size_t i = 0; i < 150000; ++i)
+        server.body.push_back((char)((i * 2654435761u) >> 13));
+    const std::vector<uint8_t> bodyBytes(server.body.begin(), server.body.end());
+    const std::string digest = digestOf(bodyBytes);
+    HttpsResponse response;
+    char error[160];
+    char finished[65];
+
+    {
+        // The first attempt drops 40% in and leaves the bytes and a tag.
+        ResumableDownload part;
+        CHECK(part.open(partPath, digest.c_str(), server.body.size()));
+        CHECK(part.resumedFrom() == 0);
+        server.dropAfter = 60000;
+        CHECK(!fetchFromStandIn(server, part, response, error, sizeof(error)));
+        CHECK(strcmp(error, "Truncated HTTPS body") == 0);
+        CHECK(part.close() && part.size() == 60000);
+        CHECK(server.header("Range").empty());
+    }
+    CHECK(fileExists(tagPath));
+
+    {
+        // After a restart it asks for the rest, conditional on the ETag, and
+        // the digest covers the kept bytes it read back.
+        ResumableDownload part;
+        CHECK(part.open(partPath, digest.c_str(), server.body.size()));
+        CHECK(part.resumedFrom() == 60000);
+        server.dropAfter = 30000;
+        CHECK(!fetchFromStandIn(server, part, response, error, sizeof(error)));
+        CHECK(server.header("Range") == "bytes=60000-" && server.header("If-Range") == "\"v1\"");
+        CHECK(response.statusCode == 206 && response.partial && response.rangeStart == 60000 &&
+              response.completeLength == 150000);
+        CHECK(part.close() && part.size() == 90000);
+
+        // A retry in the same update keeps the running hash.
+        CHECK(part.open(partPath, digest.c_str(), server.body.size()));
+        CHECK(part.resumedFrom() == 90000);
+        server.dropAfter = std::string::npos;
+        server.chunked = true;
+        CHECK(fetchFromStandIn(server, part, response, error, sizeof(error)));
+        CHECK(server.header("Range") == "bytes=90000-");
+        CHECK(part.close() && part.size() == server.body.size());
+        part.finishHex(finished);
+        CHECK(digest == finished);
+        CHECK(readFileText(partPath) == server.body);
+        part.discard();
+        CHECK(!fileExists(partPath) && !fileExists(tagPath));
+    }
+
+    server.chunked = false;
+    const size_t ignored[] = {0, 1, 2};
+    for (size_t scenario = 0; scenario < sizeof(ignored) / sizeof(ignored[0]); ++scenario)
+    {
+        {
+            ResumableDownload part;
+            CHECK(part.open(partPath, digest.c_str(), server.body.size()));
+            server.etag = "\"v1\"";
+            server.dropAfter = 50000;
+            CHECK(!fetchFromStandIn(server, part, response, error, sizeof(error)));
+        }
+        // 0: the file changed on the server, so If-Range fails; 1: the
+        // server ignores ranges; 2: the kept bytes belong to another build.
+        server.etag = scenario == 0 ? "\"v2\"" : "\"v1\"";
+        server.ranges = scenario != 1;
+        server.dropAfter = std::string::npos;
+        ResumableDownload part;
+        const std::string otherDigest(64, 'a');
+        if (scenario == 2)
+        {
+            CHECK(part.open(partPath, otherDigest.c_str(), server.body.size()));
+            CHECK(part.resumedFrom() == 0);
+            part.discard();
+        }
+        CHECK(part.open(partPath, digest.c_str(), server.body.size()));
+        CHECK(part.resumedFrom() == (scenario == 2 ? 0u : 50000u));
+        CHECK(fetchFromStandIn(server, part, response, error, sizeof(error)));
+        CHECK(response.statusCode == 200 && !response.partial);
+        CHECK(part.close() && part.size() == server.body.size());
+        part.finishHex(finished);
+        CHECK(digest == finished);
+        CHECK(readFileText(partPath) == server.body);
+        part.discard();
+        server.ranges = true;
+    }
+
+    {
+        // A kept file as long as the artifact is not resumed past its end,
+        // and a 416 from the server fails the attempt.
+        CHECK(writeText(partPath, server.body.c_str()));
+        CHECK(writeText(tagPath, (digest + "\n\"v1\"\n").c_str()));
+        ResumableDownload part;
+        CHECK(part.open(partPath, digest.c_str(), server.body.size()));
+        CHECK(part.resumedFrom() == 0 && !fileExists(tagPath));
+        part.discard();
+
+        CHECK(writeText(partPath, "abc"));
+        CHECK(writeText(tagPath, (digest + "\n\"v1\"\n").c_str()));
+        CHECK(part.open(partPath, digest.c_str(), 3 + 1));
+        server.body = server.body.substr(0, 3);
+        CHECK(!fetchFromStandIn(server, part, response, error, sizeof(error)));
+        CHECK(response.statusCode == 416);
+        part.discard();
+    }
+}
+
+void testCiaStagedFallback()
+{
+    const char *partPath = "build/host-tests/update-fixture.cia.part";
+    const char *tagPath = "build/host-tests/update-fixture.cia.part.tag";
+    remove(partPath);
+    remove(tagPath);
+
+    const uint64_t title = 0x000400000ff3ff00ULL;
+    const std::vector<uint8_t> cia = makeFixtureCia(title, 3 * CIA_STREAM_CHUNK_BYTES + 12345);
+    const std::string digest = digestOf(cia);
+    StandInHttpServer server;
+    server.body.assign(cia.begin(), cia.end());
+    const HttpsRange whole = {0, NULL};
+    HttpsResponse response;
+    char error[160];
+
+    {
+        // A refused CIA is not worth staging; the same bytes would fail again.
+        FakeCiaInstallService service;
+        CiaStreamInstall install(service, title + 0x100, cia.size(), digest.c_str());
+        CHECK(!fetchFromStandIn(server, whole, writeCiaStream, &install, response, error, sizeof(error)));
+        CHECK(install.failed() && !install.interrupted());
+    }
+
+    {
+        // A dropped stream is; AM has been handed two chunks, which go.
+        FakeCiaInstallService service;
+        CiaStreamInstall install(service, title, cia.size(), digest.c_str());
+        server.dropAfter = 2 * CIA_STREAM_CHUNK_BYTES + 100;
+        CHECK(!fetchFromStandIn(server, whole, writeCiaStream, &install, response, error, sizeof(error)));
+        CHECK(install.interrupted());
+        install.cancel();
+        CHECK(service.events == "wwc" && service.finishes == 0);
+    }
+
+    {
+        // The staged copy survives its own drop and resumes from the SD card.
+        ResumableDownload part;
+        CHECK(part.open(partPath, digest.c_str(), cia.size()));
+        server.dropAfter = 70000;
+        CHECK(!fetchFromStandIn(server, part, response, error, sizeof(error)));
+        CHECK(part.close() && part.size() == 70000);
+    }
+    CHECK(fileExists(partPath));
+
+    ResumableDownload part;
+    CHECK(part.open(partPath, digest.c_str(), cia.size()));
+    server.dropAfter = std::string::npos;
+    CHECK(fetchFromStandIn(server, part, response, error, sizeof(error)));
+    CHECK(server.header("Range") == "bytes=70000-" && response.statusCode == 206);
+    CHECK(part.close() && part.size() == cia.size());
+    char finished[65];
+    part.finishHex(finished);
+    CHECK(digest == finished);
+
+    // Installing the staged file makes the same AM calls as a stream.
+    const std::string staged = readFileText(partPath);
+    part.discard();
+    FakeCiaInstallService service;
+    CiaStreamInstall install(service, title, cia.size(), digest.c_str());
+    CHECK(feedCia(install, std::vector<uint8_t>(staged.begin(), staged.end())));
+    CHECK(install.finish() == CIA_STREAM_OK && !install.interrupted());
+    CHECK(service.installed == cia && service.events == "wwwwf");
+}
+
+void testPartialResponseChecks()
+{
+    const char *partPath = "build/host-tests/update-fixture.3dsx.part";
+    HttpsResponse response;
+    char error[160];
+    std::string location;
+    const HttpsRange whole = {0, NULL};
+    const HttpsRange resume = {10, "\"v1\""};
+
+    // A 206 answers only a range request, and only for the span asked.
+    const char *unasked = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 0-3/4\r\nContent-Length: 4\r\n\r\nabcd";
+    {
+        memset(&response, 0, sizeof(response));
+        HttpResponseReader reader(response, location, whole, 100, NULL, NULL, error, sizeof(error));
+        CHECK(reader.feed(reinterpret_cast<const unsigned char *>(unasked), strlen(unasked)) ==
+              HttpResponseReader::READ_FAILED);
+    }
+    const char *wrongStart = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 8-11/12\r\nContent-Length: 4\r\n\r\nabcd";
+    {
+        HttpResponseReader reader(response, location, resume, 100, NULL, NULL, error, sizeof(error));
+        CHECK(reader.feed(reinterpret_cast<const unsigned char *>(wrongStart), strlen(wrongStart)) ==
+              HttpResponseReader::READ_FAILED);
+        CHECK(strcmp(error, "HTTPS 206 without a matching Content-Range") == 0);
+    }
+    const char *wrongLength = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 10-13/14\r\nContent-Length: 3\r\n\r\nabc";
+    {
+        HttpResponseReader reader(response, location, resume, 100, NULL, NULL, error, sizeof(error));
+        CHECK(reader.feed(reinterpret_cast<const unsigned char *>(wrongLength), strlen(wrongLength)) ==
+              HttpResponseReader::READ_FAILED);
+    }
+    const char *longChunks =
+        "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 10-13/14\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nabcde\r\n0\r\n\r\n";
+    {
+        HttpResponseReader reader(response, location, resume, 100, NULL, NULL, error, sizeof(error));
+        CHECK(reader.feed(reinterpret_cast<const unsigned char *>(longChunks), strlen(longChunks)) ==
+              HttpResponseReader::READ_FAILED);
+        CHECK(strcmp(error, "HTTPS body exceeds Content-Range") == 0);
+    }
+    const char *shortClose = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 10-13/14\r\n\r\nab";
+    {
+        HttpResponseReader reader(response, location, resume, 100, NULL, NULL, error, sizeof(error));
+        CHECK(reader.feed(reinterpret_cast<const unsigned char *>(shortClose), strlen(shortClose)) ==
+              HttpResponseReader::READ_MORE);
+        CHECK(reader.closed() == HttpResponseReader::READ_FAILED);
+    }
+    const char *weakTag = "HTTP/1.1 200 OK\r\nETag: W/\"v1\"\r\nLast-Modified: Sat, 17 Oct 2026 10:00:00 GMT\r\nContent-Length: 0\r\n\r\n";
+    {
+        HttpResponseReader reader(response, location, whole, 100, NULL, NULL, error, sizeof(error));
+        CHECK(reader.feed(reinterpret_cast<const unsigned char *>(weakTag), strlen(weakTag)) ==
+              HttpResponseReader::READ_COMPLETE);
+        CHECK(strcmp(response.validator, "Sat, 17 Oct 2026 10:00:00 GMT") == 0);
+    }
+
+    // A continuation that starts anywhere but the kept length is refused.
+    remove(partPath);
+    const std::string digest(64, 'b');
+    {
+        ResumableDownload part;
+        CHECK(part.open(partPath, digest.c_str(), 100));
+        memset(&response, 0, sizeof(response));
+        response.statusCode = 200;
+        CHECK(part.write(response, reinterpret_cast<const uint8_t *>("0123456789"), 10));
+    }
+    ResumableDownload part;
+    CHECK(part.open(partPath, digest.c_str(), 100) && part.resumedFrom() == 10);
+    response.statusCode = 206;
+    response.partial = true;
+    response.rangeStart = 12;
+    CHECK(!part.write(response, reinterpret_cast<const uint8_t *>("ab"), 2));
+    CHECK(strcmp(part.error(), "RANGE AT 12 NOT 10") == 0);
+    part.discard();
+}
+
+bool collectPatched(const uint8_t *data, size_t length, void *userData)
+{
+    std::vector<uint8_t> *out = static_cast<std::vector<uint8_t> *>(userData);
+    out->insert(out->end(), data, data + length);
+    return true;
+}
+
+void appendVarint(std::vector<uint8_t> &out, uint64_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.push_back((uint8_t)(value | 0x80));
+    out.push_back((uint8_t)value);
+}
+
+// Applies patch to the base file in uneven pieces, as a download delivers it.
+DeltaPatchStatus applyFixturePatch(const char *basePath, const std::vector<uint8_t> &patch, uint64_t patchSize,
+                                   const std::string &patchDigest, const std::vector<uint8_t> &target,
+                                   const std::string &targetDigest, std::vector<uint8_t> &out,
+                                   std::string &error)
+{
+    out.clear();
+    FILE *base = fopen(basePath, "rb");
+    if (!base)
+        return DELTA_PATCH_IO_FAILED;
+    DeltaPatchApplier applier(base, collectPatched, &out, patchSize, patchDigest.c_str(),
+                              target.size(), targetDigest.c_str());
+    bool accepted = true;
+    size_t offset = 0;
+    for (size_t step = 7; accepted && offset < patch.size(); step = step * 13 % 4099 + 1)
+    {
+        const size_t take = std::min(step, patch.size() - offset);
+        accepted = applier.write(&patch[offset], take);
+        offset += take;
+    }
+    const DeltaPatchStatus status = applier.finish();
+    fclose(base);
+    error = applier.error();
+    // Structural faults stop the download at the byte that shows them.
+    if (status == DELTA_PATCH_INVALID && error != "PATCH TRUNCATED")
+        CHECK(!accepted);
+    return status;
+}
+
+bool writeBytes(const char *path, const std::vector<uint8_t> &bytes)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+    const bool wrote = fwrite(&bytes[0], 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && wrote;
+}
+
+void testDeltaPatchRoundTrip()
+{
+    const char *basePath = "build/host-tests/delta-base.3dsx";
+    // Word-sized "code" whose next release moves, edits, drops and adds bytes:
+    // an insertion shifts everything after it, so the words that point past
+    // it change too.
+    std::vector<uint8_t> base(256 * 1024);
+    uint32_t seed = 0x9e3779b9u;
+    for (size_t i = 0; i < base.size(); ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        base[i] = (uint8_t)(seed >> 24);
+    }
+    std::vector<uint8_t> target(base);
+    target.insert(target.begin() + 40000, 300, 0x5a);
+    for (size_t i = 40300 + 16; i + 4 <= target.size(); i += 256)
+    {
+        uint32_t word = 0;
+        memcpy(&word, &target[i], 4);
+        word += 300;
+        memcpy(&target[i], &word, 4);
+    }
+    target[120000] ^= 0xff;
+    target.erase(target.begin() + 150000, target.begin() + 152000);
+    target.insert(target.end(), base.begin() + 1000, base.begin() + 9000);
+    CHECK(writeBytes(basePath, base));
+
+    std::vector<uint8_t> patch;
+    buildDeltaPatch(&base[0], base.size(), &target[0], target.size(), patch);
+    CHECK(patch.size() < target.size() / 20);
+    const std::string patchDigest = digestOf(patch);
+    const std::string targetDigest = digestOf(target);
+
+    std::vector<uint8_t> out;
+    std::string error;
+    CHECK(applyFixturePatch(basePath, patch, patch.size(), patchDigest, target, targetDigest, out, error) ==
+          DELTA_PATCH_OK);
+    CHECK(out == target);
+
+    // Digests compare without regard to case, as the manifest may send either.
+    std::string upperDigest(patchDigest);
+    std::transform(upperDigest.begin(), upperDigest.end(), upperDigest.begin(), ::toupper);
+    CHECK(applyFixturePatch(basePath, patch, patch.size(), upperDigest, target, targetDigest, out, error) ==
+          DELTA_PATCH_OK);
+
+    // An unrelated base still patches, it just needs INSERTs.
+    std::vector<uint8_t> fresh(target.size(), 0);
+    std::vector<uint8_t> freshPatch;
+    buildDeltaPatch(&fresh[0], 100, &target[0], target.size(), freshPatch);
+    CHECK(freshPatch.size() > target.size());
+    CHECK(writeBytes(basePath, std::vector<uint8_t>(fresh.begin(), fresh.begin() + 100)));
+    CHECK(applyFixturePatch(basePath, freshPatch, freshPatch.size(), digestOf(freshPatch), target, targetDigest,
+                            out, error) == DELTA_PATCH_OK);
+    CHECK(out == target);
+    remove(basePath);
+}
+
+void testDeltaPatchRejects()
+{
+    const char *basePath = "build/host-tests/delta-base.3dsx";
+    std::vector<uint8_t> base(64 * 1024);
+    for (size_t i = 0; i < base.size(); ++i)
+        base[i] = (uint8_t)(i * 7 + (i >> 9));
+    std::vector<uint8_t> target(base);
+    target.insert(target.begin() + 5000, 64, 0x11);
+    target[30000] ^= 0x40;
+    CHECK(writeBytes(basePath, base));
+    std::vector<uint8_t> patch;
+    buildDeltaPatch(&base[0], base.size(), &target[0], target.size(), patch);
+    const std::string patchDigest = digestOf(patch);
+    const std::string targetDigest = digestOf(target);
+    std::vector<uint8_t> out;
+    std::string error;
+
+    // The patch is checked against the manifest before its result is.
+    CHECK(applyFixturePatch(basePath, patch, patch.size(), std::string(64, 'a'), target, targetDigest, out,
+                            error) == DELTA_PATCH_CHECKSUM_MISMATCH);
+    CHECK(error == "PATCH CHECKSUM MISMATCH");
+    CHECK(applyFixturePatch(basePath, patch, patch.size(), patchDigest, target, std::string(64, 'a'), out,
+                            error) == DELTA_PATCH_TARGET_MISMATCH);
+    CHECK(error == "PATCHED CHECKSUM MISMATCH");
+    CHECK(out == target);
+    CHECK(applyFixturePatch(basePath, patch, patch.size() - 1, patchDigest, target, targetDigest, out, error) ==
+          DELTA_PATCH_CHECKSUM_MISMATCH);
+    CHECK(error.compare(0, 15, "PATCH SIZE OVER") == 0);
+
+    // A patch that ends early or runs on is refused even with a digest
+    // that matches it.
+    std::vector<uint8_t> truncated(patch.begin(), patch.end() - 1);
+    CHECK(applyFixturePatch(basePath, truncated, truncated.size(), digestOf(truncated), target, targetDigest, out,
+                            error) == DELTA_PATCH_INVALID);
+    CHECK(error == "PATCH TRUNCATED");
+    std::vector<uint8_t> trailing(patch);
+    trailing.push_back(0);
+    CHECK(applyFixturePatch(basePath, trailing, trailing.size(), digestOf(trailing), target, targetDigest, out,
+                            error) == DELTA_PATCH_INVALID);
+    CHECK(error == "PATCH HAS TRAILING BYTES");
+
+    // Operations may not read past the base nor write past the target.
+    std::vector<uint8_t> header(patch.begin(), patch.begin() + 4);
+    appendVarint(header, base.size());
+    appendVarint(header, target.size());
+    std::vector<uint8_t> pastBase(header);
+    appendVarint(pastBase, DELTA_OP_COPY);
+    appendVarint(pastBase, base.size() - 8);
+    appendVarint(pastBase, 16);
+    CHECK(applyFixturePatch(basePath, pastBase, pastBase.size(), digestOf(pastBase), target, targetDigest, out,
+                            error) == DELTA_PATCH_INVALID);
+    CHECK(error == "PATCH READS PAST BASE");
+    std::vector<uint8_t> pastTarget(header);
+    appendVarint(pastTarget, DELTA_OP_INSERT);
+    appendVarint(pastTarget, target.size() + 1);
+    CHECK(applyFixturePatch(basePath, pastTarget, pastTarget.size(), digestOf(pastTarget), target, targetDigest,
+                            out, error) == DELTA_PATCH_INVALID);
+    CHECK(error.compare(0, 18, "PATCH WRITES PAST ") == 0);
+
+    // The installed file must be the build the patch was made from.
+    base.push_back(0);
+    CHECK(writeBytes(basePath, base));
+    CHECK(applyFixturePatch(basePath, patch, patch.size(), patchDigest, target, targetDigest, out, error) ==
+          DELTA_PATCH_INVALID);
+    CHECK(error.compare(0, 16, "PATCH BASE SIZE ") == 0);
+    CHECK(out.empty());
+    remove(basePath);
+}
+
 int main()
 {
     testPresetDefaults();
@@ -535,6 +2645,32 @@ int main()
     testTimestampAndScopedNotices();
     testTicketFlowHelpers();
     testBrushRenderingMath();
+    testIncrementalViewportMatchesFullRender();
+    testViewportKernels();
+    testMinimapCacheTiles();
+    testWebSocketFrameParsing();
+    testDeltaDrawPackets();
+    testBrushStampMasks();
+    testBrushStrokeSweep();
+    testControlMessageRouting();
+    testProtocolFieldCursor();
+    testStrokeSimplifier();
+    testDrawBatching();
+    testBufferPool();
+    testSpscQueue();
+    testNetworkWait();
+    testStrokeJournal();
+    testStrokeJournalQueueFull();
+    testLocalEchoTiles();
+    testLocalEchoRestack();
+    testSha256Streaming();
+    testCiaStreamInstall();
+    testHttpRangeParsing();
+    testResumableDownload();
+    testCiaStagedFallback();
+    testPartialResponseChecks();
+    testDeltaPatchRoundTrip();
+    testDeltaPatchRejects();
 
     if (failures)
     {
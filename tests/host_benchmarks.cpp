@@ -0,0 +1,930 @@
+#include "brush_render.h"
+#include "buffer_pool.h"
+#include "brush_stamp.h"
+#include "control_router.h"
+#include "draw_batch.h"
+#include "draw_packet.h"
+#include "minimap_cache.h"
+#include "protocol.h"
+#include "stroke_simplify.h"
+#include "viewport_render.h"
+#include "websocket_frame.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace Doodle;
+
+namespace
+{
+
+typedef std::chrono::steady_clock BenchClock;
+
+// Keeps the optimizer from discarding work whose result is never read.
+volatile unsigned benchSink = 0;
+
+double elapsedNs(BenchClock::time_point start, int iterations)
+{
+    const double total = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        BenchClock::now() - start).count();
+    return total / (double)(iterations > 0 ? iterations : 1);
+}
+
+void fillPattern(std::vector<u8> &pixels)
+{
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = (u8)(i * 31 + i / 7);
+}
+
+const char *zoomName(int zoomLevel)
+{
+    if (zoomLevel <= -1) return "0.5x";
+    if (zoomLevel == 1) return "2x";
+    if (zoomLevel >= 2) return "4x";
+    return "1x";
+}
+
+// The per-pixel loop renderViewport used before the zoom-specialized
+// kernels. Kept here as the baseline for the kernel comparison.
+void renderViewportPerPixel(const ViewportSource &source, u8 *buffer,
+                            int fbWidth, int fbHeight)
+{
+    const bool rotatedFramebuffer = fbWidth < fbHeight;
+    for (int screenY = 0; screenY < VIEWPORT_SCREEN_HEIGHT; screenY++)
+    {
+        for (int screenX = 0; screenX < VIEWPORT_SCREEN_WIDTH; screenX++)
+        {
+            int fbX = rotatedFramebuffer ? fbWidth - 1 - screenY : screenX;
+            int fbY = rotatedFramebuffer ? screenX : screenY;
+            if (fbX < 0 || fbX >= fbWidth || fbY < 0 || fbY >= fbHeight)
+                continue;
+
+            int canvasX = viewportCanvasCoordinate(source.offsetX, source.zoomLevel, screenX);
+            int canvasY = viewportCanvasCoordinate(source.offsetY, source.zoomLevel, screenY);
+            int bufferIdx = 3 * (fbY * fbWidth + fbX);
+            if (canvasX >= 0 && canvasX < source.width && canvasY >= 0 && canvasY < source.height)
+            {
+                int canvasIdx = 3 * (canvasY * source.width + canvasX);
+                buffer[bufferIdx] = source.pixels[canvasIdx + 2];
+                buffer[bufferIdx + 1] = source.pixels[canvasIdx + 1];
+                buffer[bufferIdx + 2] = source.pixels[canvasIdx];
+            }
+            else
+            {
+                buffer[bufferIdx] = buffer[bufferIdx + 1] = buffer[bufferIdx + 2] = VIEWPORT_BACKDROP;
+            }
+        }
+    }
+}
+
+void benchViewportKernels()
+{
+    const int canvasWidth = 1920;
+    const int canvasHeight = 1080;
+    const int fbWidth = 240;
+    const int fbHeight = 320;
+    const int frames = 600;
+    std::vector<u8> pixels(canvasWidth * canvasHeight * 3);
+    std::vector<u8> buffer(fbWidth * fbHeight * 3);
+    fillPattern(pixels);
+    DirtyRect everything = {0, 0, VIEWPORT_SCREEN_WIDTH - 1,
+                            VIEWPORT_SCREEN_HEIGHT - 1, true};
+
+    printf("viewport kernels vs per-pixel loop (full pass, %d frames)\n", frames);
+    printf("  %-5s %16s %14s %8s\n", "zoom", "per-pixel ns/fr", "kernel ns/fr", "speedup");
+    for (int zoomLevel = -1; zoomLevel <= 2; ++zoomLevel)
+    {
+        ViewportSource source = {&pixels[0], canvasWidth, canvasHeight,
+                                 400, 300, zoomLevel};
+        BenchClock::time_point start = BenchClock::now();
+        for (int frame = 0; frame < frames; ++frame)
+            renderViewportPerPixel(source, &buffer[0], fbWidth, fbHeight);
+        const double loopNs = elapsedNs(start, frames);
+        benchSink += buffer[buffer.size() / 3];
+
+        start = BenchClock::now();
+        for (int frame = 0; frame < frames; ++frame)
+            renderViewportRect(source, &buffer[0], fbWidth, fbHeight, everything);
+        const double kernelNs = elapsedNs(start, frames);
+        benchSink += buffer[buffer.size() / 3];
+
+        printf("  %-5s %16.0f %14.0f %7.2fx\n", zoomName(zoomLevel),
+               loopNs, kernelNs, kernelNs > 0.0 ? loopNs / kernelNs : 0.0);
+    }
+    printf("  (0.5x kernels box-average four samples per pixel; the loop point-samples one)\n");
+}
+
+void benchViewport()
+{
+    const int canvasWidth = 1920;
+    const int canvasHeight = 1080;
+    const int fbWidth = 240;
+    const int fbHeight = 320;
+    const int frames = 600;
+    std::vector<u8> pixels(canvasWidth * canvasHeight * 3);
+    std::vector<u8> buffer(fbWidth * fbHeight * 3);
+    fillPattern(pixels);
+
+    printf("viewport (1920x1080 canvas, %d frames)\n", frames);
+    printf("  %-5s %14s %18s %12s\n", "zoom", "full ns/frame", "12px stroke ns/fr", "px/frame");
+    for (int zoomLevel = -1; zoomLevel <= 2; ++zoomLevel)
+    {
+        ViewportSource source = {&pixels[0], canvasWidth, canvasHeight,
+                                 400, 300, zoomLevel};
+        IncrementalViewport viewport;
+        DirtyRect none = {0, 0, 0, 0, false};
+
+        BenchClock::time_point start = BenchClock::now();
+        for (int frame = 0; frame < frames; ++frame)
+            viewport.render(source, none, &buffer[0], fbWidth, fbHeight, true);
+        const double fullNs = elapsedNs(start, frames);
+
+        // Simulates a busy channel: one 12px brush stamp per frame, walking
+        // across the visible area.
+        long written = 0;
+        start = BenchClock::now();
+        for (int frame = 0; frame < frames; ++frame)
+        {
+            const int x = source.offsetX + (frame * 3) % 120;
+            const int y = source.offsetY + (frame * 2) % 80;
+            DirtyRect stroke = {x - 6, y - 6, x + 6, y + 6, true};
+            written += viewport.render(source, stroke, &buffer[0], fbWidth, fbHeight, false);
+        }
+        const double strokeNs = elapsedNs(start, frames);
+
+        printf("  %-5s %14.0f %18.0f %12ld\n", zoomName(zoomLevel),
+               fullNs, strokeNs, written / frames);
+        benchSink += buffer[buffer.size() / 2];
+    }
+}
+
+// The point-sampled rebuild renderTop ran every 15 frames before the
+// tiled cache. Kept here as the baseline for the minimap comparison.
+void rebuildMinimapPointSampled(const u8 *pixels, int canvasWidth, int canvasHeight, u8 *cache)
+{
+    for (int y = 0; y < MINIMAP_HEIGHT; y++)
+    {
+        for (int x = 0; x < MINIMAP_WIDTH; x++)
+        {
+            int cx = x * canvasWidth / MINIMAP_WIDTH;
+            int cy = y * canvasHeight / MINIMAP_HEIGHT;
+            int canvasIdx = 3 * (cy * canvasWidth + cx);
+            int cacheIdx = 3 * (y * MINIMAP_WIDTH + x);
+            cache[cacheIdx] = pixels[canvasIdx];
+            cache[cacheIdx + 1] = pixels[canvasIdx + 1];
+            cache[cacheIdx + 2] = pixels[canvasIdx + 2];
+        }
+    }
+}
+
+void benchMinimap()
+{
+    const int canvasWidth = 1920;
+    const int canvasHeight = 1080;
+    const int rounds = 300;
+    std::vector<u8> pixels(canvasWidth * canvasHeight * 3);
+    std::vector<u8> cache(MINIMAP_WIDTH * MINIMAP_HEIGHT * 3);
+    fillPattern(pixels);
+    MinimapCache *minimap = new MinimapCache();
+
+    BenchClock::time_point start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+        rebuildMinimapPointSampled(&pixels[0], canvasWidth, canvasHeight, &cache[0]);
+    const double pointNs = elapsedNs(start, rounds);
+    benchSink += cache[cache.size() / 2];
+
+    start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        minimap->invalidate();
+        minimap->update(&pixels[0], canvasWidth, canvasHeight);
+    }
+    const double fullNs = elapsedNs(start, rounds);
+
+    // 15 frames of a 12px stroke between refreshes, as renderTop sees it.
+    long tiles = 0;
+    start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (int frame = 0; frame < 15; ++frame)
+        {
+            const int x = 400 + (round * 15 + frame) * 3 % 600;
+            const int y = 300 + (round * 15 + frame) * 2 % 400;
+            DirtyRect stroke = {x - 6, y - 6, x + 6, y + 6, true};
+            minimap->invalidateCanvasRect(stroke);
+        }
+        tiles += minimap->update(&pixels[0], canvasWidth, canvasHeight);
+    }
+    const double strokeNs = elapsedNs(start, rounds);
+    benchSink += minimap->pixels()[MINIMAP_WIDTH * 3];
+    delete minimap;
+
+    printf("minimap (1920x1080 canvas, %d refreshes)\n", rounds);
+    printf("  point-sampled full rebuild  %10.0f ns\n", pointNs);
+    printf("  box-filtered full rebuild   %10.0f ns\n", fullNs);
+    printf("  box-filtered dirty tiles    %10.0f ns (%ld tiles/refresh)\n",
+           strokeNs, tiles / rounds);
+}
+
+// A burst of 1,000 unmasked binary frames, each a type-1 draw packet with
+// five points, laid out the way the server writes them into one TLS record.
+std::vector<uint8_t> captureDrawFrameBurst()
+{
+    std::vector<uint8_t> burst;
+    for (int frame = 0; frame < 1000; ++frame)
+    {
+        uint8_t packet[27] = {1, 0, 0, 0, 20, 0, 5};
+        packet[1] = (uint8_t)frame;
+        for (int point = 0; point < 5; ++point)
+        {
+            packet[7 + point * 4] = (uint8_t)(frame + point);
+            packet[9 + point * 4] = (uint8_t)(frame * 3 + point);
+        }
+        burst.push_back(0x82);
+        burst.push_back((uint8_t)sizeof(packet));
+        burst.insert(burst.end(), packet, packet + sizeof(packet));
+    }
+    return burst;
+}
+
+// Mirrors the frame loop with the buffer the client used before
+// ReceiveBuffer: append with insert, drop each parsed frame with erase.
+size_t replayWithVectorErase(const std::vector<uint8_t> &burst, size_t chunk)
+{
+    std::vector<uint8_t> receiveBuffer;
+    size_t payloadBytes = 0;
+    for (size_t offset = 0; offset < burst.size(); offset += chunk)
+    {
+        const size_t length = std::min(chunk, burst.size() - offset);
+        receiveBuffer.insert(receiveBuffer.end(), &burst[offset], &burst[offset] + length);
+        WebSocketFrameHeader header;
+        while (parseWebSocketFrameHeader(receiveBuffer.data(), receiveBuffer.size(),
+                                         1 << 20, header) == WEBSOCKET_FRAME_READY &&
+               receiveBuffer.size() >= header.headerLength + header.payloadLength)
+        {
+            payloadBytes += receiveBuffer[header.headerLength];
+            receiveBuffer.erase(receiveBuffer.begin(),
+                                receiveBuffer.begin() + header.headerLength + header.payloadLength);
+        }
+    }
+    return payloadBytes;
+}
+
+size_t replayWithReceiveBuffer(const std::vector<uint8_t> &burst, size_t chunk)
+{
+    ReceiveBuffer receiveBuffer;
+    size_t payloadBytes = 0;
+    for (size_t offset = 0; offset < burst.size(); offset += chunk)
+    {
+        const size_t length = std::min(chunk, burst.size() - offset);
+        memcpy(receiveBuffer.prepare(chunk), &burst[offset], length);
+        receiveBuffer.commit(length);
+        WebSocketFrameHeader header;
+        while (parseWebSocketFrameHeader(receiveBuffer.data(), receiveBuffer.size(),
+                                         1 << 20, header) == WEBSOCKET_FRAME_READY &&
+               receiveBuffer.size() >= header.headerLength + header.payloadLength)
+        {
+            payloadBytes += receiveBuffer.data()[header.headerLength];
+            receiveBuffer.consume(header.headerLength + (size_t)header.payloadLength);
+        }
+    }
+    return payloadBytes;
+}
+
+void benchWebSocketBurst()
+{
+    const std::vector<uint8_t> burst = captureDrawFrameBurst();
+    const int rounds = 200;
+
+    printf("websocket frame burst (1000 frames, %u bytes, %d rounds)\n",
+           (unsigned)burst.size(), rounds);
+    printf("  %-8s %16s %16s %8s\n", "read", "insert/erase ns", "cursor ns", "speedup");
+    const size_t chunks[] = {8192, burst.size()};
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i)
+    {
+        BenchClock::time_point start = BenchClock::now();
+        for (int round = 0; round < rounds; ++round)
+            benchSink += (unsigned)replayWithVectorErase(burst, chunks[i]);
+        const double eraseNs = elapsedNs(start, rounds);
+
+        start = BenchClock::now();
+        for (int round = 0; round < rounds; ++round)
+            benchSink += (unsigned)replayWithReceiveBuffer(burst, chunks[i]);
+        const double cursorNs = elapsedNs(start, rounds);
+
+        char label[16];
+        snprintf(label, sizeof(label), "%uB", (unsigned)chunks[i]);
+        printf("  %-8s %16.0f %16.0f %7.2fx\n", label, eraseNs, cursorNs,
+               cursorNs > 0.0 ? eraseNs / cursorNs : 0.0);
+    }
+}
+
+// Draw packets for four zigzag strokes across a 1920x1080 canvas: a 12px
+// circle, a feathered 4.5px circle, an 8px spray and a 20px square.
+std::vector<std::vector<uint8_t> > recordDrawPackets()
+{
+    const DrawPacketStyle styles[] = {
+        {200, 40, 40, 120, 0, false},
+        {40, 200, 40, 45, 0, true},
+        {40, 40, 200, 80, BRUSH_RENDER_SPRAY_SHAPE, false},
+        {90, 90, 90, 200, BRUSH_RENDER_SQUARE_SHAPE, false},
+    };
+    std::vector<std::vector<uint8_t> > packets;
+    for (size_t stroke = 0; stroke < sizeof(styles) / sizeof(styles[0]); ++stroke)
+    {
+        std::vector<DrawPoint> points;
+        const int spacing = brushStrokeSpacing(styles[stroke].sizeTenths, styles[stroke].shape);
+        for (int i = 0; i < 600; ++i)
+        {
+            const int wave = i % 160 < 80 ? i % 80 : 80 - i % 80;
+            DrawPoint point = {100 + i * spacing * 2 % 1700,
+                               120 + (int)stroke * 220 + wave * 2};
+            points.push_back(point);
+        }
+        size_t start = 0;
+        while (start + 1 < points.size())
+        {
+            uint8_t packet[DRAW_PACKET_MAX_BYTES];
+            size_t length = 0;
+            size_t count = encodeDeltaDrawPacket(styles[stroke], &points[start], points.size() - start,
+                                                 packet, sizeof(packet), length);
+            packets.push_back(std::vector<uint8_t>(packet, packet + length));
+            start += count - 1;
+        }
+    }
+    return packets;
+}
+
+struct StampTarget
+{
+    u8 *pixels;
+    int width;
+    int height;
+    BrushStampCache *cache;
+};
+
+void stampPerPixel(const StampTarget &target, int x, int y, const DrawPacketStyle &style)
+{
+    const int upperSize = std::min(31, style.sizeTenths / 10 + (style.sizeTenths % 10 ? 1 : 0));
+    const int extent = upperSize / 2;
+    for (int dy = -extent; dy <= extent; dy++)
+    {
+        for (int dx = -extent; dx <= extent; dx++)
+        {
+            const int coverage = brushStampCoverageTenths(x, y, dx, dy, style.sizeTenths,
+                                                          style.shape, style.feather);
+            const int px = x + dx;
+            const int py = y + dy;
+            if (coverage <= 0 || px < 0 || px >= target.width || py < 0 || py >= target.height)
+                continue;
+            u8 *pixel = target.pixels + 3 * (py * target.width + px);
+            pixel[0] = blendBrushChannel(pixel[0], style.r, coverage);
+            pixel[1] = blendBrushChannel(pixel[1], style.g, coverage);
+            pixel[2] = blendBrushChannel(pixel[2], style.b, coverage);
+        }
+    }
+}
+
+void stampMasked(const StampTarget &target, int x, int y, const DrawPacketStyle &style)
+{
+    drawBrushStamp(*target.cache, target.pixels, target.width, target.height, x, y,
+                   style.sizeTenths, style.shape, style.r, style.g, style.b, style.feather);
+}
+
+// Decodes and interpolates each packet the way processDrawPacket does.
+long replayDrawPackets(const std::vector<std::vector<uint8_t> > &packets, const StampTarget &target,
+                       void (*stamp)(const StampTarget &, int, int, const DrawPacketStyle &))
+{
+    long stamps = 0;
+    DrawPoint points[DRAW_PACKET_MAX_POINTS];
+    for (size_t p = 0; p < packets.size(); ++p)
+    {
+        DrawPacketStyle style;
+        size_t count = 0;
+        if (!decodeDrawPacket(&packets[p][0], packets[p].size(), style, points, count) || count == 0)
+            continue;
+        stamp(target, points[0].x, points[0].y, style);
+        ++stamps;
+        for (size_t i = 1; i < count; ++i)
+        {
+            const int deltaX = points[i].x - points[i - 1].x;
+            const int deltaY = points[i].y - points[i - 1].y;
+            const int steps = brushStrokeSegmentSteps(deltaX, deltaY, style.sizeTenths, style.shape);
+            for (int step = 1; step <= steps; ++step)
+            {
+                const int x = (int)(points[i - 1].x + (float)deltaX * step / steps + 0.5f);
+                const int y = (int)(points[i - 1].y + (float)deltaY * step / steps + 0.5f);
+                stamp(target, x, y, style);
+                ++stamps;
+            }
+        }
+    }
+    return stamps;
+}
+
+// Same interpolation, handing each packet's stamps to drawBrushStamps.
+long replayDrawPacketsSwept(const std::vector<std::vector<uint8_t> > &packets,
+                            const StampTarget &target)
+{
+    long stamps = 0;
+    DrawPoint points[DRAW_PACKET_MAX_POINTS];
+    std::vector<DrawPoint> centers;
+    for (size_t p = 0; p < packets.size(); ++p)
+    {
+        DrawPacketStyle style;
+        size_t count = 0;
+        if (!decodeDrawPacket(&packets[p][0], packets[p].size(), style, points, count) || count == 0)
+            continue;
+        centers.assign(1, points[0]);
+        for (size_t i = 1; i < count; ++i)
+        {
+            const int deltaX = points[i].x - points[i - 1].x;
+            const int deltaY = points[i].y - points[i - 1].y;
+            const int steps = brushStrokeSegmentSteps(deltaX, deltaY, style.sizeTenths, style.shape);
+            for (int step = 1; step <= steps; ++step)
+            {
+                DrawPoint center = {(int)(points[i - 1].x + (float)deltaX * step / steps + 0.5f),
+                                    (int)(points[i - 1].y + (float)deltaY * step / steps + 0.5f)};
+                centers.push_back(center);
+            }
+        }
+        drawBrushStamps(*target.cache, target.pixels, target.width, target.height,
+                        &centers[0], centers.size(), style.sizeTenths, style.shape,
+                        style.r, style.g, style.b, style.feather);
+        stamps += (long)centers.size();
+    }
+    return stamps;
+}
+
+void benchBrushStamps()
+{
+    const int canvasWidth = 1920;
+    const int canvasHeight = 1080;
+    const int rounds = 5;
+    const std::vector<std::vector<uint8_t> > packets = recordDrawPackets();
+    std::vector<u8> pixels(canvasWidth * canvasHeight * 3);
+    fillPattern(pixels);
+    BrushStampCache cache;
+    StampTarget target = {&pixels[0], canvasWidth, canvasHeight, &cache};
+
+    long stamps = 0;
+    BenchClock::time_point start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+        stamps = replayDrawPackets(packets, target, stampPerPixel);
+    const double perPixelNs = elapsedNs(start, rounds);
+    benchSink += pixels[pixels.size() / 3];
+
+    start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+        stamps = replayDrawPackets(packets, target, stampMasked);
+    const double maskedNs = elapsedNs(start, rounds);
+    benchSink += pixels[pixels.size() / 3];
+
+    start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+        stamps = replayDrawPacketsSwept(packets, target);
+    const double sweptNs = elapsedNs(start, rounds);
+    benchSink += pixels[pixels.size() / 3];
+
+    printf("brush stamps (%u packets, %ld stamps per replay, %lu masks built)\n",
+           (unsigned)packets.size(), stamps, cache.builds());
+    printf("  per-pixel shape tests  %12.0f stamps/s\n", stamps * 1e9 / perPixelNs);
+    printf("  cached stamp masks     %12.0f stamps/s (%.1fx)\n", stamps * 1e9 / maskedNs,
+           maskedNs > 0.0 ? perPixelNs / maskedNs : 0.0);
+    printf("  swept solid runs       %12.0f stamps/s (%.1fx)\n", stamps * 1e9 / sweptNs,
+           sweptNs > 0.0 ? perPixelNs / sweptNs : 0.0);
+}
+
+// A support session as the server sends it: presence refreshes around a
+// staff ticket list, one opened thread and a page of staff chat.
+std::vector<std::string> recordControlSession()
+{
+    std::vector<std::string> lines;
+    char line[4096];
+    for (int refresh = 0; refresh < 4; ++refresh)
+    {
+        std::string presence = "{\"type\":\"presence\",\"channel\":\"main\",\"total\":12,\"truncated\":false,\"users\":[";
+        for (int user = 0; user < 12; ++user)
+        {
+            snprintf(line, sizeof(line),
+                     "%s{\"id\":\"session-%d-%d\",\"identityId\":\"identity-%04d\",\"username\":\"doodler%d\","
+                     "\"displayName\":\"Doodler %d\",\"role\":\"%s\",\"status\":\"active\",\"channel\":\"main\","
+                     "\"clientType\":\"3ds\",\"deviceModel\":\"new-3ds-xl\",\"deviceModelLabel\":\"New 3DS XL\","
+                     "\"sessionCount\":1,\"muteSecondsRemaining\":0,\"banSecondsRemaining\":0,\"readOnly\":false}",
+                     user ? "," : "", refresh, user, user, user, user, user == 0 ? "admin" : "user");
+            presence += line;
+        }
+        presence += "]}";
+        lines.push_back(presence);
+
+        lines.push_back("{\"type\":\"ticketCounts\",\"mineOpen\":1,\"staffNeedsReply\":3,\"staffChatUnread\":2}");
+        lines.push_back("{\"type\":\"ticketListStart\",\"scope\":\"staff\",\"count\":6}");
+        for (int ticket = 0; ticket < 6; ++ticket)
+        {
+            snprintf(line, sizeof(line),
+                     "{\"type\":\"ticketSummary\",\"ticket\":{\"id\":%d,\"messageCount\":%d,\"category\":\"unban\","
+                     "\"status\":\"open\",\"subject\":\"Appeal for ticket %d\",\"identityId\":\"identity-%04d\","
+                     "\"username\":\"doodler%d\",\"displayName\":\"Doodler %d\",\"banReason\":\"Spam\","
+                     "\"blockTypes\":[\"ip\",\"device\"],\"createdAt\":\"2026-07-24T09:23:45.123Z\","
+                     "\"updatedAt\":\"2026-07-24T10:01:02.000Z\",\"lastMessage\":\"Please take another look\"}}",
+                     100 + ticket, 3 + ticket, ticket, ticket, ticket, ticket);
+            lines.push_back(line);
+        }
+        lines.push_back("{\"type\":\"ticketListEnd\",\"nextBeforeId\":94,"
+                        "\"nextCursor\":{\"updatedAt\":\"2026-07-24T08:00:00.000Z\",\"id\":94}}");
+        lines.push_back("{\"type\":\"ticketThreadStart\",\"ticket\":{\"id\":100,\"messageCount\":6,"
+                        "\"category\":\"unban\",\"status\":\"open\",\"subject\":\"Appeal\"}}");
+        for (int message = 0; message < 6; ++message)
+        {
+            snprintf(line, sizeof(line),
+                     "{\"type\":\"ticketMessage\",\"message\":{\"id\":%d,\"ticketId\":100,\"authorKind\":\"%s\","
+                     "\"displayName\":\"Doodler 0\",\"role\":\"user\",\"createdAt\":\"2026-07-24T09:23:45.123Z\","
+                     "\"message\":\"I was drawing a \\\"tree\\\" and got flagged.\\nCan you check?\"}}",
+                     500 + message, message % 2 ? "staff" : "user");
+            lines.push_back(line);
+        }
+        lines.push_back("{\"type\":\"ticketThreadEnd\",\"ticketId\":100,\"nextBeforeMessageId\":0}");
+        lines.push_back("{\"type\":\"staffChatStart\",\"count\":8}");
+        for (int message = 0; message < 8; ++message)
+        {
+            snprintf(line, sizeof(line),
+                     "{\"type\":\"staffChatMessage\",\"live\":%s,\"message\":{\"id\":%d,\"identityId\":\"identity-0000\","
+                     "\"username\":\"doodler0\",\"displayName\":\"Doodler 0\",\"role\":\"admin\","
+                     "\"createdAt\":\"2026-07-24T09:23:45.123Z\",\"message\":\"Looking at ticket %d now\"}}",
+                     message == 7 ? "true" : "false", 900 + message, 100 + message);
+            lines.push_back(line);
+        }
+        lines.push_back("{\"type\":\"staffChatEnd\",\"nextBeforeId\":892}");
+        lines.push_back("{\"type\":\"staffChatResult\",\"ok\":true}");
+        lines.push_back("{\"type\":\"ticketResult\",\"ok\":true,\"action\":\"reply\",\"ticketId\":100}");
+    }
+    return lines;
+}
+
+struct ControlScratch
+{
+    char text[96];
+    char extra[32];
+    int a;
+    int b;
+    int c;
+    bool flag;
+    bool other;
+    StaffChatMessage staffMessage;
+    SupportTicketSummary ticket;
+    SupportTicketMessage ticketMessage;
+    TicketCursor cursor;
+    ChannelInfo channelInfo[8];
+    char channels[8][25];
+    PresenceUser users[24];
+    PresenceInfo presence;
+    IdentityInfo identity;
+    ModerationResult moderation;
+};
+
+// handleJsonControl's parser chain before routing: every parser in turn
+// scans the line for its own type marker until one accepts it.
+bool dispatchSequential(const char *line, ControlScratch &out)
+{
+    return Protocol::parseSupportOnly(line, out.text, sizeof(out.text), out.extra, sizeof(out.extra), out.a) ||
+           Protocol::parseTicketCounts(line, out.a, out.b, out.c) ||
+           Protocol::parseStaffChatStart(line, out.a) ||
+           Protocol::parseStaffChatMessage(line, out.staffMessage) ||
+           Protocol::parseStaffChatEnd(line, out.a) ||
+           Protocol::parseStaffChatResult(line, out.flag, out.text, sizeof(out.text)) ||
+           Protocol::parseTicketListStart(line, out.extra, sizeof(out.extra), out.a) ||
+           Protocol::parseTicketSummary(line, out.ticket) ||
+           Protocol::parseTicketMessage(line, out.ticketMessage) ||
+           Protocol::parseTicketListEnd(line, out.cursor) ||
+           Protocol::parseTicketThreadEnd(line, out.a, out.b) ||
+           Protocol::parseTicketResult(line, out.flag, out.extra, sizeof(out.extra), out.text, sizeof(out.text), out.a) ||
+           strstr(line, "\"type\":\"accessRestored\"") ||
+           strstr(line, "\"type\":\"error\"") ||
+           Protocol::parseChannels(line, out.channels, out.channelInfo, 8, out.a, out.extra) ||
+           Protocol::parsePresence(line, out.users, 24, out.a, out.presence) ||
+           Protocol::parseOnboardingState(line, out.flag, out.other, out.extra, sizeof(out.extra)) ||
+           Protocol::parseIdentityAccepted(line, out.identity) ||
+           strstr(line, "\"type\":\"identityNeedsDisplayName\"") ||
+           Protocol::parseDisplayNameRejected(line, out.text, sizeof(out.text)) ||
+           strstr(line, "\"type\":\"displayNameChanged\"") ||
+           Protocol::parseRulesRejected(line, out.text, sizeof(out.text), out.extra, sizeof(out.extra)) ||
+           Protocol::parseRulesRequired(line, out.extra, sizeof(out.extra)) ||
+           strstr(line, "\"type\":\"rulesAccepted\"") ||
+           Protocol::parseMuted(line, out.text, sizeof(out.text), out.a) ||
+           Protocol::parseDisconnected(line, out.text, sizeof(out.text)) ||
+           Protocol::parseIdentityBackupCode(line, out.identity) ||
+           Protocol::parseRecoveryFailed(line, out.text, sizeof(out.text)) ||
+           strstr(line, "\"type\":\"adminCanvasResult\"") ||
+           Protocol::parseModerationResult(line, out.moderation);
+}
+
+bool dispatchRouted(const char *line, ControlScratch &out)
+{
+    switch (controlMessageType(line))
+    {
+        case CONTROL_MESSAGE_TICKET_COUNTS: return Protocol::parseTicketCounts(line, out.a, out.b, out.c);
+        case CONTROL_MESSAGE_STAFF_CHAT_START: return Protocol::parseStaffChatStart(line, out.a);
+        case CONTROL_MESSAGE_STAFF_CHAT_MESSAGE: return Protocol::parseStaffChatMessage(line, out.staffMessage);
+        case CONTROL_MESSAGE_STAFF_CHAT_END: return Protocol::parseStaffChatEnd(line, out.a);
+        case CONTROL_MESSAGE_STAFF_CHAT_RESULT:
+            return Protocol::parseStaffChatResult(line, out.flag, out.text, sizeof(out.text));
+        case CONTROL_MESSAGE_TICKET_LIST_START:
+            return Protocol::parseTicketListStart(line, out.extra, sizeof(out.extra), out.a);
+        case CONTROL_MESSAGE_TICKET_SUMMARY:
+        case CONTROL_MESSAGE_TICKET_THREAD_START:
+        case CONTROL_MESSAGE_TICKET_UPDATED: return Protocol::parseTicketSummary(line, out.ticket);
+        case CONTROL_MESSAGE_TICKET_MESSAGE: return Protocol::parseTicketMessage(line, out.ticketMessage);
+        case CONTROL_MESSAGE_TICKET_LIST_END: return Protocol::parseTicketListEnd(line, out.cursor);
+        case CONTROL_MESSAGE_TICKET_THREAD_END: return Protocol::parseTicketThreadEnd(line, out.a, out.b);
+        case CONTROL_MESSAGE_TICKET_RESULT:
+            return Protocol::parseTicketResult(line, out.flag, out.extra, sizeof(out.extra),
+                                               out.text, sizeof(out.text), out.a);
+        case CONTROL_MESSAGE_PRESENCE: return Protocol::parsePresence(line, out.users, 24, out.a, out.presence);
+        default: return false;
+    }
+}
+
+double replayControlLines(const std::vector<std::string> &lines, bool routed, int rounds,
+                          ControlScratch &scratch)
+{
+    BenchClock::time_point start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+        for (size_t i = 0; i < lines.size(); ++i)
+            benchSink += (routed ? dispatchRouted(lines[i].c_str(), scratch)
+                                 : dispatchSequential(lines[i].c_str(), scratch)) ? 1u : 0u;
+    return elapsedNs(start, rounds * (int)lines.size());
+}
+
+void benchControlRouting()
+{
+    const std::vector<std::string> session = recordControlSession();
+    const int rounds = 200;
+    std::vector<std::string> presence;
+    std::vector<std::string> tickets;
+    for (size_t i = 0; i < session.size(); ++i)
+        (controlMessageType(session[i].c_str()) == CONTROL_MESSAGE_PRESENCE ? presence : tickets)
+            .push_back(session[i]);
+    ControlScratch scratch;
+    memset(&scratch, 0, sizeof(scratch));
+
+    printf("control messages (%u presence, %u ticket and staff-chat lines, %d rounds)\n",
+           (unsigned)presence.size(), (unsigned)tickets.size(), rounds);
+    printf("  %-16s %16s %16s %8s\n", "lines", "chain ns/msg", "routed ns/msg", "speedup");
+    const char *labels[] = {"whole session", "presence", "ticket/staff"};
+    const std::vector<std::string> *sets[] = {&session, &presence, &tickets};
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); ++i)
+    {
+        const double chainNs = replayControlLines(*sets[i], false, rounds, scratch);
+        const double routedNs = replayControlLines(*sets[i], true, rounds, scratch);
+        printf("  %-16s %16.0f %16.0f %7.2fx\n", labels[i], chainNs, routedNs,
+               routedNs > 0.0 ? chainNs / routedNs : 0.0);
+    }
+}
+
+// A looping stylus stroke sampled once per pixel step, as the touch handler
+// records it, cut into the 32-point batches main.cpp flushes.
+std::vector<DrawPoint> recordLoopingStroke()
+{
+    std::vector<DrawPoint> stroke;
+    int lastX = -1, lastY = -1;
+    for (int step = 0; step <= 6000; ++step)
+    {
+        const double t = step / 6000.0 * 12.566370;
+        DrawPoint point = {(int)floor(400.0 + 150.0 * cos(t) + 40.0 * cos(5.0 * t) + 0.5),
+                           (int)floor(300.0 + 110.0 * sin(t) + 40.0 * sin(3.0 * t) + 0.5)};
+        if (point.x == lastX && point.y == lastY)
+            continue;
+        stroke.push_back(point);
+        lastX = point.x;
+        lastY = point.y;
+    }
+    return stroke;
+}
+
+size_t encodedStrokeBytes(const std::vector<DrawPoint> &points)
+{
+    DrawPacketStyle style = {20, 40, 60, 30, 0, false};
+    size_t total = 0;
+    size_t start = 0;
+    while (start < points.size())
+    {
+        uint8_t packet[DRAW_PACKET_MAX_BYTES];
+        size_t length = 0;
+        const size_t count = encodeDeltaDrawPacket(style, &points[start], points.size() - start,
+                                                   packet, sizeof(packet), length);
+        if (count == 0)
+            break;
+        total += length;
+        start += count;
+    }
+    return total;
+}
+
+void benchStrokeSimplify()
+{
+    const std::vector<DrawPoint> stroke = recordLoopingStroke();
+    const size_t batchPoints = 32;
+    const int tolerances[] = {-1, 5, 10};
+    StrokeSimplifier simplifier;
+    std::vector<DrawPoint> sent;
+
+    printf("stroke simplification (%u samples in %u-point batches)\n",
+           (unsigned)stroke.size(), (unsigned)batchPoints);
+    printf("  %-16s %12s %12s %14s\n", "tolerance", "points", "bytes", "ns/batch");
+    for (size_t t = 0; t < sizeof(tolerances) / sizeof(tolerances[0]); ++t)
+    {
+        simplifier.setToleranceTenths(tolerances[t]);
+        size_t points = 0;
+        size_t bytes = 0;
+        int batches = 0;
+        const BenchClock::time_point start = BenchClock::now();
+        for (size_t first = 0; first < stroke.size(); first += batchPoints - 1)
+        {
+            const size_t count = std::min(batchPoints, stroke.size() - first);
+            simplifier.simplify(&stroke[first], count, 30, 0, sent);
+            points += sent.size();
+            bytes += encodedStrokeBytes(sent);
+            ++batches;
+            if (count < batchPoints)
+                break;
+        }
+        const double ns = elapsedNs(start, batches);
+        char label[24];
+        if (tolerances[t] < 0)
+            snprintf(label, sizeof(label), "off");
+        else
+            snprintf(label, sizeof(label), "%d.%d px", tolerances[t] / 10, tolerances[t] % 10);
+        printf("  %-16s %12u %12u %14.0f\n", label, (unsigned)points, (unsigned)bytes, ns);
+    }
+}
+
+struct UplinkTotals
+{
+    size_t packets;
+    size_t bytes;
+    size_t frames;
+    uint64_t worstLatencyMs;
+};
+
+void sendUplinkBatch(const std::vector<DrawPoint> &batch, StrokeSimplifier &simplifier,
+                     std::vector<DrawPoint> &sent, UplinkTotals &totals)
+{
+    simplifier.simplify(&batch[0], batch.size(), 30, 0, sent);
+    DrawPacketStyle style = {20, 40, 60, 30, 0, false};
+    size_t start = 0;
+    while (start < sent.size())
+    {
+        uint8_t packet[DRAW_PACKET_MAX_BYTES];
+        size_t length = 0;
+        const size_t count = encodeDeltaDrawPacket(style, &sent[start], sent.size() - start,
+                                                   packet, sizeof(packet), length);
+        if (count == 0)
+            break;
+        ++totals.packets;
+        totals.bytes += length;
+        if (start + count >= sent.size() || count < 2)
+            break;
+        start += count - 1;
+    }
+}
+
+// Replays the looping stroke at 60 frames a second, samplesPerFrame at a
+// time, through either the former fixed 32-point flush or a DrawBatcher.
+UplinkTotals replayUplink(const std::vector<DrawPoint> &stroke, size_t samplesPerFrame,
+                          DrawBatcher *batcher)
+{
+    StrokeSimplifier simplifier;
+    std::vector<DrawPoint> pending;
+    std::vector<DrawPoint> sent;
+    UplinkTotals totals = {0, 0, 0, 0};
+    uint64_t oldestMs = 0;
+    for (size_t next = 0; next < stroke.size(); ++totals.frames)
+    {
+        const uint64_t nowMs = totals.frames * 50 / 3;
+        if (pending.empty())
+            oldestMs = nowMs;
+        const size_t end = std::min(stroke.size(), next + samplesPerFrame);
+        pending.insert(pending.end(), stroke.begin() + next, stroke.begin() + end);
+        next = end;
+        const bool flush = batcher ? batcher->due(pending, nowMs) : pending.size() >= 32;
+        if (flush)
+        {
+            totals.worstLatencyMs = std::max(totals.worstLatencyMs, nowMs - oldestMs);
+            sendUplinkBatch(pending, simplifier, sent, totals);
+            pending.clear();
+            if (batcher)
+                batcher->reset();
+        }
+    }
+    if (!pending.empty())
+        sendUplinkBatch(pending, simplifier, sent, totals);
+    return totals;
+}
+
+void benchDrawBatching()
+{
+    const std::vector<DrawPoint> stroke = recordLoopingStroke();
+    const size_t speeds[] = {2, 6, 16, 32};
+    printf("draw batching (%u samples at 60 frames/s; packets/s, bytes/s, worst held ms)\n",
+           (unsigned)stroke.size());
+    printf("  %-14s %22s %22s\n", "samples/frame", "32-point flush", "33 ms batches");
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); ++i)
+    {
+        DrawBatcher batcher;
+        const UplinkTotals runs[] = {replayUplink(stroke, speeds[i], NULL),
+                                     replayUplink(stroke, speeds[i], &batcher)};
+        printf("  %-14u", (unsigned)speeds[i]);
+        for (size_t r = 0; r < 2; ++r)
+        {
+            const double seconds = runs[r].frames / 60.0;
+            printf(" %6.0f %7.0f %6u", runs[r].packets / seconds, runs[r].bytes / seconds,
+                   (unsigned)runs[r].worstLatencyMs);
+        }
+        printf("\n");
+    }
+}
+
+// The hand-offs a received draw frame and an outgoing draw packet used to
+// make: a vector per queued message and per built frame, plus a string copy
+// of every text line before parsing.
+double replayVectorMessages(const std::vector<std::string> &lines, int rounds)
+{
+    const BenchClock::time_point start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            const uint8_t *bytes = (const uint8_t *)lines[i].data();
+            std::vector<uint8_t> received(bytes, bytes + lines[i].size());
+            std::vector<uint8_t> event;
+            event = std::move(received);
+            std::string line(event.begin(), event.end());
+            std::vector<uint8_t> outgoing(bytes, bytes + 24);
+            std::vector<uint8_t> frame;
+            frame.reserve(outgoing.size() + 6);
+            frame.insert(frame.end(), outgoing.begin(), outgoing.end());
+            benchSink += (unsigned)line[line.size() / 2] + frame[3];
+        }
+    }
+    return elapsedNs(start, rounds * (int)lines.size());
+}
+
+double replayPooledMessages(const std::vector<std::string> &lines, int rounds, BufferPool &pool)
+{
+    const BenchClock::time_point start = BenchClock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            PooledBuffer received;
+            pool.acquireCopy(lines[i].data(), lines[i].size(), received);
+            PooledBuffer event(std::move(received));
+            const char *line = event.c_str();
+            PooledBuffer outgoing;
+            pool.acquireCopy(lines[i].data(), 24, outgoing);
+            PooledBuffer frame;
+            pool.acquireCopy(outgoing.data(), outgoing.size(), frame);
+            benchSink += (unsigned)line[event.size() / 2] + frame.data()[3];
+        }
+    }
+    return elapsedNs(start, rounds * (int)lines.size());
+}
+
+void benchMessageBuffers()
+{
+    const std::vector<std::string> session = recordControlSession();
+    const int rounds = 200;
+    BufferPool pool;
+    pool.reserve();
+    const double vectorNs = replayVectorMessages(session, rounds);
+    const double pooledNs = replayPooledMessages(session, rounds, pool);
+    const BufferPoolStats stats = pool.stats();
+    printf("message buffers (%u lines, %d rounds)\n", (unsigned)session.size(), rounds);
+    printf("  %-16s %12.0f ns/msg\n", "vectors", vectorNs);
+    printf("  %-16s %12.0f ns/msg %8.2fx  (%lu of %lu buffers from the heap)\n", "pooled",
+           pooledNs, pooledNs > 0.0 ? vectorNs / pooledNs : 0.0,
+           (unsigned long)stats.heapAllocations, (unsigned long)stats.acquired);
+}
+
+} // namespace
+
+int main()
+{
+    benchViewport();
+    benchViewportKernels();
+    benchMinimap();
+    benchWebSocketBurst();
+    benchBrushStamps();
+    benchControlRouting();
+    benchStrokeSimplify();
+    benchDrawBatching();
+    benchMessageBuffers();
+    printf("sink %u\n", benchSink);
+    return 0;
+}
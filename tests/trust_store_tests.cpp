@@ -0,0 +1,291 @@
+#include "trust_store.h"
+
+#include "mbedtls/platform_time.h"
+#include "mbedtls/x509_crt.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+using namespace Doodle;
+
+// The client supplies this from the 3DS clock; the host uses wall time.
+extern "C" mbedtls_ms_time_t mbedtls_ms_time(void)
+{
+    return (mbedtls_ms_time_t)time(NULL) * 1000;
+}
+
+namespace
+{
+
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+void check(bool condition, const char *expression, const char *file, int line)
+{
+    if (condition)
+        return;
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    ++failures;
+}
+
+const char BUNDLE_PATH[] = "data/cacert.pem";
+const char FIXTURE_DIR[] = "tests/fixtures/trust_store/";
+
+std::string readText(const char *path)
+{
+    std::string text;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "cannot read %s\n", path);
+        ++failures;
+        return text;
+    }
+    char buffer[16384];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        text.append(buffer, got);
+    fclose(file);
+    return text;
+}
+
+std::string fixture(const char *name)
+{
+    return readText((std::string(FIXTURE_DIR) + name).c_str());
+}
+
+// Returns mbedtls_x509_crt_parse's result: 0 when every certificate parsed.
+int parseChain(const std::string &pem, mbedtls_x509_crt &chain)
+{
+    mbedtls_x509_crt_init(&chain);
+    return mbedtls_x509_crt_parse(&chain, reinterpret_cast<const unsigned char *>(pem.c_str()),
+                                  pem.size() + 1);
+}
+
+size_t chainLength(const mbedtls_x509_crt &chain)
+{
+    size_t length = 0;
+    for (const mbedtls_x509_crt *crt = &chain; crt && crt->raw.len > 0; crt = crt->next)
+        ++length;
+    return length;
+}
+
+struct Verification
+{
+    int result;
+    uint32_t flags;
+};
+
+// The same anchors both as the chain the client used to parse at startup
+// and as a trust-store table.
+struct Anchors
+{
+    mbedtls_x509_crt chain;
+    std::vector<uint8_t> table;
+    TrustStore store;
+};
+
+void loadAnchors(const std::string &pem, Anchors &anchors)
+{
+    CHECK(parseChain(pem, anchors.chain) == 0);
+    CHECK(buildTrustStore(pem.data(), pem.size(), anchors.table));
+    CHECK(!anchors.table.empty() && anchors.store.attach(&anchors.table[0], anchors.table.size()));
+}
+
+// Verifies peer against the chain and through the issuer callback and
+// returns whether both agree; chainWay gets the chain's outcome.
+bool verifyBothWays(mbedtls_x509_crt &peer, Anchors &anchors, const char *hostname,
+                    Verification &chainWay)
+{
+    Verification callbackWay;
+    chainWay.flags = 0;
+    callbackWay.flags = 0;
+    chainWay.result = mbedtls_x509_crt_verify(&peer, &anchors.chain, NULL, hostname,
+                                              &chainWay.flags, NULL, NULL);
+    callbackWay.result = mbedtls_x509_crt_verify_with_ca_cb(
+        &peer, trustStoreIssuers, &anchors.store, &mbedtls_x509_crt_profile_default, hostname,
+        &callbackWay.flags, NULL, NULL);
+    const bool same = chainWay.result == callbackWay.result && chainWay.flags == callbackWay.flags;
+    if (!same)
+        fprintf(stderr, "chain gave %d/0x%08x, trust store gave %d/0x%08x\n", chainWay.result,
+                (unsigned)chainWay.flags, callbackWay.result, (unsigned)callbackWay.flags);
+    return same;
+}
+
+bool verifyBothWays(const std::string &presented, const std::string &anchorPem,
+                    const char *hostname, Verification &chainWay)
+{
+    mbedtls_x509_crt peer;
+    Anchors anchors;
+    CHECK(parseChain(presented, peer) == 0);
+    loadAnchors(anchorPem, anchors);
+    const bool same = verifyBothWays(peer, anchors, hostname, chainWay);
+    mbedtls_x509_crt_free(&peer);
+    mbedtls_x509_crt_free(&anchors.chain);
+    return same;
+}
+
+void testTableMatchesBundle()
+{
+    const std::string bundle = readText(BUNDLE_PATH);
+    mbedtls_x509_crt chain;
+    CHECK(parseChain(bundle, chain) == 0);
+
+    std::vector<uint8_t> table;
+    size_t certificates = 0;
+    CHECK(buildTrustStore(bundle.data(), bundle.size(), table, &certificates));
+    CHECK(certificates == chainLength(chain));
+    CHECK(certificates >= 100);
+    TrustStore store;
+    CHECK(!table.empty() && store.attach(&table[0], table.size()));
+    CHECK(store.size() == certificates);
+
+    // Every root is found under its own subject, with the same DER the PEM
+    // parse produced, and parses in place.
+    size_t found = 0;
+    for (const mbedtls_x509_crt *root = &chain; root && root->raw.len > 0; root = root->next)
+    {
+        size_t first = 0;
+        const size_t count = store.findSubject(root->subject_raw.p, root->subject_raw.len, first);
+        for (size_t i = first; i < first + count; ++i)
+        {
+            const uint8_t *der;
+            size_t length;
+            CHECK(store.certificate(i, der, length));
+            if (length == root->raw.len && memcmp(der, root->raw.p, length) == 0)
+            {
+                ++found;
+                break;
+            }
+        }
+    }
+    CHECK(found == certificates);
+
+    size_t parsed = 0;
+    for (size_t i = 0; i < store.size(); ++i)
+    {
+        const uint8_t *der;
+        size_t length;
+        mbedtls_x509_crt crt;
+        mbedtls_x509_crt_init(&crt);
+        if (store.certificate(i, der, length) && mbedtls_x509_crt_parse_der_nocopy(&crt, der, length) == 0)
+            ++parsed;
+        mbedtls_x509_crt_free(&crt);
+    }
+    CHECK(parsed == certificates);
+    mbedtls_x509_crt_free(&chain);
+
+    // The table is checked before anything trusts its offsets.
+    std::vector<uint8_t> damaged(table);
+    damaged[0] = 'X';
+    CHECK(!store.attach(&damaged[0], damaged.size()));
+    CHECK(!store.attach(&table[0], TRUST_STORE_HEADER_BYTES + TRUST_STORE_ENTRY_BYTES));
+    damaged = table;
+    damaged[TRUST_STORE_HEADER_BYTES + 8 + 3] = 0x7f;
+    CHECK(!store.attach(&damaged[0], damaged.size()));
+    CHECK(store.size() == 0);
+    CHECK(!buildTrustStore("no certificates here", 20, table));
+    CHECK(table.empty());
+}
+
+void testNameHashFolding()
+{
+    mbedtls_x509_crt root, recased, intermediate;
+    CHECK(parseChain(fixture("root.pem"), root) == 0);
+    CHECK(parseChain(fixture("recased-root.pem"), recased) == 0);
+    CHECK(parseChain(fixture("intermediate.pem"), intermediate) == 0);
+
+    // recased-root.pem names "C=us, O=DOODLE FIXTURE, CN=doodle fixture root",
+    // which Mbed TLS treats as the same name as the original root.
+    const uint32_t rootHash = trustStoreNameHash(root.subject_raw.p, root.subject_raw.len);
+    CHECK(root.subject_raw.len == recased.subject_raw.len);
+    CHECK(memcmp(root.subject_raw.p, recased.subject_raw.p, root.subject_raw.len) != 0);
+    CHECK(trustStoreNameHash(recased.subject_raw.p, recased.subject_raw.len) == rootHash);
+    CHECK(trustStoreNameHash(intermediate.issuer_raw.p, intermediate.issuer_raw.len) == rootHash);
+    CHECK(trustStoreNameHash(intermediate.subject_raw.p, intermediate.subject_raw.len) != rootHash);
+
+    const uint8_t *subject;
+    size_t subjectLength;
+    CHECK(certificateSubject(root.raw.p, root.raw.len, subject, subjectLength));
+    CHECK(subjectLength == root.subject_raw.len &&
+          memcmp(subject, root.subject_raw.p, subjectLength) == 0);
+
+    mbedtls_x509_crt_free(&root);
+    mbedtls_x509_crt_free(&recased);
+    mbedtls_x509_crt_free(&intermediate);
+}
+
+void testVerificationMatches()
+{
+    const std::string bundle = readText(BUNDLE_PATH);
+    const std::string root = fixture("root.pem");
+    const std::string impostor = fixture("impostor-root.pem");
+    const std::string recased = fixture("recased-root.pem");
+    const std::string leaf = fixture("leaf.pem");
+    const std::string presented = leaf + fixture("intermediate.pem");
+    const char host[] = "updates.doodle.test";
+    Verification outcome;
+
+    CHECK(verifyBothWays(presented, bundle, host, outcome));
+    CHECK(outcome.result != 0 && (outcome.flags & MBEDTLS_X509_BADCERT_NOT_TRUSTED));
+
+    CHECK(verifyBothWays(presented, bundle + root, host, outcome));
+    CHECK(outcome.result == 0 && outcome.flags == 0);
+
+    CHECK(verifyBothWays(presented, root + bundle, "wrong.doodle.test", outcome));
+    CHECK(outcome.flags == MBEDTLS_X509_BADCERT_CN_MISMATCH);
+
+    CHECK(verifyBothWays(leaf, bundle + root, host, outcome));
+    CHECK(outcome.flags & MBEDTLS_X509_BADCERT_NOT_TRUSTED);
+
+    // Same name, different key: found by name and then rejected, on its own
+    // and ahead of the real root.
+    CHECK(verifyBothWays(presented, bundle + impostor, host, outcome));
+    CHECK(outcome.result != 0);
+    CHECK(verifyBothWays(presented, bundle + impostor + root, host, outcome));
+    CHECK(outcome.result == 0 && outcome.flags == 0);
+
+    CHECK(verifyBothWays(presented, bundle + recased, host, outcome));
+    CHECK(outcome.result == 0 && outcome.flags == 0);
+
+    // Each bundled root presented as a server's only certificate.
+    Anchors anchors;
+    loadAnchors(bundle, anchors);
+    size_t matched = 0;
+    size_t roots = 0;
+    for (const mbedtls_x509_crt *root = &anchors.chain; root && root->raw.len > 0;
+         root = root->next, ++roots)
+    {
+        mbedtls_x509_crt peer;
+        mbedtls_x509_crt_init(&peer);
+        CHECK(mbedtls_x509_crt_parse_der(&peer, root->raw.p, root->raw.len) == 0);
+        if (verifyBothWays(peer, anchors, NULL, outcome))
+            ++matched;
+        mbedtls_x509_crt_free(&peer);
+    }
+    CHECK(roots >= 100);
+    CHECK(matched == roots);
+    mbedtls_x509_crt_free(&anchors.chain);
+}
+
+} // namespace
+
+int main()
+{
+    testTableMatchesBundle();
+    testNameHashFolding();
+    testVerificationMatches();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d trust store check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All trust store checks passed.\n");
+    return 0;
+}
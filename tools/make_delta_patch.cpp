@@ -0,0 +1,97 @@
+// Release tool: writes the delta patch the updater applies to the previous
+// release's artifact instead of downloading the new one whole, and prints
+// the manifest fields that advertise it.
+// Usage: make_delta_patch <old artifact> <new artifact> <patch.dpatch>
+#include <stdio.h>
+#include <vector>
+
+#include "delta_patch.h"
+#include "sha256.h"
+
+namespace
+{
+bool readFile(const char *path, std::vector<uint8_t> &contents)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    uint8_t buffer[16384];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        contents.insert(contents.end(), buffer, buffer + got);
+    const bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+// Rebuilds target from the patch the way the client does, so a patch is
+// never published that the client would refuse.
+bool appliesCleanly(const char *basePath, const std::vector<uint8_t> &patch, const char *patchDigest,
+                    size_t targetSize, const char *targetDigest)
+{
+    FILE *base = fopen(basePath, "rb");
+    if (!base)
+        return false;
+    Doodle::DeltaPatchApplier applier(base, NULL, NULL, patch.size(), patchDigest, targetSize, targetDigest);
+    const bool wrote = applier.write(patch.empty() ? NULL : &patch[0], patch.size());
+    const Doodle::DeltaPatchStatus status = applier.finish();
+    fclose(base);
+    if (!wrote || status != Doodle::DELTA_PATCH_OK)
+        fprintf(stderr, "patch does not apply: %s\n", applier.error());
+    return wrote && status == Doodle::DELTA_PATCH_OK;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s <old artifact> <new artifact> <patch.dpatch>\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> base;
+    std::vector<uint8_t> target;
+    if (!readFile(argv[1], base) || base.empty())
+    {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    if (!readFile(argv[2], target) || target.empty())
+    {
+        fprintf(stderr, "cannot read %s\n", argv[2]);
+        return 1;
+    }
+
+    std::vector<uint8_t> patch;
+    Doodle::buildDeltaPatch(&base[0], base.size(), &target[0], target.size(), patch);
+
+    char patchDigest[65];
+    char targetDigest[65];
+    Doodle::Sha256 hash;
+    hash.update(&patch[0], patch.size());
+    hash.finishHex(patchDigest);
+    hash.reset();
+    hash.update(&target[0], target.size());
+    hash.finishHex(targetDigest);
+    if (!appliesCleanly(argv[1], patch, patchDigest, target.size(), targetDigest))
+        return 1;
+
+    FILE *file = fopen(argv[3], "wb");
+    if (!file)
+    {
+        fprintf(stderr, "cannot write %s\n", argv[3]);
+        return 1;
+    }
+    const bool wroteAll = fwrite(&patch[0], 1, patch.size(), file) == patch.size();
+    if (fclose(file) != 0 || !wroteAll)
+    {
+        fprintf(stderr, "cannot write %s\n", argv[3]);
+        remove(argv[3]);
+        return 1;
+    }
+    printf("delta patch: %lu bytes for a %lu byte artifact\n", (unsigned long)patch.size(),
+           (unsigned long)target.size());
+    printf("\"patchSize\": %lu,\n\"patchSha256\": \"%s\"\n", (unsigned long)patch.size(), patchDigest);
+    return 0;
+}
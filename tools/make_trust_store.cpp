@@ -0,0 +1,63 @@
+// Build host tool: converts the PEM CA bundle into the trust-store table
+// the client links in. Usage: make_trust_store <bundle.pem> <table.dts>
+#include <stdio.h>
+#include <vector>
+
+#include "trust_store.h"
+
+namespace
+{
+bool readFile(const char *path, std::vector<char> &contents)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    char buffer[16384];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        contents.insert(contents.end(), buffer, buffer + got);
+    const bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <bundle.pem> <table.dts>\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<char> pem;
+    if (!readFile(argv[1], pem) || pem.empty())
+    {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> table;
+    size_t certificates = 0;
+    if (!Doodle::buildTrustStore(&pem[0], pem.size(), table, &certificates))
+    {
+        fprintf(stderr, "%s: malformed certificate in bundle\n", argv[1]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[2], "wb");
+    if (!file)
+    {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        return 1;
+    }
+    const bool wroteAll = fwrite(&table[0], 1, table.size(), file) == table.size();
+    if (fclose(file) != 0 || !wroteAll)
+    {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        remove(argv[2]);
+        return 1;
+    }
+    printf("trust store: %lu certificates, %lu bytes\n", (unsigned long)certificates,
+           (unsigned long)table.size());
+    return 0;
+}